@@ -1,13 +1,79 @@
-// #include <sys/socket.h>
-// #include <unistd.h>
-// #include <errno.h>
-
 #include "ip.h"
 #include "net.h"
 #include "string.h"
 #include "string_builder.h"
 
 
+#define TIMEOUT (10 * 1000) // Milliseconds
+
+
+typedef struct client {
+    string         request;
+    s32            sent;
+    b32            connected;
+    u64            timer;
+    string_builder *response;
+    s32            status;     // Of the program
+} client;
+
+
+void client_done(net_loop *loop, s32 fd, client *c, s32 status) {
+    c->status = status;
+    net_cancel_timer(loop, c->timer);
+    net_close(loop, fd);
+}
+
+void client_timeout(net_loop *loop, void *user) {
+    client *c = user;
+    printf("Timed out\n");
+    c->status = 1;
+    net_stop(loop);
+}
+
+void client_write(net_loop *loop, s32 fd, void *user) {
+    client *c = user;
+
+    if (!c->connected) {
+        s32 error = net_connect_error(fd);
+        if (error != 0) {
+            errno = error;
+            perror("connect");
+            client_done(loop, fd, c, 1);
+            return;
+        }
+        c->connected = true;
+    }
+
+    while (c->sent < c->request.length) {
+        s64 n = net_write(fd, c->request.data + c->sent, c->request.length - c->sent);
+        if (n == NET_AGAIN) return;
+        if (n < 0) {
+            client_done(loop, fd, c, 1);
+            return;
+        }
+        c->sent += n;
+    }
+}
+
+void client_read(net_loop *loop, s32 fd, void *user) {
+    client *c = user;
+    c8 buffer[16 * 1024];
+
+    for (;;) {
+        s64 n = net_read(fd, buffer, sizeof(buffer));
+        if (n == NET_AGAIN) return;
+        if (n < 0) {
+            client_done(loop, fd, c, 1);
+            return;
+        }
+        if (n == 0) {
+            client_done(loop, fd, c, 0);
+            return;
+        }
+        string_write_n(c->response, buffer, n);
+    }
+}
+
 s32 main(s32 argc, c8 *argv[]) {
 
     //
@@ -21,9 +87,9 @@ s32 main(s32 argc, c8 *argv[]) {
     // req.Header.Set("X-Prometheus-Scrape-Timeout-Seconds", strconv.FormatFloat(s.timeout.Seconds(), 'f', -1, 64))
     //
 
-    ipv4 addr     = ipv4_parse_address("127.0.0.1");
-    net_conn conn = net_connect(NET_TCP, addr, 9090);
-    if (conn.socket < 0) {
+    ipv4 addr = ipv4_parse_address("127.0.0.1");
+    s32 fd    = net_connect_start(addr, 9090);
+    if (fd < 0) {
         return 1;
     }
 
@@ -32,28 +98,26 @@ s32 main(s32 argc, c8 *argv[]) {
     string_write(builder, "Host: 127.0.0.1:9090\r\n");
     string_write(builder, "Accept: application/openmetrics-text; version=0.0.1,text/plain;version=0.0.4;q=0.5,*/*;q=0.1\r\n");
     string_write(builder, "User-Agent: Crometheus/0.0.0\r\n");
+    string_write(builder, "Connection: close\r\n");
     string_write(builder, "\r\n");
 
     string request = string_builder_to_string(builder);
     string_free_builder(builder);
     printf("Request:\n\n%.*s\n\n", request.length, request.data);
 
-    s32 sent = send(conn.socket, request.data, request.length, 0);
-    if (sent != request.length) {
-        close(conn.socket);
-        return 1;
-    }
+    net_loop *loop = net_make_loop();
+    client c = {
+        .request  = request,
+        .response = string_make_builder(),
+    };
+    c.timer = net_add_timer(loop, TIMEOUT, client_timeout, &c);
+    net_watch(loop, fd, client_read, client_write, &c);
+    net_run(loop);
+    net_free_loop(loop);
 
-    c8 buffer[1024];
-    builder = string_make_builder();
-    s32 received = 1024;
-    while (received == 1024) {
-        received = recv(conn.socket, buffer, 1024, 0);
-        string_write_n(builder, buffer, received);
-    }
-    string response = string_builder_to_string(builder);
-    string_free_builder(builder);
+    string response = string_builder_to_string(c.response);
+    string_free_builder(c.response);
     printf("Response:\n\n%.*s\n", response.length, response.data);
 
-    return 0;
+    return c.status;
 }
@@ -1,70 +1,162 @@
-#include <sys/socket.h>
-#include <unistd.h>
-#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
 
 #include "ip.h"
+#include "net.h"
+#include "string.h"
 
 
-typedef struct socket_address {
-    u8   length;     // Total length of the struct
-    u8   family;
-    u16  port;       // In network byte order
-    ipv4 address;
-    u8   padding[8];
-} socket_address;
+//
+// Answers every request with a small page, on one thread: connections are
+// read until the end of the headers, answered, and closed. Those idle for
+// longer than the timeout are closed too.
+//
 
-u16 reverse_byte_order_16(u16 port) {
-    return (port << 8) | (port >> 8);
+
+#define REQUEST_MAX  (8 * 1024)
+#define IDLE_TIMEOUT (10 * 1000) // Milliseconds
+#define ACCEPT_RETRY (100)       // Milliseconds, after accept failed
+
+
+typedef struct conn {
+    s32 fd;
+    u64 timer;
+    s32 length;                 // Of the request so far
+    s32 written;                // Of the response, once answering
+    b32 answering;
+    c8  request[REQUEST_MAX];
+} conn;
+
+
+static const c8 response[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: text/plain\r\n"
+    "Content-Length: 6\r\n"
+    "Connection: close\r\n"
+    "\r\n"
+    "hello\n";
+
+static s64 served;
+static u64 accept_retry_timer; // 0 when none is armed
+
+
+void conn_close(net_loop *loop, conn *c) {
+    net_cancel_timer(loop, c->timer);
+    net_close(loop, c->fd);
+    free(c);
 }
 
-u32 reverse_byte_order_32(u32 v) {
-    return (((v & 0xFF000000) >> 24) |
-            ((v & 0x00FF0000) >> 8) |
-            ((v & 0x0000FF00) << 8) |
-            ((v & 0x000000FF) << 24));
+void conn_timeout(net_loop *loop, void *user) {
+    conn *c = user;
+    c->timer = 0;
+    conn_close(loop, c);
 }
 
-int main(int argc, char *argv[]) {
-    int s = socket(PF_INET, SOCK_STREAM, 0);
-    if (s == -1) return 1;
+void conn_write(net_loop *loop, s32 fd, void *user) {
+    conn *c = user;
+    if (!c->answering) return;
 
-    socket_address server;
-    server.length  = sizeof(socket_address);
-    server.family  = AF_INET;
-    server.address = reverse_byte_order_32(ipv4_parse_address("0.0.0.0"));
-    server.port    = reverse_byte_order_16(8080);
+    while (c->written < (s32) sizeof(response) - 1) {
+        s64 n = net_write(fd, response + c->written, sizeof(response) - 1 - c->written);
+        if (n == NET_AGAIN) return; // Called again with room
+        if (n < 0) {
+            conn_close(loop, c);
+            return;
+        }
+        c->written += n;
+    }
 
-    s32 success = bind(s, (struct sockaddr *) &server, sizeof(socket_address));
-    if (success < 0) {
-        printf("bind: %d\n", errno);
-        return 1;
+    served += 1;
+    conn_close(loop, c);
+}
+
+void conn_read(net_loop *loop, s32 fd, void *user) {
+    conn *c = user;
+    if (c->answering) return;
+
+    for (;;) {
+        if (c->length == REQUEST_MAX) {
+            conn_close(loop, c);
+            return;
+        }
+
+        s64 n = net_read(fd, c->request + c->length, REQUEST_MAX - c->length);
+        if (n == NET_AGAIN) return;
+        if (n <= 0) {
+            conn_close(loop, c);
+            return;
+        }
+
+        s32 from = c->length >= 3 ? c->length - 3 : 0; // The end may straddle two reads
+        c->length += n;
+        for (s32 i = from; i + 4 <= c->length; i++) {
+            if (c->request[i] == '\r' && c->request[i + 1] == '\n' && c->request[i + 2] == '\r' && c->request[i + 3] == '\n') {
+                c->answering = true;
+                conn_write(loop, fd, c);
+                return;
+            }
+        }
     }
+}
 
-    if (listen(s, 10) == -1) return 3;
+void accept_all(net_loop *loop, s32 listener, void *user);
 
-    c8 buffer[1024];
+void accept_retry(net_loop *loop, void *user) {
+    accept_retry_timer = 0;
+    accept_all(loop, (s32) (s64) user, NULL);
+}
 
-    socket_address client;
-    u32 client_length = sizeof(socket_address);
+void accept_all(net_loop *loop, s32 listener, void *user) {
     for (;;) {
-        s32 conn = accept(s, (struct sockaddr *) &client, &client_length);
-        if (conn == -1) return 4;
+        s32 fd = net_accept(listener, NULL, NULL);
+        if (fd == NET_AGAIN) return;
+        if (fd < 0) {
+            // Out of descriptors most likely (EMFILE). The connections left
+            // stay queued, but the listener is edge-triggered: closing others
+            // raises no new event for them, so try again in a while.
+            perror("accept");
+            if (!accept_retry_timer) {
+                accept_retry_timer = net_add_timer(loop, ACCEPT_RETRY, accept_retry, (void*) (s64) listener);
+            }
+            return;
+        }
+
+        conn *c = malloc(sizeof(conn));
+        c->fd        = fd;
+        c->length    = 0;
+        c->written   = 0;
+        c->answering = false;
+        c->timer     = net_add_timer(loop, IDLE_TIMEOUT, conn_timeout, c);
+        if (!net_watch(loop, fd, conn_read, conn_write, c)) {
+            conn_close(loop, c);
+        }
+    }
+}
+
+void report(net_loop *loop, void *user) {
+    fprintf(stderr, "served: %lld\n", (long long) served);
+    net_add_timer(loop, 10 * 1000, report, NULL);
+}
 
-        ipv4 client_address = reverse_byte_order_32(client.address);
-        ipv4_b c = ipv4_bytes(client_address);
-        u16 port = reverse_byte_order_16(client.port);
-        printf("accepted: %u.%u.%u.%u:%i\n", c.abcd.a, c.abcd.b, c.abcd.c, c.abcd.d, port);
+s32 main(s32 argc, c8 *argv[]) {
+    u16 port = argc > 1 ? atoi(argv[1]) : 8080;
 
-        s32 len = read(conn, buffer, 1024);
-        printf("%.*s\n", len, buffer);
-        break;
+    s32 listener = net_listen(ipv4_parse_address("0.0.0.0"), port, 4096);
+    if (listener < 0) {
+        perror("listen");
+        return 1;
     }
 
-    success = close(s);
-    if (success < 0) {
-        printf("close: %d\n", errno);
+    net_loop *loop = net_make_loop();
+    net_watch(loop, listener, accept_all, NULL, NULL);
+    net_add_timer(loop, 10 * 1000, report, NULL);
+
+    if (net_run(loop) < 0) {
+        perror("epoll_wait");
         return 1;
     }
 
+    net_free_loop(loop);
+    close(listener);
     return 0;
 }
@@ -0,0 +1,439 @@
+#include "io.h"
+#include "ip.h"
+#include "ipdb.h"
+#include "job.h"
+
+
+//
+//     ipagg [-p length | -d ranges.ipdb] [-s requests|bytes] [-k count] [-f tsv|json] [-t threads] [file]
+//
+// counts the requests and bytes of an access log (common or combined log
+// format, from `file` or stdin) per client address, per network of the
+// given prefix length (-p 24), or per range of a compiled database (-d, see
+// ipdb.h: ranges with the same metadata count together). Prints the top
+// `count` (default 20, 0 for all) by requests or bytes:
+//
+//     key  requests  bytes
+//
+// tab-separated, or as an object per line with -f json.
+//
+// The log is cut in chunks at newlines, aggregated in parallel on the job
+// system, each thread into its own hash table, and the tables are merged at
+// the end: threads never share a line of memory while counting. Files are
+// mapped, stdin is read and counted a few chunks per thread at a time. The top is
+// kept in a heap of `count` entries. Lines whose first field isn't an IPv4
+// address are counted and skipped.
+//
+
+
+#define CHUNK_SIZE (4 * MEGABYTE) // Of input, about
+#define DB_MISSING (0xFFFFFFFF)   // Key of the addresses in no range of the database
+
+
+typedef struct options {
+    s32  prefix;     // Length, when grouping by network
+    ipdb *db;        // When grouping by range
+    b32  by_bytes;
+    s64  top;
+    b32  json;
+} options;
+
+typedef struct counter {
+    u32 key;         // Network, or offset of the metadata in the database
+    u64 requests;    // 0 when the slot is empty
+    u64 bytes;
+} counter;
+
+typedef struct table {
+    counter *slots;
+    s64     n;
+    s64     cap;     // Power of 2
+    s64     n_skipped;
+} table;
+
+typedef struct aggregation {
+    options    *options;
+    const c8   *data;
+    s64        *starts;  // Of each chunk, and the end of the last one
+    table      *tables;  // Per thread
+} aggregation;
+
+
+u64 hash(u32 key) {
+    u64 h = key * 0x9E3779B97F4A7C15ull;
+    return h ^ (h >> 29);
+}
+
+void table_init(table *t, s64 cap) {
+    t->slots     = array_alloc(cap, counter);
+    t->n         = 0;
+    t->cap       = cap;
+    t->n_skipped = 0;
+    __builtin_memset(t->slots, 0, cap * sizeof(counter));
+}
+
+void table_add(table *t, u32 key, u64 requests, u64 bytes);
+
+// At most half full.
+void table_grow(table *t) {
+    table bigger;
+    table_init(&bigger, 2 * t->cap);
+    for (s64 i = 0; i < t->cap; i++) {
+        if (t->slots[i].requests) table_add(&bigger, t->slots[i].key, t->slots[i].requests, t->slots[i].bytes);
+    }
+    free(t->slots);
+    bigger.n_skipped = t->n_skipped;
+    *t = bigger;
+}
+
+void table_add(table *t, u32 key, u64 requests, u64 bytes) {
+    u64 mask = t->cap - 1;
+    for (u64 i = hash(key) & mask; ; i = (i + 1) & mask) {
+        counter *c = &t->slots[i];
+        if (c->requests && c->key == key) {
+            c->requests += requests;
+            c->bytes    += bytes;
+            return;
+        }
+        if (!c->requests) {
+            c->key      = key;
+            c->requests = requests;
+            c->bytes    = bytes;
+            if (++t->n * 2 > t->cap) table_grow(t);
+            return;
+        }
+    }
+}
+
+//
+// The size of the response: the field after the status, after the quoted
+// request. 0 when it's "-" or the line is cut short.
+//
+u64 parse_bytes(const c8 *line, const c8 *end) {
+    const c8 *p = __builtin_memchr(line, '"', end - line);
+    if (!p) return 0;
+    p = __builtin_memchr(p + 1, '"', end - p - 1);
+    if (!p) return 0;
+
+    p++;
+    while (p < end && *p == ' ') p++;
+    while (p < end && *p != ' ') p++; // Status
+    while (p < end && *p == ' ') p++;
+
+    u64 bytes = 0;
+    for (; p < end && (u8) (*p - '0') < 10; p++) bytes = bytes * 10 + (*p - '0');
+    return bytes;
+}
+
+// Job: the lines of a chunk into the table of the thread.
+void aggregate_chunk(void *data, s32 index, s32 thread) {
+    aggregation *job = data;
+    options *o       = job->options;
+    table *t         = &job->tables[thread];
+    const c8 *p      = job->data + job->starts[index];
+    const c8 *end    = job->data + job->starts[index + 1];
+    ipv4 mask        = o->prefix == 0 ? 0 : 0xFFFFFFFF << (32 - o->prefix);
+
+    while (p < end) {
+        const c8 *newline = __builtin_memchr(p, '\n', end - p);
+        const c8 *eol     = newline ? newline : end;
+
+        const c8 *space = p;
+        while (space < eol && *space != ' ' && *space != '\t') space++;
+
+        ipv4 address;
+        if (space == p || !ipv4_parse((string){ .length = (u32) (space - p), .data = (c8*) p }, &address)) {
+            // Blank lines aren't errors
+            t->n_skipped += eol > p && !(eol - p == 1 && *p == '\r');
+            p = eol + 1;
+            continue;
+        }
+
+        u32 key;
+        if (o->db) {
+            string metadata;
+            key = ipdb_lookup_ipv4(o->db, address, &metadata) ? (u32) (metadata.data - o->db->strings) : DB_MISSING;
+        } else {
+            key = address & mask;
+        }
+        table_add(t, key, 1, parse_bytes(space, eol));
+        p = eol + 1;
+    }
+}
+
+// Ranking: more first, then by key for a stable output.
+b32 before(options *o, counter *a, counter *b) {
+    u64 x = o->by_bytes ? a->bytes : a->requests, y = o->by_bytes ? b->bytes : b->requests;
+    if (x != y) return x > y;
+    return a->key < b->key;
+}
+
+//
+// The `k` first counters of the table, in order: a heap of the k best so far
+// with the worst on top, each counter either replaces the top or is dropped.
+//
+s64 top(options *o, table *t, s64 k, counter *out) {
+    s64 n = 0;
+    for (s64 i = 0; i < t->cap; i++) {
+        counter c = t->slots[i];
+        if (!c.requests) continue;
+        if (n == k && !before(o, &c, &out[0])) continue;
+
+        // Push, or replace the top, then sift down.
+        s64 at;
+        if (n < k) {
+            at = n++;
+            while (at > 0 && before(o, &out[(at - 1) / 2], &c)) {
+                out[at] = out[(at - 1) / 2];
+                at = (at - 1) / 2;
+            }
+        } else {
+            at = 0;
+            for (;;) {
+                s64 child = 2 * at + 1;
+                if (child >= n) break;
+                if (child + 1 < n && before(o, &out[child], &out[child + 1])) child++;
+                if (!before(o, &c, &out[child])) break;
+                out[at] = out[child];
+                at = child;
+            }
+        }
+        out[at] = c;
+    }
+
+    // Pop the worst to the end, n times.
+    for (s64 m = n - 1; m > 0; m--) {
+        counter last = out[m];
+        out[m] = out[0];
+        s64 at = 0;
+        for (;;) {
+            s64 child = 2 * at + 1;
+            if (child >= m) break;
+            if (child + 1 < m && before(o, &out[child], &out[child + 1])) child++;
+            if (!before(o, &last, &out[child])) break;
+            out[at] = out[child];
+            at = child;
+        }
+        out[at] = last;
+    }
+    return n;
+}
+
+// False when the output can't be written.
+b32 print_counters(options *o, counter *counters, s64 n) {
+    c8 line[IPV4_STRING_SIZE + 128];
+    s64 cap = MEGABYTE;
+    c8 *buffer = memory_alloc(cap);
+    s64 length = 0;
+    b32 ok = true;
+
+    for (s64 i = 0; i < n; i++) {
+        // The key, as text
+        string key;
+        if (o->db) {
+            key = counters[i].key == DB_MISSING
+                ? (string){ .length = 1, .data = "-" }
+                : (string){ .length = (u32) __builtin_strlen(o->db->strings + counters[i].key), .data = (c8*) o->db->strings + counters[i].key };
+        } else {
+            s32 m = ipv4_format(counters[i].key, line);
+            if (o->prefix < 32) m += snprintf(line + m, 4, "/%d", o->prefix);
+            key = (string){ .length = (u32) m, .data = line };
+        }
+
+        // With JSON, the metadata of the database is escaped. It has no
+        // length limit: the buffer grows for the longest.
+        s64 size = 6 * (s64) key.length + 128;
+        if (length + size > cap) {
+            ok = ok && io_write_all(1, buffer, length);
+            length = 0;
+        }
+        if (size > cap) {
+            cap    = size;
+            buffer = memory_realloc(buffer, cap);
+        }
+        c8 *p = buffer + length;
+        if (o->json) {
+            p += snprintf(p, 10, "{\"key\":\"");
+            for (u32 j = 0; j < key.length; j++) {
+                u8 c = key.data[j];
+                if (c == '"' || c == '\\') *p++ = '\\';
+                if (c < 0x20) p += snprintf(p, 7, "\\u%04x", c);
+                else *p++ = c;
+            }
+            p += snprintf(p, 96, "\",\"requests\":%llu,\"bytes\":%llu}\n",
+                          (unsigned long long) counters[i].requests, (unsigned long long) counters[i].bytes);
+        } else {
+            __builtin_memcpy(p, key.data, key.length);
+            p += key.length;
+            p += snprintf(p, 96, "\t%llu\t%llu\n", (unsigned long long) counters[i].requests, (unsigned long long) counters[i].bytes);
+        }
+        length = p - buffer;
+    }
+    ok = ok && io_write_all(1, buffer, length);
+    free(buffer);
+    return ok;
+}
+
+// Cuts whole lines in chunks, and counts them into the tables of the threads.
+void count_lines(job_system *jobs, aggregation *job, const c8 *data, s64 length) {
+    // Chunks end after the first newline following CHUNK_SIZE bytes.
+    s64 n_chunks = 0;
+    s64 *starts = array_alloc(length / CHUNK_SIZE + 2, s64);
+    starts[0] = 0;
+    for (s64 start = 0; start < length; ) {
+        s64 end = start + CHUNK_SIZE;
+        if (end >= length) {
+            end = length;
+        } else {
+            const c8 *newline = __builtin_memchr(data + end, '\n', length - end);
+            end = newline ? newline - data + 1 : length;
+        }
+        starts[++n_chunks] = end;
+        start = end;
+    }
+
+    job->data   = data;
+    job->starts = starts;
+    job_run(jobs, aggregate_chunk, job, (s32) n_chunks);
+    free(starts);
+}
+
+// The lines of `data`, or of stdin when it's NULL.
+s32 run(options *o, const c8 *data, s64 length, s32 n_threads) {
+    job_system *jobs = job_make_system(n_threads);
+    n_threads = job_thread_count(jobs);
+
+    aggregation job = {
+        .options = o,
+        .tables  = array_alloc(n_threads, table),
+    };
+    for (s32 i = 0; i < n_threads; i++) table_init(&job.tables[i], 1024);
+
+    b32 read_failed = false;
+    if (data) {
+        count_lines(jobs, &job, data, length);
+    } else {
+        // Two chunks per thread at a time, up to the last newline: the
+        // partial line left is carried over to the front for the next read.
+        s64 cap = 2 * n_threads * CHUNK_SIZE, carried = 0;
+        c8 *buffer = memory_alloc(cap);
+        for (b32 end = false; !end; ) {
+            s64 n = io_read_all(0, buffer + carried, cap - carried);
+            if (n < 0) {
+                read_failed = true;
+                break;
+            }
+            end = n < cap - carried;
+            length = carried + n;
+
+            s64 cut = length;
+            if (!end) {
+                while (cut > 0 && buffer[cut - 1] != '\n') cut--;
+                if (cut == 0) { // A line longer than the buffer
+                    cap    *= 2;
+                    buffer  = memory_realloc(buffer, cap);
+                    carried = length;
+                    continue;
+                }
+            }
+            count_lines(jobs, &job, buffer, cut);
+
+            carried = length - cut;
+            __builtin_memmove(buffer, buffer + cut, carried);
+        }
+        free(buffer);
+    }
+
+    // Merged into the first table.
+    table *all = &job.tables[0];
+    for (s32 i = 1; i < n_threads; i++) {
+        table *t = &job.tables[i];
+        for (s64 j = 0; j < t->cap; j++) {
+            if (t->slots[j].requests) table_add(all, t->slots[j].key, t->slots[j].requests, t->slots[j].bytes);
+        }
+        all->n_skipped += t->n_skipped;
+        free(t->slots);
+    }
+
+    b32 written = false;
+    if (read_failed) {
+        fprintf(stderr, "ipagg: can't read stdin\n");
+    } else {
+        s64 k = o->top > 0 && o->top < all->n ? o->top : all->n;
+        counter *best = array_alloc(k > 0 ? k : 1, counter);
+        s64 n = top(o, all, k, best);
+        written = print_counters(o, best, n);
+        free(best);
+
+        if (all->n_skipped) fprintf(stderr, "ipagg: %lld lines skipped\n", (long long) all->n_skipped);
+        if (!written) fprintf(stderr, "ipagg: can't write the output\n");
+    }
+
+    free(all->slots);
+    free(job.tables);
+    job_free_system(jobs);
+    return written ? 0 : 1;
+}
+
+b32 is(const c8 *arg, const c8 *s) {
+    return string_equal(string_make((c8*) arg), string_make((c8*) s));
+}
+
+s32 usage(void) {
+    fprintf(stderr, "usage: ipagg [-p length | -d ranges.ipdb] [-s requests|bytes] [-k count] [-f tsv|json] [-t threads] [file]\n");
+    return 1;
+}
+
+int main(s32 argc, c8 *argv[]) {
+    options o = { .prefix = 32, .db = NULL, .by_bytes = false, .top = 20, .json = false };
+    const c8 *filename = NULL;
+    s32 n_threads = 0;
+
+    for (s32 i = 1; i < argc; i++) {
+        c8 *arg = argv[i];
+        b32 has_value = is(arg, "-p") || is(arg, "-d") || is(arg, "-s") || is(arg, "-k") || is(arg, "-f") || is(arg, "-t");
+        if (has_value && i + 1 == argc) return usage();
+
+        if (is(arg, "-p")) {
+            o.prefix = atoi(argv[++i]);
+            if (o.prefix < 0 || o.prefix > 32) return usage();
+        } else if (is(arg, "-d")) {
+            o.db = ipdb_open(argv[++i]);
+            if (!o.db) {
+                fprintf(stderr, "ipagg: can't open the database %s\n", argv[i]);
+                return 1;
+            }
+        } else if (is(arg, "-s")) {
+            arg = argv[++i];
+            if (is(arg, "bytes")) o.by_bytes = true;
+            else if (!is(arg, "requests")) return usage();
+        } else if (is(arg, "-k")) {
+            o.top = atoll(argv[++i]);
+        } else if (is(arg, "-f")) {
+            arg = argv[++i];
+            if (is(arg, "json")) o.json = true;
+            else if (!is(arg, "tsv")) return usage();
+        } else if (is(arg, "-t")) {
+            n_threads = atoi(argv[++i]);
+        } else if ((arg[0] == '-' && arg[1]) || filename) {
+            return usage();
+        } else {
+            filename = arg;
+        }
+    }
+
+    c8 *data = NULL;
+    s64 length = 0;
+    b32 mapped = filename && !is(filename, "-");
+    if (mapped && !io_map_file(&data, &length, filename)) {
+        fprintf(stderr, "ipagg: can't read %s\n", filename);
+        return 1;
+    }
+
+    // An empty file maps to NULL: it's counted as empty, not read from stdin.
+    s32 status = run(&o, mapped && !data ? "" : data, length, n_threads);
+
+    if (mapped) io_unmap_file(data, length);
+    if (o.db) ipdb_close(o.db);
+    return status;
+}
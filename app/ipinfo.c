@@ -1,40 +1,511 @@
+#include "io.h"
 #include "ip.h"
+#include "ipdb.h"
+#include "job.h"
 
-int main(s32 argc, c8 *argv[]) {
-    if (argc != 2) {
-        return 1;
+
+//
+//     ipinfo 10.0.0.0/8
+//
+// describes one range (or address), IPv4 or IPv6.
+//
+//     ipinfo [-f tsv|json] [-d ranges.ipdb] [-a] [-t threads] [file]
+//
+// describes every range or address of a list, one per line (the first field,
+// the rest of the line is ignored), read from `file` or stdin. A line of
+// output per line of input:
+//
+//     range  mask  wildcard  host count  min  max  [metadata]
+//
+// tab-separated, or as an object per line with -f json. With -d, metadata is
+// that of the most specific range of a compiled database (ipdb.h) containing
+// the first address. With -a, the list is aggregated first: the output is the
+// fewest ranges covering the same addresses, in order, IPv4 then IPv6.
+//
+// Chunks of lines are parsed and formatted in parallel on the job system,
+// each into its own buffer, and the buffers are written out in order: a few
+// writes per megabyte of input. Invalid lines are counted and skipped. Files
+// are mapped, stdin is read a window of chunks at a time.
+//
+
+
+#define CHUNK_SIZE    (MEGABYTE) // Of input, about
+#define CHUNK_RANGES  (32768)    // Of aggregated ranges
+#define RECORD_SIZE   (512)      // Longest line of output, without metadata
+
+
+typedef struct options {
+    b32  json;
+    b32  aggregate;
+    ipdb *db;
+} options;
+
+typedef struct output {
+    c8  *data;
+    s64 length;
+    s64 cap;
+} output;
+
+typedef struct chunk {
+    const c8   *data;    // Lines, or
+    s64        length;
+    ipv4_range *ipv4s;   // Ranges to format
+    s64        n_ipv4s;
+    ipv6_range *ipv6s;
+    s64        n_ipv6s;
+
+    output     out;
+    s64        n_invalid;
+} chunk;
+
+typedef struct bulk {
+    options *options;
+    chunk   *chunks;
+
+    // Aggregated, from every chunk
+    ipv4_range *ipv4s;
+    s64        n_ipv4s;
+    s64        cap_ipv4s;
+    ipv6_range *ipv6s;
+    s64        n_ipv6s;
+    s64        cap_ipv6s;
+} bulk;
+
+
+c8* reserve(output *out, s64 n) {
+    if (out->length + n > out->cap) {
+        out->cap  = out->cap ? 2 * out->cap : 2 * CHUNK_SIZE;
+        if (out->cap < out->length + n) out->cap = out->length + n;
+        out->data = memory_realloc(out->data, out->cap);
     }
+    return out->data + out->length;
+}
 
-    ipv4_range range = ipv4_parse_range(argv[1]);
-    if (!range.address) {
-        return 1;
+s32 format_decimal(ipv6 value, c8 *buffer) {
+    c8 digits[40];
+    s32 n = 0;
+    do {
+        digits[n++] = '0' + (c8) (value % 10);
+        value /= 10;
+    } while (value);
+    for (s32 i = 0; i < n; i++) buffer[i] = digits[n - 1 - i];
+    return n;
+}
+
+c8* put(c8 *p, const c8 *s, s32 n) {
+    __builtin_memcpy(p, s, n);
+    return p + n;
+}
+
+// The metadata, escaped for JSON or with tabs and newlines replaced by spaces for TSV.
+c8* put_metadata(c8 *p, b32 json, string metadata) {
+    for (u32 i = 0; i < metadata.length; i++) {
+        u8 c = metadata.data[i];
+        if (json && (c == '"' || c == '\\')) {
+            *p++ = '\\';
+            *p++ = c;
+        } else if (c < 0x20) {
+            if (json) {
+                p += snprintf(p, 7, "\\u%04x", c);
+            } else {
+                *p++ = ' ';
+            }
+        } else {
+            *p++ = c;
+        }
     }
+    return p;
+}
 
-    ipv4 min = ipv4_min_in_range(range);
-    ipv4 max = ipv4_max_in_range(range);
+//
+// One line of output, from the fields formatted as strings: IPv4 and IPv6
+// only differ by how those are made.
+//
+void write_record(output *out, options *o, string range, c8 fields[5][IPV6_STRING_SIZE], s32 lengths[5], b32 found, string metadata) {
+    static const c8 *keys[5] = { "\",\"mask\":\"", "\",\"wildcard\":\"", "\",\"hosts\":", ",\"min\":\"", "\",\"max\":\"" };
+    static const s32 key_lengths[5] = { 10, 14, 10, 8, 9 };
 
-    printf("IP Range: %s\n", argv[1]);
+    c8 *p = reserve(out, RECORD_SIZE + range.length + (o->db && found ? 6 * (s64) metadata.length : 0));
+    if (o->json) {
+        p = put(p, "{\"range\":\"", 10);
+        p = put(p, range.data, range.length);
+        for (s32 i = 0; i < 5; i++) {
+            p = put(p, keys[i], key_lengths[i]);
+            p = put(p, fields[i], lengths[i]);
+        }
+        *p++ = '"';
+        if (o->db) {
+            if (found) {
+                p = put(p, ",\"metadata\":\"", 13);
+                p = put_metadata(p, true, metadata);
+                *p++ = '"';
+            } else {
+                p = put(p, ",\"metadata\":null", 16);
+            }
+        }
+        *p++ = '}';
+    } else {
+        p = put(p, range.data, range.length);
+        for (s32 i = 0; i < 5; i++) {
+            *p++ = '\t';
+            p = put(p, fields[i], lengths[i]);
+        }
+        if (o->db) {
+            *p++ = '\t';
+            if (found) p = put_metadata(p, false, metadata);
+        }
+    }
+    *p++ = '\n';
+    out->length = p - out->data;
+}
+
+void write_ipv4(output *out, options *o, string text, ipv4_range range) {
+    c8 fields[5][IPV6_STRING_SIZE];
+    s32 lengths[5];
+    lengths[0] = ipv4_format(range.mask, fields[0]);
+    lengths[1] = ipv4_format(range.wildcard, fields[1]);
+    lengths[2] = format_decimal((ipv6) range.wildcard + 1, fields[2]);
+    lengths[3] = ipv4_format(ipv4_min_in_range(range), fields[3]);
+    lengths[4] = ipv4_format(ipv4_max_in_range(range), fields[4]);
 
-    printf("Mask: ");
-    ipv4_bytes mask_bytes = ipv4_to_bytes(range.mask);
-    for (s32 i = 0; i < 4; ++i) printf("%u.", mask_bytes.bytes[i]);
-    printf("\n");
+    string metadata = {0};
+    b32 found = o->db && ipdb_lookup_ipv4(o->db, ipv4_min_in_range(range), &metadata);
+    write_record(out, o, text, fields, lengths, found, metadata);
+}
 
-    printf("Wildcard: ");
-    ipv4_bytes wild_bytes = ipv4_to_bytes(range.wildcard);
-    for (s32 i = 0; i < 4; ++i) printf("%u.", wild_bytes.bytes[i]);
-    printf("\n");
+void write_ipv6(output *out, options *o, string text, ipv6_range range) {
+    c8 fields[5][IPV6_STRING_SIZE];
+    s32 lengths[5];
+    lengths[0] = ipv6_format(range.mask, fields[0]);
+    lengths[1] = ipv6_format(range.wildcard, fields[1]);
+    if (range.wildcard == ~(ipv6) 0) {
+        lengths[2] = 39;
+        __builtin_memcpy(fields[2], "340282366920938463463374607431768211456", 39); // 2^128
+    } else {
+        lengths[2] = format_decimal(range.wildcard + 1, fields[2]);
+    }
+    lengths[3] = ipv6_format(ipv6_min_in_range(range), fields[3]);
+    lengths[4] = ipv6_format(ipv6_max_in_range(range), fields[4]);
 
-    printf("Host count: %u\n", range.wildcard + 1);
+    string metadata = {0};
+    b32 found = o->db && ipdb_lookup_ipv6(o->db, ipv6_min_in_range(range), &metadata);
+    write_record(out, o, text, fields, lengths, found, metadata);
+}
 
-    printf("Min address: ");
-    ipv4_bytes min_bytes = ipv4_to_bytes(min);
-    for (s32 i = 0; i < 4; ++i) printf("%u.", min_bytes.bytes[i]);
-    printf("\n");
-    printf("Max address: ");
-    ipv4_bytes max_bytes = ipv4_to_bytes(max);
-    for (s32 i = 0; i < 4; ++i) printf("%u.", max_bytes.bytes[i]);
-    printf("\n");
+// First field of the line, trimmed. Empty for blank lines and comments.
+string first_field(const c8 *line, s64 length) {
+    s64 start = 0;
+    while (start < length && (line[start] == ' ' || line[start] == '\t' || line[start] == '\r')) start++;
+    if (start < length && line[start] == '#') start = length;
+    s64 end = start;
+    while (end < length && line[end] != ' ' && line[end] != '\t' && line[end] != '\r') end++;
+    return (string){ .length = (u32) (end - start), .data = (c8*) line + start };
+}
 
+b32 is_ipv6(string s) {
+    return __builtin_memchr(s.data, ':', s.length) != NULL;
+}
+
+// Job: lines of a chunk, formatted, or parsed into ranges to aggregate.
+void process_lines(void *data, s32 index, s32 thread) {
+    bulk *job  = data;
+    options *o = job->options;
+    chunk *c   = &job->chunks[index];
+
+    for (s64 start = 0; start < c->length; ) {
+        const c8 *newline = __builtin_memchr(c->data + start, '\n', c->length - start);
+        s64 end = newline ? newline - c->data : c->length;
+        string field = first_field(c->data + start, end - start);
+        start = end + 1;
+        if (field.length == 0) continue;
+
+        if (is_ipv6(field)) {
+            ipv6_range range;
+            if (!ipv6_parse_range(field, &range)) {
+                c->n_invalid++;
+            } else if (o->aggregate) {
+                if (!(c->n_ipv6s & (c->n_ipv6s - 1))) {
+                    c->ipv6s = memory_realloc(c->ipv6s, (c->n_ipv6s ? 2 * c->n_ipv6s : 1) * sizeof(ipv6_range));
+                }
+                c->ipv6s[c->n_ipv6s++] = range;
+            } else {
+                write_ipv6(&c->out, o, field, range);
+            }
+        } else {
+            ipv4_range range;
+            if (!ipv4_parse_cidr(field, &range)) {
+                c->n_invalid++;
+            } else if (o->aggregate) {
+                if (!(c->n_ipv4s & (c->n_ipv4s - 1))) {
+                    c->ipv4s = memory_realloc(c->ipv4s, (c->n_ipv4s ? 2 * c->n_ipv4s : 1) * sizeof(ipv4_range));
+                }
+                c->ipv4s[c->n_ipv4s++] = range;
+            } else {
+                write_ipv4(&c->out, o, field, range);
+            }
+        }
+    }
+}
+
+// Job: aggregated ranges of a chunk, formatted.
+void process_ranges(void *data, s32 index, s32 thread) {
+    bulk *job  = data;
+    options *o = job->options;
+    chunk *c   = &job->chunks[index];
+    c8 text[IPV6_STRING_SIZE + 4];
+
+    for (s64 i = 0; i < c->n_ipv4s; i++) {
+        s32 n = ipv4_format(c->ipv4s[i].address, text);
+        n += snprintf(text + n, 4, "/%d", ipv4_prefix_length(c->ipv4s[i]));
+        write_ipv4(&c->out, o, (string){ .length = n, .data = text }, c->ipv4s[i]);
+    }
+    for (s64 i = 0; i < c->n_ipv6s; i++) {
+        s32 n = ipv6_format(c->ipv6s[i].address, text);
+        n += snprintf(text + n, 5, "/%d", ipv6_prefix_length(c->ipv6s[i]));
+        write_ipv6(&c->out, o, (string){ .length = n, .data = text }, c->ipv6s[i]);
+    }
+}
+
+// Runs a window of chunks, writes their output in order and empties them.
+b32 run_window(job_system *jobs, job_fn fn, bulk *job, s32 n_chunks, s64 *n_invalid) {
+    job_run(jobs, fn, job, n_chunks);
+
+    b32 ok = true;
+    for (s32 i = 0; i < n_chunks; i++) {
+        chunk *c = &job->chunks[i];
+        ok = ok && io_write_all(1, c->out.data, c->out.length);
+        c->out.length = 0;
+        *n_invalid   += c->n_invalid;
+        c->n_invalid  = 0;
+
+        if (fn == process_lines && job->options->aggregate) {
+            if (job->n_ipv4s + c->n_ipv4s > job->cap_ipv4s) {
+                job->cap_ipv4s = 2 * (job->n_ipv4s + c->n_ipv4s);
+                job->ipv4s     = memory_realloc(job->ipv4s, job->cap_ipv4s * sizeof(ipv4_range));
+            }
+            if (job->n_ipv6s + c->n_ipv6s > job->cap_ipv6s) {
+                job->cap_ipv6s = 2 * (job->n_ipv6s + c->n_ipv6s);
+                job->ipv6s     = memory_realloc(job->ipv6s, job->cap_ipv6s * sizeof(ipv6_range));
+            }
+            if (c->n_ipv4s) __builtin_memcpy(job->ipv4s + job->n_ipv4s, c->ipv4s, c->n_ipv4s * sizeof(ipv4_range));
+            if (c->n_ipv6s) __builtin_memcpy(job->ipv6s + job->n_ipv6s, c->ipv6s, c->n_ipv6s * sizeof(ipv6_range));
+            job->n_ipv4s += c->n_ipv4s;
+            job->n_ipv6s += c->n_ipv6s;
+            free(c->ipv4s);
+            free(c->ipv6s);
+            c->ipv4s   = NULL;
+            c->ipv6s   = NULL;
+            c->n_ipv4s = 0;
+            c->n_ipv6s = 0;
+        }
+    }
+    return ok;
+}
+
+// Cuts whole lines into windows of chunks, and runs them.
+b32 run_lines(job_system *jobs, bulk *job, s32 window, const c8 *data, s64 length, s64 *n_invalid) {
+    b32 ok = true;
+    for (s64 start = 0; start < length && ok; ) {
+        s32 n = 0;
+        for (; n < window && start < length; n++) {
+            s64 end = start + CHUNK_SIZE;
+            if (end >= length) {
+                end = length;
+            } else {
+                const c8 *newline = __builtin_memchr(data + end, '\n', length - end);
+                end = newline ? newline - data + 1 : length;
+            }
+            job->chunks[n].data   = data + start;
+            job->chunks[n].length = end - start;
+            start = end;
+        }
+        ok = run_window(jobs, process_lines, job, n, n_invalid);
+    }
+    return ok;
+}
+
+// The lines of `data`, or of stdin when it's NULL.
+s32 run_bulk(options *o, const c8 *data, s64 length, s32 n_threads) {
+    job_system *jobs = job_make_system(n_threads);
+    s32 window = 4 * job_thread_count(jobs);
+
+    bulk job = { .options = o, .chunks = array_alloc(window, chunk) };
+    __builtin_memset(job.chunks, 0, window * sizeof(chunk));
+
+    b32 ok = true, read_failed = false;
+    s64 n_invalid = 0;
+    if (data) {
+        ok = run_lines(jobs, &job, window, data, length, &n_invalid);
+    } else {
+        // A window's worth at a time, up to the last newline: the partial
+        // line left is carried over to the front for the next read.
+        s64 cap = window * CHUNK_SIZE, carried = 0;
+        c8 *buffer = memory_alloc(cap);
+        for (b32 end = false; !end && ok; ) {
+            s64 n = io_read_all(0, buffer + carried, cap - carried);
+            if (n < 0) {
+                read_failed = true;
+                break;
+            }
+            end = n < cap - carried;
+            length = carried + n;
+
+            s64 cut = length;
+            if (!end) {
+                while (cut > 0 && buffer[cut - 1] != '\n') cut--;
+                if (cut == 0) { // A line longer than the buffer
+                    cap    *= 2;
+                    buffer  = memory_realloc(buffer, cap);
+                    carried = length;
+                    continue;
+                }
+            }
+            ok = run_lines(jobs, &job, window, buffer, cut, &n_invalid);
+
+            carried = length - cut;
+            __builtin_memmove(buffer, buffer + cut, carried);
+        }
+        free(buffer);
+    }
+    ok = ok && !read_failed;
+
+    if (o->aggregate && ok) {
+        ipv4_range_set *set4 = ipv4_range_set_make(job.ipv4s, job.n_ipv4s);
+        ipv6_range_set *set6 = ipv6_range_set_make(job.ipv6s, job.n_ipv6s);
+        ipv4_range *ranges4;
+        ipv6_range *ranges6;
+        s64 n4 = ipv4_range_set_to_ranges(set4, &ranges4);
+        s64 n6 = ipv6_range_set_to_ranges(set6, &ranges6);
+
+        for (s64 i = 0, j = 0; (i < n4 || j < n6) && ok; ) {
+            s32 n = 0;
+            for (; n < window && (i < n4 || j < n6); n++) {
+                chunk *c = &job.chunks[n];
+                c->n_ipv4s = n4 - i < CHUNK_RANGES ? n4 - i : CHUNK_RANGES;
+                c->ipv4s   = ranges4 + i;
+                i += c->n_ipv4s;
+                c->n_ipv6s = c->n_ipv4s ? 0 : (n6 - j < CHUNK_RANGES ? n6 - j : CHUNK_RANGES);
+                c->ipv6s   = ranges6 + j;
+                j += c->n_ipv6s;
+            }
+            ok = run_window(jobs, process_ranges, &job, n, &n_invalid);
+        }
+
+        free(ranges4);
+        free(ranges6);
+        ipv4_range_set_free(set4);
+        ipv6_range_set_free(set6);
+    }
+
+    for (s32 i = 0; i < window; i++) free(job.chunks[i].out.data);
+    free(job.chunks);
+    free(job.ipv4s);
+    free(job.ipv6s);
+    job_free_system(jobs);
+
+    if (n_invalid) fprintf(stderr, "ipinfo: %lld invalid lines skipped\n", (long long) n_invalid);
+    if (read_failed) {
+        fprintf(stderr, "ipinfo: can't read stdin\n");
+        return 1;
+    }
+    if (!ok) {
+        fprintf(stderr, "ipinfo: can't write the output\n");
+        return 1;
+    }
+    return 0;
+}
+
+s32 describe(string text) {
+    c8 mask[IPV6_STRING_SIZE], wildcard[IPV6_STRING_SIZE], min[IPV6_STRING_SIZE], max[IPV6_STRING_SIZE], hosts[48];
+
+    if (is_ipv6(text)) {
+        ipv6_range range;
+        if (!ipv6_parse_range(text, &range)) return 1;
+        ipv6_format(range.mask, mask);
+        ipv6_format(range.wildcard, wildcard);
+        ipv6_format(ipv6_min_in_range(range), min);
+        ipv6_format(ipv6_max_in_range(range), max);
+        if (range.wildcard == ~(ipv6) 0) {
+            __builtin_memcpy(hosts, "340282366920938463463374607431768211456", 40);
+        } else {
+            hosts[format_decimal(range.wildcard + 1, hosts)] = 0;
+        }
+    } else {
+        ipv4_range range;
+        if (!ipv4_parse_cidr(text, &range)) return 1;
+        ipv4_format(range.mask, mask);
+        ipv4_format(range.wildcard, wildcard);
+        ipv4_format(ipv4_min_in_range(range), min);
+        ipv4_format(ipv4_max_in_range(range), max);
+        hosts[format_decimal((ipv6) range.wildcard + 1, hosts)] = 0;
+    }
+
+    printf("IP Range: %.*s\nMask: %s\nWildcard: %s\nHost count: %s\nMin address: %s\nMax address: %s\n",
+           (s32) text.length, text.data, mask, wildcard, hosts, min, max);
     return 0;
 }
+
+b32 is(const c8 *arg, const c8 *s) {
+    return string_equal(string_make((c8*) arg), string_make((c8*) s));
+}
+
+s32 usage(void) {
+    fprintf(stderr, "usage: ipinfo <range>\n"
+                    "       ipinfo [-f tsv|json] [-d ranges.ipdb] [-a] [-t threads] [file]\n");
+    return 1;
+}
+
+int main(s32 argc, c8 *argv[]) {
+    options o = { .json = false, .aggregate = false, .db = NULL };
+    const c8 *filename = NULL;
+    s32 n_threads = 0;
+
+    for (s32 i = 1; i < argc; i++) {
+        c8 *arg = argv[i];
+        if ((is(arg, "-f") || is(arg, "-d") || is(arg, "-t")) && i + 1 == argc) {
+            return usage();
+        }
+        if (is(arg, "-f")) {
+            arg = argv[++i];
+            if (is(arg, "json")) o.json = true;
+            else if (!is(arg, "tsv")) return usage();
+        } else if (is(arg, "-d")) {
+            o.db = ipdb_open(argv[++i]);
+            if (!o.db) {
+                fprintf(stderr, "ipinfo: can't open the database %s\n", argv[i]);
+                return 1;
+            }
+        } else if (is(arg, "-t")) {
+            n_threads = atoi(argv[++i]);
+        } else if (is(arg, "-a")) {
+            o.aggregate = true;
+        } else if (arg[0] == '-' && arg[1]) {
+            return usage();
+        } else if (filename) {
+            return usage();
+        } else {
+            filename = arg;
+        }
+    }
+
+    // A lone argument that's a range rather than a file: describe it.
+    if (argc == 2 && filename) {
+        string text = { .length = (u32) __builtin_strlen(filename), .data = (c8*) filename };
+        if (describe(text) == 0) return 0;
+    }
+
+    c8 *data = NULL;
+    s64 length = 0;
+    b32 mapped = filename && !is(filename, "-");
+    if (mapped && !io_map_file(&data, &length, filename)) {
+        fprintf(stderr, "ipinfo: can't read %s%s\n", filename, argc == 2 ? ", not a range either" : "");
+        return 1;
+    }
+
+    // An empty file maps to NULL: nothing to read then, not stdin.
+    s32 status = mapped && !data ? 0 : run_bulk(&o, data, length, n_threads);
+
+    if (mapped) io_unmap_file(data, length);
+    if (o.db) ipdb_close(o.db);
+    return status;
+}
@@ -1,6 +1,11 @@
+#include <stddef.h> // offsetof
+
 #include "c.h"
 #include "io.h"
 #include "json.h"
+#include "json_encoder.h"
+#include "json_document.h"
+#include "json_pointer.h"
 
 
 typedef struct person person;
@@ -34,7 +39,8 @@ json_array decode_array_of_places(json_decoder *decoder);
 void* decode_address(json_decoder *decoder);
 
 void* decode_person(json_decoder *decoder) {
-	person *p = struct_init(person);
+	// From the decoder: released with everything else if the document fails.
+	person *p = memory_set(json_alloc(decoder, sizeof(person)), sizeof(person), 0);
 
 	json_field_spec fields[] = {
 		{ .name="name",       .spec={ .kind=JSON_STRING,  .target={ .string=&p->name }}},
@@ -91,21 +97,28 @@ void* decode_person(json_decoder *decoder) {
 			},
 		},
 	};
-	if (!json_parse_object(decoder, fields, 11)) {
+
+	// The names never change, only the targets: hash them once for all persons.
+	local_persist json_field_table *table = NULL;
+	if (!table) table = json_make_field_table(fields, 11);
+
+	if (!json_parse_object_with_table(decoder, table, fields)) {
 		return NULL;
 	}
 	return p;
 }
 
 void* decode_address(json_decoder *decoder) {
-	address *addr = struct_init(address);
+	address *addr = memory_set(json_alloc(decoder, sizeof(address)), sizeof(address), 0);
 
 	json_field_spec fields[] = {
 		{ .name="city",   .spec={ .kind=JSON_STRING,  .target={ .string=&addr->city }}},
 		{ .name="street", .spec={ .kind=JSON_STRING,  .target={ .string=&addr->street }}},
 		{ .name="number", .spec={ .kind=JSON_INTEGER, .target={ .integer=&addr->number }}},
 	};
-	json_parse_object(decoder, fields, 3);
+	if (!json_parse_object(decoder, fields, 3)) {
+		return NULL;
+	}
 	return addr;
 }
 
@@ -139,6 +152,158 @@ json_array decode_array_of_places(json_decoder *decoder) {
 	return places;
 }
 
+//
+// Encoding uses the same kind of specs, with encode callbacks.
+//
+void encode_person(json_encoder *encoder, void *object);
+void encode_address(json_encoder *encoder, void *object);
+void encode_person_array(json_encoder *encoder, json_array *persons);
+void encode_array_of_places(json_encoder *encoder, json_array *places);
+
+void encode_person(json_encoder *encoder, void *object) {
+	person *p = object;
+
+	json_field_spec fields[] = {
+		{ .name="name",       .spec={ .kind=JSON_STRING,  .target={ .string=&p->name }}},
+		{ .name="age",        .spec={ .kind=JSON_INTEGER, .target={ .integer=&p->age }}},
+		{ .name="height",     .spec={ .kind=JSON_FLOAT,   .target={ .real=&p->height }}},
+		{ .name="subscribed", .spec={ .kind=JSON_BOOLEAN, .target={ .boolean=&p->subscribed }}},
+		{ .name="member",     .spec={ .kind=JSON_BOOLEAN, .target={ .boolean=&p->member }}},
+		{
+			.name="address",
+			.spec={
+				.kind=JSON_OBJECT,
+				.callback={ .encode_object_fn=encode_address },
+				.target={ .object=(void**) &p->address },
+			},
+		},
+		{
+			.name="friends",
+			.spec={
+				.kind=JSON_ARRAY,
+				.callback={ .encode_array_fn=encode_person_array },
+				.target={ .array=&p->friends },
+			}
+		},
+		{
+			.name="favoriteNumbers",
+			.spec={
+				.kind=JSON_ARRAY,
+				.callback={ .encode_array_fn=json_encode_array_of_integer },
+				.target={ .array=&p->favorite_numbers },
+			},
+		},
+		{
+			.name="nicknames",
+			.spec={
+				.kind=JSON_ARRAY,
+				.callback={ .encode_array_fn=json_encode_array_of_string },
+				.target={ .array=&p->nicknames },
+			},
+		},
+		{
+			.name="favoriteFood",
+			.spec={
+				.kind=JSON_ARRAY,
+				.callback={ .encode_array_fn=json_encode_array_of_string },
+				.target={ .array=&p->favorite_food },
+			},
+		},
+		{
+			.name="favoritePlaces",
+			.spec={
+				.kind=JSON_ARRAY,
+				.callback={ .encode_array_fn=encode_array_of_places },
+				.target={ .array=&p->favorite_places },
+			},
+		},
+	};
+	json_encode_object(encoder, fields, 11);
+}
+
+void encode_address(json_encoder *encoder, void *object) {
+	address *addr = object;
+
+	json_field_spec fields[] = {
+		{ .name="city",   .spec={ .kind=JSON_STRING,  .target={ .string=&addr->city }}},
+		{ .name="street", .spec={ .kind=JSON_STRING,  .target={ .string=&addr->street }}},
+		{ .name="number", .spec={ .kind=JSON_INTEGER, .target={ .integer=&addr->number }}},
+	};
+	json_encode_object(encoder, fields, 3);
+}
+
+void encode_person_array(json_encoder *encoder, json_array *persons) {
+	json_array_spec array = {
+		.item_size=sizeof(person*),
+		.array=persons,
+		.spec={
+			.kind=JSON_OBJECT,
+			.callback={ .encode_object_fn=encode_person },
+		},
+	};
+	json_encode_array(encoder, &array);
+}
+
+void encode_array_of_places(json_encoder *encoder, json_array *places) {
+	json_array_spec array = {
+		.item_size=sizeof(json_array),
+		.array=places,
+		.spec={
+			.kind=JSON_ARRAY,
+			.callback={ .encode_array_fn=json_encode_array_of_float },
+		},
+	};
+	json_encode_array(encoder, &array);
+}
+
+//
+// Same shape decoded with a plan: the address is stored inline, friends are
+// stored directly in their array, and there is no callback.
+//
+typedef struct planned_person planned_person;
+
+struct planned_person {
+	c8 *name;
+	s32 age;
+	f32 height;
+	b32 subscribed;
+	b32 member;
+	address address;
+	json_array friends;          // planned_person
+	json_array favorite_numbers; // s32
+	json_array nicknames;        // c8*
+	json_array favorite_food;    // c8*
+	json_array favorite_places;  // json_array of f32
+};
+
+json_plan* make_person_plan(void) {
+	json_plan *string  = json_plan_scalar(JSON_STRING);
+	json_plan *integer = json_plan_scalar(JSON_INTEGER);
+	json_plan *real    = json_plan_scalar(JSON_FLOAT);
+	json_plan *boolean = json_plan_scalar(JSON_BOOLEAN);
+
+	json_plan *addr = json_plan_object(sizeof(address));
+	json_plan_field(addr, "city",   offsetof(address, city),   string);
+	json_plan_field(addr, "street", offsetof(address, street), string);
+	json_plan_field(addr, "number", offsetof(address, number), integer);
+
+	json_plan *p = json_plan_object(sizeof(planned_person));
+	json_plan_field(p, "name",            offsetof(planned_person, name),             string);
+	json_plan_field(p, "age",             offsetof(planned_person, age),              integer);
+	json_plan_field(p, "height",          offsetof(planned_person, height),           real);
+	json_plan_field(p, "subscribed",      offsetof(planned_person, subscribed),       boolean);
+	json_plan_field(p, "member",          offsetof(planned_person, member),           boolean);
+	json_plan_field(p, "address",         offsetof(planned_person, address),          addr);
+	json_plan_field(p, "friends",         offsetof(planned_person, friends),          json_plan_array(p));
+	json_plan_field(p, "favoriteNumbers", offsetof(planned_person, favorite_numbers), json_plan_array(integer));
+	json_plan_field(p, "nicknames",       offsetof(planned_person, nicknames),        json_plan_array(string));
+	json_plan_field(p, "favoriteFood",    offsetof(planned_person, favorite_food),    json_plan_array(string));
+	json_plan_field(p, "favoritePlaces",  offsetof(planned_person, favorite_places),  json_plan_array(json_plan_array(real)));
+
+	json_compile_plan(p);
+	return p;
+}
+
 void print_person(person *p);
 
 s32 main(s32 argc, c8 *argv[]) {
@@ -154,10 +319,80 @@ s32 main(s32 argc, c8 *argv[]) {
 	person *john_doe = decode_person(decoder);
 	if (!john_doe) {
 		printf("NULL\n");
+		json_print_error(&decoder->error, json_data);
 	} else {
 		print_person(john_doe);
+
+		printf("---\n");
+		printf("ENCODED:\n");
+		fflush(stdout);
+
+		json_encoder *encoder = json_make_fd_encoder(1);
+		json_set_indent(encoder, 2);
+		encode_person(encoder, john_doe);
+		json_free_encoder(encoder);
+		printf("\n");
+	}
+
+	printf("---\n");
+	printf("FOUND (plan):\n");
+
+	json_plan *plan = make_person_plan();
+	planned_person planned;
+	decoder = json_make_decoder(json_data);
+	if (!json_decode_with_plan(decoder, plan, &planned)) {
+		printf("NULL\n");
+		json_print_error(&decoder->error, json_data);
+	} else {
+		printf("%s, %d, %f, lives in %s\n", planned.name, planned.age, planned.height, planned.address.city);
+		for (s32 i = 0; i < planned.friends.length; i++) {
+			planned_person *friend = &((planned_person*) planned.friends.data)[i];
+			printf("- friend: %s, %d, lives in %s\n", friend->name, friend->age,
+				friend->address.city ? friend->address.city : "(unknown)");
+		}
+		json_array *places = (json_array*) planned.favorite_places.data;
+		for (s32 i = 0; i < planned.favorite_places.length; i++) {
+			f32 *coords = (f32*) places[i].data;
+			printf("- place: %f / %f\n", coords[0], coords[1]);
+		}
+	}
+
+	printf("---\n");
+	printf("FOUND (indexed):\n");
+
+	decoder = json_make_indexed_decoder(json_data);
+	person *indexed = decode_person(decoder);
+	if (!indexed) {
+		printf("NULL\n");
+		json_print_error(&decoder->error, json_data);
+	} else {
+		print_person(indexed);
 	}
+	json_free_decoder(decoder);
+
+	printf("---\n");
+	printf("LOOKUP (document):\n");
+
+	json_document *document = json_parse_document(json_data);
+	if (!document) {
+		printf("NULL\n");
+	} else {
+		json_cursor root    = json_root(document);
+		string      city    = json_get_string(json_lookup(json_lookup(root, "address"), "city"));
+		json_cursor friends = json_lookup(root, "friends");
+		printf("address.city: %.*s\n", city.length, city.data);
+		printf("friends: %d, age of the second: %lld\n", json_length(friends),
+			(long long) json_get_integer(json_lookup(json_index(friends, 1), "age")));
+		json_free_document(document);
+	}
+
+	printf("---\n");
+	printf("EXTRACT (pointer):\n");
 
+	string street = json_extract(json_data, "/address/street");
+	string place  = json_extract(json_data, "/favoritePlaces/1");
+	printf("/address/street: %.*s\n", street.length, street.data);
+	printf("/favoritePlaces/1: %.*s\n", place.length, place.data);
 
 	free(json_data);
 
@@ -0,0 +1,581 @@
+#include <stddef.h> // offsetof
+#include <time.h>   // clock_gettime(2)
+
+#include "c.h"
+#include "arena.h"
+#include "json.h"
+#include "json_document.h"
+#include "json_pointer.h"
+
+
+//
+// Throughput of the decode paths of json.h on generated corpora:
+//
+//     bin/json_bench [seconds per measure] [corpus]
+//
+// Each corpus is a set of documents of one shape, each path decodes all of
+// them in turn, as many times as fit in the time given. Decoded values go to
+// an arena, reset between passes, so the allocator doesn't dominate.
+//
+// Paths:
+// - skip:            json_parse_object without fields, everything is validated and skipped
+// - skip (indexed):  same, with json_make_indexed_decoder
+// - mapped:          field specs and callbacks, the usual way
+// - mapped (indexed)
+// - plan:            json_decode_with_plan
+// - document:        json_parse_document
+// - pointer:         json_extract of a single value
+//
+
+
+typedef struct corpus      corpus;
+typedef struct bench_path  bench_path;
+
+typedef b8 (*bench_fn)(corpus *c, const c8 *document, arena *a);
+
+struct corpus {
+	const c8  *name;
+	const c8  *description;
+	void      (*generate)(corpus *c);
+	bench_fn  mapped;
+	json_plan *(*make_plan)(void);
+	const c8  *pointer;
+
+	// Generated
+	c8        *data;      // Documents, NUL-separated
+	s64       length;
+	s64       cap;
+	s32       n_documents;
+	s32       cap_documents;
+	s64       *offsets;
+	json_plan *plan;
+};
+
+struct bench_path {
+	const c8 *name;
+	bench_fn run;
+};
+
+
+//
+// Generation
+//
+
+u64 random_state = 0x2545F4914F6CDD1Dull;
+
+u32 random_u32(void) {
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 7;
+	random_state ^= random_state << 17;
+	return (u32) (random_state >> 16);
+}
+
+s32 random_between(s32 min, s32 max) {
+	return min + (s32) (random_u32() % (u32) (max - min + 1));
+}
+
+void emit(corpus *c, const c8 *format, ...) {
+	va_list args;
+	for (;;) {
+		va_start(args, format);
+		s64 n = vsnprintf(c->data + c->length, c->cap - c->length, format, args);
+		va_end(args);
+		if (c->length + n < c->cap) {
+			c->length += n;
+			return;
+		}
+		c->cap  = 2 * c->cap + n;
+		c->data = memory_realloc(c->data, c->cap);
+	}
+}
+
+void begin_document(corpus *c) {
+	if (c->n_documents == c->cap_documents) {
+		c->cap_documents = c->cap_documents ? 2 * c->cap_documents : 64;
+		c->offsets = memory_realloc(c->offsets, c->cap_documents * sizeof(s64));
+	}
+	c->offsets[c->n_documents++] = c->length;
+}
+
+void end_document(corpus *c) {
+	emit(c, "%c", '\0'); // Counted: it's a character written by the format
+}
+
+s32 document_length(corpus *c, s32 d) {
+	s64 end = d + 1 < c->n_documents ? c->offsets[d + 1] : c->length;
+	return (s32) (end - c->offsets[d] - 1);
+}
+
+// Lowercase words, sometimes with characters that must be escaped.
+void emit_text(corpus *c, s32 n_words, s32 escapes) {
+	local_persist const c8 *specials[] = { "\\n", "\\t", "\\\"", "\\\\", "\\u00e9", "\\ud83d\\ude00", "\\/" };
+	for (s32 i = 0; i < n_words; i++) {
+		if (i) emit(c, " ");
+		s32 length = random_between(2, 9);
+		for (s32 j = 0; j < length; j++) emit(c, "%c", 'a' + random_between(0, 25));
+		if (escapes && random_between(0, 3) == 0) emit(c, "%s", specials[random_between(0, 6)]);
+	}
+}
+
+
+// Mapped paths run twice, with and without the structural index.
+b32 bench_indexed = false;
+
+// Of the document being run, without its NUL, for the paths that take it.
+s32 bench_length;
+
+json_decoder* bench_make_decoder(const c8 *document) {
+	return bench_indexed ? json_make_indexed_decoder(document) : json_make_decoder(document);
+}
+
+
+//
+// Deep: objects nested 48 levels, each with a few scalars.
+//
+
+typedef struct deep_node deep_node;
+
+struct deep_node {
+	s32        level;
+	c8         *name;
+	json_array values;
+	deep_node  *child;
+};
+
+void generate_deep(corpus *c) {
+	for (s32 d = 0; d < 4000; d++) {
+		begin_document(c);
+		s32 depth = 48;
+		for (s32 level = 0; level < depth; level++) {
+			emit(c, "{\"level\": %d, \"name\": \"node %d\", \"values\": [%d, %d, %d], \"child\": ",
+				level, random_u32() % 1000, random_between(0, 99), random_between(0, 99), random_between(0, 99));
+		}
+		emit(c, "null");
+		for (s32 level = 0; level < depth; level++) emit(c, "}");
+		end_document(c);
+	}
+}
+
+void* decode_deep_node(json_decoder *decoder) {
+	deep_node *node = json_alloc(decoder, sizeof(deep_node));
+	memory_set(node, sizeof(deep_node), 0);
+
+	json_field_spec fields[] = {
+		{ .name="level",  .spec={ .kind=JSON_INTEGER, .target={ .integer=&node->level }}},
+		{ .name="name",   .spec={ .kind=JSON_STRING,  .target={ .string=&node->name }}},
+		{ .name="values", .spec={ .kind=JSON_ARRAY,   .callback={ .array_fn=json_decode_array_of_integer }, .target={ .array=&node->values }}},
+		{ .name="child",  .spec={ .kind=JSON_OBJECT,  .callback={ .object_fn=decode_deep_node }, .target={ .object=(void**) &node->child }}},
+	};
+	if (!json_parse_object(decoder, fields, 4)) return NULL;
+	return node;
+}
+
+b8 mapped_deep(corpus *c, const c8 *document, arena *a) {
+	json_decoder *decoder = bench_make_decoder(document);
+	decoder->arena = a;
+	b8 ok = decode_deep_node(decoder) != NULL;
+	json_free_decoder(decoder);
+	return ok;
+}
+
+
+//
+// Wide: objects of 256 keys of every type, 16 of them decoded.
+//
+
+#define WIDE_KEYS   (256)
+#define WIDE_MAPPED (16)
+
+typedef struct wide_record wide_record;
+
+struct wide_record {
+	s32 integers[WIDE_MAPPED];
+	f32 floats[WIDE_MAPPED];
+	c8  *strings[WIDE_MAPPED];
+	b32 booleans[WIDE_MAPPED];
+};
+
+json_field_table *wide_table;
+c8 wide_names[WIDE_MAPPED][16];
+
+// Mapped keys are spread over the object, with every type.
+s32 wide_mapped_key(s32 i) {
+	return i * 15 + 1;
+}
+
+void generate_wide(corpus *c) {
+	for (s32 d = 0; d < 3000; d++) {
+		begin_document(c);
+		emit(c, "{");
+		for (s32 k = 0; k < WIDE_KEYS; k++) {
+			emit(c, "%s\"attribute_%03d\": ", k ? ", " : "", k);
+			switch (k % 4) {
+				case 0: emit(c, "%d", random_u32() % 100000); break;
+				case 1: emit(c, "%d.%03d", random_between(0, 999), random_between(0, 999)); break;
+				case 2: emit(c, "\""); emit_text(c, 2, false); emit(c, "\""); break;
+				case 3: emit(c, random_between(0, 1) ? "true" : "false"); break;
+			}
+		}
+		emit(c, "}");
+		end_document(c);
+	}
+}
+
+void wide_fields(wide_record *record, json_field_spec *fields) {
+	for (s32 i = 0; i < WIDE_MAPPED; i++) {
+		s32 key = wide_mapped_key(i);
+		sprintf(wide_names[i], "attribute_%03d", key);
+		fields[i] = (json_field_spec){ .name=wide_names[i] };
+		switch (key % 4) {
+			case 0: fields[i].spec = (json_value_spec){ .kind=JSON_INTEGER, .target={ .integer=&record->integers[i] }}; break;
+			case 1: fields[i].spec = (json_value_spec){ .kind=JSON_FLOAT,   .target={ .real=&record->floats[i] }}; break;
+			case 2: fields[i].spec = (json_value_spec){ .kind=JSON_STRING,  .target={ .string=&record->strings[i] }}; break;
+			case 3: fields[i].spec = (json_value_spec){ .kind=JSON_BOOLEAN, .target={ .boolean=&record->booleans[i] }}; break;
+		}
+	}
+}
+
+b8 mapped_wide(corpus *c, const c8 *document, arena *a) {
+	wide_record record;
+	json_field_spec fields[WIDE_MAPPED];
+	wide_fields(&record, fields);
+	if (!wide_table) wide_table = json_make_field_table(fields, WIDE_MAPPED);
+
+	json_decoder *decoder = bench_make_decoder(document);
+	decoder->arena = a;
+	b8 ok = json_parse_object_with_table(decoder, wide_table, fields);
+	json_free_decoder(decoder);
+	return ok;
+}
+
+json_plan* make_wide_plan(void) {
+	json_plan *p = json_plan_object(sizeof(wide_record));
+	for (s32 i = 0; i < WIDE_MAPPED; i++) {
+		s32 key = wide_mapped_key(i);
+		sprintf(wide_names[i], "attribute_%03d", key);
+		switch (key % 4) {
+			case 0: json_plan_field(p, wide_names[i], offsetof(wide_record, integers) + i * sizeof(s32), json_plan_scalar(JSON_INTEGER)); break;
+			case 1: json_plan_field(p, wide_names[i], offsetof(wide_record, floats)   + i * sizeof(f32), json_plan_scalar(JSON_FLOAT));   break;
+			case 2: json_plan_field(p, wide_names[i], offsetof(wide_record, strings)  + i * sizeof(c8*), json_plan_scalar(JSON_STRING));  break;
+			case 3: json_plan_field(p, wide_names[i], offsetof(wide_record, booleans) + i * sizeof(b32), json_plan_scalar(JSON_BOOLEAN)); break;
+		}
+	}
+	json_compile_plan(p);
+	return p;
+}
+
+
+//
+// Numbers: coordinates and a time series.
+//
+
+typedef struct series series;
+
+struct series {
+	s32        id;
+	json_array points; // json_array of f64
+	json_array values; // s64
+};
+
+void generate_numbers(corpus *c) {
+	for (s32 d = 0; d < 200; d++) {
+		begin_document(c);
+		emit(c, "{\"id\": %d, \"points\": [", d);
+		for (s32 i = 0; i < 2000; i++) {
+			emit(c, "%s[%d.%06d, -%d.%06d]", i ? ", " : "",
+				random_between(0, 89), random_between(0, 999999), random_between(0, 179), random_between(0, 999999));
+		}
+		emit(c, "], \"values\": [");
+		s64 time = 1600000000000ll;
+		for (s32 i = 0; i < 4000; i++) {
+			time += random_between(1, 5000);
+			emit(c, "%s%lld", i ? "," : "", (long long) time);
+		}
+		emit(c, "]}");
+		end_document(c);
+	}
+}
+
+json_array decode_points(json_decoder *decoder) {
+	json_array points = { .length=0, .data=NULL };
+	json_array_spec array = {
+		.item_size=sizeof(json_array),
+		.array=&points,
+		.spec={ .kind=JSON_ARRAY, .callback={ .array_fn=json_decode_array_of_f64 }},
+	};
+	if (!json_parse_array(decoder, &array)) points.length = -1;
+	return points;
+}
+
+b8 mapped_numbers(corpus *c, const c8 *document, arena *a) {
+	series s;
+	json_field_spec fields[] = {
+		{ .name="id",     .spec={ .kind=JSON_INTEGER, .target={ .integer=&s.id }}},
+		{ .name="points", .spec={ .kind=JSON_ARRAY, .callback={ .array_fn=decode_points },            .target={ .array=&s.points }}},
+		{ .name="values", .spec={ .kind=JSON_ARRAY, .callback={ .array_fn=json_decode_array_of_s64 }, .target={ .array=&s.values }}},
+	};
+	json_decoder *decoder = bench_make_decoder(document);
+	decoder->arena = a;
+	b8 ok = json_parse_object(decoder, fields, 3);
+	json_free_decoder(decoder);
+	return ok;
+}
+
+// Plans only know f32 and s32: it's the generic path, for comparison.
+json_plan* make_numbers_plan(void) {
+	json_plan *p = json_plan_object(sizeof(series));
+	json_plan_field(p, "id",     offsetof(series, id),     json_plan_scalar(JSON_INTEGER));
+	json_plan_field(p, "points", offsetof(series, points), json_plan_array(json_plan_array(json_plan_scalar(JSON_FLOAT))));
+	json_compile_plan(p);
+	return p;
+}
+
+
+//
+// Strings: long texts with escape sequences.
+//
+
+typedef struct article article;
+
+struct article {
+	s32        id;
+	c8         *title;
+	c8         *body;
+	json_array lines;
+};
+
+void generate_strings(corpus *c) {
+	for (s32 d = 0; d < 2000; d++) {
+		begin_document(c);
+		emit(c, "{\"id\": %d, \"title\": \"", d);
+		emit_text(c, 8, false);
+		emit(c, "\", \"body\": \"");
+		emit_text(c, 400, true);
+		emit(c, "\", \"lines\": [");
+		for (s32 i = 0; i < 20; i++) {
+			emit(c, "%s\"", i ? ", " : "");
+			emit_text(c, 12, i % 2);
+			emit(c, "\"");
+		}
+		emit(c, "]}");
+		end_document(c);
+	}
+}
+
+b8 mapped_strings(corpus *c, const c8 *document, arena *a) {
+	article art;
+	json_field_spec fields[] = {
+		{ .name="id",    .spec={ .kind=JSON_INTEGER, .target={ .integer=&art.id }}},
+		{ .name="title", .spec={ .kind=JSON_STRING,  .target={ .string=&art.title }}},
+		{ .name="body",  .spec={ .kind=JSON_STRING,  .target={ .string=&art.body }}},
+		{ .name="lines", .spec={ .kind=JSON_ARRAY, .callback={ .array_fn=json_decode_array_of_string }, .target={ .array=&art.lines }}},
+	};
+	json_decoder *decoder = bench_make_decoder(document);
+	decoder->arena = a;
+	b8 ok = json_parse_object(decoder, fields, 4);
+	json_free_decoder(decoder);
+	return ok;
+}
+
+json_plan* make_strings_plan(void) {
+	json_plan *string = json_plan_scalar(JSON_STRING);
+	json_plan *p = json_plan_object(sizeof(article));
+	json_plan_field(p, "id",    offsetof(article, id),    json_plan_scalar(JSON_INTEGER));
+	json_plan_field(p, "title", offsetof(article, title), string);
+	json_plan_field(p, "body",  offsetof(article, body),  string);
+	json_plan_field(p, "lines", offsetof(article, lines), json_plan_array(string));
+	json_compile_plan(p);
+	return p;
+}
+
+
+//
+// Skip: a big payload nobody reads, then the few fields that matter.
+//
+
+typedef struct event event;
+
+struct event {
+	s32 id;
+	c8  *kind;
+};
+
+void generate_skip(corpus *c) {
+	for (s32 d = 0; d < 600; d++) {
+		begin_document(c);
+		emit(c, "{\"payload\": {\"entries\": [");
+		for (s32 i = 0; i < 60; i++) {
+			emit(c, "%s{\"key\": \"entry %d\", \"text\": \"", i ? ", " : "", i);
+			emit_text(c, 20, true);
+			emit(c, "\", \"scores\": [%d, %d, %d], \"nested\": {\"a\": [{\"b\": null}, [true, false]], \"c\": \"{[\\\"]}\"}}",
+				random_between(0, 99), random_between(0, 99), random_between(0, 99));
+		}
+		emit(c, "]}, \"meta\": {\"id\": %d, \"kind\": \"event\"}}", d);
+		end_document(c);
+	}
+}
+
+void* decode_event(json_decoder *decoder) {
+	event *e = json_alloc(decoder, sizeof(event));
+	json_field_spec fields[] = {
+		{ .name="id",   .spec={ .kind=JSON_INTEGER, .target={ .integer=&e->id }}},
+		{ .name="kind", .spec={ .kind=JSON_STRING,  .target={ .string=&e->kind }}},
+	};
+	if (!json_parse_object(decoder, fields, 2)) return NULL;
+	return e;
+}
+
+b8 mapped_skip(corpus *c, const c8 *document, arena *a) {
+	event *e = NULL;
+	json_field_spec fields[] = {
+		{ .name="meta", .spec={ .kind=JSON_OBJECT, .callback={ .object_fn=decode_event }, .target={ .object=(void**) &e }}},
+	};
+	json_decoder *decoder = bench_make_decoder(document);
+	decoder->arena = a;
+	b8 ok = json_parse_object(decoder, fields, 1) && e;
+	json_free_decoder(decoder);
+	return ok;
+}
+
+json_plan* make_skip_plan(void) {
+	json_plan *meta = json_plan_object(sizeof(event));
+	json_plan_field(meta, "id",   offsetof(event, id),   json_plan_scalar(JSON_INTEGER));
+	json_plan_field(meta, "kind", offsetof(event, kind), json_plan_scalar(JSON_STRING));
+
+	json_plan *p = json_plan_object(sizeof(event));
+	json_plan_field(p, "meta", 0, meta);
+	json_compile_plan(p);
+	return p;
+}
+
+
+//
+// Paths
+//
+
+b8 run_skip(corpus *c, const c8 *document, arena *a) {
+	json_decoder *decoder = json_make_decoder(document);
+	b8 ok = json_parse_object(decoder, NULL, 0);
+	json_free_decoder(decoder);
+	return ok;
+}
+
+b8 run_skip_indexed(corpus *c, const c8 *document, arena *a) {
+	json_decoder *decoder = json_make_indexed_decoder(document);
+	b8 ok = json_parse_object(decoder, NULL, 0);
+	json_free_decoder(decoder);
+	return ok;
+}
+
+b8 run_mapped(corpus *c, const c8 *document, arena *a) {
+	return c->mapped(c, document, a);
+}
+
+b8 run_plan(corpus *c, const c8 *document, arena *a) {
+	if (!c->plan) return false;
+	u8 dst[1024];
+	json_decoder *decoder = json_make_decoder(document);
+	decoder->arena = a;
+	b8 ok = json_decode_with_plan(decoder, c->plan, dst);
+	json_free_decoder(decoder);
+	return ok;
+}
+
+b8 run_document(corpus *c, const c8 *document, arena *a) {
+	json_document *d = json_parse_document(document);
+	if (!d) return false;
+	json_free_document(d);
+	return true;
+}
+
+b8 run_pointer(corpus *c, const c8 *document, arena *a) {
+	return json_extract_n(document, bench_length, c->pointer).data != NULL;
+}
+
+b8 run_mapped_indexed(corpus *c, const c8 *document, arena *a) {
+	bench_indexed = true;
+	b8 ok = c->mapped(c, document, a);
+	bench_indexed = false;
+	return ok;
+}
+
+
+corpus corpora[] = {
+	{ "deep",    "objects nested 48 levels",            generate_deep,    mapped_deep,    NULL,              "/child/child/child/child/level" },
+	{ "wide",    "256 keys per object, 16 mapped",      generate_wide,    mapped_wide,    make_wide_plan,    "/attribute_200" },
+	{ "numbers", "coordinates and time series",         generate_numbers, mapped_numbers, make_numbers_plan, "/values/100" },
+	{ "strings", "long strings with escapes",           generate_strings, mapped_strings, make_strings_plan, "/lines/3" },
+	{ "skip",    "big unread payload, then 2 fields",   generate_skip,    mapped_skip,    make_skip_plan,    "/meta/id" },
+};
+
+bench_path paths[] = {
+	{ "skip",             run_skip },
+	{ "skip (indexed)",   run_skip_indexed },
+	{ "mapped",           run_mapped },
+	{ "mapped (indexed)", run_mapped_indexed },
+	{ "plan",             run_plan },
+	{ "document",         run_document },
+	{ "pointer",          run_pointer },
+};
+
+
+f64 now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+s32 main(s32 argc, c8 *argv[]) {
+	f64 seconds = argc > 1 ? atof(argv[1]) : 0.5;
+	const c8 *only = argc > 2 ? argv[2] : NULL;
+
+	arena *a = arena_make(0);
+
+	printf("%-8s %-18s %10s %12s\n", "corpus", "path", "MB/s", "docs/s");
+	for (s32 i = 0; i < (s32) (sizeof(corpora) / sizeof(corpora[0])); i++) {
+		corpus *c = &corpora[i];
+		if (only && __builtin_strcmp(only, c->name) != 0) continue;
+
+		c->cap  = MEGABYTE;
+		c->data = memory_alloc(c->cap);
+		c->generate(c);
+		c->plan = c->make_plan ? c->make_plan() : NULL;
+		printf("%s: %s, %d documents, %.1f MB\n", c->name, c->description, c->n_documents, c->length / 1e6);
+
+		for (s32 p = 0; p < (s32) (sizeof(paths) / sizeof(paths[0])); p++) {
+			bench_path *path = &paths[p];
+			if (path->run == run_plan && !c->plan) continue;
+
+			// One pass to check, then as many as fit in `seconds`.
+			for (s32 d = 0; d < c->n_documents; d++) {
+				bench_length = document_length(c, d);
+				if (!path->run(c, c->data + c->offsets[d], a)) {
+					printf("%-8s %-18s failed on document %d\n", c->name, path->name, d);
+					goto next;
+				}
+			}
+			arena_reset(a);
+
+			s64 passes = 0;
+			f64 start = now(), elapsed;
+			do {
+				for (s32 d = 0; d < c->n_documents; d++) {
+					bench_length = document_length(c, d);
+					path->run(c, c->data + c->offsets[d], a);
+				}
+				arena_reset(a);
+				passes++;
+				elapsed = now() - start;
+			} while (elapsed < seconds);
+
+			printf("%-8s %-18s %10.1f %12.0f\n", c->name, path->name,
+				passes * c->length / elapsed / 1e6, passes * c->n_documents / elapsed);
+		next:;
+		}
+		free(c->data);
+		free(c->offsets);
+	}
+
+	arena_free(a);
+	return 0;
+}
@@ -0,0 +1,156 @@
+#ifndef __robin_c_arena
+#define __robin_c_arena
+
+
+#include "c.h"
+
+
+#ifndef X_ARENA_BLOCK_SIZE
+#define X_ARENA_BLOCK_SIZE (MEGABYTE)
+#endif
+
+
+//
+// Bump allocator: allocations are carved out of big blocks and never freed
+// one by one, everything goes away at once with arena_reset or arena_free.
+// Not thread-safe, use one arena per thread.
+//
+
+
+//
+// Declarations
+//
+
+
+typedef struct arena        arena;
+typedef struct arena__block arena__block;
+typedef struct arena_mark   arena_mark;
+
+
+external arena* arena_make(u64 block_size);
+external void   arena_free(arena *a);
+external void   arena_reset(arena *a);
+external void*  arena_alloc(arena *a, u64 size);
+external void*  arena_realloc(arena *a, void *ptr, u64 old_size, u64 new_size);
+external arena_mark arena_save  (arena *a);
+external void       arena_rewind(arena *a, arena_mark mark);
+
+internal inline u64 arena__align(u64 size);
+
+
+//
+// Definitions
+//
+
+
+struct arena__block {
+    arena__block *next;
+    u64          size;
+    u64          used;
+    u64          padding; // Keep `data` 16 bytes aligned
+    u8           data[];
+};
+
+struct arena {
+    u64          block_size;
+    arena__block *current; // Blocks are linked from the most recent one
+};
+
+struct arena_mark {
+    arena__block *block;
+    u64          used;
+};
+
+
+// `block_size` 0 is X_ARENA_BLOCK_SIZE.
+arena* arena_make(u64 block_size) {
+    arena *a = struct_alloc(arena);
+    a->block_size = block_size ? block_size : X_ARENA_BLOCK_SIZE;
+    a->current    = NULL;
+    return a;
+}
+
+void arena_free(arena *a) {
+    arena__block *block = a->current;
+    while (block) {
+        arena__block *next = block->next;
+        free(block);
+        block = next;
+    }
+    free(a);
+}
+
+// Forget every allocation, only the oldest block is kept around.
+void arena_reset(arena *a) {
+    arena__block *block = a->current;
+    while (block && block->next) {
+        arena__block *next = block->next;
+        free(block);
+        block = next;
+    }
+    if (block) block->used = 0;
+    a->current = block;
+}
+
+// Returns 16 bytes aligned memory, uninitialized.
+void* arena_alloc(arena *a, u64 size) {
+    size = arena__align(size);
+
+    arena__block *block = a->current;
+    if (!block || block->used + size > block->size) {
+        u64 block_size = size > a->block_size ? size : a->block_size;
+        block = memory_alloc(sizeof(arena__block) + block_size);
+        block->next = a->current;
+        block->size = block_size;
+        block->used = 0;
+        a->current  = block;
+    }
+
+    void *ptr = block->data + block->used;
+    block->used += size;
+    return ptr;
+}
+
+// Grows in place when `ptr` is the last allocation, copies otherwise.
+void* arena_realloc(arena *a, void *ptr, u64 old_size, u64 new_size) {
+    if (!ptr) return arena_alloc(a, new_size);
+
+    arena__block *block = a->current;
+    u64 old_aligned = arena__align(old_size);
+    u64 new_aligned = arena__align(new_size);
+    if ((u8*) ptr + old_aligned == block->data + block->used &&
+        block->used - old_aligned + new_aligned <= block->size) {
+        block->used = block->used - old_aligned + new_aligned;
+        return ptr;
+    }
+
+    void *new_ptr = arena_alloc(a, new_size);
+    __builtin_memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
+    return new_ptr;
+}
+
+//
+// Position to rewind to, to release everything allocated after it at once
+// (e.g. what a failed decoding allocated) and keep what was before.
+//
+arena_mark arena_save(arena *a) {
+    return (arena_mark){ .block = a->current, .used = a->current ? a->current->used : 0 };
+}
+
+void arena_rewind(arena *a, arena_mark mark) {
+    arena__block *block = a->current;
+    while (block && block != mark.block) {
+        arena__block *next = block->next;
+        free(block);
+        block = next;
+    }
+    if (block) block->used = mark.used;
+    a->current = block;
+}
+
+u64 arena__align(u64 size) {
+    return (size + 15) & ~(u64) 15;
+}
+
+
+#endif // __robin_c_arena
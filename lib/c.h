@@ -29,8 +29,9 @@
 #define TERABYTE 1024*GIGABYTE
 
 #define memory_alloc      malloc
+#define memory_realloc    realloc
 #define struct_alloc(T)   memory_alloc(sizeof(T))
-#define array_alloc(n, T) memory_alloc(n * sizeof(T))
+#define array_alloc(n, T) memory_alloc((n) * sizeof(T))
 
 #define memory_init(n)   memory_set(memory_alloc(n), n, 0);
 #define struct_init(T)   memory_set(struct_alloc(T), sizeof(T), 0);
@@ -60,17 +61,14 @@ external void* memory_copy(void *dst, void *src, s32 n);
 external void* memory_set(void *dst, s32 n, c8 value);
 
 
+// Let the compiler pick the best copy/fill for the target (rep movsb, vector
+// stores, ...): hot paths like the string builder rely on these for bulk copies.
 void* memory_copy(void *dst, void *src, s32 n) {
-	c8 *cdst = (c8*) dst;
-	c8 *csrc = (c8*) src;
-	for (s32 i = 0; i < n; i++) cdst[i] = csrc[i];
-	return dst;
+	return __builtin_memcpy(dst, src, n);
 }
 
 void* memory_set(void *dst, s32 n, c8 value) {
-	c8 *cdst = (c8*) dst;
-	for (s32 i = 0; i < n; i++) cdst[i] = value;
-	return dst;
+	return __builtin_memset(dst, value, n);
 }
 
 
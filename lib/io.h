@@ -2,38 +2,154 @@
 #define __robin_c_io
 
 
-#include <fcntl.h>  // open(2)
-#include <unistd.h> // read(2)
+#include <errno.h>    // EINTR
+#include <fcntl.h>    // open(2)
+#include <unistd.h>   // read(2)
+#include <sys/mman.h> // mmap(2)
+#include <sys/stat.h> // fstat(2)
 
 #include "c.h"
-#include "string_builder.h"
 
 
-external b32 io_read_file(c8 **dst, const c8 *filename);
+external b32  io_read_file(c8 **dst, const c8 *filename);
+external b32  io_map_file(c8 **dst, s64 *length, const c8 *filename);
+external void io_unmap_file(c8 *data, s64 length);
+external s64  io_read_all(s32 fd, void *data, s64 length);
+external b32  io_write_all(s32 fd, const void *data, s64 length);
 
 
+//
+// Read a whole file in a NUL-terminated buffer, allocated at the size of the
+// file (grown if it isn't a regular file, or grew in the meantime).
+//
 b32 io_read_file(c8 **dst, const c8 *filename) {
-	s32 fd, n;
-	string_builder *builder;
-	c8 buffer[1024];
-	
+	struct stat info;
+	s64 cap, length, n;
+	s32 fd;
+	c8 *data;
+
 	fd = open(filename, O_RDONLY);
-	if (fd == 0) {
+	if (fd < 0) {
 		return false;
 	}
 
-	builder = string_make_builder();
+	cap = 4 * KILOBYTE;
+	if (fstat(fd, &info) == 0 && info.st_size > 0) {
+		cap = info.st_size + 1;
+	}
+	data   = memory_alloc(cap);
+	length = 0;
 
 	for (;;) {
-		n = read(fd, buffer, 1024);
+		if (length + 1 == cap) {
+			// Full: only grow if there is more to read.
+			c8 probe;
+			n = read(fd, &probe, 1);
+			if (n == 1) {
+				cap *= 2;
+				data = memory_realloc(data, cap);
+				data[length++] = probe;
+				continue;
+			}
+		} else {
+			n = read(fd, data + length, cap - 1 - length);
+		}
+		if (n < 0) {
+			free(data);
+			close(fd);
+			return false;
+		}
+		if (n == 0) {
+			break;
+		}
+		length += n;
+	}
+	close(fd);
+
+	data[length] = '\0';
+	*dst = data;
+	return true;
+}
+
+//
+// Map a whole file read-only, without copying it. The mapping isn't NUL
+// terminated: use `length`. Empty files map to NULL.
+//
+b32 io_map_file(c8 **dst, s64 *length, const c8 *filename) {
+	struct stat info;
+	s32 fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	if (fstat(fd, &info) < 0) {
+		close(fd);
+		return false;
+	}
+
+	*dst    = NULL;
+	*length = info.st_size;
+	if (info.st_size > 0) {
+		void *data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED) {
+			close(fd);
+			return false;
+		}
+		madvise(data, info.st_size, MADV_SEQUENTIAL);
+		*dst = data;
+	}
+
+	close(fd);
+	return true;
+}
+
+void io_unmap_file(c8 *data, s64 length) {
+	if (data) {
+		munmap(data, length);
+	}
+}
+
+//
+// read(2) until `length` bytes are read or the input ends. Returns how many
+// were read, fewer only at the end, or -1 on errors.
+//
+s64 io_read_all(s32 fd, void *data, s64 length) {
+	c8 *p = data;
+	s64 n, total = 0;
+
+	while (total < length) {
+		n = read(fd, p + total, length - total);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n < 0) {
+			return -1;
+		}
 		if (n == 0) {
 			break;
 		}
-		string_write_n(builder, buffer, n);
+		total += n;
 	}
+	return total;
+}
 
-	*dst = string_builder_to_c(builder);
-	string_free_builder(builder);
+// write(2) until everything is written, retrying when interrupted.
+b32 io_write_all(s32 fd, const void *data, s64 length) {
+	const c8 *p = data;
+	s64 n;
+
+	while (length > 0) {
+		n = write(fd, p, length);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n < 0) {
+			return false;
+		}
+		p      += n;
+		length -= n;
+	}
 	return true;
 }
 
@@ -3,17 +3,76 @@
 
 
 #include "c.h"
+#include "sort.h"
+#include "string.h"
 
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
 
-typedef u32               ipv4;
-typedef union ipv4_b      ipv4_b;
-typedef struct ipv4_range ipv4_range;
+
+#define IPV4_STRING_SIZE (16) // "255.255.255.255" and the NUL
+#define IPV6_STRING_SIZE (46) // "ffff:ffff:ffff:ffff:ffff:ffff:255.255.255.255" and the NUL
+
+
+typedef u32                   ipv4;
+typedef union ipv4_b          ipv4_b;
+typedef struct ipv4_range     ipv4_range;
+typedef struct ipv4_interval  ipv4_interval;
+typedef struct ipv4_range_set ipv4_range_set;
+
+typedef unsigned __int128     ipv6;
+typedef struct ipv6_range     ipv6_range;
+typedef struct ipv6_interval  ipv6_interval;
+typedef struct ipv6_range_set ipv6_range_set;
 
 external ipv4       ipv4_parse_address(const c8 *s);
+external b8         ipv4_parse(string s, ipv4 *address);
+external s64        ipv4_parse_batch(const string *strings, s64 n, ipv4 *addresses, b8 *valid);
+external s32        ipv4_format(ipv4 address, c8 *buffer);
 external ipv4_b     ipv4_bytes(ipv4 address);
 external ipv4_range ipv4_parse_range(const c8 *s);
+external b8         ipv4_parse_cidr(string s, ipv4_range *range);
 external ipv4       ipv4_min_in_range(ipv4_range range);
 external ipv4       ipv4_max_in_range(ipv4_range range);
+external s32        ipv4_prefix_length(ipv4_range range);
+
+external ipv4_range_set* ipv4_range_set_make(const ipv4_range *ranges, s64 n);
+external void            ipv4_range_set_free(ipv4_range_set *set);
+external b8              ipv4_range_set_contains(ipv4_range_set *set, ipv4 address);
+external ipv4_range_set* ipv4_range_set_union       (ipv4_range_set *a, ipv4_range_set *b);
+external ipv4_range_set* ipv4_range_set_intersection(ipv4_range_set *a, ipv4_range_set *b);
+external ipv4_range_set* ipv4_range_set_difference  (ipv4_range_set *a, ipv4_range_set *b);
+external s64             ipv4_range_set_to_ranges(ipv4_range_set *set, ipv4_range **ranges);
+
+external ipv6 ipv6_parse_address(const c8 *s);
+external b8   ipv6_parse(string s, ipv6 *address);
+external s32  ipv6_format(ipv6 address, c8 *buffer);
+external b8   ipv6_parse_range(string s, ipv6_range *range);
+external ipv6 ipv6_min_in_range(ipv6_range range);
+external ipv6 ipv6_max_in_range(ipv6_range range);
+external s32  ipv6_prefix_length(ipv6_range range);
+
+external ipv6_range_set* ipv6_range_set_make(const ipv6_range *ranges, s64 n);
+external void            ipv6_range_set_free(ipv6_range_set *set);
+external b8              ipv6_range_set_contains(ipv6_range_set *set, ipv6 address);
+external ipv6_range_set* ipv6_range_set_union       (ipv6_range_set *a, ipv6_range_set *b);
+external ipv6_range_set* ipv6_range_set_intersection(ipv6_range_set *a, ipv6_range_set *b);
+external ipv6_range_set* ipv6_range_set_difference  (ipv6_range_set *a, ipv6_range_set *b);
+external s64             ipv6_range_set_to_ranges(ipv6_range_set *set, ipv6_range **ranges);
+
+internal b8              ipv4__parse_16(string s, ipv4 *address);
+internal ipv4_range_set* ipv4__range_set_alloc(s64 capacity);
+internal void            ipv4__range_set_push(ipv4_range_set *set, u64 min, u64 max);
+internal ipv4_range_set* ipv4__range_set_finish(ipv4_range_set *set);
+internal s64             ipv4__range_set_layout(ipv4_range_set *set, s64 i, s64 k);
+
+internal u32             ipv6__hex_digit(c8 c);
+internal ipv6_range_set* ipv6__range_set_alloc(s64 capacity);
+internal void            ipv6__range_set_push(ipv6_range_set *set, ipv6 min, ipv6 max);
+internal ipv6_range_set* ipv6__range_set_finish(ipv6_range_set *set);
+internal s64             ipv6__range_set_layout(ipv6_range_set *set, s64 i, s64 k);
+internal s32             ipv6__interval_compare(const void *a, const void *b);
 
 
 struct ipv4_range {
@@ -22,6 +81,47 @@ struct ipv4_range {
     ipv4 wildcard;
 };
 
+struct ipv4_interval {
+    ipv4 min;
+    ipv4 max; // Included
+};
+
+//
+// Addresses as sorted, disjoint and non-adjacent intervals, e.g. allow or deny
+// lists with lots of overlapping entries:
+//
+//     ipv4_range_set *deny = ipv4_range_set_make(ranges, n_ranges);
+//     if (ipv4_range_set_contains(deny, address)) ...
+//
+// Sets are immutable, the operations make new ones in linear time. Lookups
+// search a copy of the intervals in Eytzinger order (the layout of a binary
+// heap: the first levels of every search share the same cache lines),
+// without branches on the comparisons.
+//
+struct ipv4_range_set {
+    ipv4_interval *intervals;
+    s64           n_intervals;
+    ipv4_interval *eytzinger;  // From index 1
+};
+
+struct ipv6_range {
+    ipv6 address;
+    ipv6 mask;
+    ipv6 wildcard;
+};
+
+struct ipv6_interval {
+    ipv6 min;
+    ipv6 max; // Included
+};
+
+// Same as ipv4_range_set.
+struct ipv6_range_set {
+    ipv6_interval *intervals;
+    s64           n_intervals;
+    ipv6_interval *eytzinger;  // From index 1
+};
+
 union ipv4_b {
     u8 bytes[4];
     struct {
@@ -32,34 +132,80 @@ union ipv4_b {
     } abcd;
 };
 
+// Returns 0 if `s` isn't an address, see ipv4_parse.
 ipv4 ipv4_parse_address(const c8 *s) {
-    s32 len = 0;
-    while (s[len] != 0) len++;
+    u32 length = 0;
+    while (length < 16 && s[length] != 0) length++;
 
-    u8 bytes[4] = {0, 0, 0, 0};
-    s32 b = 0;
-    for (s32 i = 0; i < len; ++i) {
-        c8 c = s[i];
-        if ('0' <= c && c <= '9') {
-            bytes[b] *= 10;
-            bytes[b] += c - '0';
-        } else if (c == '.') {
-            if (b >= 3) return 0; // @Error
-            b++;
-        }  else {
-            return 0; // @Error
+    ipv4 result;
+    if (!ipv4_parse((string){ .length = length, .data = (c8*) s }, &result)) return 0;
+    return result;
+}
+
+//
+// Dotted quad only: 4 octets of 1 to 3 digits up to 255, without leading zeros
+// ("010" could be octal), nothing before or after. `s` doesn't have to be
+// NUL-terminated.
+//
+b8 ipv4_parse(string s, ipv4 *address) {
+    if (s.length < 7 || s.length > 15) return false;
+
+    ipv4 result = 0;
+    u32  i      = 0;
+    for (s32 octet = 0; octet < 4; octet++) {
+        if (octet > 0) {
+            if (i >= s.length || s.data[i] != '.') return false;
+            i++;
+        }
+
+        u32 start = i;
+        u32 value = 0;
+        while (i < s.length && i - start < 3 && string_is_digit_char(s.data[i])) {
+            value = value * 10 + (s.data[i] - '0');
+            i++;
         }
+        if (i == start || value > 255 || (s.data[start] == '0' && i - start > 1)) return false;
+        result = result << 8 | value;
     }
+    if (i != s.length) return false;
 
-    ipv4 result;
-    result = bytes[0];
-    result <<= 8;
-    result += bytes[1];
-    result <<= 8;
-    result += bytes[2];
-    result <<= 8;
-    result += bytes[3];
-    return result;
+    *address = result;
+    return true;
+}
+
+//
+// ipv4_parse on each string, for the hot loops (e.g. a column of access
+// logs): `valid[i]` tells whether `strings[i]` was an address, `addresses[i]`
+// is 0 when it wasn't. Returns the number of valid addresses.
+//
+// With SSSE3 (-mssse3 or a -march that has it), each address is parsed in a
+// 16 bytes register, without a loop over its characters. Otherwise, same as
+// calling ipv4_parse.
+//
+s64 ipv4_parse_batch(const string *strings, s64 n, ipv4 *addresses, b8 *valid) {
+    s64 n_valid = 0;
+    for (s64 i = 0; i < n; i++) {
+        ipv4 address = 0;
+        b8 ok = ipv4__parse_16(strings[i], &address);
+        addresses[i] = ok ? address : 0;
+        valid[i]     = ok;
+        n_valid     += ok;
+    }
+    return n_valid;
+}
+
+// `buffer` has room for IPV4_STRING_SIZE characters, returns the length written, without the NUL.
+s32 ipv4_format(ipv4 address, c8 *buffer) {
+    s32 n = 0;
+    for (s32 shift = 24; shift >= 0; shift -= 8) {
+        u32 octet = (address >> shift) & 0xFF;
+        if (octet >= 100) buffer[n++] = '0' + octet / 100;
+        if (octet >= 10)  buffer[n++] = '0' + octet / 10 % 10;
+        buffer[n++] = '0' + octet % 10;
+        if (shift) buffer[n++] = '.';
+    }
+    buffer[n] = 0;
+    return n;
 }
 
 ipv4_b ipv4_bytes(ipv4 address) {
@@ -111,6 +257,32 @@ ipv4_range ipv4_parse_range(const c8 *s) {
     return result;
 }
 
+// Validated ipv4_parse_range: "address/length", or an address alone for a /32.
+b8 ipv4_parse_cidr(string s, ipv4_range *range) {
+    u32 slash = 0;
+    while (slash < s.length && s.data[slash] != '/') slash++;
+
+    ipv4 address;
+    if (!ipv4_parse((string){ .length = slash, .data = s.data }, &address)) return false;
+
+    u32 length = 32;
+    if (slash < s.length) {
+        u32 digits = s.length - slash - 1;
+        if (digits < 1 || digits > 2) return false;
+        length = 0;
+        for (u32 i = slash + 1; i < s.length; i++) {
+            if (!string_is_digit_char(s.data[i])) return false;
+            length = length * 10 + (s.data[i] - '0');
+        }
+        if (length > 32 || (s.data[slash + 1] == '0' && digits > 1)) return false;
+    }
+
+    range->address  = address;
+    range->wildcard = length == 0 ? 0xFFFFFFFF : ((ipv4) 1 << (32 - length)) - 1;
+    range->mask     = ~range->wildcard;
+    return true;
+}
+
 ipv4 ipv4_min_in_range(ipv4_range range) {
     return range.address & range.mask;
 }
@@ -119,5 +291,642 @@ ipv4 ipv4_max_in_range(ipv4_range range) {
     return range.address | range.wildcard;
 }
 
+// The n of "/n": ranges are CIDR blocks, so the wildcard is the low bits.
+s32 ipv4_prefix_length(ipv4_range range) {
+    return 32 - __builtin_popcount(range.wildcard);
+}
+
+ipv4_range_set* ipv4_range_set_make(const ipv4_range *ranges, s64 n) {
+    // By first address, the last one as the value.
+    sort_kv *sorted = array_alloc(n > 0 ? n : 1, sort_kv);
+    for (s64 i = 0; i < n; i++) {
+        sorted[i].key   = ipv4_min_in_range(ranges[i]);
+        sorted[i].value = ipv4_max_in_range(ranges[i]);
+    }
+    sort_pairs(sorted, n, NULL);
+
+    ipv4_range_set *set = ipv4__range_set_alloc(n);
+    for (s64 i = 0; i < n; i++) ipv4__range_set_push(set, sorted[i].key, sorted[i].value);
+    free(sorted);
+    return ipv4__range_set_finish(set);
+}
+
+void ipv4_range_set_free(ipv4_range_set *set) {
+    free(set->intervals);
+    free(set->eytzinger);
+    free(set);
+}
+
+//
+// Finds the first interval that ends at or after `address`, the only one that
+// can contain it: the comparison picks the child, k ends up past a leaf, and
+// the interval is the last node where the search went left.
+//
+b8 ipv4_range_set_contains(ipv4_range_set *set, ipv4 address) {
+    ipv4_interval *e = set->eytzinger;
+    s64 n = set->n_intervals;
+
+    s64 k = 1;
+    while (k <= n) {
+        __builtin_prefetch(e + 8 * k); // 3 levels down, 8 intervals a cache line
+        k = 2 * k + (e[k].max < address);
+    }
+    k >>= __builtin_ffsll(~k);
+
+    return k > 0 && e[k].min <= address;
+}
+
+ipv4_range_set* ipv4_range_set_union(ipv4_range_set *a, ipv4_range_set *b) {
+    ipv4_range_set *set = ipv4__range_set_alloc(a->n_intervals + b->n_intervals);
+
+    s64 i = 0, j = 0;
+    while (i < a->n_intervals || j < b->n_intervals) {
+        if (j == b->n_intervals || (i < a->n_intervals && a->intervals[i].min < b->intervals[j].min)) {
+            ipv4__range_set_push(set, a->intervals[i].min, a->intervals[i].max);
+            i++;
+        } else {
+            ipv4__range_set_push(set, b->intervals[j].min, b->intervals[j].max);
+            j++;
+        }
+    }
+    return ipv4__range_set_finish(set);
+}
+
+ipv4_range_set* ipv4_range_set_intersection(ipv4_range_set *a, ipv4_range_set *b) {
+    ipv4_range_set *set = ipv4__range_set_alloc(a->n_intervals + b->n_intervals);
+
+    s64 i = 0, j = 0;
+    while (i < a->n_intervals && j < b->n_intervals) {
+        ipv4_interval x = a->intervals[i], y = b->intervals[j];
+        ipv4 min = x.min > y.min ? x.min : y.min;
+        ipv4 max = x.max < y.max ? x.max : y.max;
+        if (min <= max) ipv4__range_set_push(set, min, max);
+
+        if (x.max < y.max) i++;
+        else               j++;
+    }
+    return ipv4__range_set_finish(set);
+}
+
+// What's in `a` and not in `b`.
+ipv4_range_set* ipv4_range_set_difference(ipv4_range_set *a, ipv4_range_set *b) {
+    ipv4_range_set *set = ipv4__range_set_alloc(a->n_intervals + b->n_intervals);
+
+    s64 j = 0;
+    for (s64 i = 0; i < a->n_intervals; i++) {
+        ipv4_interval x = a->intervals[i];
+        u64 start = x.min; // Of what's left of x, past x.max once it's all removed
+
+        while (j < b->n_intervals && b->intervals[j].max < start) j++;
+        for (s64 k = j; k < b->n_intervals && b->intervals[k].min <= x.max; k++) {
+            ipv4_interval y = b->intervals[k];
+            if (y.min > start) ipv4__range_set_push(set, start, y.min - 1);
+            if ((u64) y.max + 1 > start) start = (u64) y.max + 1;
+            if (start > x.max) break;
+        }
+        if (start <= x.max) ipv4__range_set_push(set, start, x.max);
+    }
+    return ipv4__range_set_finish(set);
+}
+
+//
+// The fewest CIDR ranges covering exactly the set, in order: each interval is
+// cut into the biggest aligned blocks that fit. Returns their number, `*ranges`
+// is allocated, to free.
+//
+s64 ipv4_range_set_to_ranges(ipv4_range_set *set, ipv4_range **ranges) {
+    s64 n = 0, capacity = set->n_intervals + 1;
+    *ranges = array_alloc(capacity, ipv4_range);
+
+    for (s64 i = 0; i < set->n_intervals; i++) {
+        u64 start = set->intervals[i].min;
+        u64 end   = (u64) set->intervals[i].max + 1;
+        while (start < end) {
+            u64 size = start ? start & -start : (u64) 1 << 32; // Alignment of start
+            while (start + size > end) size >>= 1;
+
+            if (n == capacity) {
+                capacity *= 2;
+                *ranges = memory_realloc(*ranges, capacity * sizeof(ipv4_range));
+            }
+            (*ranges)[n++] = (ipv4_range){
+                .address  = (ipv4) start,
+                .mask     = (ipv4) ~(size - 1),
+                .wildcard = (ipv4) (size - 1),
+            };
+            start += size;
+        }
+    }
+    return n;
+}
+
+ipv4_range_set* ipv4__range_set_alloc(s64 capacity) {
+    ipv4_range_set *set = struct_alloc(ipv4_range_set);
+    set->intervals   = array_alloc(capacity > 0 ? capacity : 1, ipv4_interval);
+    set->n_intervals = 0;
+    set->eytzinger   = NULL;
+    return set;
+}
+
+// Intervals come sorted by `min`: merged into the last one when they overlap or touch it.
+void ipv4__range_set_push(ipv4_range_set *set, u64 min, u64 max) {
+    if (set->n_intervals > 0) {
+        ipv4_interval *last = &set->intervals[set->n_intervals - 1];
+        if (min <= (u64) last->max + 1) {
+            if (max > last->max) last->max = (ipv4) max;
+            return;
+        }
+    }
+    set->intervals[set->n_intervals++] = (ipv4_interval){ .min = (ipv4) min, .max = (ipv4) max };
+}
+
+ipv4_range_set* ipv4__range_set_finish(ipv4_range_set *set) {
+    set->eytzinger = array_alloc(set->n_intervals + 1, ipv4_interval);
+    ipv4__range_set_layout(set, 0, 1);
+    return set;
+}
+
+// In-order walk of the implicit tree: node k gets the i-th interval. Returns the next i.
+s64 ipv4__range_set_layout(ipv4_range_set *set, s64 i, s64 k) {
+    if (k > set->n_intervals) return i;
+    i = ipv4__range_set_layout(set, i, 2 * k);
+    set->eytzinger[k] = set->intervals[i++];
+    return ipv4__range_set_layout(set, i, 2 * k + 1);
+}
+
+//
+// IPv6
+//
+// Addresses are 128 bits integers, in host order: masks, comparisons and
+// increments are plain arithmetic, as for ipv4.
+//
+
+// Returns 0 if `s` isn't an address, see ipv6_parse.
+ipv6 ipv6_parse_address(const c8 *s) {
+    u32 length = 0;
+    while (length < 64 && s[length] != 0) length++;
+
+    ipv6 result;
+    if (!ipv6_parse((string){ .length = length, .data = (c8*) s }, &result)) return 0;
+    return result;
+}
+
+//
+// All the textual forms of RFC 4291: 8 groups of 1 to 4 hex digits, one "::"
+// for a run of zero groups, and the last 32 bits as a dotted quad
+// ("::ffff:192.0.2.1"). No zone ("%eth0"), no brackets.
+//
+b8 ipv6_parse(string s, ipv6 *address) {
+    if (s.length < 2 || s.length > IPV6_STRING_SIZE - 1) return false;
+
+    u16 groups[8];
+    s32 n_groups = 0;
+    s32 gap      = -1; // Where the "::" is, in groups
+    u32 i        = 0;
+
+    if (s.data[0] == ':') {
+        if (s.data[1] != ':') return false;
+        gap = 0;
+        i   = 2;
+    }
+
+    while (i < s.length) {
+        u32 start = i;
+        u32 value = 0;
+        for (; i < s.length && i - start < 5; i++) {
+            u32 digit = ipv6__hex_digit(s.data[i]);
+            if (digit > 15) break;
+            value = value << 4 | digit;
+        }
+
+        if (i < s.length && s.data[i] == '.') {
+            ipv4 tail;
+            if (n_groups > 6 || !ipv4_parse((string){ .length = s.length - start, .data = s.data + start }, &tail)) return false;
+            groups[n_groups++] = (u16) (tail >> 16);
+            groups[n_groups++] = (u16) tail;
+            break;
+        }
+        if (i == start || i - start > 4 || n_groups == 8) return false;
+        groups[n_groups++] = (u16) value;
+
+        if (i == s.length) break;
+        if (s.data[i++] != ':' || i == s.length) return false;
+        if (s.data[i] == ':') {
+            if (gap >= 0) return false;
+            gap = n_groups;
+            i++;
+        }
+    }
+    if (gap < 0 ? n_groups != 8 : n_groups > 7) return false;
+
+    // The groups after the "::" go to the end, zeros in between.
+    if (gap >= 0) {
+        s32 n_after = n_groups - gap;
+        for (s32 g = 7; g >= 8 - n_after; g--) groups[g] = groups[g - (8 - n_groups)];
+        for (s32 g = gap; g < 8 - n_after; g++) groups[g] = 0;
+    }
+
+    u64 hi = (u64) groups[0] << 48 | (u64) groups[1] << 32 | (u64) groups[2] << 16 | groups[3];
+    u64 lo = (u64) groups[4] << 48 | (u64) groups[5] << 32 | (u64) groups[6] << 16 | groups[7];
+    *address = (ipv6) hi << 64 | lo;
+    return true;
+}
+
+//
+// RFC 5952: lowercase, no leading zeros, the longest run of 2 zero groups or
+// more as "::" (the first one if there are several), and mapped IPv4
+// addresses (::ffff:0:0/96) with a dotted quad. `buffer` has room for
+// IPV6_STRING_SIZE characters, returns the length written, without the NUL.
+//
+s32 ipv6_format(ipv6 address, c8 *buffer) {
+    const c8 *hex = "0123456789abcdef";
+
+    u16 groups[8];
+    for (s32 g = 0; g < 8; g++) groups[g] = (u16) (address >> (16 * (7 - g)));
+
+    b32 mapped = address >> 32 == 0xFFFF;
+    s32 n_groups = mapped ? 6 : 8;
+
+    s32 best = -1, best_length = 1;
+    for (s32 g = 0; g < n_groups;) {
+        s32 length = 0;
+        while (g + length < n_groups && groups[g + length] == 0) length++;
+        if (length > best_length) {
+            best        = g;
+            best_length = length;
+        }
+        g += length ? length : 1;
+    }
+
+    s32 n = 0;
+    for (s32 g = 0; g < n_groups; g++) {
+        if (g == best) {
+            buffer[n++] = ':';
+            buffer[n++] = ':';
+            g += best_length - 1;
+            continue;
+        }
+        if (g > 0 && g != best + best_length) buffer[n++] = ':';
+
+        u16 group = groups[g];
+        s32 shift = 12;
+        while (shift > 0 && !(group >> shift)) shift -= 4;
+        for (; shift >= 0; shift -= 4) buffer[n++] = hex[(group >> shift) & 15];
+    }
+
+    if (mapped) {
+        if (best + best_length != n_groups) buffer[n++] = ':';
+        n += ipv4_format((ipv4) address, buffer + n);
+    }
+    buffer[n] = 0;
+    return n;
+}
+
+// "address/length", or an address alone for a /128.
+b8 ipv6_parse_range(string s, ipv6_range *range) {
+    u32 slash = 0;
+    while (slash < s.length && s.data[slash] != '/') slash++;
+
+    ipv6 address;
+    if (!ipv6_parse((string){ .length = slash, .data = s.data }, &address)) return false;
+
+    u32 length = 128;
+    if (slash < s.length) {
+        u32 digits = s.length - slash - 1;
+        if (digits < 1 || digits > 3) return false;
+        length = 0;
+        for (u32 i = slash + 1; i < s.length; i++) {
+            if (!string_is_digit_char(s.data[i])) return false;
+            length = length * 10 + (s.data[i] - '0');
+        }
+        if (length > 128 || (s.data[slash + 1] == '0' && digits > 1)) return false;
+    }
+
+    range->address  = address;
+    range->wildcard = length == 0 ? ~(ipv6) 0 : ((ipv6) 1 << (128 - length)) - 1;
+    range->mask     = ~range->wildcard;
+    return true;
+}
+
+ipv6 ipv6_min_in_range(ipv6_range range) {
+    return range.address & range.mask;
+}
+
+ipv6 ipv6_max_in_range(ipv6_range range) {
+    return range.address | range.wildcard;
+}
+
+// Same as ipv4_prefix_length.
+s32 ipv6_prefix_length(ipv6_range range) {
+    return 128 - __builtin_popcountll((u64) range.wildcard) - __builtin_popcountll((u64) (range.wildcard >> 64));
+}
+
+// Same as ipv4_range_set_make.
+ipv6_range_set* ipv6_range_set_make(const ipv6_range *ranges, s64 n) {
+    ipv6_interval *sorted = array_alloc(n > 0 ? n : 1, ipv6_interval);
+    for (s64 i = 0; i < n; i++) {
+        sorted[i].min = ipv6_min_in_range(ranges[i]);
+        sorted[i].max = ipv6_max_in_range(ranges[i]);
+    }
+    qsort(sorted, n, sizeof(ipv6_interval), ipv6__interval_compare);
+
+    ipv6_range_set *set = ipv6__range_set_alloc(n);
+    for (s64 i = 0; i < n; i++) ipv6__range_set_push(set, sorted[i].min, sorted[i].max);
+    free(sorted);
+    return ipv6__range_set_finish(set);
+}
+
+void ipv6_range_set_free(ipv6_range_set *set) {
+    free(set->intervals);
+    free(set->eytzinger);
+    free(set);
+}
+
+// Same search as ipv4_range_set_contains.
+b8 ipv6_range_set_contains(ipv6_range_set *set, ipv6 address) {
+    ipv6_interval *e = set->eytzinger;
+    s64 n = set->n_intervals;
+
+    s64 k = 1;
+    while (k <= n) {
+        __builtin_prefetch(e + 4 * k); // 2 levels down, 2 intervals a cache line
+        k = 2 * k + (e[k].max < address);
+    }
+    k >>= __builtin_ffsll(~k);
+
+    return k > 0 && e[k].min <= address;
+}
+
+ipv6_range_set* ipv6_range_set_union(ipv6_range_set *a, ipv6_range_set *b) {
+    ipv6_range_set *set = ipv6__range_set_alloc(a->n_intervals + b->n_intervals);
+
+    s64 i = 0, j = 0;
+    while (i < a->n_intervals || j < b->n_intervals) {
+        if (j == b->n_intervals || (i < a->n_intervals && a->intervals[i].min < b->intervals[j].min)) {
+            ipv6__range_set_push(set, a->intervals[i].min, a->intervals[i].max);
+            i++;
+        } else {
+            ipv6__range_set_push(set, b->intervals[j].min, b->intervals[j].max);
+            j++;
+        }
+    }
+    return ipv6__range_set_finish(set);
+}
+
+ipv6_range_set* ipv6_range_set_intersection(ipv6_range_set *a, ipv6_range_set *b) {
+    ipv6_range_set *set = ipv6__range_set_alloc(a->n_intervals + b->n_intervals);
+
+    s64 i = 0, j = 0;
+    while (i < a->n_intervals && j < b->n_intervals) {
+        ipv6_interval x = a->intervals[i], y = b->intervals[j];
+        ipv6 min = x.min > y.min ? x.min : y.min;
+        ipv6 max = x.max < y.max ? x.max : y.max;
+        if (min <= max) ipv6__range_set_push(set, min, max);
+
+        if (x.max < y.max) i++;
+        else               j++;
+    }
+    return ipv6__range_set_finish(set);
+}
+
+// What's in `a` and not in `b`.
+ipv6_range_set* ipv6_range_set_difference(ipv6_range_set *a, ipv6_range_set *b) {
+    ipv6_range_set *set = ipv6__range_set_alloc(a->n_intervals + b->n_intervals);
+
+    s64 j = 0;
+    for (s64 i = 0; i < a->n_intervals; i++) {
+        ipv6_interval x = a->intervals[i];
+        ipv6 start = x.min; // Of what's left of x
+        b32  left  = true;  // There's no address past the last one to move start to
+
+        while (j < b->n_intervals && b->intervals[j].max < start) j++;
+        for (s64 k = j; k < b->n_intervals && b->intervals[k].min <= x.max; k++) {
+            ipv6_interval y = b->intervals[k];
+            if (y.min > start) ipv6__range_set_push(set, start, y.min - 1);
+            if (y.max >= x.max) {
+                left = false;
+                break;
+            }
+            if (y.max >= start) start = y.max + 1;
+        }
+        if (left) ipv6__range_set_push(set, start, x.max);
+    }
+    return ipv6__range_set_finish(set);
+}
+
+// Same as ipv4_range_set_to_ranges.
+s64 ipv6_range_set_to_ranges(ipv6_range_set *set, ipv6_range **ranges) {
+    s64 n = 0, capacity = set->n_intervals + 1;
+    *ranges = array_alloc(capacity, ipv6_range);
+
+    for (s64 i = 0; i < set->n_intervals; i++) {
+        ipv6 start = set->intervals[i].min;
+        ipv6 max   = set->intervals[i].max;
+        for (;;) {
+            // Shortest prefix aligned on start, that doesn't go past max
+            s32 zeros = start == 0 ? 128 : (u64) start ? __builtin_ctzll((u64) start) : 64 + __builtin_ctzll((u64) (start >> 64));
+            ipv6 wildcard = zeros == 128 ? ~(ipv6) 0 : ((ipv6) 1 << zeros) - 1;
+            while ((start | wildcard) > max) wildcard >>= 1;
+
+            if (n == capacity) {
+                capacity *= 2;
+                *ranges = memory_realloc(*ranges, capacity * sizeof(ipv6_range));
+            }
+            (*ranges)[n++] = (ipv6_range){ .address = start, .mask = ~wildcard, .wildcard = wildcard };
+
+            if ((start | wildcard) == max) break;
+            start = (start | wildcard) + 1;
+        }
+    }
+    return n;
+}
+
+u32 ipv6__hex_digit(c8 c) {
+    if ('0' <= c && c <= '9') return c - '0';
+    c |= 0x20; // Lowercase
+    if ('a' <= c && c <= 'f') return c - 'a' + 10;
+    return 16;
+}
+
+ipv6_range_set* ipv6__range_set_alloc(s64 capacity) {
+    ipv6_range_set *set = struct_alloc(ipv6_range_set);
+    set->intervals   = array_alloc(capacity > 0 ? capacity : 1, ipv6_interval);
+    set->n_intervals = 0;
+    set->eytzinger   = NULL;
+    return set;
+}
+
+// Same as ipv4__range_set_push, the last interval can end at the last address.
+void ipv6__range_set_push(ipv6_range_set *set, ipv6 min, ipv6 max) {
+    if (set->n_intervals > 0) {
+        ipv6_interval *last = &set->intervals[set->n_intervals - 1];
+        if (last->max == ~(ipv6) 0 || min <= last->max + 1) {
+            if (max > last->max) last->max = max;
+            return;
+        }
+    }
+    set->intervals[set->n_intervals++] = (ipv6_interval){ .min = min, .max = max };
+}
+
+ipv6_range_set* ipv6__range_set_finish(ipv6_range_set *set) {
+    set->eytzinger = array_alloc(set->n_intervals + 1, ipv6_interval);
+    ipv6__range_set_layout(set, 0, 1);
+    return set;
+}
+
+s64 ipv6__range_set_layout(ipv6_range_set *set, s64 i, s64 k) {
+    if (k > set->n_intervals) return i;
+    i = ipv6__range_set_layout(set, i, 2 * k);
+    set->eytzinger[k] = set->intervals[i++];
+    return ipv6__range_set_layout(set, i, 2 * k + 1);
+}
+
+s32 ipv6__interval_compare(const void *a, const void *b) {
+    const ipv6_interval *x = a, *y = b;
+    if (x->min != y->min) return x->min < y->min ? -1 : 1;
+    return 0;
+}
+
+
+#if defined(__SSSE3__)
+//
+// By octet lengths, (l0 - 1) * 27 + (l1 - 1) * 9 + (l2 - 1) * 3 + (l3 - 1):
+// where the digits go, each octet in 4 bytes, right-aligned (hundreds, tens,
+// ones, 0). 0x80 makes a 0.
+//
+internal const u8 ipv4__shuffles[81][16] = {
+    { 0x80, 0x80,    0, 0x80, 0x80, 0x80,    2, 0x80, 0x80, 0x80,    4, 0x80, 0x80, 0x80,    6, 0x80 }, // 1111
+    { 0x80, 0x80,    0, 0x80, 0x80, 0x80,    2, 0x80, 0x80, 0x80,    4, 0x80, 0x80,    6,    7, 0x80 }, // 1112
+    { 0x80, 0x80,    0, 0x80, 0x80, 0x80,    2, 0x80, 0x80, 0x80,    4, 0x80,    6,    7,    8, 0x80 }, // 1113
+    { 0x80, 0x80,    0, 0x80, 0x80, 0x80,    2, 0x80, 0x80,    4,    5, 0x80, 0x80, 0x80,    7, 0x80 }, // 1121
+    { 0x80, 0x80,    0, 0x80, 0x80, 0x80,    2, 0x80, 0x80,    4,    5, 0x80, 0x80,    7,    8, 0x80 }, // 1122
+    { 0x80, 0x80,    0, 0x80, 0x80, 0x80,    2, 0x80, 0x80,    4,    5, 0x80,    7,    8,    9, 0x80 }, // 1123
+    { 0x80, 0x80,    0, 0x80, 0x80, 0x80,    2, 0x80,    4,    5,    6, 0x80, 0x80, 0x80,    8, 0x80 }, // 1131
+    { 0x80, 0x80,    0, 0x80, 0x80, 0x80,    2, 0x80,    4,    5,    6, 0x80, 0x80,    8,    9, 0x80 }, // 1132
+    { 0x80, 0x80,    0, 0x80, 0x80, 0x80,    2, 0x80,    4,    5,    6, 0x80,    8,    9,   10, 0x80 }, // 1133
+    { 0x80, 0x80,    0, 0x80, 0x80,    2,    3, 0x80, 0x80, 0x80,    5, 0x80, 0x80, 0x80,    7, 0x80 }, // 1211
+    { 0x80, 0x80,    0, 0x80, 0x80,    2,    3, 0x80, 0x80, 0x80,    5, 0x80, 0x80,    7,    8, 0x80 }, // 1212
+    { 0x80, 0x80,    0, 0x80, 0x80,    2,    3, 0x80, 0x80, 0x80,    5, 0x80,    7,    8,    9, 0x80 }, // 1213
+    { 0x80, 0x80,    0, 0x80, 0x80,    2,    3, 0x80, 0x80,    5,    6, 0x80, 0x80, 0x80,    8, 0x80 }, // 1221
+    { 0x80, 0x80,    0, 0x80, 0x80,    2,    3, 0x80, 0x80,    5,    6, 0x80, 0x80,    8,    9, 0x80 }, // 1222
+    { 0x80, 0x80,    0, 0x80, 0x80,    2,    3, 0x80, 0x80,    5,    6, 0x80,    8,    9,   10, 0x80 }, // 1223
+    { 0x80, 0x80,    0, 0x80, 0x80,    2,    3, 0x80,    5,    6,    7, 0x80, 0x80, 0x80,    9, 0x80 }, // 1231
+    { 0x80, 0x80,    0, 0x80, 0x80,    2,    3, 0x80,    5,    6,    7, 0x80, 0x80,    9,   10, 0x80 }, // 1232
+    { 0x80, 0x80,    0, 0x80, 0x80,    2,    3, 0x80,    5,    6,    7, 0x80,    9,   10,   11, 0x80 }, // 1233
+    { 0x80, 0x80,    0, 0x80,    2,    3,    4, 0x80, 0x80, 0x80,    6, 0x80, 0x80, 0x80,    8, 0x80 }, // 1311
+    { 0x80, 0x80,    0, 0x80,    2,    3,    4, 0x80, 0x80, 0x80,    6, 0x80, 0x80,    8,    9, 0x80 }, // 1312
+    { 0x80, 0x80,    0, 0x80,    2,    3,    4, 0x80, 0x80, 0x80,    6, 0x80,    8,    9,   10, 0x80 }, // 1313
+    { 0x80, 0x80,    0, 0x80,    2,    3,    4, 0x80, 0x80,    6,    7, 0x80, 0x80, 0x80,    9, 0x80 }, // 1321
+    { 0x80, 0x80,    0, 0x80,    2,    3,    4, 0x80, 0x80,    6,    7, 0x80, 0x80,    9,   10, 0x80 }, // 1322
+    { 0x80, 0x80,    0, 0x80,    2,    3,    4, 0x80, 0x80,    6,    7, 0x80,    9,   10,   11, 0x80 }, // 1323
+    { 0x80, 0x80,    0, 0x80,    2,    3,    4, 0x80,    6,    7,    8, 0x80, 0x80, 0x80,   10, 0x80 }, // 1331
+    { 0x80, 0x80,    0, 0x80,    2,    3,    4, 0x80,    6,    7,    8, 0x80, 0x80,   10,   11, 0x80 }, // 1332
+    { 0x80, 0x80,    0, 0x80,    2,    3,    4, 0x80,    6,    7,    8, 0x80,   10,   11,   12, 0x80 }, // 1333
+    { 0x80,    0,    1, 0x80, 0x80, 0x80,    3, 0x80, 0x80, 0x80,    5, 0x80, 0x80, 0x80,    7, 0x80 }, // 2111
+    { 0x80,    0,    1, 0x80, 0x80, 0x80,    3, 0x80, 0x80, 0x80,    5, 0x80, 0x80,    7,    8, 0x80 }, // 2112
+    { 0x80,    0,    1, 0x80, 0x80, 0x80,    3, 0x80, 0x80, 0x80,    5, 0x80,    7,    8,    9, 0x80 }, // 2113
+    { 0x80,    0,    1, 0x80, 0x80, 0x80,    3, 0x80, 0x80,    5,    6, 0x80, 0x80, 0x80,    8, 0x80 }, // 2121
+    { 0x80,    0,    1, 0x80, 0x80, 0x80,    3, 0x80, 0x80,    5,    6, 0x80, 0x80,    8,    9, 0x80 }, // 2122
+    { 0x80,    0,    1, 0x80, 0x80, 0x80,    3, 0x80, 0x80,    5,    6, 0x80,    8,    9,   10, 0x80 }, // 2123
+    { 0x80,    0,    1, 0x80, 0x80, 0x80,    3, 0x80,    5,    6,    7, 0x80, 0x80, 0x80,    9, 0x80 }, // 2131
+    { 0x80,    0,    1, 0x80, 0x80, 0x80,    3, 0x80,    5,    6,    7, 0x80, 0x80,    9,   10, 0x80 }, // 2132
+    { 0x80,    0,    1, 0x80, 0x80, 0x80,    3, 0x80,    5,    6,    7, 0x80,    9,   10,   11, 0x80 }, // 2133
+    { 0x80,    0,    1, 0x80, 0x80,    3,    4, 0x80, 0x80, 0x80,    6, 0x80, 0x80, 0x80,    8, 0x80 }, // 2211
+    { 0x80,    0,    1, 0x80, 0x80,    3,    4, 0x80, 0x80, 0x80,    6, 0x80, 0x80,    8,    9, 0x80 }, // 2212
+    { 0x80,    0,    1, 0x80, 0x80,    3,    4, 0x80, 0x80, 0x80,    6, 0x80,    8,    9,   10, 0x80 }, // 2213
+    { 0x80,    0,    1, 0x80, 0x80,    3,    4, 0x80, 0x80,    6,    7, 0x80, 0x80, 0x80,    9, 0x80 }, // 2221
+    { 0x80,    0,    1, 0x80, 0x80,    3,    4, 0x80, 0x80,    6,    7, 0x80, 0x80,    9,   10, 0x80 }, // 2222
+    { 0x80,    0,    1, 0x80, 0x80,    3,    4, 0x80, 0x80,    6,    7, 0x80,    9,   10,   11, 0x80 }, // 2223
+    { 0x80,    0,    1, 0x80, 0x80,    3,    4, 0x80,    6,    7,    8, 0x80, 0x80, 0x80,   10, 0x80 }, // 2231
+    { 0x80,    0,    1, 0x80, 0x80,    3,    4, 0x80,    6,    7,    8, 0x80, 0x80,   10,   11, 0x80 }, // 2232
+    { 0x80,    0,    1, 0x80, 0x80,    3,    4, 0x80,    6,    7,    8, 0x80,   10,   11,   12, 0x80 }, // 2233
+    { 0x80,    0,    1, 0x80,    3,    4,    5, 0x80, 0x80, 0x80,    7, 0x80, 0x80, 0x80,    9, 0x80 }, // 2311
+    { 0x80,    0,    1, 0x80,    3,    4,    5, 0x80, 0x80, 0x80,    7, 0x80, 0x80,    9,   10, 0x80 }, // 2312
+    { 0x80,    0,    1, 0x80,    3,    4,    5, 0x80, 0x80, 0x80,    7, 0x80,    9,   10,   11, 0x80 }, // 2313
+    { 0x80,    0,    1, 0x80,    3,    4,    5, 0x80, 0x80,    7,    8, 0x80, 0x80, 0x80,   10, 0x80 }, // 2321
+    { 0x80,    0,    1, 0x80,    3,    4,    5, 0x80, 0x80,    7,    8, 0x80, 0x80,   10,   11, 0x80 }, // 2322
+    { 0x80,    0,    1, 0x80,    3,    4,    5, 0x80, 0x80,    7,    8, 0x80,   10,   11,   12, 0x80 }, // 2323
+    { 0x80,    0,    1, 0x80,    3,    4,    5, 0x80,    7,    8,    9, 0x80, 0x80, 0x80,   11, 0x80 }, // 2331
+    { 0x80,    0,    1, 0x80,    3,    4,    5, 0x80,    7,    8,    9, 0x80, 0x80,   11,   12, 0x80 }, // 2332
+    { 0x80,    0,    1, 0x80,    3,    4,    5, 0x80,    7,    8,    9, 0x80,   11,   12,   13, 0x80 }, // 2333
+    {    0,    1,    2, 0x80, 0x80, 0x80,    4, 0x80, 0x80, 0x80,    6, 0x80, 0x80, 0x80,    8, 0x80 }, // 3111
+    {    0,    1,    2, 0x80, 0x80, 0x80,    4, 0x80, 0x80, 0x80,    6, 0x80, 0x80,    8,    9, 0x80 }, // 3112
+    {    0,    1,    2, 0x80, 0x80, 0x80,    4, 0x80, 0x80, 0x80,    6, 0x80,    8,    9,   10, 0x80 }, // 3113
+    {    0,    1,    2, 0x80, 0x80, 0x80,    4, 0x80, 0x80,    6,    7, 0x80, 0x80, 0x80,    9, 0x80 }, // 3121
+    {    0,    1,    2, 0x80, 0x80, 0x80,    4, 0x80, 0x80,    6,    7, 0x80, 0x80,    9,   10, 0x80 }, // 3122
+    {    0,    1,    2, 0x80, 0x80, 0x80,    4, 0x80, 0x80,    6,    7, 0x80,    9,   10,   11, 0x80 }, // 3123
+    {    0,    1,    2, 0x80, 0x80, 0x80,    4, 0x80,    6,    7,    8, 0x80, 0x80, 0x80,   10, 0x80 }, // 3131
+    {    0,    1,    2, 0x80, 0x80, 0x80,    4, 0x80,    6,    7,    8, 0x80, 0x80,   10,   11, 0x80 }, // 3132
+    {    0,    1,    2, 0x80, 0x80, 0x80,    4, 0x80,    6,    7,    8, 0x80,   10,   11,   12, 0x80 }, // 3133
+    {    0,    1,    2, 0x80, 0x80,    4,    5, 0x80, 0x80, 0x80,    7, 0x80, 0x80, 0x80,    9, 0x80 }, // 3211
+    {    0,    1,    2, 0x80, 0x80,    4,    5, 0x80, 0x80, 0x80,    7, 0x80, 0x80,    9,   10, 0x80 }, // 3212
+    {    0,    1,    2, 0x80, 0x80,    4,    5, 0x80, 0x80, 0x80,    7, 0x80,    9,   10,   11, 0x80 }, // 3213
+    {    0,    1,    2, 0x80, 0x80,    4,    5, 0x80, 0x80,    7,    8, 0x80, 0x80, 0x80,   10, 0x80 }, // 3221
+    {    0,    1,    2, 0x80, 0x80,    4,    5, 0x80, 0x80,    7,    8, 0x80, 0x80,   10,   11, 0x80 }, // 3222
+    {    0,    1,    2, 0x80, 0x80,    4,    5, 0x80, 0x80,    7,    8, 0x80,   10,   11,   12, 0x80 }, // 3223
+    {    0,    1,    2, 0x80, 0x80,    4,    5, 0x80,    7,    8,    9, 0x80, 0x80, 0x80,   11, 0x80 }, // 3231
+    {    0,    1,    2, 0x80, 0x80,    4,    5, 0x80,    7,    8,    9, 0x80, 0x80,   11,   12, 0x80 }, // 3232
+    {    0,    1,    2, 0x80, 0x80,    4,    5, 0x80,    7,    8,    9, 0x80,   11,   12,   13, 0x80 }, // 3233
+    {    0,    1,    2, 0x80,    4,    5,    6, 0x80, 0x80, 0x80,    8, 0x80, 0x80, 0x80,   10, 0x80 }, // 3311
+    {    0,    1,    2, 0x80,    4,    5,    6, 0x80, 0x80, 0x80,    8, 0x80, 0x80,   10,   11, 0x80 }, // 3312
+    {    0,    1,    2, 0x80,    4,    5,    6, 0x80, 0x80, 0x80,    8, 0x80,   10,   11,   12, 0x80 }, // 3313
+    {    0,    1,    2, 0x80,    4,    5,    6, 0x80, 0x80,    8,    9, 0x80, 0x80, 0x80,   11, 0x80 }, // 3321
+    {    0,    1,    2, 0x80,    4,    5,    6, 0x80, 0x80,    8,    9, 0x80, 0x80,   11,   12, 0x80 }, // 3322
+    {    0,    1,    2, 0x80,    4,    5,    6, 0x80, 0x80,    8,    9, 0x80,   11,   12,   13, 0x80 }, // 3323
+    {    0,    1,    2, 0x80,    4,    5,    6, 0x80,    8,    9,   10, 0x80, 0x80, 0x80,   12, 0x80 }, // 3331
+    {    0,    1,    2, 0x80,    4,    5,    6, 0x80,    8,    9,   10, 0x80, 0x80,   12,   13, 0x80 }, // 3332
+    {    0,    1,    2, 0x80,    4,    5,    6, 0x80,    8,    9,   10, 0x80,   12,   13,   14, 0x80 }, // 3333
+};
+#endif
+
+//
+// The address is loaded in one register, its dots and digits are found with
+// compares. The dots give the length of each octet, which picks the shuffle
+// that spreads the digits out: a multiply-add then gives the 4 octets at once.
+//
+b8 ipv4__parse_16(string s, ipv4 *address) {
+#if defined(__SSSE3__)
+    if (s.length < 7 || s.length > 15) return false;
+
+    // Copied: only `s.length` bytes, at most 15, are known to be readable.
+    c8 copy[16] = {0};
+    __builtin_memcpy(copy, s.data, s.length);
+
+    __m128i v      = _mm_loadu_si128((const __m128i*) copy);
+    __m128i inside = _mm_cmpgt_epi8(_mm_set1_epi8((c8) s.length),
+                                    _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+    __m128i digits = _mm_sub_epi8(v, _mm_set1_epi8('0'));
+    __m128i is_digit = _mm_cmpeq_epi8(_mm_max_epu8(digits, _mm_set1_epi8(9)), _mm_set1_epi8(9));
+
+    u32 in   = (u32) _mm_movemask_epi8(inside);
+    u32 dots = (u32) _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('.'))) & in;
+    u32 nums = (u32) _mm_movemask_epi8(is_digit) & in;
+    if ((dots | nums) != in || __builtin_popcount(dots) != 3) return false;
+
+    u32 d0 = __builtin_ctz(dots);
+    u32 d1 = __builtin_ctz(dots & (dots - 1));
+    u32 d2 = 31 - __builtin_clz(dots);
+    u32 l0 = d0, l1 = d1 - d0 - 1, l2 = d2 - d1 - 1, l3 = s.length - d2 - 1;
+    if (l0 - 1 > 2 || l1 - 1 > 2 || l2 - 1 > 2 || l3 - 1 > 2) return false; // Unsigned, 0 wraps
+
+    // A '0' starting an octet, followed by a digit
+    u32 starts = (1 | dots << 1) & in;
+    u32 zeros  = (u32) _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('0')));
+    if (zeros & starts & nums >> 1) return false;
+
+    const u8 *shuffle = ipv4__shuffles[(l0 - 1) * 27 + (l1 - 1) * 9 + (l2 - 1) * 3 + (l3 - 1)];
+    __m128i spread = _mm_shuffle_epi8(digits, _mm_loadu_si128((const __m128i*) shuffle));
+    __m128i pairs  = _mm_maddubs_epi16(spread, _mm_setr_epi8(100, 10, 1, 0, 100, 10, 1, 0, 100, 10, 1, 0, 100, 10, 1, 0));
+    __m128i octets = _mm_madd_epi16(pairs, _mm_set1_epi16(1));
+    if (_mm_movemask_epi8(_mm_cmpgt_epi32(octets, _mm_set1_epi32(255)))) return false;
+
+    __m128i packed = _mm_shuffle_epi8(octets, _mm_setr_epi8(12, 8, 4, 0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1));
+    *address = (u32) _mm_cvtsi128_si32(packed);
+    return true;
+#else
+    return ipv4_parse(s, address);
+#endif
+}
+
 
 #endif // __robin_c_ip
@@ -0,0 +1,197 @@
+#ifndef __robin_c_ip_filter
+#define __robin_c_ip_filter
+
+
+#include <sys/mman.h> // mmap(2), madvise(2)
+
+#include "c.h"
+#include "ip.h"
+
+
+#ifndef X_IPV4_FILTER_PREFETCH
+#define X_IPV4_FILTER_PREFETCH (8) // Addresses ahead, in batches
+#endif
+
+
+//
+// Membership filter in front of an exact lookup (ip_lpm.h, ipv4_range_set),
+// for when most addresses aren't listed:
+//
+//     ipv4_filter *filter = ipv4_filter_make_bloom(ranges, n_ranges, 32, 10);
+//     if (ipv4_filter_may_contain(filter, address)) ... exact lookup ...
+//
+// "No" is certain and costs one cache miss, "maybe" has to be checked.
+//
+// Two kinds:
+// - Blocked Bloom filter: each key sets 8 bits in a single 64 bytes block, one
+//   in each of its 8 words. About 1% false positives at 10 bits per key.
+//   Addresses are keyed by their first `prefix` bits: 32 for lists of
+//   addresses, 24 when ranges are /24 or shorter (a shorter range inserts each
+//   of its blocks, a longer one stands for its whole block).
+// - Bitmap of the whole space, 1 bit per address (512 MB): exact, for lists
+//   with big ranges. On huge pages when there are some, otherwise asked for.
+//
+// Built once and read-only afterwards: queries can run on any number of threads.
+//
+
+
+//
+// Declarations
+//
+
+
+typedef struct ipv4_filter ipv4_filter;
+
+
+external ipv4_filter* ipv4_filter_make_bloom (const ipv4_range *ranges, s64 n, s32 prefix, s32 bits_per_key);
+external ipv4_filter* ipv4_filter_make_bitmap(const ipv4_range *ranges, s64 n);
+external void         ipv4_filter_free(ipv4_filter *filter);
+external b8           ipv4_filter_may_contain(ipv4_filter *filter, ipv4 address);
+external s64          ipv4_filter_candidates (ipv4_filter *filter, const ipv4 *addresses, s64 n, s64 *indices);
+
+internal ipv4_filter* ipv4__filter_alloc(u64 size);
+internal u64*         ipv4__filter_word(ipv4_filter *filter, ipv4 address);
+internal u64          ipv4__filter_hash(u64 key);
+
+
+//
+// Definitions
+//
+
+
+struct ipv4_filter {
+    u64 *words;    // Bloom: blocks of 8 words. Bitmap: 2^26 words
+    u64 n_blocks;  // 0 for a bitmap
+    s32 shift;     // 32 - prefix
+    u64 size;      // Of the mapping
+};
+
+
+// Multipliers picking the bit of each word of a block.
+internal const u32 ipv4__filter_salts[8] = {
+    0x47B6137B, 0x44974D91, 0x8824AD5B, 0xA2B7289D, 0x705495C7, 0x2DF1424B, 0x9EFC4947, 0x5C6BFB31,
+};
+
+
+ipv4_filter* ipv4_filter_make_bloom(const ipv4_range *ranges, s64 n, s32 prefix, s32 bits_per_key) {
+    assert(0 < prefix && prefix <= 32 && bits_per_key > 0);
+    s32 shift = 32 - prefix;
+
+    u64 n_keys = 0;
+    for (s64 i = 0; i < n; i++) {
+        n_keys += (ipv4_max_in_range(ranges[i]) >> shift) - (ipv4_min_in_range(ranges[i]) >> shift) + 1;
+    }
+
+    u64 n_blocks = (n_keys * bits_per_key + 511) / 512;
+    if (n_blocks == 0) n_blocks = 1;
+
+    ipv4_filter *filter = ipv4__filter_alloc(n_blocks * 64);
+    filter->n_blocks = n_blocks;
+    filter->shift    = shift;
+
+    for (s64 i = 0; i < n; i++) {
+        u64 last = ipv4_max_in_range(ranges[i]) >> shift;
+        for (u64 key = ipv4_min_in_range(ranges[i]) >> shift; key <= last; key++) {
+            u64 h      = ipv4__filter_hash(key);
+            u64 *block = filter->words + 8 * ((h >> 32) * n_blocks >> 32);
+            for (s32 w = 0; w < 8; w++) block[w] |= (u64) 1 << ((u32) h * ipv4__filter_salts[w] >> 26);
+        }
+    }
+    return filter;
+}
+
+ipv4_filter* ipv4_filter_make_bitmap(const ipv4_range *ranges, s64 n) {
+    ipv4_filter *filter = ipv4__filter_alloc((u64) 1 << 29);
+    filter->n_blocks = 0;
+    filter->shift    = 0;
+
+    for (s64 i = 0; i < n; i++) {
+        u64 start = ipv4_min_in_range(ranges[i]);
+        u64 end   = (u64) ipv4_max_in_range(ranges[i]) + 1;
+
+        // Bits up to the first whole word, whole words, bits after the last one.
+        while (start < end && start % 64) {
+            filter->words[start / 64] |= (u64) 1 << start % 64;
+            start++;
+        }
+        if (end - start >= 64) {
+            __builtin_memset(filter->words + start / 64, 0xFF, (end - start) / 64 * 8);
+            start += (end - start) / 64 * 64;
+        }
+        for (; start < end; start++) filter->words[start / 64] |= (u64) 1 << start % 64;
+    }
+    return filter;
+}
+
+void ipv4_filter_free(ipv4_filter *filter) {
+    munmap(filter->words, filter->size);
+    free(filter);
+}
+
+b8 ipv4_filter_may_contain(ipv4_filter *filter, ipv4 address) {
+    if (!filter->n_blocks) return (filter->words[address / 64] >> (address % 64)) & 1;
+
+    u64 h      = ipv4__filter_hash(address >> filter->shift);
+    u64 *block = filter->words + 8 * ((h >> 32) * filter->n_blocks >> 32);
+    u64 result = 1;
+    for (s32 w = 0; w < 8; w++) result &= block[w] >> ((u32) h * ipv4__filter_salts[w] >> 26);
+    return (b8) result;
+}
+
+//
+// Writes the index of every address that may be in the filter to `indices`
+// (n of them at most), in order, and returns their number: those are the ones
+// to look up in the exact table. Blocks are prefetched a few addresses ahead.
+//
+s64 ipv4_filter_candidates(ipv4_filter *filter, const ipv4 *addresses, s64 n, s64 *indices) {
+    s64 n_candidates = 0;
+    for (s64 i = 0; i < n; i++) {
+        if (i + X_IPV4_FILTER_PREFETCH < n) {
+            __builtin_prefetch(ipv4__filter_word(filter, addresses[i + X_IPV4_FILTER_PREFETCH]));
+        }
+        indices[n_candidates] = i;
+        n_candidates += ipv4_filter_may_contain(filter, addresses[i]);
+    }
+    return n_candidates;
+}
+
+//
+// Anonymous mapping, zeroed: explicit huge pages if the system has some
+// reserved, transparent ones otherwise.
+//
+ipv4_filter* ipv4__filter_alloc(u64 size) {
+    const u64 huge = 2 * MEGABYTE;
+
+    ipv4_filter *filter = struct_alloc(ipv4_filter);
+    filter->size  = size >= huge ? (size + huge - 1) / huge * huge : size;
+    filter->words = MAP_FAILED;
+    if (size >= huge) {
+        filter->words = mmap(NULL, filter->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    }
+    if (filter->words == MAP_FAILED) {
+        filter->words = mmap(NULL, filter->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        assert(filter->words != MAP_FAILED);
+        madvise(filter->words, filter->size, MADV_HUGEPAGE);
+    }
+    return filter;
+}
+
+// The word of the address in a bitmap, the first word of its block in a Bloom filter.
+u64* ipv4__filter_word(ipv4_filter *filter, ipv4 address) {
+    if (!filter->n_blocks) return filter->words + address / 64;
+    u64 h = ipv4__filter_hash(address >> filter->shift);
+    return filter->words + 8 * ((h >> 32) * filter->n_blocks >> 32);
+}
+
+// Mixes every bit of the key into every bit of the hash (MurmurHash3's finalizer).
+u64 ipv4__filter_hash(u64 key) {
+    key ^= key >> 33;
+    key *= 0xFF51AFD7ED558CCDull;
+    key ^= key >> 33;
+    key *= 0xC4CEB9FE1A85EC53ull;
+    key ^= key >> 33;
+    return key;
+}
+
+
+#endif // __robin_c_ip_filter
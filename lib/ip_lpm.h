@@ -0,0 +1,512 @@
+#ifndef __robin_c_ip_lpm
+#define __robin_c_ip_lpm
+
+
+#include <sys/mman.h> // mmap(2), madvise(2)
+
+#include "c.h"
+#include "ip.h"
+
+
+#define IPV4_LPM_NONE (0x7FFFFFFF)
+
+#ifndef X_IPV4_LPM_BATCH
+#define X_IPV4_LPM_BATCH (16)
+#endif
+
+
+//
+// Longest-prefix match over many ranges, e.g. to tell which network an
+// address is from:
+//
+//     ipv4_lpm *lpm = ipv4_lpm_make(ranges, values, n_ranges);
+//     u32 value = ipv4_lpm_lookup(lpm, address);
+//
+// returns the value of the most specific range containing `address`, or
+// IPV4_LPM_NONE. Values are anything below IPV4_LPM_NONE, typically an index
+// in the caller's own table. Of equal ranges, the last one wins.
+//
+// DIR-24-8: the first 24 bits of the address index a flat table of 2^24
+// entries (64 MB, on huge pages when the kernel allows it). An entry is the
+// value itself, or for the /24 blocks that hold longer prefixes, the number of
+// a group of 256 entries indexed by the last 8 bits. A lookup is one memory
+// access, two in those blocks. ipv4_lpm_lookup_batch loads the entries of a
+// whole batch before using any of them, so that their cache misses overlap.
+//
+// Built once and read-only afterwards: lookups can run on any number of threads.
+//
+// IPv6 (ipv6_lpm_make, same interface) can't have a flat table. It's a
+// compressed trie (poptrie): a table of 2^20 entries for the first 20 bits,
+// then nodes of 6 bits strides, each 2 bitmaps of its 64 slots and 2 indices.
+// The slots that are nodes are contiguous in the node array, the others are
+// runs of leaves, one value per run in the leaf array: the index of a slot is
+// the popcount of the bitmap below it. Nodes are 24 bytes (vs 256 entries for
+// a multibit trie), most of the trie stays in cache and a lookup is one access
+// per 6 bits past 20, 5 nodes for a /48. ipv6_lpm_lookup_batch walks a batch
+// of addresses in lockstep, a level at a time, so that their loads overlap.
+// Counting bits needs POPCNT (-mpopcnt, or a -march that has it) to be fast.
+//
+
+
+//
+// Declarations
+//
+
+
+typedef struct ipv4_lpm         ipv4_lpm;
+typedef struct ipv4_lpm__prefix ipv4_lpm__prefix;
+typedef struct ipv6_lpm         ipv6_lpm;
+typedef struct ipv6_lpm__node   ipv6_lpm__node;
+typedef struct ipv6_lpm__prefix ipv6_lpm__prefix;
+
+
+external ipv4_lpm* ipv4_lpm_make(const ipv4_range *ranges, const u32 *values, s64 n);
+external void      ipv4_lpm_free(ipv4_lpm *lpm);
+external u32       ipv4_lpm_lookup(ipv4_lpm *lpm, ipv4 address);
+external void      ipv4_lpm_lookup_batch(ipv4_lpm *lpm, const ipv4 *addresses, u32 *values, s64 n);
+
+external ipv6_lpm* ipv6_lpm_make(const ipv6_range *ranges, const u32 *values, s64 n);
+external void      ipv6_lpm_free(ipv6_lpm *lpm);
+external u32       ipv6_lpm_lookup(ipv6_lpm *lpm, ipv6 address);
+external void      ipv6_lpm_lookup_batch(ipv6_lpm *lpm, const ipv6 *addresses, u32 *values, s64 n);
+
+internal void ipv4_lpm__paint(ipv4_lpm *lpm, u64 start, u64 end, u32 value);
+internal u32  ipv4_lpm__make_group(ipv4_lpm *lpm);
+internal void ipv6_lpm__insert  (ipv6_lpm *lpm, ipv6_lpm__prefix *prefix);
+internal void ipv6_lpm__compress(ipv6_lpm *lpm, u32 scratch_node, u32 node);
+internal u32  ipv6_lpm__scratch_node(ipv6_lpm *lpm, u32 entry);
+internal s32  ipv6_lpm__compare(const void *a, const void *b);
+
+
+//
+// Definitions
+//
+
+
+#define IPV4_LPM__GROUP      (0x80000000)
+#define IPV4_LPM__TBL24_SIZE ((u64) (1 << 24) * sizeof(u32))
+
+
+struct ipv4_lpm {
+    u32 *tbl24;      // By the first 24 bits: a value, or IPV4_LPM__GROUP | group
+    u32 *tbl8;       // Groups of 256 entries, by the last 8 bits
+    s32 n_groups;
+    s32 cap_groups;
+};
+
+struct ipv6_lpm {
+    u32            *root;     // 2^20 entries, by the first 20 bits: a value, or IPV4_LPM__GROUP | node
+    ipv6_lpm__node *nodes;
+    s64            n_nodes;
+    s64            cap_nodes;
+    u32            *leaves;
+    s64            n_leaves;
+    s64            cap_leaves;
+
+    // While building: a subtree of the root, uncompressed, 64 entries a node
+    u32            *scratch;
+    s64            n_scratch;
+    s64            cap_scratch;
+};
+
+struct ipv6_lpm__node {
+    u64 nodes;       // Slots that are nodes
+    u64 leaves;      // Slots that start a run of leaves with the same value
+    u32 first_node;  // Index of the node of the first slot that is one
+    u32 first_leaf;
+};
+
+struct ipv6_lpm__prefix {
+    ipv6 min;
+    s32  length;
+    u32  value;
+    s64  index;  // In the ranges given
+};
+
+struct ipv4_lpm__prefix {
+    ipv4 min;
+    ipv4 max;
+    s32  length;
+    s64  index;  // In the ranges given
+};
+
+
+ipv4_lpm* ipv4_lpm_make(const ipv4_range *ranges, const u32 *values, s64 n) {
+    ipv4_lpm *lpm = struct_alloc(ipv4_lpm);
+    lpm->tbl8       = NULL;
+    lpm->n_groups   = 0;
+    lpm->cap_groups = 0;
+
+    // Mapped rather than allocated, to ask for huge pages: random lookups in
+    // 64 MB would otherwise miss the TLB almost every time. Starts zeroed,
+    // which ipv4_lpm__paint relies on.
+    lpm->tbl24 = mmap(NULL, IPV4_LPM__TBL24_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    assert(lpm->tbl24 != MAP_FAILED);
+    madvise(lpm->tbl24, IPV4_LPM__TBL24_SIZE, MADV_HUGEPAGE);
+
+    // By start, then length, then index: counted by length first, which
+    // keeps the order of the indices, then radix sorted by start, which keeps
+    // the order of the lengths.
+    s64 by_length[34] = {0};
+    for (s64 i = 0; i < n; i++) by_length[ipv4_prefix_length(ranges[i]) + 1]++;
+    for (s32 l = 1; l < 34; l++) by_length[l] += by_length[l - 1];
+
+    sort_kv *order = array_alloc(n > 0 ? n : 1, sort_kv);
+    for (s64 i = 0; i < n; i++) {
+        order[by_length[ipv4_prefix_length(ranges[i])]++] = (sort_kv){ .key = ipv4_min_in_range(ranges[i]), .value = (u32) i };
+    }
+    sort_pairs(order, n, NULL);
+
+    ipv4_lpm__prefix *prefixes = array_alloc(n > 0 ? n : 1, ipv4_lpm__prefix);
+    for (s64 j = 0; j < n; j++) {
+        s64 i = order[j].value;
+        assert(values[i] < IPV4_LPM_NONE);
+        prefixes[j].min    = ipv4_min_in_range(ranges[i]);
+        prefixes[j].max    = ipv4_max_in_range(ranges[i]);
+        prefixes[j].length = ipv4_prefix_length(ranges[i]);
+        prefixes[j].index  = i;
+    }
+    free(order);
+
+    //
+    // Prefixes are either nested or disjoint. Sorted by start then length,
+    // a stack of the ones containing the current address tells the most
+    // specific one, and the address space is cut into segments that are
+    // painted once each, in order: building doesn't depend on how much the
+    // ranges overlap. Equal prefixes are sorted by index, the last one ends
+    // up on top.
+    //
+    s64 *stack = array_alloc(n > 0 ? n : 1, s64);
+    s64 depth  = 0;
+    u64 cursor = 0; // Next address to paint
+
+    for (s64 i = 0; i <= n; i++) {
+        u64 start = i < n ? prefixes[i].min : (u64) 1 << 32;
+
+        while (depth > 0 && prefixes[stack[depth - 1]].max < start) {
+            ipv4_lpm__prefix *top = &prefixes[stack[--depth]];
+            if (cursor <= top->max) ipv4_lpm__paint(lpm, cursor, top->max, values[top->index]);
+            cursor = (u64) top->max + 1 > cursor ? (u64) top->max + 1 : cursor;
+        }
+
+        u32 value = depth > 0 ? values[prefixes[stack[depth - 1]].index] : IPV4_LPM_NONE;
+        if (cursor < start) ipv4_lpm__paint(lpm, cursor, start - 1, value);
+        cursor = start;
+
+        if (i < n) stack[depth++] = i;
+    }
+
+    free(stack);
+    free(prefixes);
+    return lpm;
+}
+
+void ipv4_lpm_free(ipv4_lpm *lpm) {
+    munmap(lpm->tbl24, IPV4_LPM__TBL24_SIZE);
+    free(lpm->tbl8);
+    free(lpm);
+}
+
+u32 ipv4_lpm_lookup(ipv4_lpm *lpm, ipv4 address) {
+    u32 entry = lpm->tbl24[address >> 8];
+    if (entry & IPV4_LPM__GROUP) {
+        entry = lpm->tbl8[(u64) (entry & ~IPV4_LPM__GROUP) << 8 | (address & 0xFF)];
+    }
+    return entry;
+}
+
+//
+// Same as ipv4_lpm_lookup on each address, pipelined over batches: while a
+// batch is resolved, the groups of the next one and the entries of the one
+// after are already being loaded.
+//
+void ipv4_lpm_lookup_batch(ipv4_lpm *lpm, const ipv4 *addresses, u32 *values, s64 n) {
+    const s32 B = X_IPV4_LPM_BATCH;
+    u32 *tbl24 = lpm->tbl24;
+    u32 *tbl8  = lpm->tbl8;
+
+    u32 entries[2][X_IPV4_LPM_BATCH];
+    s64 n_batches = n / B;
+
+    for (s64 k = 0; k <= n_batches; k++) {
+        s64 i = k * B;
+
+        if (k + 2 < n_batches) {
+            for (s32 j = 0; j < B; j++) __builtin_prefetch(&tbl24[addresses[i + 2 * B + j] >> 8]);
+        }
+
+        if (k + 1 < n_batches) {
+            u32 *next = entries[(k + 1) & 1];
+            for (s32 j = 0; j < B; j++) {
+                ipv4 address = addresses[i + B + j];
+                next[j] = tbl24[address >> 8];
+                if (next[j] & IPV4_LPM__GROUP) {
+                    __builtin_prefetch(&tbl8[(u64) (next[j] & ~IPV4_LPM__GROUP) << 8 | (address & 0xFF)]);
+                }
+            }
+        }
+
+        if (k == 0 && n_batches > 0) {
+            for (s32 j = 0; j < B; j++) entries[0][j] = tbl24[addresses[j] >> 8];
+        }
+
+        if (k < n_batches) {
+            u32 *current = entries[k & 1];
+            for (s32 j = 0; j < B; j++) {
+                u32 entry = current[j];
+                if (entry & IPV4_LPM__GROUP) {
+                    entry = tbl8[(u64) (entry & ~IPV4_LPM__GROUP) << 8 | (addresses[i + j] & 0xFF)];
+                }
+                values[i + j] = entry;
+            }
+        }
+    }
+    for (s64 i = n_batches * B; i < n; i++) values[i] = ipv4_lpm_lookup(lpm, addresses[i]);
+}
+
+//
+// Sets the addresses in [start, end] to `value`, segments come in order: the
+// entry of a block that's only partly covered is still 0 the first time it's
+// touched, and a group the next times.
+//
+void ipv4_lpm__paint(ipv4_lpm *lpm, u64 start, u64 end, u32 value) {
+    while (start <= end) {
+        u64 block_end = start | 0xFF;
+
+        if ((start & 0xFF) == 0 && block_end <= end) {
+            u64 stop = (end + 1) >> 8;
+            for (u64 block = start >> 8; block < stop; block++) lpm->tbl24[block] = value;
+            start = stop << 8;
+            continue;
+        }
+
+        u32 *entry = &lpm->tbl24[start >> 8];
+        if (!(*entry & IPV4_LPM__GROUP)) *entry = IPV4_LPM__GROUP | ipv4_lpm__make_group(lpm);
+
+        u32 *group = lpm->tbl8 + ((u64) (*entry & ~IPV4_LPM__GROUP) << 8);
+        u64 stop   = end < block_end ? end : block_end;
+        for (u64 address = start; address <= stop; address++) group[address & 0xFF] = value;
+        start = stop + 1;
+    }
+}
+
+// Returns the number of a new group, uninitialized.
+u32 ipv4_lpm__make_group(ipv4_lpm *lpm) {
+    if (lpm->n_groups == lpm->cap_groups) {
+        lpm->cap_groups = lpm->cap_groups ? 2 * lpm->cap_groups : 64;
+        lpm->tbl8 = memory_realloc(lpm->tbl8, (u64) lpm->cap_groups * 256 * sizeof(u32));
+        assert(lpm->tbl8);
+    }
+    return (u32) lpm->n_groups++;
+}
+
+ipv6_lpm* ipv6_lpm_make(const ipv6_range *ranges, const u32 *values, s64 n) {
+    ipv6_lpm *lpm = struct_alloc(ipv6_lpm);
+    lpm->root        = array_alloc(1 << 20, u32);
+    lpm->nodes       = NULL;
+    lpm->n_nodes     = 0;
+    lpm->cap_nodes   = 0;
+    lpm->leaves      = NULL;
+    lpm->n_leaves    = 0;
+    lpm->cap_leaves  = 0;
+    lpm->scratch     = NULL;
+    lpm->n_scratch   = 0;
+    lpm->cap_scratch = 0;
+    for (s32 i = 0; i < 1 << 20; i++) lpm->root[i] = IPV4_LPM_NONE;
+
+    ipv6_lpm__prefix *prefixes = array_alloc(n > 0 ? n : 1, ipv6_lpm__prefix);
+    for (s64 i = 0; i < n; i++) {
+        assert(values[i] < IPV4_LPM_NONE);
+        prefixes[i].min    = ipv6_min_in_range(ranges[i]);
+        prefixes[i].length = ipv6_prefix_length(ranges[i]);
+        prefixes[i].value  = values[i];
+        prefixes[i].index  = i;
+    }
+    qsort(prefixes, n, sizeof(ipv6_lpm__prefix), ipv6_lpm__compare);
+
+    //
+    // /20 and shorter first, shortest first, straight into the root. Then the
+    // longer ones, a root entry at a time: they're inserted shortest first in
+    // an uncompressed subtree, made from the value of the entry, and that
+    // subtree is compressed into the nodes and leaves. The scratch space only
+    // ever holds one subtree.
+    //
+    s64 i = 0;
+    for (; i < n && prefixes[i].length <= 20; i++) {
+        u32 first = (u32) (prefixes[i].min >> 108);
+        for (u32 k = 0; k < (u32) 1 << (20 - prefixes[i].length); k++) lpm->root[first + k] = prefixes[i].value;
+    }
+    while (i < n) {
+        u32 slot = (u32) (prefixes[i].min >> 108);
+
+        lpm->n_scratch = 0;
+        ipv6_lpm__scratch_node(lpm, lpm->root[slot]);
+        for (; i < n && (u32) (prefixes[i].min >> 108) == slot; i++) ipv6_lpm__insert(lpm, &prefixes[i]);
+
+        if (lpm->n_nodes == lpm->cap_nodes) {
+            lpm->cap_nodes = lpm->cap_nodes ? 2 * lpm->cap_nodes : 64;
+            lpm->nodes = memory_realloc(lpm->nodes, lpm->cap_nodes * sizeof(ipv6_lpm__node));
+        }
+        u32 node = (u32) lpm->n_nodes++;
+        ipv6_lpm__compress(lpm, 0, node);
+        lpm->root[slot] = IPV4_LPM__GROUP | node;
+    }
+
+    free(prefixes);
+    free(lpm->scratch);
+    lpm->scratch = NULL;
+    return lpm;
+}
+
+void ipv6_lpm_free(ipv6_lpm *lpm) {
+    free(lpm->root);
+    free(lpm->nodes);
+    free(lpm->leaves);
+    free(lpm);
+}
+
+// Same as ipv4_lpm_lookup, IPV4_LPM_NONE when no range contains `address`.
+u32 ipv6_lpm_lookup(ipv6_lpm *lpm, ipv6 address) {
+    u32 entry = lpm->root[(u32) (address >> 108)];
+    if (!(entry & IPV4_LPM__GROUP)) return entry;
+
+    ipv6_lpm__node *node = &lpm->nodes[entry & ~IPV4_LPM__GROUP];
+    for (s32 shift = 102; ; shift -= 6) {
+        u64 bit   = (u64) 1 << ((u32) (address >> shift) & 63);
+        u64 until = bit | (bit - 1);
+        if (!(node->nodes & bit)) return lpm->leaves[node->first_leaf + __builtin_popcountll(node->leaves & until) - 1];
+        node = &lpm->nodes[node->first_node + __builtin_popcountll(node->nodes & until) - 1];
+    }
+}
+
+void ipv6_lpm_lookup_batch(ipv6_lpm *lpm, const ipv6 *addresses, u32 *values, s64 n) {
+    const s32 B = X_IPV4_LPM_BATCH;
+
+    for (s64 i = 0; i < n; i += B) {
+        s32 m = n - i < B ? (s32) (n - i) : B;
+
+        // A value, or IPV4_LPM__GROUP | the node to go through next
+        u32 entries[X_IPV4_LPM_BATCH];
+        b32 deeper = false;
+        for (s32 j = 0; j < m; j++) {
+            entries[j] = lpm->root[(u32) (addresses[i + j] >> 108)];
+            deeper    |= entries[j] & IPV4_LPM__GROUP;
+        }
+
+        // Every address still in the trie goes down one level per round, the loads of a round are independent.
+        for (s32 shift = 102; deeper; shift -= 6) {
+            deeper = false;
+            for (s32 j = 0; j < m; j++) {
+                if (!(entries[j] & IPV4_LPM__GROUP)) continue;
+
+                ipv6_lpm__node *node = &lpm->nodes[entries[j] & ~IPV4_LPM__GROUP];
+                u64 bit   = (u64) 1 << ((u32) (addresses[i + j] >> shift) & 63);
+                u64 until = bit | (bit - 1);
+                if (node->nodes & bit) {
+                    u32 next = node->first_node + __builtin_popcountll(node->nodes & until) - 1;
+                    __builtin_prefetch(&lpm->nodes[next]);
+                    entries[j] = IPV4_LPM__GROUP | next;
+                    deeper     = true;
+                } else {
+                    entries[j] = lpm->leaves[node->first_leaf + __builtin_popcountll(node->leaves & until) - 1];
+                }
+            }
+        }
+
+        for (s32 j = 0; j < m; j++) values[i + j] = entries[j];
+    }
+}
+
+//
+// Into the scratch subtree, 6 bits a node from bit 20: down to the node of
+// the prefix's last stride, made from the entry it replaces when it's not
+// there yet, then its part of that node is written.
+//
+void ipv6_lpm__insert(ipv6_lpm *lpm, ipv6_lpm__prefix *prefix) {
+    u32 node  = 0;
+    s32 depth = 26; // Bits of the address consumed at this node
+    u32 index = (u32) (prefix->min >> (128 - depth)) & 63;
+
+    while (prefix->length > depth) {
+        u32 entry = lpm->scratch[node * 64 + index];
+        if (!(entry & IPV4_LPM__GROUP)) {
+            entry = IPV4_LPM__GROUP | ipv6_lpm__scratch_node(lpm, entry);
+            lpm->scratch[node * 64 + index] = entry;
+        }
+        node   = entry & ~IPV4_LPM__GROUP;
+        depth += 6;
+        index  = (u32) (prefix->min >> (128 - depth)) & 63;
+    }
+
+    for (u32 i = 0; i < (u32) 1 << (depth - prefix->length); i++) lpm->scratch[node * 64 + index + i] = prefix->value;
+}
+
+//
+// Scratch node into `node`, already allocated: its child nodes are allocated
+// together first, so that they're contiguous, then filled one by one.
+//
+void ipv6_lpm__compress(ipv6_lpm *lpm, u32 scratch_node, u32 node) {
+    u32 *entries = lpm->scratch + (u64) scratch_node * 64;
+
+    ipv6_lpm__node result = {
+        .nodes      = 0,
+        .leaves     = 0,
+        .first_node = (u32) lpm->n_nodes,
+        .first_leaf = (u32) lpm->n_leaves,
+    };
+    for (s32 i = 0; i < 64; i++) {
+        if (entries[i] & IPV4_LPM__GROUP) {
+            result.nodes |= (u64) 1 << i;
+            continue;
+        }
+        if (lpm->n_leaves > result.first_leaf && lpm->leaves[lpm->n_leaves - 1] == entries[i]) continue;
+
+        if (lpm->n_leaves == lpm->cap_leaves) {
+            lpm->cap_leaves = lpm->cap_leaves ? 2 * lpm->cap_leaves : 256;
+            lpm->leaves = memory_realloc(lpm->leaves, lpm->cap_leaves * sizeof(u32));
+        }
+        lpm->leaves[lpm->n_leaves++] = entries[i];
+        result.leaves |= (u64) 1 << i;
+    }
+
+    s32 n_children = __builtin_popcountll(result.nodes);
+    while (lpm->n_nodes + n_children > lpm->cap_nodes) {
+        lpm->cap_nodes = lpm->cap_nodes ? 2 * lpm->cap_nodes : 64;
+        lpm->nodes = memory_realloc(lpm->nodes, lpm->cap_nodes * sizeof(ipv6_lpm__node));
+    }
+    lpm->n_nodes += n_children;
+    lpm->nodes[node] = result;
+
+    u32 child = result.first_node;
+    for (s32 i = 0; i < 64; i++) {
+        if (entries[i] & IPV4_LPM__GROUP) ipv6_lpm__compress(lpm, entries[i] & ~IPV4_LPM__GROUP, child++);
+    }
+}
+
+// A scratch node of 64 copies of `entry`, returns its number.
+u32 ipv6_lpm__scratch_node(ipv6_lpm *lpm, u32 entry) {
+    if (lpm->n_scratch == lpm->cap_scratch) {
+        lpm->cap_scratch = lpm->cap_scratch ? 2 * lpm->cap_scratch : 64;
+        lpm->scratch = memory_realloc(lpm->scratch, lpm->cap_scratch * 64 * sizeof(u32));
+        assert(lpm->scratch);
+    }
+
+    u32 *node = lpm->scratch + lpm->n_scratch * 64;
+    for (s32 i = 0; i < 64; i++) node[i] = entry;
+    return (u32) lpm->n_scratch++;
+}
+
+// /20 and shorter first, by length. Then by root entry, then by length. Then in the order they were given.
+s32 ipv6_lpm__compare(const void *a, const void *b) {
+    const ipv6_lpm__prefix *x = a, *y = b;
+    b32 x_short = x->length <= 20, y_short = y->length <= 20;
+    if (x_short != y_short) return x_short ? -1 : 1;
+    if (!x_short) {
+        u32 x_slot = (u32) (x->min >> 108), y_slot = (u32) (y->min >> 108);
+        if (x_slot != y_slot) return x_slot < y_slot ? -1 : 1;
+    }
+    if (x->length != y->length) return x->length < y->length ? -1 : 1;
+    return x->index < y->index ? -1 : x->index > y->index;
+}
+
+#endif // __robin_c_ip_lpm
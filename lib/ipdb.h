@@ -0,0 +1,604 @@
+#ifndef __robin_c_ipdb
+#define __robin_c_ipdb
+
+
+#include <stdio.h>    // snprintf(3), rename(2)
+#include <sys/stat.h> // stat(2)
+
+#include "c.h"
+#include "io.h"
+#include "ip.h"
+
+
+#define IPDB_VERSION (1)
+
+
+//
+// Compiled databases of IP ranges and their metadata, e.g. geolocation or
+// reputation lists. The text list is compiled once:
+//
+//     ipdb_compile("ranges.txt", "ranges.ipdb", &error_line);
+//
+// one range per line, an address or a CIDR range (IPv4 or IPv6), then its
+// metadata, the rest of the line. Blank lines and lines starting with '#'
+// are skipped. Processes then map the database and look addresses up in
+// place, without parsing anything:
+//
+//     ipdb *db = ipdb_open("ranges.ipdb");
+//     string metadata;
+//     if (ipdb_lookup_ipv4(db, address, &metadata)) ...
+//
+// Ranges can overlap, the longest prefix wins (the last one of equal ones).
+// They are flattened at compile time into disjoint intervals, each with the
+// metadata of its most specific range, stored in Eytzinger order (see
+// ipv4_range_set): a lookup is a branchless search and one more load for the
+// metadata. Identical metadata is stored once.
+//
+// The mapping is read-only and shared through the page cache: any number of
+// processes, and of threads, can read the same database for the memory of
+// one. Databases are written next to their final name then renamed, so a
+// new version replaces the old one atomically: readers that have it mapped
+// keep reading the old one, ipdb_reopen switches to the new one.
+//
+// Layout, native endian: header (64 bytes), IPv6 intervals (`n_ipv6` + 1,
+// the first one unused), IPv4 intervals (`n_ipv4` + 1), their metadata
+// (u32, `n_ipv6` + 1 then `n_ipv4` + 1), the offsets of the metadata strings
+// (u32, `n_strings` + 1), then the strings, each with a NUL.
+//
+
+
+//
+// Declarations
+//
+
+
+typedef struct ipdb          ipdb;
+typedef struct ipdb__header  ipdb__header;
+typedef struct ipdb__prefix  ipdb__prefix;
+typedef struct ipdb__builder ipdb__builder;
+
+
+external b8    ipdb_compile(const c8 *source, const c8 *database, s64 *error_line);
+external b8    ipdb_compile_text(const c8 *text, s64 length, const c8 *database, s64 *error_line);
+external ipdb* ipdb_open(const c8 *database);
+external ipdb* ipdb_reopen(ipdb *db);
+external void  ipdb_close(ipdb *db);
+external b8    ipdb_lookup_ipv4(ipdb *db, ipv4 address, string *metadata);
+external b8    ipdb_lookup_ipv6(ipdb *db, ipv6 address, string *metadata);
+
+internal b8   ipdb__check(const ipdb *db, s64 strings_size);
+internal b8   ipdb__parse_line(string line, ipdb__prefix *prefix, string *metadata);
+internal u32  ipdb__intern(ipdb__builder *builder, string metadata);
+internal s64  ipdb__flatten(ipdb__prefix *prefixes, s64 n, ipv6_interval *intervals, u32 *values);
+internal s64  ipdb__layout(const ipv6_interval *intervals, const u32 *values, s64 n, ipv6_interval *eytzinger, u32 *out, s64 i, s64 k);
+internal b8   ipdb__write(ipdb__builder *builder, const c8 *database);
+internal s32  ipdb__prefix_compare(const void *a, const void *b);
+
+
+//
+// Definitions
+//
+
+
+struct ipdb {
+    const ipv4_interval *ipv4_intervals; // Eytzinger order, from index 1
+    const u32           *ipv4_values;    // Metadata of each interval, same order
+    s64                  n_ipv4;
+    const ipv6_interval *ipv6_intervals;
+    const u32           *ipv6_values;
+    s64                  n_ipv6;
+    const u32           *offsets;        // Of each string, and the end of the last one
+    const c8            *strings;
+    s64                  n_strings;
+
+    c8  *mapping;
+    s64  size;
+    u64  device;                         // Of the file that was mapped, to notice a new one
+    u64  inode;
+    c8  *filename;
+};
+
+struct ipdb__header {
+    c8  magic[8];     // "IPRANGES"
+    u32 version;
+    u32 byte_order;   // 0x01020304, as written
+    s64 n_ipv4;
+    s64 n_ipv6;
+    s64 n_strings;
+    s64 strings_size; // With the NULs
+    u8  reserved[16];
+};
+
+struct ipdb__prefix {
+    ipv6 min;         // IPv4 ones in the low 32 bits
+    ipv6 max;
+    u32  length;
+    u32  value;
+    s64  index;       // Line
+};
+
+struct ipdb__builder {
+    ipdb__prefix  *prefixes;
+    s64            n_prefixes[2]; // IPv4 ones from the start, IPv6 ones from the end
+
+    c8            *strings;
+    s64            strings_size;
+    s64            strings_cap;
+    u32           *offsets;
+    s64            n_strings;
+    s64            offsets_cap;
+    u32           *table;         // Open addressing: string + 1, 0 when empty
+    s64            table_cap;
+
+    ipv6_interval *intervals[2];
+    u32           *values[2];
+    s64            n_intervals[2];
+};
+
+
+//
+// `error_line` (can be NULL) gets the number of the first line that isn't a
+// valid range, from 1, or 0 if the problem is reading or writing a file.
+// Nothing is written when the list has an error.
+//
+b8 ipdb_compile(const c8 *source, const c8 *database, s64 *error_line) {
+    c8 *text;
+    s64 length;
+    if (!io_map_file(&text, &length, source)) {
+        if (error_line) *error_line = 0;
+        return false;
+    }
+    b8 ok = ipdb_compile_text(text, length, database, error_line);
+    io_unmap_file(text, length);
+    return ok;
+}
+
+b8 ipdb_compile_text(const c8 *text, s64 length, const c8 *database, s64 *error_line) {
+    s64 n_lines = 0;
+    for (s64 i = 0; i < length; i++) n_lines += text[i] == '\n';
+    n_lines++;
+
+    ipdb__builder builder = {0};
+    builder.prefixes    = array_alloc(n_lines, ipdb__prefix);
+    builder.table_cap   = 1024;
+    builder.table       = memory_alloc(builder.table_cap * sizeof(u32));
+    __builtin_memset(builder.table, 0, builder.table_cap * sizeof(u32));
+    builder.offsets_cap = 256;
+    builder.offsets     = array_alloc(builder.offsets_cap, u32);
+    builder.offsets[0]  = 0;
+
+    b8 ok = true;
+    s64 line = 0;
+    for (s64 start = 0; start < length && ok; ) {
+        s64 end = start;
+        while (end < length && text[end] != '\n') end++;
+        line++;
+
+        string s = { .length = (u32) (end - start), .data = (c8*) text + start };
+        start = end + 1;
+
+        // Blank or comment
+        u32 first = 0;
+        while (first < s.length && (s.data[first] == ' ' || s.data[first] == '\t' || s.data[first] == '\r')) first++;
+        if (first == s.length || s.data[first] == '#') continue;
+
+        ipdb__prefix prefix;
+        string metadata;
+        if (!ipdb__parse_line(s, &prefix, &metadata)) {
+            if (error_line) *error_line = line;
+            ok = false;
+            break;
+        }
+        prefix.value = ipdb__intern(&builder, metadata);
+        prefix.index = line;
+
+        b32 v6 = prefix.length & 0x100;
+        prefix.length &= 0xFF;
+        if (v6) builder.prefixes[n_lines - 1 - builder.n_prefixes[1]++] = prefix;
+        else    builder.prefixes[builder.n_prefixes[0]++] = prefix;
+    }
+
+    if (ok) {
+        ipdb__prefix *families[2] = {
+            builder.prefixes,
+            builder.prefixes + n_lines - builder.n_prefixes[1],
+        };
+        for (s32 f = 0; f < 2; f++) {
+            s64 n = builder.n_prefixes[f];
+            qsort(families[f], n, sizeof(ipdb__prefix), ipdb__prefix_compare);
+
+            // Each prefix splits at most one interval in two: 2n + 1 at most.
+            builder.intervals[f]   = array_alloc(2 * n + 1, ipv6_interval);
+            builder.values[f]      = array_alloc(2 * n + 1, u32);
+            builder.n_intervals[f] = ipdb__flatten(families[f], n, builder.intervals[f], builder.values[f]);
+        }
+
+        ok = ipdb__write(&builder, database);
+        if (!ok && error_line) *error_line = 0;
+
+        for (s32 f = 0; f < 2; f++) {
+            free(builder.intervals[f]);
+            free(builder.values[f]);
+        }
+    }
+
+    free(builder.prefixes);
+    free(builder.strings);
+    free(builder.offsets);
+    free(builder.table);
+    return ok;
+}
+
+//
+// Returns NULL if the database is missing or invalid. Mapped as is, then
+// checked in one pass over the metadata (not the intervals): lookups trust
+// the values and offsets they read.
+//
+ipdb* ipdb_open(const c8 *database) {
+    // Stat before mapping: if the file is replaced in between, the next
+    // ipdb_reopen sees a new file and maps it again, which is harmless.
+    struct stat info;
+    if (stat(database, &info) < 0) return NULL;
+
+    c8 *mapping;
+    s64 size;
+    if (!io_map_file(&mapping, &size, database)) return NULL;
+
+    ipdb__header *header = (ipdb__header*) mapping;
+    if (size < (s64) sizeof(ipdb__header) ||
+        __builtin_memcmp(header->magic, "IPRANGES", 8) != 0 ||
+        header->version != IPDB_VERSION ||
+        header->byte_order != 0x01020304 ||
+        header->n_ipv4 < 0 || header->n_ipv6 < 0 || header->n_strings < 0 || header->strings_size < 0 ||
+        header->n_ipv4 > size || header->n_ipv6 > size || header->n_strings > size ||
+        size != (s64) sizeof(ipdb__header) +
+                (header->n_ipv6 + 1) * (s64) sizeof(ipv6_interval) +
+                (header->n_ipv4 + 1) * (s64) sizeof(ipv4_interval) +
+                (header->n_ipv6 + 1 + header->n_ipv4 + 1 + header->n_strings + 1) * 4 +
+                header->strings_size) {
+        io_unmap_file(mapping, size);
+        return NULL;
+    }
+
+    // Random lookups: read it all in now rather than page by page, and
+    // replace the sequential advice of io_map_file, which lasts and would
+    // have the pages reclaimed early once read.
+    madvise(mapping, size, MADV_RANDOM);
+    madvise(mapping, size, MADV_WILLNEED);
+
+    ipdb *db = struct_alloc(ipdb);
+    c8 *p = mapping + sizeof(ipdb__header);
+    db->n_ipv6         = header->n_ipv6;
+    db->ipv6_intervals = (const ipv6_interval*) p;
+    p += (db->n_ipv6 + 1) * sizeof(ipv6_interval);
+    db->n_ipv4         = header->n_ipv4;
+    db->ipv4_intervals = (const ipv4_interval*) p;
+    p += (db->n_ipv4 + 1) * sizeof(ipv4_interval);
+    db->ipv6_values    = (const u32*) p;
+    p += (db->n_ipv6 + 1) * 4;
+    db->ipv4_values    = (const u32*) p;
+    p += (db->n_ipv4 + 1) * 4;
+    db->n_strings      = header->n_strings;
+    db->offsets        = (const u32*) p;
+    p += (db->n_strings + 1) * 4;
+    db->strings        = p;
+
+    if (!ipdb__check(db, header->strings_size)) {
+        io_unmap_file(mapping, size);
+        free(db);
+        return NULL;
+    }
+
+    db->mapping = mapping;
+    db->size    = size;
+    db->device  = info.st_dev;
+    db->inode   = info.st_ino;
+
+    s64 n = 0;
+    while (database[n]) n++;
+    db->filename = memory_alloc(n + 1);
+    __builtin_memcpy(db->filename, database, n + 1);
+    return db;
+}
+
+//
+// When the file was replaced since `db` was opened, returns the new database
+// and closes `db`. Otherwise, or if the new one can't be opened, returns `db`.
+// Lookups in progress in `db` on other threads must be over: call it where
+// the database isn't in use, e.g. between two requests.
+//
+ipdb* ipdb_reopen(ipdb *db) {
+    struct stat info;
+    if (stat(db->filename, &info) < 0) return db;
+    if ((u64) info.st_dev == db->device && (u64) info.st_ino == db->inode) return db;
+
+    ipdb *fresh = ipdb_open(db->filename);
+    if (!fresh) return db;
+
+    ipdb_close(db);
+    return fresh;
+}
+
+void ipdb_close(ipdb *db) {
+    io_unmap_file(db->mapping, db->size);
+    free(db->filename);
+    free(db);
+}
+
+//
+// Sets `metadata` to that of the most specific range containing `address`
+// (NUL-terminated, in the mapping), returns false when none does.
+//
+b8 ipdb_lookup_ipv4(ipdb *db, ipv4 address, string *metadata) {
+    const ipv4_interval *e = db->ipv4_intervals;
+    s64 n = db->n_ipv4;
+
+    s64 k = 1;
+    while (k <= n) {
+        __builtin_prefetch(e + 8 * k); // 3 levels down, 8 intervals a cache line
+        k = 2 * k + (e[k].max < address);
+    }
+    k >>= __builtin_ffsll(~k);
+
+    if (k == 0 || e[k].min > address) return false;
+
+    u32 value = db->ipv4_values[k];
+    metadata->data   = (c8*) db->strings + db->offsets[value];
+    metadata->length = db->offsets[value + 1] - db->offsets[value] - 1;
+    return true;
+}
+
+// Same as ipdb_lookup_ipv4. IPv4 ranges don't contain mapped addresses (::ffff:0:0/96).
+b8 ipdb_lookup_ipv6(ipdb *db, ipv6 address, string *metadata) {
+    const ipv6_interval *e = db->ipv6_intervals;
+    s64 n = db->n_ipv6;
+
+    s64 k = 1;
+    while (k <= n) {
+        __builtin_prefetch(e + 4 * k); // 2 levels down, 2 intervals a cache line
+        k = 2 * k + (e[k].max < address);
+    }
+    k >>= __builtin_ffsll(~k);
+
+    if (k == 0 || e[k].min > address) return false;
+
+    u32 value = db->ipv6_values[k];
+    metadata->data   = (c8*) db->strings + db->offsets[value];
+    metadata->length = db->offsets[value + 1] - db->offsets[value] - 1;
+    return true;
+}
+
+// Values index strings, whose offsets go up from 0 to the end, each string ending with its NUL.
+b8 ipdb__check(const ipdb *db, s64 strings_size) {
+    // Index 0 of the intervals is unused, lookups never read its value.
+    for (s64 k = 1; k <= db->n_ipv4; k++) {
+        if (db->ipv4_values[k] >= db->n_strings) return false;
+    }
+    for (s64 k = 1; k <= db->n_ipv6; k++) {
+        if (db->ipv6_values[k] >= db->n_strings) return false;
+    }
+
+    if (db->offsets[0] != 0 || db->offsets[db->n_strings] != strings_size) return false;
+    for (s64 i = 0; i < db->n_strings; i++) {
+        u32 end = db->offsets[i + 1];
+        if (end <= db->offsets[i] || db->strings[end - 1] != '\0') return false;
+    }
+    return true;
+}
+
+//
+// "<address or CIDR range> <metadata>". IPv4 prefixes are returned in the low
+// 32 bits with their length, IPv6 ones with 0x100 added to the length.
+//
+b8 ipdb__parse_line(string line, ipdb__prefix *prefix, string *metadata) {
+    u32 i = 0;
+    while (i < line.length && (line.data[i] == ' ' || line.data[i] == '\t')) i++;
+    u32 start = i;
+    b32 v6 = false;
+    while (i < line.length && line.data[i] != ' ' && line.data[i] != '\t' && line.data[i] != '\r') {
+        v6 |= line.data[i] == ':';
+        i++;
+    }
+    string range = { .length = i - start, .data = line.data + start };
+
+    while (i < line.length && (line.data[i] == ' ' || line.data[i] == '\t')) i++;
+    u32 end = line.length;
+    while (end > i && (line.data[end - 1] == ' ' || line.data[end - 1] == '\t' || line.data[end - 1] == '\r')) end--;
+    *metadata = (string){ .length = end - i, .data = line.data + i };
+
+    if (v6) {
+        ipv6_range r;
+        if (!ipv6_parse_range(range, &r)) return false;
+        prefix->min    = ipv6_min_in_range(r);
+        prefix->max    = ipv6_max_in_range(r);
+        prefix->length = 0x100 | ipv6_prefix_length(r);
+        return true;
+    }
+
+    ipv4_range r;
+    if (!ipv4_parse_cidr(range, &r)) return false;
+    prefix->min    = ipv4_min_in_range(r);
+    prefix->max    = ipv4_max_in_range(r);
+    prefix->length = ipv4_prefix_length(r);
+    return true;
+}
+
+// Index of the string, added if it's new.
+u32 ipdb__intern(ipdb__builder *builder, string metadata) {
+    u64 h = 0xCBF29CE484222325ull; // FNV-1a
+    for (u32 i = 0; i < metadata.length; i++) h = (h ^ (u8) metadata.data[i]) * 0x100000001B3ull;
+
+    u64 slot = h & (builder->table_cap - 1);
+    for (; builder->table[slot]; slot = (slot + 1) & (builder->table_cap - 1)) {
+        u32 s = builder->table[slot] - 1;
+        u32 length = builder->offsets[s + 1] - builder->offsets[s] - 1;
+        if (length == metadata.length &&
+            __builtin_memcmp(builder->strings + builder->offsets[s], metadata.data, length) == 0) {
+            return s;
+        }
+    }
+
+    while (builder->strings_size + metadata.length + 1 > builder->strings_cap) {
+        builder->strings_cap = builder->strings_cap ? 2 * builder->strings_cap : 4 * KILOBYTE;
+        builder->strings = memory_realloc(builder->strings, builder->strings_cap);
+    }
+    __builtin_memcpy(builder->strings + builder->strings_size, metadata.data, metadata.length);
+    builder->strings_size += metadata.length;
+    builder->strings[builder->strings_size++] = '\0';
+    assert(builder->strings_size <= 0xFFFFFFFF);
+
+    if (builder->n_strings + 2 > builder->offsets_cap) {
+        builder->offsets_cap *= 2;
+        builder->offsets = memory_realloc(builder->offsets, builder->offsets_cap * sizeof(u32));
+    }
+    u32 s = (u32) builder->n_strings++;
+    builder->offsets[s + 1] = (u32) builder->strings_size;
+    builder->table[slot]    = s + 1;
+
+    // At most half full
+    if (2 * builder->n_strings > builder->table_cap) {
+        s64 cap = 2 * builder->table_cap;
+        u32 *table = memory_alloc(cap * sizeof(u32));
+        __builtin_memset(table, 0, cap * sizeof(u32));
+        for (s64 i = 0; i < builder->table_cap; i++) {
+            if (!builder->table[i]) continue;
+            u32 t = builder->table[i] - 1;
+            u64 g = 0xCBF29CE484222325ull;
+            for (u32 j = builder->offsets[t]; j + 1 < builder->offsets[t + 1]; j++) g = (g ^ (u8) builder->strings[j]) * 0x100000001B3ull;
+            u64 k = g & (cap - 1);
+            while (table[k]) k = (k + 1) & (cap - 1);
+            table[k] = builder->table[i];
+        }
+        free(builder->table);
+        builder->table     = table;
+        builder->table_cap = cap;
+    }
+    return s;
+}
+
+//
+// Sorted prefixes (ipdb__prefix_compare) into disjoint intervals, each with
+// the value of its most specific prefix, adjacent ones with the same value
+// merged. A sweep with the stack of the prefixes containing the current
+// address: each one is pushed and popped once. Returns the number of
+// intervals.
+//
+s64 ipdb__flatten(ipdb__prefix *prefixes, s64 n, ipv6_interval *intervals, u32 *values) {
+    ipdb__prefix **stack = array_alloc(n > 0 ? n : 1, ipdb__prefix*);
+    s64 depth = 0, n_intervals = 0;
+    ipv6 cursor = 0;  // First address without an interval yet
+    b32 done = false; // When the last interval ends at the last address
+
+    #define ipdb__emit(MIN, MAX, VALUE) do { \
+        if (n_intervals > 0 && values[n_intervals - 1] == (VALUE) && intervals[n_intervals - 1].max + 1 == (MIN)) { \
+            intervals[n_intervals - 1].max = (MAX); \
+        } else { \
+            intervals[n_intervals] = (ipv6_interval){ .min = (MIN), .max = (MAX) }; \
+            values[n_intervals++]  = (VALUE); \
+        } \
+    } while (0)
+
+    for (s64 i = 0; i <= n; i++) {
+        // Close the prefixes that end before this one, or all of them at the end.
+        while (depth > 0 && (i == n || stack[depth - 1]->max < prefixes[i].min)) {
+            ipdb__prefix *top = stack[--depth];
+            if (done || cursor > top->max) continue;
+            ipdb__emit(cursor, top->max, top->value);
+            done   = top->max == ~(ipv6) 0;
+            cursor = top->max + 1;
+        }
+        if (i == n) break;
+
+        if (depth > 0 && cursor < prefixes[i].min) {
+            ipdb__emit(cursor, prefixes[i].min - 1, stack[depth - 1]->value);
+        }
+        cursor = prefixes[i].min;
+        stack[depth++] = &prefixes[i];
+    }
+
+    #undef ipdb__emit
+
+    free(stack);
+    return n_intervals;
+}
+
+// In-order walk of the implicit tree, as ipv4__range_set_layout: node k gets the i-th interval. Returns the next i.
+s64 ipdb__layout(const ipv6_interval *intervals, const u32 *values, s64 n, ipv6_interval *eytzinger, u32 *out, s64 i, s64 k) {
+    if (k > n) return i;
+    i = ipdb__layout(intervals, values, n, eytzinger, out, i, 2 * k);
+    eytzinger[k] = intervals[i];
+    out[k]       = values[i];
+    i++;
+    return ipdb__layout(intervals, values, n, eytzinger, out, i, 2 * k + 1);
+}
+
+// Written next to `database` then renamed, readers never see a partial file.
+b8 ipdb__write(ipdb__builder *builder, const c8 *database) {
+    s64 n_ipv4 = builder->n_intervals[0], n_ipv6 = builder->n_intervals[1];
+
+    ipdb__header header = {
+        .magic        = { 'I', 'P', 'R', 'A', 'N', 'G', 'E', 'S' },
+        .version      = IPDB_VERSION,
+        .byte_order   = 0x01020304,
+        .n_ipv4       = n_ipv4,
+        .n_ipv6       = n_ipv6,
+        .n_strings    = builder->n_strings,
+        .strings_size = builder->strings_size,
+    };
+
+    // Both families in Eytzinger order, index 0 unused.
+    ipv6_interval *eytzinger6 = array_alloc(n_ipv6 + 1, ipv6_interval);
+    u32           *values6    = array_alloc(n_ipv6 + 1, u32);
+    ipv6_interval *eytzinger  = array_alloc(n_ipv4 + 1, ipv6_interval);
+    u32           *values4    = array_alloc(n_ipv4 + 1, u32);
+    eytzinger6[0] = eytzinger[0] = (ipv6_interval){ .min = 0, .max = 0 };
+    values6[0]    = values4[0]   = 0;
+    ipdb__layout(builder->intervals[1], builder->values[1], n_ipv6, eytzinger6, values6, 0, 1);
+    ipdb__layout(builder->intervals[0], builder->values[0], n_ipv4, eytzinger,  values4, 0, 1);
+
+    ipv4_interval *eytzinger4 = array_alloc(n_ipv4 + 1, ipv4_interval);
+    for (s64 k = 0; k <= n_ipv4; k++) {
+        eytzinger4[k] = (ipv4_interval){ .min = (ipv4) eytzinger[k].min, .max = (ipv4) eytzinger[k].max };
+    }
+
+    c8 temporary[4096];
+    s32 n = snprintf(temporary, sizeof(temporary), "%s.%d.tmp", database, (s32) getpid());
+    b32 ok = n >= 0 && n < (s32) sizeof(temporary);
+
+    s32 fd = ok ? open(temporary, O_WRONLY | O_CREAT | O_TRUNC, 0644) : -1;
+    ok = fd >= 0;
+    if (ok) {
+        ok = io_write_all(fd, &header, sizeof(header)) &&
+             io_write_all(fd, eytzinger6, (n_ipv6 + 1) * sizeof(ipv6_interval)) &&
+             io_write_all(fd, eytzinger4, (n_ipv4 + 1) * sizeof(ipv4_interval)) &&
+             io_write_all(fd, values6, (n_ipv6 + 1) * 4) &&
+             io_write_all(fd, values4, (n_ipv4 + 1) * 4) &&
+             io_write_all(fd, builder->offsets, (builder->n_strings + 1) * 4) &&
+             io_write_all(fd, builder->strings, builder->strings_size);
+        // On disk before it's renamed: after a crash, the old database or the new one, whole.
+        ok = ok && fsync(fd) == 0;
+        ok = close(fd) == 0 && ok;
+        if (!ok || rename(temporary, database) < 0) {
+            unlink(temporary);
+            ok = false;
+        }
+    }
+
+    free(eytzinger6);
+    free(values6);
+    free(eytzinger);
+    free(values4);
+    free(eytzinger4);
+    return ok;
+}
+
+// By first address, then shortest first, then in the order of the lines: the most specific is pushed last.
+s32 ipdb__prefix_compare(const void *a, const void *b) {
+    const ipdb__prefix *x = a, *y = b;
+    if (x->min != y->min) return x->min < y->min ? -1 : 1;
+    if (x->length != y->length) return x->length < y->length ? -1 : 1;
+    return x->index < y->index ? -1 : x->index > y->index;
+}
+
+
+#endif // __robin_c_ipdb
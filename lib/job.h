@@ -0,0 +1,174 @@
+#ifndef __robin_c_job
+#define __robin_c_job
+
+
+#include <pthread.h>
+#include <unistd.h> // sysconf(3)
+
+#include "c.h"
+
+
+//
+// A fixed set of worker threads running "parallel for" jobs:
+//
+//     job_system *jobs = job_make_system(0);
+//     job_run(jobs, process_chunk, &chunks, n_chunks);
+//
+// calls `process_chunk(&chunks, i, thread)` for every i in [0, n_chunks), on
+// all the threads (the calling one included) and returns once all are done.
+// `thread` is in [0, job_thread_count(jobs)), to index per-thread state.
+// Items are handed out one by one, so uneven items balance themselves.
+//
+// Compile with -pthread.
+//
+
+
+//
+// Declarations
+//
+
+
+typedef struct job_system job_system;
+typedef struct job__worker job__worker;
+
+typedef void (*job_fn)(void *data, s32 index, s32 thread);
+
+
+external job_system* job_make_system(s32 n_threads);
+external void        job_free_system(job_system *jobs);
+external s32         job_thread_count(job_system *jobs);
+external void        job_run(job_system *jobs, job_fn fn, void *data, s32 count);
+
+internal void* job__worker_main(void *arg);
+internal void  job__work(job_system *jobs, s32 thread);
+
+
+//
+// Definitions
+//
+
+
+struct job__worker {
+    job_system *jobs;
+    s32        thread;
+    pthread_t  handle;
+};
+
+struct job_system {
+    s32             n_threads; // Workers + the calling thread
+    job__worker     *workers;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t  wake;      // A job was started, or the system is stopping
+    pthread_cond_t  done;      // The last worker left the current job
+    u64             generation;
+    b32             stop;
+    s32             busy;      // Workers still in the current job
+
+    // Current job
+    job_fn          fn;
+    void            *data;
+    s32             count;
+    s32             next;      // Next index to run, atomically incremented
+};
+
+
+// `n_threads` 0 is one thread per CPU. 1 runs everything on the calling thread.
+job_system* job_make_system(s32 n_threads) {
+    if (n_threads <= 0) n_threads = (s32) sysconf(_SC_NPROCESSORS_ONLN);
+    if (n_threads <= 0) n_threads = 1;
+
+    job_system *jobs = struct_alloc(job_system);
+    jobs->n_threads  = n_threads;
+    jobs->generation = 0;
+    jobs->stop       = false;
+    jobs->busy       = 0;
+    jobs->fn         = NULL;
+    pthread_mutex_init(&jobs->mutex, NULL);
+    pthread_cond_init(&jobs->wake, NULL);
+    pthread_cond_init(&jobs->done, NULL);
+
+    jobs->workers = array_alloc(n_threads - 1, job__worker);
+    for (s32 i = 0; i < n_threads - 1; i++) {
+        jobs->workers[i].jobs   = jobs;
+        jobs->workers[i].thread = i + 1;
+        pthread_create(&jobs->workers[i].handle, NULL, job__worker_main, &jobs->workers[i]);
+    }
+    return jobs;
+}
+
+void job_free_system(job_system *jobs) {
+    pthread_mutex_lock(&jobs->mutex);
+    jobs->stop = true;
+    pthread_cond_broadcast(&jobs->wake);
+    pthread_mutex_unlock(&jobs->mutex);
+
+    for (s32 i = 0; i < jobs->n_threads - 1; i++) {
+        pthread_join(jobs->workers[i].handle, NULL);
+    }
+    pthread_mutex_destroy(&jobs->mutex);
+    pthread_cond_destroy(&jobs->wake);
+    pthread_cond_destroy(&jobs->done);
+    free(jobs->workers);
+    free(jobs);
+}
+
+s32 job_thread_count(job_system *jobs) {
+    return jobs->n_threads;
+}
+
+// Not reentrant: `fn` can't call job_run on the same system.
+void job_run(job_system *jobs, job_fn fn, void *data, s32 count) {
+    if (count <= 0) return;
+
+    pthread_mutex_lock(&jobs->mutex);
+    jobs->fn    = fn;
+    jobs->data  = data;
+    jobs->count = count;
+    jobs->next  = 0;
+    jobs->busy  = jobs->n_threads - 1;
+    jobs->generation++;
+    pthread_cond_broadcast(&jobs->wake);
+    pthread_mutex_unlock(&jobs->mutex);
+
+    job__work(jobs, 0);
+
+    pthread_mutex_lock(&jobs->mutex);
+    while (jobs->busy > 0) pthread_cond_wait(&jobs->done, &jobs->mutex);
+    jobs->fn = NULL;
+    pthread_mutex_unlock(&jobs->mutex);
+}
+
+void* job__worker_main(void *arg) {
+    job__worker *worker = arg;
+    job_system  *jobs   = worker->jobs;
+    u64 seen = 0;
+
+    for (;;) {
+        pthread_mutex_lock(&jobs->mutex);
+        while (!jobs->stop && jobs->generation == seen) pthread_cond_wait(&jobs->wake, &jobs->mutex);
+        if (jobs->stop) {
+            pthread_mutex_unlock(&jobs->mutex);
+            return NULL;
+        }
+        seen = jobs->generation;
+        pthread_mutex_unlock(&jobs->mutex);
+
+        job__work(jobs, worker->thread);
+
+        pthread_mutex_lock(&jobs->mutex);
+        if (--jobs->busy == 0) pthread_cond_signal(&jobs->done);
+        pthread_mutex_unlock(&jobs->mutex);
+    }
+}
+
+void job__work(job_system *jobs, s32 thread) {
+    for (;;) {
+        s32 index = __atomic_fetch_add(&jobs->next, 1, __ATOMIC_RELAXED);
+        if (index >= jobs->count) return;
+        jobs->fn(jobs->data, index, thread);
+    }
+}
+
+
+#endif // __robin_c_job
@@ -3,8 +3,21 @@
 
 
 #include "c.h"
+#include "arena.h"
 #include "string_builder.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__PCLMUL__)
+#include <wmmintrin.h>
+#endif
+
+
+#ifndef X_JSON_ERROR_PATH_SIZE
+#define X_JSON_ERROR_PATH_SIZE (256) // Longer paths keep their innermost part
+#endif
+
 
 //
 // Declarations
@@ -12,6 +25,7 @@
 
 
 typedef enum json_value_type json_value_type;
+typedef enum json_error_code json_error_code;
 
 typedef struct json_array      json_array;
 
@@ -20,44 +34,116 @@ typedef struct json_field_spec json_field_spec;
 typedef struct json_array_spec json_array_spec;
 
 typedef struct json_decoder json_decoder;
+typedef struct json_error   json_error;
+
+typedef struct json_field_table json_field_table;
+typedef struct json__field_slot json__field_slot;
+
+typedef struct json_plan        json_plan;
+typedef struct json__plan_field json__plan_field;
 
 typedef json_array (*json_array_fn)  (json_decoder *decoder);
 typedef void*      (*json_object_fn) (json_decoder *decoder);
 
+// Encoding counterparts of the callbacks, see json_encoder.h.
+typedef struct json_encoder json_encoder;
+
+typedef void (*json_encode_array_fn)  (json_encoder *encoder, json_array *array);
+typedef void (*json_encode_object_fn) (json_encoder *encoder, void *object);
+
 
 external json_decoder* json_make_decoder(const c8 *data);
+external json_decoder* json_make_indexed_decoder(const c8 *data);
+external void          json_free_decoder(json_decoder *decoder);
+external void*         json_alloc(json_decoder *decoder, s64 size);
 external b8            json_parse_object(json_decoder *decoder, json_field_spec *fields, s32 n_fields);
 external b8            json_parse_array (json_decoder *decoder, json_array_spec *array);
+external void          json_print_error (json_error *error, const c8 *data);
+
+external json_field_table* json_make_field_table(json_field_spec *fields, s32 n_fields);
+external void              json_free_field_table(json_field_table *table);
+external b8                json_parse_object_with_table(json_decoder *decoder, json_field_table *table, json_field_spec *fields);
+
+external json_plan* json_plan_scalar(json_value_type kind);
+external json_plan* json_plan_object(s32 size);
+external json_plan* json_plan_array (json_plan *item);
+external void       json_plan_field (json_plan *object, c8 *name, s32 offset, json_plan *value);
+external void       json_compile_plan(json_plan *plan);
+external b8         json_decode_with_plan(json_decoder *decoder, json_plan *plan, void *dst);
 
 external json_array json_decode_array_of_integer(json_decoder *decoder);
 external json_array json_decode_array_of_float  (json_decoder *decoder);
 external json_array json_decode_array_of_string (json_decoder *decoder);
+external json_array json_decode_array_of_s64    (json_decoder *decoder);
+external json_array json_decode_array_of_f64    (json_decoder *decoder);
 
-internal s32 json__find_field(c8 *name, json_field_spec *fields, s32 n_fields);
+internal s32 json__find_field(const c8 *key, s32 length, json_field_spec *fields, s32 n_fields, json_field_table *table);
+internal u64 json__hash_key  (const c8 *key, s32 length, u64 seed);
+internal b8  json__fill_field_table(json_field_table *table, json_field_spec *fields, s32 n_fields);
 
 internal inline b32 json__is_whitespace(const c8 c);
 internal inline b32 json__is_alpha     (const c8 c);
 internal inline b32 json__is_digit     (const c8 c);
 internal inline b32 json__is_escapable (const c8 c);
 internal inline c8  json__escaped      (const c8 c);
+internal inline s32 json__hex4         (const c8 *s);
+internal inline s32 json__encode_utf8  (u32 codepoint, c8 *dst);
+
+internal s32 json__scan_string  (const c8 *data, s32 i, s32 length);
+internal s32 json__skip_blank_at(const c8 *data, s32 i);
 
 // @Improvement: have skip_XXX procedures that are simpler - and more efficient - that parse_XXX.
-// @Bug: errors don't bubble up immediatly, other errors are printed on the way.
 internal b8 json__parse_string        (json_decoder *decoder, c8 **dst);
-internal b8 json__parse_number        (json_decoder *decoder, void *dst);
+internal b8 json__parse_number        (json_decoder *decoder, json_value_type kind, void *dst);
 internal b8 json__parse_boolean       (json_decoder *decoder, b32 *dst);
 internal b8 json__parse_null          (json_decoder *decoder, void **dst);
 internal b8 json__parse_array         (json_decoder *decoder, json_array_spec *array);
-internal b8 json__parse_object        (json_decoder *decoder, json_field_spec *fields, s32 n_fields);
+internal b8 json__parse_object        (json_decoder *decoder, json_field_spec *fields, s32 n_fields, json_field_table *table);
 internal b8 json__parse_array_field   (json_decoder *decoder, json_field_spec *field);
 internal b8 json__parse_object_field  (json_decoder *decoder, json_field_spec *field);
+internal b8 json__read_key            (json_decoder *decoder, const c8 **key, s32 *length, c8 **copy);
+internal b8 json__parse_key           (json_decoder *decoder, json_field_spec *fields, s32 n_fields, json_field_table *table, s32 *index);
+internal b8 json__skip_value          (json_decoder *decoder);
+internal b8 json__object_callback     (json_decoder *decoder, json_object_fn fn, void **dst);
+internal b8 json__array_callback      (json_decoder *decoder, json_array_fn fn, json_array *dst);
+
+internal b8  json__parse_numbers(json_decoder *decoder, json_value_type kind, s32 size, json_array *dst, b32 report, b32 *range);
+internal s32 json__scan_numbers(const c8 *data, s32 i, s32 length, s32 *commas);
+internal s32 json__number_at   (const c8 *data, s32 i, s32 end, json_value_type kind, s64 *integer, f64 *real);
+internal inline u32 json__read_digits(const c8 *s, s32 *n);
+
+internal void json__build_index (json_decoder *decoder);
+internal void json__classify    (const u8 *block, u64 *backslash, u64 *quote, u64 *whitespace, u64 *op, u64 *control, u64 *escapable);
+internal inline u64 json__prefix_xor(u64 bits);
+
+internal b8 json__index_parse (json_decoder *decoder, json_value_type kind, json_field_spec *fields, s32 n_fields, json_field_table *table, json_array_spec *array);
+internal b8 json__index_object(json_decoder *decoder, json_field_spec *fields, s32 n_fields, json_field_table *table);
+internal b8 json__index_array (json_decoder *decoder, json_array_spec *array);
+internal b8 json__index_value (json_decoder *decoder, json_value_spec *spec, void *dst);
+internal b8 json__index_scalar_end(json_decoder *decoder);
+inline internal c8 json__token(json_decoder *decoder);
+
+internal b8 json__execute_plan  (json_decoder *decoder, json_plan *plan, u8 *dst);
+internal b8 json__execute_object(json_decoder *decoder, json_plan *plan, u8 *dst);
+internal b8 json__execute_array (json_decoder *decoder, json_plan *plan, json_array *dst);
 
 inline internal c8   json__read   (json_decoder *decoder);
 inline internal void json__back   (json_decoder *decoder);
 inline internal c8   json__char   (json_decoder *decoder);
-
-internal void json__error(json_decoder *decoder, c8 *msg);
-internal void json__errorf(json_decoder *decoder, const c8 *fmt, ...);
+inline internal c8   json__read_nonblank(json_decoder *decoder);
+
+internal void* json__realloc(json_decoder *decoder, void *ptr, s64 old_size, s64 new_size);
+internal void  json__free   (json_decoder *decoder, void *ptr);
+internal void  json__track  (json_decoder *decoder, void *ptr, s32 slot);
+internal s32   json__tracked(json_decoder *decoder, void *ptr);
+internal void  json__begin  (json_decoder *decoder);
+internal b8    json__end    (json_decoder *decoder, b8 ok);
+
+internal void json__error(json_decoder *decoder, json_error_code code, c8 *msg);
+internal void json__errorf(json_decoder *decoder, json_error_code code, const c8 *fmt, ...);
+internal b8   json__error_key  (json_decoder *decoder, s32 key);
+internal b8   json__error_index(json_decoder *decoder, s32 index);
+internal void json__error_prepend(json_error *error, const c8 *segment, s32 length);
 internal b8   json__check_type(json_decoder *decoder, json_value_type expected, json_value_type spec);
 
 
@@ -78,10 +164,72 @@ enum json_value_type {
     JSON_OBJECT       = 1 << 6,
 };
 
+enum json_error_code {
+    JSON_OK = 0,
+    JSON_ERROR_SYNTAX,   // Unexpected character
+    JSON_ERROR_END,      // The input ends in the middle of the document
+    JSON_ERROR_STRING,   // Invalid escape sequence or control character
+    JSON_ERROR_NUMBER,   // Invalid or out of range number
+    JSON_ERROR_TYPE,     // A value of a kind the spec doesn't accept
+    JSON_ERROR_TRAILING, // Something else than whitespace after the document
+    JSON_ERROR_CALLBACK, // A callback failed without saying why
+};
+
+//
+// Decoding stops at the first error, which is kept in the decoder (nothing is
+// printed, see json_print_error):
+//
+//     person *p = decode_person(decoder);
+//     if (!p) {
+//         json_error *error = &decoder->error;
+//         fprintf(stderr, "%s at %d:%d, in %s\n", error->message, error->line, error->column, error->path);
+//     }
+//
+// Every procedure returns as soon as something failed, callbacks included:
+// once the decoder has an error, json_parse_XXX return false right away.
+//
+// Everything the root value allocated (json_alloc) is released when it
+// fails: the decoder's arena is rewound to where it was, or the malloc'd
+// blocks are freed. Targets are left pointing to released memory, so a failed
+// decoding costs what was read until the error, and nothing leaks.
+//
+struct json_error {
+    json_error_code code;
+    s32             offset; // In the input, of the faulty character
+    s32             line;   // From 1
+    s32             column; // From 1, in bytes
+    c8              message[128];
+
+    // JSON Pointer of the value where it happened ("/friends/2/name"), empty
+    // at the root. Built on the way out, so it costs nothing until then.
+    c8              path[X_JSON_ERROR_PATH_SIZE];
+};
+
 struct json_decoder {
     b32      root;
     const c8 *data;  // Data to parse
+    s32      length; // Of `data`, without the NUL: vector loads stop there
     s32      cursor; // To store the current position, to not expose it to callbacks
+
+    // Structural index, only for decoders made with json_make_indexed_decoder.
+    u32      *index;   // Positions of the structural characters, then `length`
+    s32      n_index;
+    s32      next;     // Next entry of `index` to consume
+    s32      invalid;  // Position of the first invalid string character, -1 if none
+
+    // Where decoded strings and arrays go, malloc if NULL. With an arena,
+    // nothing has to be freed one by one: see json_alloc.
+    arena    *arena;
+
+    json_error error;
+
+    // While the root value is decoded, what to release if it fails: the
+    // position of the arena, or the blocks json_alloc got from malloc.
+    b32        tracking;
+    arena_mark mark;
+    void       **allocations;
+    s32        n_allocations;
+    s32        cap_allocations;
 };
 
 struct json_array {
@@ -94,6 +242,8 @@ struct json_value_spec {
     union {
         json_object_fn object_fn;
         json_array_fn  array_fn;
+        json_encode_object_fn encode_object_fn;
+        json_encode_array_fn  encode_array_fn;
     } callback;
     union {
         c8         **string;
@@ -122,27 +272,206 @@ struct json_array_spec {
     json_value_spec spec;
 };
 
+//
+// Perfect hash of the field names of a `json_field_spec` array, built once by
+// `json_make_field_table` and reused for every object decoded with the same
+// fields (same names, in the same order): each key then costs one hash and at
+// most `max_probe` comparisons against the input bytes, whatever the number of
+// fields.
+//
+struct json__field_slot {
+    const c8 *name;   // NULL for an empty slot
+    s32      length;
+    s32      index;   // Index in the `json_field_spec` array
+};
+
+struct json_field_table {
+    s32              n_fields;
+    s32              max_probe; // 1 when the hash is perfect
+    u64              seed;
+    u32              mask;      // Number of slots - 1
+    json__field_slot *slots;
+};
+
+//
+// A plan describes the shape of a document and where each value goes in the
+// destination struct, by offset. It is built once (json_plan_XXX), compiled
+// (json_compile_plan) and then executed over any number of documents with
+// json_decode_with_plan: no callbacks, no pointer targets, a single switch on
+// the expected kind per value.
+//
+// Destinations, by kind:
+// - JSON_STRING:  c8*
+// - JSON_INTEGER: s32
+// - JSON_FLOAT:   f32
+// - JSON_BOOLEAN: b32
+// - JSON_OBJECT:  the struct itself (`size` bytes), zeroed first, also on null
+// - JSON_ARRAY:   json_array, of `item->size` bytes items
+//
+struct json__plan_field {
+    c8        *name;
+    s32       offset;
+    json_plan *plan;
+};
+
+struct json_plan {
+    json_value_type  kind;
+    s32              size; // Size of the destination
+
+    // JSON_OBJECT
+    s32              n_fields;
+    s32              cap_fields;
+    json__plan_field *fields;
+    json_field_table *table;
+
+    // JSON_ARRAY
+    json_plan        *item;
+};
+
 
 json_decoder* json_make_decoder(const c8 *data) {
     json_decoder *decoder = struct_alloc(json_decoder);
     decoder->data         = data;
     decoder->root         = true;
     decoder->cursor       = 0;
+    decoder->length       = __builtin_strlen(data);
+    decoder->index        = NULL;
+    decoder->n_index      = 0;
+    decoder->next         = 0;
+    decoder->invalid      = -1;
+    decoder->arena        = NULL;
+    decoder->error        = (json_error){ .code = JSON_OK };
+    decoder->tracking     = false;
+    decoder->allocations  = NULL;
+    decoder->n_allocations   = 0;
+    decoder->cap_allocations = 0;
+    return decoder;
+}
+
+//
+// Same as json_make_decoder, but the whole document is indexed first, and the
+// json_parse_XXX procedures then walk the index instead of the characters
+// (see "Structural index" below). Worth it for large documents.
+//
+// Callbacks work the same, as long as they only use json_parse_object,
+// json_parse_object_with_table and json_parse_array (or json_decode_array_XXX):
+// plans and JSON_STRUCT codecs read the characters and ignore the index.
+//
+json_decoder* json_make_indexed_decoder(const c8 *data) {
+    json_decoder *decoder = json_make_decoder(data);
+    json__build_index(decoder);
     return decoder;
 }
 
+void json_free_decoder(json_decoder *decoder) {
+    if (decoder->index) free(decoder->index);
+    free(decoder->allocations);
+    free(decoder);
+}
+
+//
+// Memory for decoded values, from the decoder's arena if it has one. Callbacks
+// allocating their objects with it don't need a pass to free them. Blocks
+// taken at the root, before anything is parsed (by a callback called directly
+// on the decoder), belong to the root value too.
+//
+void* json_alloc(json_decoder *decoder, s64 size) {
+    if (decoder->arena) return arena_alloc(decoder->arena, size);
+    void *ptr = memory_alloc(size);
+    if (decoder->tracking || decoder->root) json__track(decoder, ptr, -1);
+    return ptr;
+}
+
+void* json__realloc(json_decoder *decoder, void *ptr, s64 old_size, s64 new_size) {
+    if (decoder->arena) return arena_realloc(decoder->arena, ptr, old_size, new_size);
+    // Looked up while `ptr` is still valid: realloc may free it.
+    s32 slot = decoder->tracking && ptr ? json__tracked(decoder, ptr) : -1;
+    void *new_ptr = memory_realloc(ptr, new_size);
+    if (decoder->tracking) json__track(decoder, new_ptr, slot);
+    return new_ptr;
+}
+
+// Arena memory is released all at once, with the arena.
+void json__free(json_decoder *decoder, void *ptr) {
+    if (decoder->arena || !ptr) return;
+    if (decoder->tracking) json__track(decoder, NULL, json__tracked(decoder, ptr));
+    free(ptr);
+}
+
+//
+// Put `ptr` in `slot` of the blocks to release on failure, or add it if
+// `slot` is -1. A NULL `ptr` removes the block of `slot`.
+//
+void json__track(json_decoder *decoder, void *ptr, s32 slot) {
+    if (slot >= 0) {
+        if (ptr) {
+            decoder->allocations[slot] = ptr;
+        } else {
+            decoder->allocations[slot] = decoder->allocations[--decoder->n_allocations];
+        }
+        return;
+    }
+    if (!ptr) return;
+
+    if (decoder->n_allocations == decoder->cap_allocations) {
+        decoder->cap_allocations = decoder->cap_allocations ? 2 * decoder->cap_allocations : 64;
+        decoder->allocations = memory_realloc(decoder->allocations, decoder->cap_allocations * sizeof(void*));
+    }
+    decoder->allocations[decoder->n_allocations++] = ptr;
+}
+
+//
+// Slot of `ptr` in the blocks to release on failure, -1 if it isn't one.
+// Blocks are mostly resized or freed right after they're allocated (arrays
+// growing, key copies), so the search starts from the most recent one.
+//
+s32 json__tracked(json_decoder *decoder, void *ptr) {
+    for (s32 i = decoder->n_allocations - 1; i >= 0; i--) {
+        if (decoder->allocations[i] == ptr) return i;
+    }
+    return -1;
+}
+
+// The root value starts: errors and allocations are from now on (along with
+// the blocks json_alloc gave just before, json__end forgets the others).
+void json__begin(json_decoder *decoder) {
+    decoder->root          = false;
+    decoder->error         = (json_error){ .code = JSON_OK };
+    decoder->tracking      = true;
+    if (decoder->arena) decoder->mark = arena_save(decoder->arena);
+}
+
+// The root value is done: if it failed, release everything it allocated.
+b8 json__end(json_decoder *decoder, b8 ok) {
+    if (!ok) {
+        if (decoder->arena) {
+            arena_rewind(decoder->arena, decoder->mark);
+        } else {
+            for (s32 i = 0; i < decoder->n_allocations; i++) free(decoder->allocations[i]);
+        }
+    }
+    decoder->tracking      = false;
+    decoder->n_allocations = 0;
+    return ok;
+}
+
 b8 json_parse_object(json_decoder *decoder, json_field_spec *fields, s32 n_fields) {
+    // A callback carrying on after a failure stops here.
+    if (decoder->error.code) return false;
+    if (decoder->index) return json__index_parse(decoder, JSON_OBJECT, fields, n_fields, NULL, NULL);
+
     //
     // If we're the root object, we need to do some extra stuff:
     // - discard leading whitespaces
     // - check that the first non-whitespace is an opening bracket
     // - check that there are no non-whitespace character after the closing bracket
+    // - release what was allocated if anything fails
     //
     b32 root = decoder->root;
     c8 c;
 
     if (root) {
-        decoder->root = false;
+        json__begin(decoder);
 
         decoder->cursor = -1;
         c = json__read(decoder);
@@ -151,65 +480,244 @@ b8 json_parse_object(json_decoder *decoder, json_field_spec *fields, s32 n_field
 
     // Put back the non-whitespace char (which should be '{') in the
     // read buffer, for json__parse_object to check.
-    b8 ok = json__parse_object(decoder, fields, n_fields);
-    if (!ok) return false;
+    b8 ok = json__parse_object(decoder, fields, n_fields, NULL);
+    if (!root) return ok;
 
-    if (root) {
+    if (ok) {
         c = json__read(decoder);
         while (json__is_whitespace(c)) c = json__read(decoder);
         if (c != '\0') {
-            json__error(decoder, "parse object: expected end of string, but found other data");
-            return false;
+            json__error(decoder, JSON_ERROR_TRAILING, "parse object: expected end of string, but found other data");
+            ok = false;
         }
     }
 
-    return true;
+    return json__end(decoder, ok);
 }
 
 b8 json_parse_array(json_decoder *decoder, json_array_spec *array) {
-    //
-    // If we're the root object, we need to do some extra stuff:
-    // - discard leading whitespaces
-    // - check that the first non-whitespace is an opening bracket
-    // - check that there are no non-whitespace character after the closing bracket
-    //
+    if (decoder->error.code) return false;
+    if (decoder->index) return json__index_parse(decoder, JSON_ARRAY, NULL, 0, NULL, array);
+
+    // Same as json_parse_object, see the comments there.
     b32 root = decoder->root;
     c8 c;
 
     if (root) {
-        decoder->root = false;
+        json__begin(decoder);
 
         decoder->cursor = -1;
         c = json__read(decoder);
         while (json__is_whitespace(c)) c = json__read(decoder);
     }
 
-    // Put back the non-whitespace char (which should be '[') in the
-    // read buffer, for json__array_object to check.
     b8 ok = json__parse_array(decoder, array);
-    if (!ok) return false;
+    if (!root) return ok;
+
+    if (ok) {
+        c = json__read(decoder);
+        while (json__is_whitespace(c)) c = json__read(decoder);
+        if (c != '\0') {
+            json__error(decoder, JSON_ERROR_TRAILING, "parse array: expected end of string, but found other data");
+            ok = false;
+        }
+    }
+
+    return json__end(decoder, ok);
+}
+
+b8 json_parse_object_with_table(json_decoder *decoder, json_field_table *table, json_field_spec *fields) {
+    if (decoder->error.code) return false;
+    if (decoder->index) return json__index_parse(decoder, JSON_OBJECT, fields, table->n_fields, table, NULL);
+
+    // Same as json_parse_object, see the comments there.
+    b32 root = decoder->root;
+    c8 c;
 
     if (root) {
+        json__begin(decoder);
+
+        decoder->cursor = -1;
+        c = json__read(decoder);
+        while (json__is_whitespace(c)) c = json__read(decoder);
+    }
+
+    b8 ok = json__parse_object(decoder, fields, table->n_fields, table);
+    if (!root) return ok;
+
+    if (ok) {
         c = json__read(decoder);
         while (json__is_whitespace(c)) c = json__read(decoder);
         if (c != '\0') {
-            json__error(decoder, "parse array: expected end of string, but found other data");
-            return false;
+            json__error(decoder, JSON_ERROR_TRAILING, "parse object: expected end of string, but found other data");
+            ok = false;
+        }
+    }
+
+    return json__end(decoder, ok);
+}
+
+//
+// Only the names are read from `fields`, so the table can be built from the
+// first array of specs and kept around (e.g. in a `local_persist`) while the
+// targets change for every object.
+//
+json_field_table* json_make_field_table(json_field_spec *fields, s32 n_fields) {
+    json_field_table *table = struct_alloc(json_field_table);
+    table->n_fields = n_fields;
+
+    // Look for a seed without any collision, with a load factor <= 1/2 first,
+    // then with bigger tables. Usually the first few seeds work.
+    u32 size = 4;
+    while (size < 2 * (u32) n_fields) size *= 2;
+
+    for (s32 attempt = 0; attempt < 4; attempt++, size *= 2) {
+        table->mask  = size - 1;
+        table->slots = array_alloc(size, json__field_slot);
+
+        for (u64 seed = 1; seed <= 64; seed++) {
+            table->seed      = seed * 0x9E3779B97F4A7C15ull;
+            table->max_probe = 1;
+            if (json__fill_field_table(table, fields, n_fields)) {
+                return table;
+            }
         }
+        free(table->slots);
     }
 
+    // No perfect hash (e.g. duplicated names): fallback to linear probing.
+    table->mask      = size / 2 - 1;
+    table->slots     = array_alloc(size / 2, json__field_slot);
+    table->seed      = 0x9E3779B97F4A7C15ull;
+    table->max_probe = size / 2;
+    json__fill_field_table(table, fields, n_fields);
+    return table;
+}
+
+void json_free_field_table(json_field_table *table) {
+    free(table->slots);
+    free(table);
+}
+
+// Return false if two names collide and `table->max_probe` is 1.
+b8 json__fill_field_table(json_field_table *table, json_field_spec *fields, s32 n_fields) {
+    memory_set(table->slots, (table->mask + 1) * sizeof(json__field_slot), 0);
+
+    for (s32 i = 0; i < n_fields; i++) {
+        s32 length = 0;
+        while (fields[i].name[length] != '\0') length++;
+
+        u32 slot = json__hash_key(fields[i].name, length, table->seed) & table->mask;
+        while (table->slots[slot].name) {
+            if (table->max_probe == 1) return false;
+            slot = (slot + 1) & table->mask;
+        }
+        table->slots[slot] = (json__field_slot){
+            .name   = fields[i].name,
+            .length = length,
+            .index  = i,
+        };
+    }
     return true;
 }
 
-s32 json__find_field(c8 *name, json_field_spec *fields, s32 n_fields) {
+// Hash the key 8 bytes at a time, with a multiply/xorshift mix per word.
+u64 json__hash_key(const c8 *key, s32 length, u64 seed) {
+    u64 h = seed ^ ((u64) length * 0xC2B2AE3D27D4EB4Full);
+    s32 i = 0;
+    for (; i + 8 <= length; i += 8) {
+        u64 word;
+        memory_copy(&word, (void*) (key + i), 8);
+        h = (h ^ word) * 0xFF51AFD7ED558CCDull;
+        h ^= h >> 32;
+    }
+    if (i < length) {
+        u64 word = 0;
+        memory_copy(&word, (void*) (key + i), length - i);
+        h = (h ^ word) * 0xFF51AFD7ED558CCDull;
+        h ^= h >> 32;
+    }
+    h *= 0xC4CEB9FE1A85EC53ull;
+    h ^= h >> 29;
+    return h;
+}
+
+//
+// Find the field named by the `length` bytes at `key`, which don't have to be
+// NUL-terminated (keys are matched in the input directly). Without a table,
+// this is a linear scan over `fields`.
+//
+s32 json__find_field(const c8 *key, s32 length, json_field_spec *fields, s32 n_fields, json_field_table *table) {
+    if (table) {
+        u32 slot = json__hash_key(key, length, table->seed) & table->mask;
+        for (s32 probe = 0; probe < table->max_probe; probe++) {
+            json__field_slot *candidate = &table->slots[slot];
+            if (!candidate->name) break;
+            if (candidate->length == length && __builtin_memcmp(candidate->name, key, length) == 0) {
+                return candidate->index;
+            }
+            slot = (slot + 1) & table->mask;
+        }
+        return -1;
+    }
+
     for (s32 i = 0; i < n_fields; i++) {
-        if (string_equal(fields[i].name, name)) {
+        const c8 *name = fields[i].name;
+        s32 j = 0;
+        while (j < length && name[j] == key[j]) j++;
+        if (j == length && name[j] == '\0') {
             return i;
         }
     }
     return -1;
 }
 
+//
+// The cursor should be on the opening quote of the key, it is left on the
+// closing one. Keys without escape sequences are left in place (`key` points
+// in the input), the others are unescaped in `*copy`, which must be freed.
+//
+b8 json__read_key(json_decoder *decoder, const c8 **key, s32 *length, c8 **copy) {
+    const c8 *data = decoder->data;
+    s32 start = decoder->cursor + 1;
+    s32 end   = json__scan_string(data, start, decoder->length);
+
+    *copy = NULL;
+    if (data[end] == '"') {
+        decoder->cursor = end;
+        *key    = data + start;
+        *length = end - start;
+        return true;
+    }
+
+    if (!json__parse_string(decoder, copy)) return false;
+    s32 n = 0;
+    while ((*copy)[n] != '\0') n++;
+    *key    = *copy;
+    *length = n;
+    return true;
+}
+
+//
+// Same as json__read_key, but looks the key up in `table` or `fields`.
+// `index` is set to -1 for unknown keys, or when there is neither `fields`
+// nor `table` to look into (skipped objects).
+//
+b8 json__parse_key(json_decoder *decoder, json_field_spec *fields, s32 n_fields, json_field_table *table, s32 *index) {
+    *index = -1;
+    if (!fields && !table) {
+        return json__parse_string(decoder, NULL);
+    }
+
+    const c8 *key;
+    s32 length;
+    c8 *copy;
+    if (!json__read_key(decoder, &key, &length, &copy)) return false;
+    *index = json__find_field(key, length, fields, n_fields, table);
+    if (copy) json__free(decoder, copy);
+    return true;
+}
+
 b32 json__is_whitespace(const c8 c) {
     switch (c) {
         case ' ': case '\t':
@@ -228,10 +736,10 @@ b32 json__is_digit(const c8 c) {
     return ('0' <= c && c <= '9');
 }
 
-// @Improvement: handle hexs (e.g. \uFFFF).
+// '\uXXXX' escapes are handled separately, see `json__parse_string`.
 b32 json__is_escapable(const c8 c) {
     switch (c) {
-        case '\\':
+        case '"': case '\\':
         case '/': case 'b': case 'f':
         case 'n': case 'r': case 't':
             return true;
@@ -242,6 +750,8 @@ b32 json__is_escapable(const c8 c) {
 // Return the corresponding character, assuming it follows a '\' character.
 c8 json__escaped(const c8 c) {
     switch (c) {
+        case '"':
+            return '"';
         case '\\':
             return '\\';
         case '/':
@@ -260,70 +770,198 @@ c8 json__escaped(const c8 c) {
     return 0;
 }
 
+// Value of the 4 hex digits starting at `s`, or -1 if any of them isn't one.
+// Stops on the NUL terminator since it isn't a hex digit.
+s32 json__hex4(const c8 *s) {
+    s32 value = 0;
+    for (s32 i = 0; i < 4; i++) {
+        c8 c = s[i];
+        value <<= 4;
+        if      ('0' <= c && c <= '9') value |= c - '0';
+        else if ('a' <= c && c <= 'f') value |= c - 'a' + 10;
+        else if ('A' <= c && c <= 'F') value |= c - 'A' + 10;
+        else return -1;
+    }
+    return value;
+}
+
+// Write `codepoint` as UTF-8 in `dst` (at least 4 bytes), return the number of bytes written.
+s32 json__encode_utf8(u32 codepoint, c8 *dst) {
+    if (codepoint < 0x80) {
+        dst[0] = (c8) codepoint;
+        return 1;
+    }
+    if (codepoint < 0x800) {
+        dst[0] = (c8) (0xC0 | (codepoint >> 6));
+        dst[1] = (c8) (0x80 | (codepoint & 0x3F));
+        return 2;
+    }
+    if (codepoint < 0x10000) {
+        dst[0] = (c8) (0xE0 | (codepoint >> 12));
+        dst[1] = (c8) (0x80 | ((codepoint >> 6) & 0x3F));
+        dst[2] = (c8) (0x80 | (codepoint & 0x3F));
+        return 3;
+    }
+    dst[0] = (c8) (0xF0 | (codepoint >> 18));
+    dst[1] = (c8) (0x80 | ((codepoint >> 12) & 0x3F));
+    dst[2] = (c8) (0x80 | ((codepoint >> 6) & 0x3F));
+    dst[3] = (c8) (0x80 | (codepoint & 0x3F));
+    return 4;
+}
+
+//
+// Return the index of the first '"', '\' or control character (< 0x20) at or
+// after `data[i]`, or `length` if there is none before it. For NUL-terminated
+// data that's the terminator, a control character too.
+//
+// The SSE2 version reads 16 bytes at a time, never past `length`: the last
+// few are done one by one.
+//
+s32 json__scan_string(const c8 *data, s32 i, s32 length) {
+#if defined(__SSE2__)
+    __m128i quote     = _mm_set1_epi8('"');
+    __m128i backslash = _mm_set1_epi8('\\');
+    __m128i control   = _mm_set1_epi8(0x1F);
+
+    for (; i + 16 <= length; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*) (data + i));
+        __m128i special = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+            _mm_cmpeq_epi8(_mm_max_epu8(v, control), control)); // Unsigned v <= 0x1F
+        u32 mask = (u32) _mm_movemask_epi8(special);
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+#endif
+    for (; i < length; i++) {
+        u8 c = (u8) data[i];
+        if (c == '"' || c == '\\' || c < 0x20) return i;
+    }
+    return length;
+}
+
+s32 json__skip_blank_at(const c8 *data, s32 i) {
+    while (json__is_whitespace(data[i])) i++;
+    return i;
+}
+
 //
-// This assumes the initial quote was already processed,
-// and i is the index of the first character in the string.
+// The cursor should be on the opening quote, it is left on the closing one.
+// When `dst` is NULL the string is only validated, nothing is allocated.
+//
+// Runs of regular characters are found with `json__scan_string` and copied
+// at once: a string without escape sequences is a single allocation and copy.
 //
 b8 json__parse_string(json_decoder *decoder, c8 **dst) {
-    b32 is_escaped          = false;
-    string_builder *builder = string_make_builder();
-    // @Improvement: check current char is '"'
+    const c8 *data = decoder->data;
+    s32 start = decoder->cursor + 1;
+    s32 end   = json__scan_string(data, start, decoder->length);
+
+    if (data[end] == '"') {
+        decoder->cursor = end;
+        if (dst) {
+            s32 length = end - start;
+            c8 *str = json_alloc(decoder, length + 1);
+            memory_copy(str, (void*) (data + start), length);
+            str[length] = '\0';
+            *dst = str;
+        }
+        return true;
+    }
 
-    c8 c = json__read(decoder);
-    while (c != '\0') {
+    string_builder *builder = dst ? string_make_builder() : NULL;
+    c8 utf8[4];
 
-        switch(c) {
-            case '\\':
-                is_escaped = true;
-                break;
+    for (;;) {
+        if (builder && end > start) {
+            string_write_n(builder, (c8*) (data + start), end - start);
+        }
 
-            case '"':
-                if (is_escaped) {
-                    string_write_char(builder, '"');
-                } else {
-                    goto end;
-                }
-                break;
+        c8 c = data[end];
+        decoder->cursor = end;
+        if (c == '"') {
+            break;
+        }
+        if (c == '\0') {
+            json__error(decoder, JSON_ERROR_STRING, "parse string: couldn't find '\"' at the end");
+            goto error;
+        }
+        if (c != '\\') {
+            json__error(decoder, JSON_ERROR_STRING, "parse string: unescaped control character");
+            goto error;
+        }
 
-            default:
-                if (is_escaped) {
-                    if(json__is_escapable(c)) {
-                        string_write_char(builder, json__escaped(c));
-                    } else {
-                        json__error(decoder, "parse string: invalid escaped character");
-                        goto end;
-                    }
-                } else {
-                    string_write_char(builder, c);
+        c = data[++end];
+        decoder->cursor = end;
+        if (c == 'u') {
+            s32 codepoint = json__hex4(data + end + 1);
+            if (codepoint < 0) {
+                json__error(decoder, JSON_ERROR_STRING, "parse string: invalid '\\u' escape");
+                goto error;
+            }
+            end += 4;
+
+            if (0xD800 <= codepoint && codepoint <= 0xDBFF) {
+                // High surrogate, must be followed by a low one: "\uD83D\uDE00".
+                s32 low = -1;
+                if (data[end + 1] == '\\' && data[end + 2] == 'u') {
+                    low = json__hex4(data + end + 3);
                 }
+                if (low < 0xDC00 || low > 0xDFFF) {
+                    json__error(decoder, JSON_ERROR_STRING, "parse string: unpaired high surrogate");
+                    goto error;
+                }
+                codepoint = 0x10000 + ((codepoint - 0xD800) << 10) + (low - 0xDC00);
+                end += 6;
+            } else if (0xDC00 <= codepoint && codepoint <= 0xDFFF) {
+                json__error(decoder, JSON_ERROR_STRING, "parse string: unpaired low surrogate");
+                goto error;
+            }
+
+            if (builder) {
+                string_write_n(builder, utf8, json__encode_utf8((u32) codepoint, utf8));
+            }
+        } else if (json__is_escapable(c)) {
+            if (builder) string_write_char(builder, json__escaped(c));
+        } else {
+            json__error(decoder, JSON_ERROR_STRING, "parse string: invalid escaped character");
+            goto error;
         }
 
-        c = json__read(decoder);
+        start = end + 1;
+        end   = json__scan_string(data, start, decoder->length);
     }
 
-end:
-    if (c != '"') {
-        json__error(decoder, "parse string: couldn't find '\"' at the end");
-        return false;
-    } else if (dst) {
-        // @Improvement: use custom allocator
-        *dst = string_builder_to_c(builder);
+    if (builder) {
+        c8 *str = json_alloc(decoder, builder->total_length + 1);
+        string_copy_builder(builder, str);
+        str[builder->total_length] = '\0';
+        *dst = str;
+        string_free_builder(builder);
     }
-    string_free_builder(builder);
     return true;
+
+error:
+    if (builder) string_free_builder(builder);
+    return false;
 }
 
 //
-// `dst` should only be a `f32*` or a `s32*`, depending on the expected type.
-// Never returns an error value, but instead stops whenever the number ends,
-// and let the caller detect the error (e.g. "1234a" will return 1234, and the
-// caller should detect an error when finding the 'a' after a value.
+// `dst` should be a `f32*` if `kind` is JSON_FLOAT, a `s32*` otherwise: the
+// number is converted to it whatever its textual form ("2" or "2.5").
+// Only fails without digits ("-", "1.") or when an integer doesn't fit in a
+// s32, otherwise stops whenever the number ends and let the caller detect the
+// error (e.g. "1234a" will return 1234, and the caller should detect an error
+// when finding the 'a' after a value.
 //
 // @Improvement: handle exponents (e.g. 1e5).
 //
-b8 json__parse_number(json_decoder *decoder, void *dst) {
-    b32 is_fraction = false;
-    s32 value = 0, sign = 1;
+b8 json__parse_number(json_decoder *decoder, json_value_type kind, void *dst) {
+    b32 integer = !(kind & JSON_FLOAT) && (kind & JSON_INTEGER);
+    s64 value = 0;   // Integers, checked as it grows so it can't overflow
+    f64 whole = 0.0; // Integer part of the others
+    s32 sign  = 1;
     f32 fract = 0.0, div = 1.0;
 
     c8 c = json__char(decoder);
@@ -333,6 +971,10 @@ b8 json__parse_number(json_decoder *decoder, void *dst) {
         if (c == '-') {
             sign = -1;
             c = json__read(decoder);
+            if (!json__is_digit(c)) {
+                json__error(decoder, JSON_ERROR_NUMBER, "parse number: expected a digit after '-'");
+                return false;
+            }
         }
     }
 
@@ -352,8 +994,15 @@ b8 json__parse_number(json_decoder *decoder, void *dst) {
         // Parse the integer part.
         for (;;) {
             if (json__is_digit(c)) {
-                value *= 10;
-                value += c - '0';
+                if (integer) {
+                    value = value * 10 + (c - '0');
+                    if (value > (s64) INT32_MAX + (sign < 0)) {
+                        json__error(decoder, JSON_ERROR_NUMBER, "parse number: out of range");
+                        return false;
+                    }
+                } else {
+                    whole = whole * 10 + (c - '0');
+                }
             } else if(c == '.') {
                 goto fraction;
             } else {
@@ -366,24 +1015,27 @@ b8 json__parse_number(json_decoder *decoder, void *dst) {
 fraction:
     {
         // Parse the the fractional part.
-        is_fraction = true;
+        c = json__read(decoder);
+        if (!json__is_digit(c)) {
+            json__error(decoder, JSON_ERROR_NUMBER, "parse number: expected a digit after '.'");
+            return false;
+        }
         for (;;) {
+            div   *= 10.0;
+            fract += ((f32) c - '0') / div;
             c = json__read(decoder);
             if (!json__is_digit(c)) {
                 goto end;
             }
-            div   *= 10.0;
-            fract += ((f32) c - '0') / div;
         }
     }
 
 end:
     if (dst) {
-        value *= sign;
-        if (is_fraction) {
-            *(f32*) dst = (f32) value + fract;
+        if (kind & JSON_FLOAT) {
+            *(f32*) dst = sign * ((f32) whole + fract);
         } else {
-            *(s32*) dst = value;
+            *(s32*) dst = (s32) (sign * value);
         }
     }
 
@@ -407,14 +1059,14 @@ b8 json__parse_boolean(json_decoder *decoder, b32 *dst) {
         bool_str = "false";
         bool_len = 5;
     } else {
-        json__error(decoder, "parse boolean: value does not start with 't' not 'f'");
+        json__error(decoder, JSON_ERROR_SYNTAX, "parse boolean: value does not start with 't' not 'f'");
         return false;
     }
 
     for (s32 j = 0; j < bool_len; j++) {
         if (j > 0) c = json__read(decoder);
         if (c != bool_str[j]) {
-            json__errorf(decoder, "parse boolean: expected \"%s\" but found unexpected character", bool_str);
+            json__errorf(decoder, JSON_ERROR_SYNTAX, "parse boolean: expected \"%s\" but found unexpected character", bool_str);
             return false;
         }
     }
@@ -431,7 +1083,7 @@ b8 json__parse_null(json_decoder *decoder, void **dst) {
     for (s32 j = 0; j < 4; j++) {
         c = json__read(decoder);
         if (c != null_str[j]) {
-            json__errorf(decoder, "parse null: expected \"%s\" but found unexpected character", null_str);
+            json__errorf(decoder, JSON_ERROR_SYNTAX, "parse null: expected \"%s\" but found unexpected character", null_str);
             return false;
         }
     }
@@ -443,27 +1095,26 @@ b8 json__parse_null(json_decoder *decoder, void **dst) {
 b8 json__parse_array_field(json_decoder *decoder, json_field_spec *field) {
     c8 c = json__char(decoder);
     if (c != '[') {
-        json__error(decoder, "parse array field: missing opening bracket");
+        json__error(decoder, JSON_ERROR_SYNTAX, "parse array field: missing opening bracket");
         return false;
     }
 
     if (!(field->spec.kind & JSON_ARRAY)) {
-        json__error(decoder, "parse array field: did not expect array");
+        json__error(decoder, JSON_ERROR_TYPE, "parse array field: did not expect array");
         return false;
     }
     // @Cleanup: error and return instead
     assert(field->spec.callback.array_fn);
     assert(field->spec.target.array);
 
-    *field->spec.target.array = field->spec.callback.array_fn(decoder);
-    return true;
+    return json__array_callback(decoder, field->spec.callback.array_fn, field->spec.target.array);
 }
 
 // @Improvement: only pass the json_value_spec
 b8 json__parse_object_field(json_decoder *decoder, json_field_spec *field) {
     c8 c = json__char(decoder);
     if (c != '{') {
-        json__error(decoder, "parse object field: missing opening bracket");
+        json__error(decoder, JSON_ERROR_SYNTAX, "parse object field: missing opening bracket");
         return false;
     }
 
@@ -472,21 +1123,32 @@ b8 json__parse_object_field(json_decoder *decoder, json_field_spec *field) {
     assert(field->spec.callback.object_fn);
     assert(field->spec.target.object);
 
-    *field->spec.target.object = field->spec.callback.object_fn(decoder);
-    return true;
+    return json__object_callback(decoder, field->spec.callback.object_fn, field->spec.target.object);
+}
+
+// A callback failed if it left an error (or returned a negative length, for arrays).
+b8 json__object_callback(json_decoder *decoder, json_object_fn fn, void **dst) {
+    *dst = fn(decoder);
+    return decoder->error.code == JSON_OK;
+}
+
+b8 json__array_callback(json_decoder *decoder, json_array_fn fn, json_array *dst) {
+    *dst = fn(decoder);
+    if (dst->length < 0 && decoder->error.code == JSON_OK) {
+        json__error(decoder, JSON_ERROR_CALLBACK, "parse array: callback failed");
+    }
+    return decoder->error.code == JSON_OK;
 }
 
 //
 // `i` should point to the opening bracket.
 //
 // @Improvement: handle additional fields
-// @Bug: check for unexpected types
-// @Bug: handle end-of-string
 //
-b8 json__parse_object(json_decoder *decoder, json_field_spec *fields, s32 n_fields) {
+b8 json__parse_object(json_decoder *decoder, json_field_spec *fields, s32 n_fields, json_field_table *table) {
     c8 c = json__char(decoder);
     if (c != '{') {
-        json__error(decoder, "parse object: missing opening bracket");
+        json__error(decoder, JSON_ERROR_SYNTAX, "parse object: missing opening bracket");
         return false;
     }
 
@@ -498,10 +1160,11 @@ b8 json__parse_object(json_decoder *decoder, json_field_spec *fields, s32 n_fiel
     s32 state = key;
 
     b8 ok;
+    b32 empty = true;
+    s32 key_start = 0; // Position of the current key, for the error path
 
-    c8 *field_name;
     // @Improvement: store `dst` directly to avoid the `if (field) ...` checks.
-    json_field_spec *field;
+    json_field_spec *field = NULL;
 
     while(c != '}') {
         if (json__is_whitespace(c)) {
@@ -512,7 +1175,7 @@ b8 json__parse_object(json_decoder *decoder, json_field_spec *fields, s32 n_fiel
         if (state == comma) {
 
             if (c != ',') {
-                json__error(decoder, "parse object: expected ','");
+                json__error(decoder, JSON_ERROR_SYNTAX, "parse object: expected ','");
                 return false;
             }
             state = key;
@@ -520,7 +1183,7 @@ b8 json__parse_object(json_decoder *decoder, json_field_spec *fields, s32 n_fiel
         } else if (state == colon) {
 
             if (c != ':') {
-                json__error(decoder, "parse object: expected ':'");
+                json__error(decoder, JSON_ERROR_SYNTAX, "parse object: expected ':'");
                 return false;
             }
             state = value;
@@ -528,19 +1191,15 @@ b8 json__parse_object(json_decoder *decoder, json_field_spec *fields, s32 n_fiel
         } else if (state == key) {
 
             if (c != '"') {
-                json__error(decoder, "parse object: expected '\"'");
+                json__error(decoder, JSON_ERROR_SYNTAX, "parse object: expected '\"'");
                 return false;
             }
-            ok = json__parse_string(decoder, &field_name);
-            if (ok) {
-                s32 field_idx = json__find_field(field_name, fields, n_fields);
-                if (field_idx >= 0) {
-                    field = &fields[field_idx];
-                } else {
-                    field = NULL;
-                }
-            }
+            s32 field_idx;
+            key_start = decoder->cursor;
+            ok = json__parse_key(decoder, fields, n_fields, table, &field_idx);
+            field = field_idx >= 0 ? &fields[field_idx] : NULL;
 
+            empty = false;
             state = colon;
 
         } else if (state == value) {
@@ -548,8 +1207,8 @@ b8 json__parse_object(json_decoder *decoder, json_field_spec *fields, s32 n_fiel
             switch (c) {
                 case '"':
                     if (field) {
-						if (!json__check_type(decoder, JSON_STRING, field->spec.kind)) return false;
-                        ok = json__parse_string(decoder, field->spec.target.string);
+                        ok = json__check_type(decoder, JSON_STRING, field->spec.kind) &&
+                             json__parse_string(decoder, field->spec.target.string);
                     } else {
                         ok = json__parse_string(decoder, NULL);
                     }
@@ -561,21 +1220,20 @@ b8 json__parse_object(json_decoder *decoder, json_field_spec *fields, s32 n_fiel
                 case '7': case '8': case '9':
                     if (field) {
                         if (field->spec.kind & JSON_INTEGER) {
-							if (!json__check_type(decoder, JSON_INTEGER, field->spec.kind)) return false;
-                            ok = json__parse_number(decoder, field->spec.target.integer);
+                            ok = json__parse_number(decoder, JSON_INTEGER, field->spec.target.integer);
                         } else {
-							if (!json__check_type(decoder, JSON_FLOAT, field->spec.kind)) return false;
-                            ok = json__parse_number(decoder, field->spec.target.real);
+                            ok = json__check_type(decoder, JSON_FLOAT, field->spec.kind) &&
+                                 json__parse_number(decoder, JSON_FLOAT, field->spec.target.real);
                         }
                     } else {
-                        ok = json__parse_number(decoder, NULL);
+                        ok = json__parse_number(decoder, JSON_UNKNOWN_KIND, NULL);
                     }
                     break;
 
                 case 't': case 'f':
                     if (field) {
-						if (!json__check_type(decoder, JSON_BOOLEAN, field->spec.kind)) return false;
-                        ok = json__parse_boolean(decoder, field->spec.target.boolean);
+                        ok = json__check_type(decoder, JSON_BOOLEAN, field->spec.kind) &&
+                             json__parse_boolean(decoder, field->spec.target.boolean);
                     } else {
                         ok = json__parse_boolean(decoder, NULL);
                     }
@@ -583,9 +1241,9 @@ b8 json__parse_object(json_decoder *decoder, json_field_spec *fields, s32 n_fiel
 
                 case 'n':
                     if (field) {
-						if (!json__check_type(decoder, JSON_OBJECT | JSON_ARRAY, field->spec.kind)) return false;
 						// @Bug: if it's an array, handle properly and set lenght to 0
-                        ok = json__parse_null(decoder, field->spec.target.object);
+                        ok = json__check_type(decoder, JSON_OBJECT | JSON_ARRAY, field->spec.kind) &&
+                             json__parse_null(decoder, field->spec.target.object);
                     } else {
                         ok = json__parse_null(decoder, NULL);
                     }
@@ -595,18 +1253,18 @@ b8 json__parse_object(json_decoder *decoder, json_field_spec *fields, s32 n_fiel
                     // @Improvement: handle `dst == NULL` in `parse_compound_field` and
                     // factorize objects and arrays.
                     if (field) {
-						if (!json__check_type(decoder, JSON_OBJECT, field->spec.kind)) return false;
-                        ok = json__parse_object_field(decoder, field);
+                        ok = json__check_type(decoder, JSON_OBJECT, field->spec.kind) &&
+                             json__parse_object_field(decoder, field);
                     } else {
                         // Skip the object (parse it but don't store it anywhere).
-                        ok = json__parse_object(decoder, NULL, 0);
+                        ok = json__parse_object(decoder, NULL, 0, NULL);
                     }
                     break;
 
                 case '[':
                     if (field) {
-						if (!json__check_type(decoder, JSON_ARRAY, field->spec.kind)) return false;
-                        ok = json__parse_array_field(decoder, field);
+                        ok = json__check_type(decoder, JSON_ARRAY, field->spec.kind) &&
+                             json__parse_array_field(decoder, field);
                     } else {
                         // Skip the array (parse it but don't store it anywhere).
                         ok = json__parse_array(decoder, NULL);
@@ -614,9 +1272,10 @@ b8 json__parse_object(json_decoder *decoder, json_field_spec *fields, s32 n_fiel
                     break;
 
                 default:
-                    json__error(decoder, "parse object: invalid value");
-                    return false;
+                    json__error(decoder, JSON_ERROR_SYNTAX, "parse object: invalid value");
+                    ok = false;
             }
+            if (!ok) return json__error_key(decoder, key_start);
 
             state = comma;
         }
@@ -628,8 +1287,9 @@ b8 json__parse_object(json_decoder *decoder, json_field_spec *fields, s32 n_fiel
         c = json__read(decoder);
     }
 
-    if (state != comma) {
-        json__error(decoder, "parse object: unexpected end of object");
+    // "{}" is the only object that doesn't end after a value.
+    if (state != comma && !(state == key && empty)) {
+        json__error(decoder, JSON_ERROR_SYNTAX, "parse object: unexpected end of object");
         return false;
     }
 
@@ -641,13 +1301,11 @@ b8 json__parse_object(json_decoder *decoder, json_field_spec *fields, s32 n_fiel
 // `i` should point to the opening bracket.
 //
 // @Improvement: avoid having to `if (array) ...` in every case. 
-// @Bug: check for unexpected types
-// @Bug: handle end-of-string
 //
 b8 json__parse_array(json_decoder *decoder, json_array_spec *array) {
     c8 c = json__char(decoder);
     if (c != '[') {
-        json__error(decoder, "parse array: missing opening bracket");
+        json__error(decoder, JSON_ERROR_SYNTAX, "parse array: missing opening bracket");
         return false;
     }
 
@@ -660,10 +1318,9 @@ b8 json__parse_array(json_decoder *decoder, json_array_spec *array) {
 
     b8 ok;
 
-    s32 len = 0;
+    s32 len = 0, n_items = 0;
     s32 cap = 10;
-    // @Improvement: free array on error
-    void *items = NULL, *item_ptr;
+    void *items = NULL, *item_ptr = NULL;
     json_field_spec item_field; // Used for objects and arrays in the array.
 
     while(c != ']') {
@@ -678,17 +1335,13 @@ b8 json__parse_array(json_decoder *decoder, json_array_spec *array) {
             if (array && next == value) {
 
                 if (!items) {
-                    // @Improvement: allow custom allocator
-                    items = memory_alloc(array->item_size * cap);
+                    items = json_alloc(decoder, array->item_size * cap);
                 }
 
                 // Grow the array - double the capacity everytime.
                 if (len >= cap) {
                     s32 new_cap = 2 * cap;
-                    void *new_items = memory_alloc(array->item_size * new_cap);
-                    memory_copy(new_items, array, array->item_size * len);
-                    free(items);
-                    items = new_items;
+                    items = json__realloc(decoder, items, array->item_size * cap, array->item_size * new_cap);
                     cap   = new_cap;
                 }
 
@@ -698,12 +1351,13 @@ b8 json__parse_array(json_decoder *decoder, json_array_spec *array) {
         }
 
         if (next == value) {
+            n_items++;
 
             switch (c) {
                 case '"':
                     if (array) {
-						if (!json__check_type(decoder, JSON_STRING, array->spec.kind)) return false;
-                        ok = json__parse_string(decoder, item_ptr);
+                        ok = json__check_type(decoder, JSON_STRING, array->spec.kind) &&
+                             json__parse_string(decoder, item_ptr);
                     } else {
                         ok = json__parse_string(decoder, NULL);
                     }
@@ -714,17 +1368,17 @@ b8 json__parse_array(json_decoder *decoder, json_array_spec *array) {
                 case '4': case '5': case '6':
                 case '7': case '8': case '9':
                     if (array) {
-						if (!json__check_type(decoder, JSON_INTEGER | JSON_FLOAT, array->spec.kind)) return false;
-                        ok = json__parse_number(decoder, (void*) item_ptr);
+                        ok = json__check_type(decoder, JSON_INTEGER | JSON_FLOAT, array->spec.kind) &&
+                             json__parse_number(decoder, array->spec.kind, (void*) item_ptr);
                     } else {
-                        ok = json__parse_number(decoder, NULL);
+                        ok = json__parse_number(decoder, JSON_UNKNOWN_KIND, NULL);
                     }
                     break;
 
                 case 't': case 'f':
                     if (array) {
-						if (!json__check_type(decoder, JSON_BOOLEAN, array->spec.kind)) return false;
-                        ok = json__parse_boolean(decoder, (b32*) item_ptr);
+                        ok = json__check_type(decoder, JSON_BOOLEAN, array->spec.kind) &&
+                             json__parse_boolean(decoder, (b32*) item_ptr);
                     } else {
                         ok = json__parse_boolean(decoder, NULL);
                     }
@@ -732,9 +1386,9 @@ b8 json__parse_array(json_decoder *decoder, json_array_spec *array) {
 
                 case 'n':
                     if (array) {
-						if (!json__check_type(decoder, JSON_OBJECT | JSON_ARRAY, array->spec.kind)) return false;
 						// @Bug: if it's an array, handle properly and set lenght to 0
-                        ok = json__parse_null(decoder, (void**) item_ptr);
+                        ok = json__check_type(decoder, JSON_OBJECT | JSON_ARRAY, array->spec.kind) &&
+                             json__parse_null(decoder, (void**) item_ptr);
                     } else {
                         ok = json__parse_null(decoder, NULL);
                     }
@@ -743,39 +1397,40 @@ b8 json__parse_array(json_decoder *decoder, json_array_spec *array) {
                 case '{':
                     // @Improvement: factorize objects and arrays
                     if (array) {
-						if (!json__check_type(decoder, JSON_OBJECT, array->spec.kind)) return false;
                         item_field.spec.kind = array->spec.kind;
                         item_field.spec.callback.object_fn = array->spec.callback.object_fn;
                         item_field.spec.target.object      = (void**) item_ptr;
-                        ok = json__parse_object_field(decoder, &item_field);
+                        ok = json__check_type(decoder, JSON_OBJECT, array->spec.kind) &&
+                             json__parse_object_field(decoder, &item_field);
                     } else {
-                        ok = json__parse_object(decoder, NULL, 0);
+                        ok = json__parse_object(decoder, NULL, 0, NULL);
                     }
                     break;
 
                 case '[':
                     if (array) {
-						if (!json__check_type(decoder, JSON_ARRAY, array->spec.kind)) return false;
                         item_field.spec.kind = array->spec.kind;
                         item_field.spec.callback.array_fn = array->spec.callback.array_fn;
                         item_field.spec.target.array      = (json_array*) item_ptr;
-                        ok = json__parse_array_field(decoder, &item_field);
+                        ok = json__check_type(decoder, JSON_ARRAY, array->spec.kind) &&
+                             json__parse_array_field(decoder, &item_field);
                     } else {
                         ok = json__parse_array(decoder, NULL);
                     }
                     break;
 
                 default:
-                    json__error(decoder, "parse array: invalid value");
-                    return false;
+                    json__error(decoder, JSON_ERROR_SYNTAX, "parse array: invalid value");
+                    ok = false;
             }
+            if (!ok) return json__error_index(decoder, n_items - 1);
 
             next = comma;
 
         } else {
 
             if (c != ',') {
-                json__error(decoder, "parse array: expected ','");
+                json__error(decoder, JSON_ERROR_SYNTAX, "parse array: expected ','");
                 return false;
             }
             next = value;
@@ -790,8 +1445,8 @@ b8 json__parse_array(json_decoder *decoder, json_array_spec *array) {
     }
 
     // We should end with a value
-    if (next == value && len > 0) {
-        json__error(decoder, "parse array: unexpected end of array");
+    if (next == value && n_items > 0) {
+        json__error(decoder, JSON_ERROR_SYNTAX, "parse array: unexpected end of array");
         return false;
     }
 
@@ -811,24 +1466,50 @@ b8 json__parse_array(json_decoder *decoder, json_array_spec *array) {
 
 json_array json_decode_array_of_integer(json_decoder *decoder) {
 	json_array integers = { .length=0, .data=NULL };
+
+	// Arrays of (s32) integers only take the fast path, anything else the generic one.
+	b32 root = decoder->root, range = false;
+	s32 cursor = decoder->cursor, next = decoder->next;
+	if (json__parse_numbers(decoder, JSON_INTEGER, sizeof(s32), &integers, false, &range)) return integers;
+	decoder->root   = root;
+	decoder->cursor = cursor;
+	decoder->next   = next;
+	if (range) {
+		// The generic path can't do better, have the error reported.
+		if (!json__parse_numbers(decoder, JSON_INTEGER, sizeof(s32), &integers, true, NULL)) integers.length = -1;
+		return integers;
+	}
+
 	json_array_spec array = {
 		.item_size=sizeof(s32),
 		.array=&integers,
 		.spec={ .kind=JSON_INTEGER },
 	};
-    // @Improvement: free array on error
 	if (!json_parse_array(decoder, &array)) integers.length = -1;
 	return integers;
 }
 
 json_array json_decode_array_of_float(json_decoder *decoder) {
 	json_array floats = { .length=0, .data=NULL };
+
+	// Same as above, with exact rounding on the fast path.
+	b32 root = decoder->root, range = false;
+	s32 cursor = decoder->cursor, next = decoder->next;
+	if (json__parse_numbers(decoder, JSON_FLOAT, sizeof(f32), &floats, false, &range)) return floats;
+	decoder->root   = root;
+	decoder->cursor = cursor;
+	decoder->next   = next;
+	if (range) {
+		// The generic path can't do better, have the error reported.
+		if (!json__parse_numbers(decoder, JSON_FLOAT, sizeof(f32), &floats, true, NULL)) floats.length = -1;
+		return floats;
+	}
+
 	json_array_spec array = {
 		.item_size=sizeof(f32),
 		.array=&floats,
 		.spec={ .kind=JSON_FLOAT },
 	};
-    // @Improvement: free array on error
 	if (!json_parse_array(decoder, &array)) floats.length = -1;
 	return floats;
 }
@@ -840,51 +1521,1062 @@ json_array json_decode_array_of_string(json_decoder *decoder) {
 		.array=&strings,
 		.spec={ .kind=JSON_STRING },
 	};
-    // @Improvement: free array on error
 	if (!json_parse_array(decoder, &array)) strings.length = -1;
 	return strings;
 }
 
-c8 json__read(json_decoder *decoder) {
-    return decoder->data[++decoder->cursor];
-}
+//
+// Numeric arrays
+//
+// Arrays of numbers only (coordinates, time series, ...) are decoded by a
+// dedicated kernel instead of json__parse_array: the closing bracket is found
+// first and the commas counted with SIMD, so the destination is allocated once
+// at the right size, then every number is read in place. Digits are converted
+// up to 8 at a time (SWAR: 8 characters loaded in a u64, the digits found with
+// a mask, then 3 multiplications).
+//
+// Floats are exact (correctly rounded) when the digits fit in 53 bits and the
+// exponent is small (Clinger's fast path: both are exact doubles, a single
+// rounding), which is most of them. The others go through strtod.
+//
 
-void json__back(json_decoder *decoder) {
-    decoder->cursor--;
+json_array json_decode_array_of_s64(json_decoder *decoder) {
+    json_array integers = { .length=0, .data=NULL };
+    if (!json__parse_numbers(decoder, JSON_INTEGER, sizeof(s64), &integers, true, NULL)) integers.length = -1;
+    return integers;
 }
 
-c8 json__char(json_decoder *decoder) {
-    return decoder->data[decoder->cursor];
+json_array json_decode_array_of_f64(json_decoder *decoder) {
+    json_array floats = { .length=0, .data=NULL };
+    if (!json__parse_numbers(decoder, JSON_FLOAT, sizeof(f64), &floats, true, NULL)) floats.length = -1;
+    return floats;
 }
 
-b8 json__check_type(json_decoder *decoder, json_value_type expected, json_value_type spec) {
-    if (!(expected & spec)) {
-        json__errorf(decoder, "unexpected type found: expected one of %d but got %d", expected, spec);
-        return false;
+//
+// Decode an array of numbers of `kind` into `dst` (s32/s64 or f32/f64, from
+// `size`). On failure the decoder is left on the faulty character, and the
+// error is recorded if `report` (otherwise the caller tries something else,
+// unless `*range` is set: a number didn't fit).
+// Works on the root and from callbacks, indexed or not.
+//
+b8 json__parse_numbers(json_decoder *decoder, json_value_type kind, s32 size, json_array *dst, b32 report, b32 *range) {
+    const c8 *data = decoder->data;
+    b32 root = decoder->root;
+
+    if (decoder->error.code) return false;
+    if (root) {
+        if (report) json__begin(decoder);
+        decoder->root   = false;
+        decoder->next   = 0;
+        decoder->cursor = -1;
+        json__read_nonblank(decoder);
+    } else if (decoder->index) {
+        json__token(decoder);
     }
-    return true;
-}
 
-// @Improvement: make verbosity configurable
-void json__error(json_decoder *decoder, c8 *msg) {
-    printf("json: %s, at %d\n", msg, decoder->cursor);
+    const c8 *out_of_range = "parse number: out of range";
+    json_error_code code = JSON_ERROR_SYNTAX;
+    const c8 *message;
+    u8 *items = NULL;
+    s32 len = 0;
 
-    const c8 *data = decoder->data;
+    if (json__char(decoder) != '[') {
+        message = "parse array: missing opening bracket";
+        goto error;
+    }
 
-    s32 line = decoder->cursor;
-    while (line > 0 && data[line] != '\n') line--;
+    s32 commas;
+    s32 close = json__scan_numbers(data, decoder->cursor + 1, decoder->length, &commas);
+    if (data[close] != ']') {
+        decoder->cursor = close;
+        message = "parse array: expected numbers";
+        goto error;
+    }
 
-    // Print previous line
-    if (line > 0) {
-        line++;
-        s32 previous_line = line - 2;
-        while (previous_line > 0 && data[previous_line] != '\n') previous_line--;
-        if (previous_line > 0) {
-			printf("...\n");
-			previous_line++;
-		}
+    s32 i = json__skip_blank_at(data, decoder->cursor + 1);
+    if (i < close) {
+        items = json_alloc(decoder, (s64) (commas + 1) * size);
+        for (;;) {
+            s64 integer = 0;
+            f64 real    = 0.0;
+            s32 end = json__number_at(data, i, close, kind, &integer, &real);
+            decoder->cursor = i;
+            code = JSON_ERROR_NUMBER;
+            if (end < 0) {
+                if (end == -2)      message = "parse number: expected an integer";
+                else if (end == -3) message = out_of_range;
+                else                message = "parse number: invalid number";
+                goto error;
+            }
 
-        while (data[previous_line] != '\n') {
+            switch (size) {
+                case 4:
+                    if (kind & JSON_INTEGER) {
+                        if (integer != (s32) integer) {
+                            message = out_of_range;
+                            goto error;
+                        }
+                        ((s32*) items)[len] = (s32) integer;
+                    } else {
+                        ((f32*) items)[len] = (f32) real;
+                    }
+                    break;
+                case 8:
+                    if (kind & JSON_INTEGER) ((s64*) items)[len] = integer;
+                    else                     ((f64*) items)[len] = real;
+                    break;
+            }
+            len++;
+
+            code = JSON_ERROR_SYNTAX;
+            i = json__skip_blank_at(data, end);
+            if (i == close) break;
+            if (data[i] != ',' || len > commas) {
+                decoder->cursor = i;
+                message = "parse array: expected ',' or ']'";
+                goto error;
+            }
+            i = json__skip_blank_at(data, i + 1);
+        }
+    }
+    decoder->cursor = close;
+
+    if (decoder->index) {
+        // Entries of the numbers and commas are skipped over at once.
+        s32 low = decoder->next, high = decoder->n_index;
+        while (low < high) {
+            s32 middle = low + (high - low) / 2;
+            if ((s32) decoder->index[middle] <= close) low = middle + 1;
+            else high = middle;
+        }
+        decoder->next = low;
+    }
+
+    if (root) {
+        b32 trailing = decoder->index ? decoder->next != decoder->n_index : json__read_nonblank(decoder) != '\0';
+        if (trailing) {
+            if (decoder->index) json__token(decoder);
+            code    = JSON_ERROR_TRAILING;
+            message = "parse array: expected end of string, but found other data";
+            goto error;
+        }
+        if (report) json__end(decoder, true);
+    }
+
+    dst->length = len;
+    dst->data   = items;
+    return true;
+
+error:
+    json__free(decoder, items);
+    if (range) *range = code == JSON_ERROR_NUMBER && message == out_of_range;
+    if (report) {
+        json__error(decoder, code, (c8*) message);
+        if (code == JSON_ERROR_NUMBER) json__error_index(decoder, len);
+        if (root) json__end(decoder, false);
+    }
+    return false;
+}
+
+//
+// Return the position of the first '"', '{', '}', '[', ']' or NUL from `i`,
+// with the number of commas before it. For an array of numbers that's the
+// closing bracket, and the number of items is one more than the commas.
+//
+s32 json__scan_numbers(const c8 *data, s32 i, s32 length, s32 *commas) {
+    s32 n = 0;
+#if defined(__SSE2__)
+    for (; i + 16 <= length; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*) (data + i));
+        __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+        __m128i special = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(lower, _mm_set1_epi8('{')), _mm_cmpeq_epi8(lower, _mm_set1_epi8('}'))),
+            _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')),     _mm_cmpeq_epi8(v, _mm_setzero_si128())));
+        u32 mask  = (u32) _mm_movemask_epi8(special);
+        u32 comma = (u32) _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(',')));
+        if (mask) {
+            u32 first = __builtin_ctz(mask);
+            *commas = n + __builtin_popcount(comma & ((1u << first) - 1));
+            return i + first;
+        }
+        n += __builtin_popcount(comma);
+    }
+#endif
+    for (; i < length; i++) {
+        c8 c = data[i];
+        if (c == '"' || c == '{' || c == '}' || c == '[' || c == ']' || c == '\0') break;
+        n += c == ',';
+    }
+    *commas = n;
+    return i;
+}
+
+//
+// Read the number starting at `i` (before `end`, a non-digit). Integers go to
+// `integer`, for JSON_INTEGER, anything else to `real`. Returns the position
+// after the number, or -1 if it's invalid, -2 if an integer was expected and
+// -3 if it doesn't fit.
+//
+s32 json__number_at(const c8 *data, s32 i, s32 end, json_value_type kind, s64 *integer, f64 *real) {
+    s32 start = i;
+    b32 negative = data[i] == '-';
+    i += negative;
+
+    // Significant digits in `mantissa`, up to 19 (beyond, it could overflow).
+    u64 mantissa = 0;
+    s32 n_digits = 0, exponent = 0;
+
+    // 10^n for the digits read at once.
+    local_persist const u32 scales[] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000 };
+
+    if (data[i] == '0') {
+        i++;
+    } else if (json__is_digit(data[i])) {
+        s32 first = i, n = 8;
+        while (n == 8 && i + 8 <= end) {
+            u32 digits = json__read_digits(data + i, &n);
+            mantissa = mantissa * scales[n] + digits;
+            i += n;
+        }
+        while (json__is_digit(data[i])) {
+            mantissa = mantissa * 10 + (data[i] - '0');
+            i++;
+        }
+        n_digits = i - first;
+    } else {
+        return -1;
+    }
+
+    b32 fraction = data[i] == '.' || data[i] == 'e' || data[i] == 'E';
+    if (data[i] == '.') {
+        i++;
+        s32 first = i, n = 8;
+        while (n == 8 && i + 8 <= end) {
+            u32 digits = json__read_digits(data + i, &n);
+            mantissa = mantissa * scales[n] + digits;
+            i += n;
+        }
+        while (json__is_digit(data[i])) {
+            mantissa = mantissa * 10 + (data[i] - '0');
+            i++;
+        }
+        if (i == first) return -1;
+        exponent  = first - i;
+        // Leading zeros ("0.0001") aren't significant.
+        n_digits += mantissa ? i - first : 0;
+    }
+    if (data[i] == 'e' || data[i] == 'E') {
+        i++;
+        b32 negative_exponent = data[i] == '-';
+        if (data[i] == '-' || data[i] == '+') i++;
+        if (!json__is_digit(data[i])) return -1;
+        s32 value = 0;
+        while (json__is_digit(data[i])) {
+            if (value < 100000) value = value * 10 + (data[i] - '0');
+            i++;
+        }
+        exponent += negative_exponent ? -value : value;
+    }
+
+    if (kind & JSON_INTEGER) {
+        if (fraction) return -2;
+        if (n_digits > 19 || mantissa > (u64) INT64_MAX + negative) return -3;
+        *integer = negative ? (s64) (0 - mantissa) : (s64) mantissa;
+        return i;
+    }
+
+    // Powers of 10 exactly representable as doubles.
+    local_persist const f64 powers[] = {
+        1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+    };
+    if (n_digits <= 19 && mantissa <= (1ull << 53) && exponent >= -22 && exponent <= 22) {
+        f64 value = (f64) mantissa;
+        value = exponent < 0 ? value / powers[-exponent] : value * powers[exponent];
+        *real = negative ? -value : value;
+    } else {
+        *real = strtod(data + start, NULL);
+    }
+    return i;
+}
+
+// The digits at the start of `s` (8 readable bytes), up to 8: their value, and their count in `n`.
+u32 json__read_digits(const c8 *s, s32 *n) {
+    u64 v;
+    __builtin_memcpy(&v, s, 8);
+
+    // A byte is a digit if its high nibble is 3, and adding 6 doesn't carry
+    // into it. Carries only go past bytes that aren't digits, after the run.
+    u64 invalid = ((v & 0xF0F0F0F0F0F0F0F0ull) ^ 0x3030303030303030ull) |
+                  (((v + 0x0606060606060606ull) & 0xF0F0F0F0F0F0F0F0ull) ^ 0x3030303030303030ull);
+    s32 count = invalid ? __builtin_ctzll(invalid) / 8 : 8;
+    *n = count;
+    if (!count) return 0;
+
+    // The first digit is the lowest byte: shifting the run to the top makes
+    // the bytes below leading zeros of an 8 digits number.
+    v = (v - 0x3030303030303030ull) << (8 * (8 - count));
+
+    // Pairs, then quads, then the whole.
+    v = (v * 10) + (v >> 8);
+    v = (((v & 0x000000FF000000FFull) * (100 + (1000000ull << 32))) +
+         (((v >> 16) & 0x000000FF000000FFull) * (1 + (10000ull << 32)))) >> 32;
+    return (u32) v;
+}
+
+//
+// Structural index
+//
+// Stage 1 (json__build_index) classifies the document 64 bytes at a time and
+// records the position of every structural character: brackets, colons,
+// commas, the opening quote of strings and the first character of other
+// scalars. Everything inside strings is masked out, so escaped quotes, or
+// brackets in strings, never show up. Strings are validated on the way.
+//
+// Stage 2 (json__index_XXX) is the usual recursive descent, but it moves from
+// one structural to the next instead of reading every character: blanks and
+// skipped strings are never looked at, only the decoded values are parsed.
+//
+
+void json__build_index(json_decoder *decoder) {
+    const u8 *data = (const u8*) decoder->data;
+    s32 length = decoder->length;
+
+    // There are usually a lot less structurals than bytes: grow as needed,
+    // keeping room for a whole block (and the final `length`).
+    s32 cap    = length / 8 + 65;
+    u32 *index = array_alloc(cap, u32);
+    s32 n = 0;
+
+    // State carried from one block to the next, as a single bit (the first
+    // character is escaped, the scalar goes on) or all bits (in a string).
+    u64 prev_escaped = 0, prev_in_string = 0, prev_scalar = 0;
+    s32 invalid = -1;
+
+    u8 tail[64];
+    for (s32 offset = 0; offset < length; offset += 64) {
+        const u8 *block = data + offset;
+        if (length - offset < 64) {
+            // Pad the last block with blanks, which are never structural.
+            memory_set(tail, 64, ' ');
+            memory_copy(tail, (void*) block, length - offset);
+            block = tail;
+        }
+
+        u64 backslash, quote, whitespace, op, control, escapable;
+        json__classify(block, &backslash, &quote, &whitespace, &op, &control, &escapable);
+
+        // Characters following an odd number of backslashes are escaped: odd
+        // runs starting on an even position end on an odd one and the other
+        // way around, which a single addition over the runs sorts out.
+        const u64 even_bits = 0x5555555555555555ull;
+        backslash &= ~prev_escaped;
+        u64 follows_escape = backslash << 1 | prev_escaped;
+        u64 odd_starts     = backslash & ~even_bits & ~follows_escape;
+        u64 even_runs;
+        prev_escaped = __builtin_add_overflow(odd_starts, backslash, &even_runs);
+        u64 escaped  = (even_bits ^ (even_runs << 1)) & follows_escape;
+
+        // Strings go from their opening quote (included) to the closing one
+        // (excluded): the prefix XOR of the quotes.
+        quote &= ~escaped;
+        u64 in_string  = json__prefix_xor(quote) ^ prev_in_string;
+        prev_in_string = (u64) ((s64) in_string >> 63);
+
+        // Validate the strings here, so that stage 2 can jump over the ones it
+        // doesn't decode: no control characters, known escape sequences (the
+        // digits of \uXXXX are only checked for decoded strings).
+        u64 bad = (control | (escaped & ~escapable)) & in_string;
+        if (bad && invalid < 0) invalid = offset + __builtin_ctzll(bad);
+
+        // Other scalars start on a character that is neither an operator nor
+        // a blank, and doesn't follow one of those.
+        u64 scalar          = ~(op | whitespace);
+        u64 nonquote_scalar = scalar & ~quote;
+        u64 follows_scalar  = nonquote_scalar << 1 | prev_scalar;
+        prev_scalar = nonquote_scalar >> 63;
+
+        if (n + 65 > cap) {
+            cap  *= 2;
+            index = memory_realloc(index, cap * sizeof(u32));
+        }
+        u64 structurals = (op | (scalar & ~follows_scalar)) & ~(in_string ^ quote);
+        while (structurals) {
+            index[n++] = offset + __builtin_ctzll(structurals);
+            structurals &= structurals - 1;
+        }
+    }
+
+    if (prev_in_string && invalid < 0) invalid = length;
+    index[n] = length;
+
+    decoder->index   = index;
+    decoder->n_index = n;
+    decoder->next    = 0;
+    decoder->invalid = invalid;
+}
+
+// One bit per byte of the 64 bytes `block`, for each class of characters
+// (`escapable`: the characters allowed after a backslash).
+void json__classify(const u8 *block, u64 *backslash, u64 *quote, u64 *whitespace, u64 *op, u64 *control, u64 *escapable) {
+    *backslash = *quote = *whitespace = *op = *control = *escapable = 0;
+#if defined(__SSE2__)
+    for (s32 i = 0; i < 4; i++) {
+        __m128i v = _mm_loadu_si128((const __m128i*) (block + 16 * i));
+        // '[' and ']' are '{' and '}' without the 0x20 bit.
+        __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+
+        __m128i ws = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),  _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+            _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'))));
+        __m128i ops = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(lower, _mm_set1_epi8('{')), _mm_cmpeq_epi8(lower, _mm_set1_epi8('}'))),
+            _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(',')),     _mm_cmpeq_epi8(v, _mm_set1_epi8(':'))));
+        __m128i ctl = _mm_cmpeq_epi8(_mm_max_epu8(v, _mm_set1_epi8(0x1F)), _mm_set1_epi8(0x1F)); // Unsigned v <= 0x1F
+        __m128i bs  = _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'));
+        __m128i qt  = _mm_cmpeq_epi8(v, _mm_set1_epi8('"'));
+        __m128i esc = _mm_or_si128(
+            _mm_or_si128(
+                _mm_or_si128(bs, qt),
+                _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('/')), _mm_cmpeq_epi8(v, _mm_set1_epi8('b')))),
+            _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('f')), _mm_cmpeq_epi8(v, _mm_set1_epi8('n'))),
+                _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('r')), _mm_cmpeq_epi8(_mm_or_si128(v, _mm_set1_epi8(1)), _mm_set1_epi8('u')))));
+
+        s32 shift = 16 * i;
+        *backslash  |= (u64) (u16) _mm_movemask_epi8(bs)  << shift;
+        *quote      |= (u64) (u16) _mm_movemask_epi8(qt)  << shift;
+        *whitespace |= (u64) (u16) _mm_movemask_epi8(ws)  << shift;
+        *op         |= (u64) (u16) _mm_movemask_epi8(ops) << shift;
+        *control    |= (u64) (u16) _mm_movemask_epi8(ctl) << shift;
+        *escapable  |= (u64) (u16) _mm_movemask_epi8(esc) << shift;
+    }
+#else
+    for (s32 i = 0; i < 64; i++) {
+        u8  c   = block[i];
+        u64 bit = 1ull << i;
+        if (c == '\\') *backslash |= bit;
+        if (c == '"')  *quote     |= bit;
+        if (c < 0x20)  *control   |= bit;
+        if (json__is_escapable(c) || c == 'u') *escapable |= bit;
+        if (json__is_whitespace(c)) *whitespace |= bit;
+        if (c == '{' || c == '}' || c == '[' || c == ']' || c == ',' || c == ':') *op |= bit;
+    }
+#endif
+}
+
+// Bit i of the result is the XOR of bits 0..i of `bits`.
+u64 json__prefix_xor(u64 bits) {
+#if defined(__PCLMUL__)
+    // Carry-less multiplication by all ones.
+    __m128i product = _mm_clmulepi64_si128(_mm_set_epi64x(0, (s64) bits), _mm_set1_epi8((c8) 0xFF), 0);
+    return (u64) _mm_cvtsi128_si64(product);
+#else
+    bits ^= bits << 1;
+    bits ^= bits << 2;
+    bits ^= bits << 4;
+    bits ^= bits << 8;
+    bits ^= bits << 16;
+    bits ^= bits << 32;
+    return bits;
+#endif
+}
+
+// Character of the current structural (and move the cursor there), NUL after the last one.
+c8 json__token(json_decoder *decoder) {
+    decoder->cursor = decoder->index[decoder->next];
+    return decoder->data[decoder->cursor];
+}
+
+// Same as json_parse_XXX for indexed decoders, `kind` is JSON_OBJECT or JSON_ARRAY.
+b8 json__index_parse(json_decoder *decoder, json_value_type kind, json_field_spec *fields, s32 n_fields, json_field_table *table, json_array_spec *array) {
+    b32 root = decoder->root;
+    if (root) {
+        json__begin(decoder);
+        decoder->next = 0;
+
+        if (decoder->invalid >= 0) {
+            decoder->cursor = decoder->invalid;
+            json__error(decoder, JSON_ERROR_STRING, "parse string: invalid or unterminated string");
+            return json__end(decoder, false);
+        }
+    }
+
+    b8 ok = kind == JSON_ARRAY ? json__index_array(decoder, array) : json__index_object(decoder, fields, n_fields, table);
+    if (!root) return ok;
+
+    if (ok && decoder->next != decoder->n_index) {
+        json__token(decoder);
+        json__error(decoder, JSON_ERROR_TRAILING, "parse: expected end of string, but found other data");
+        ok = false;
+    }
+    return json__end(decoder, ok);
+}
+
+//
+// The current structural should be the opening bracket, the next one is the
+// first after the closing bracket when this returns (same for arrays and
+// values below).
+//
+b8 json__index_object(json_decoder *decoder, json_field_spec *fields, s32 n_fields, json_field_table *table) {
+    if (json__token(decoder) != '{') {
+        json__error(decoder, JSON_ERROR_SYNTAX, "parse object: missing opening bracket");
+        return false;
+    }
+    decoder->next++;
+
+    c8 c = json__token(decoder);
+    if (c == '}') {
+        decoder->next++;
+        return true;
+    }
+
+    for (;;) {
+        if (c != '"') {
+            json__error(decoder, JSON_ERROR_SYNTAX, "parse object: expected '\"'");
+            return false;
+        }
+        s32 field_idx, key = decoder->cursor;
+        if (!json__parse_key(decoder, fields, n_fields, table, &field_idx)) return false;
+        decoder->next++;
+
+        if (json__token(decoder) != ':') {
+            json__error(decoder, JSON_ERROR_SYNTAX, "parse object: expected ':'");
+            return false;
+        }
+        decoder->next++;
+
+        b8 ok;
+        if (field_idx >= 0) {
+            json_field_spec *field = &fields[field_idx];
+            ok = json__index_value(decoder, &field->spec, (void*) field->spec.target.object);
+        } else {
+            ok = json__index_value(decoder, NULL, NULL);
+        }
+        if (!ok) return json__error_key(decoder, key);
+
+        c = json__token(decoder);
+        if (c == '}') break;
+        if (c != ',') {
+            json__error(decoder, JSON_ERROR_SYNTAX, "parse object: expected ',' or '}'");
+            return false;
+        }
+        decoder->next++;
+        c = json__token(decoder);
+    }
+
+    decoder->next++;
+    return true;
+}
+
+b8 json__index_array(json_decoder *decoder, json_array_spec *array) {
+    if (json__token(decoder) != '[') {
+        json__error(decoder, JSON_ERROR_SYNTAX, "parse array: missing opening bracket");
+        return false;
+    }
+    decoder->next++;
+
+    s32 len = 0, cap = 0, n_items = 0;
+    u8 *items = NULL;
+
+    c8 c = json__token(decoder);
+    if (c != ']') for (;; n_items++) {
+        void *item_ptr = NULL;
+        if (array) {
+            if (len == cap) {
+                s32 new_cap = cap ? 2 * cap : 16;
+                items = json__realloc(decoder, items, array->item_size * cap, array->item_size * new_cap);
+                cap   = new_cap;
+            }
+            item_ptr = items + array->item_size * len++;
+        }
+
+        if (!json__index_value(decoder, array ? &array->spec : NULL, item_ptr)) {
+            json__free(decoder, items);
+            return json__error_index(decoder, n_items);
+        }
+
+        c = json__token(decoder);
+        if (c == ']') break;
+        if (c != ',') {
+            json__free(decoder, items);
+            json__error(decoder, JSON_ERROR_SYNTAX, "parse array: expected ',' or ']'");
+            return false;
+        }
+        decoder->next++;
+    }
+    decoder->next++;
+
+    if (array && array->array) {
+        array->array->data   = items;
+        array->array->length = len;
+    } else {
+        json__free(decoder, items);
+    }
+    return true;
+}
+
+//
+// Parse the value at the current structural into `dst`, which is the target
+// of `spec` (or an array item). The value is only validated when `spec` is NULL.
+//
+b8 json__index_value(json_decoder *decoder, json_value_spec *spec, void *dst) {
+    switch (json__token(decoder)) {
+        case '"':
+            // Already validated by stage 1, unless it's decoded.
+            if (spec) {
+                if (!json__check_type(decoder, JSON_STRING, spec->kind)) return false;
+                if (!json__parse_string(decoder, (c8**) dst)) return false;
+            }
+            decoder->next++;
+            return true;
+
+        case '-': case '0':
+        case '1': case '2': case '3':
+        case '4': case '5': case '6':
+        case '7': case '8': case '9':
+            if (spec) {
+                json_value_type kind = (spec->kind & JSON_INTEGER) ? JSON_INTEGER : JSON_FLOAT;
+                if (!json__check_type(decoder, kind, spec->kind)) return false;
+                if (!json__parse_number(decoder, kind, dst)) return false;
+            } else {
+                if (!json__parse_number(decoder, JSON_UNKNOWN_KIND, NULL)) return false;
+            }
+            return json__index_scalar_end(decoder);
+
+        case 't': case 'f':
+            if (spec && !json__check_type(decoder, JSON_BOOLEAN, spec->kind)) return false;
+            if (!json__parse_boolean(decoder, (b32*) dst)) return false;
+            return json__index_scalar_end(decoder);
+
+        case 'n':
+            if (spec) {
+                if (!json__check_type(decoder, JSON_OBJECT | JSON_ARRAY, spec->kind)) return false;
+                if (spec->kind & JSON_ARRAY) {
+                    *(json_array*) dst = (json_array){ .length=0, .data=NULL };
+                } else {
+                    *(void**) dst = NULL;
+                }
+            }
+            if (!json__parse_null(decoder, NULL)) return false;
+            return json__index_scalar_end(decoder);
+
+        case '{':
+            if (!spec) return json__index_object(decoder, NULL, 0, NULL);
+            if (!json__check_type(decoder, JSON_OBJECT, spec->kind)) return false;
+            // @Cleanup: error and return instead
+            assert(spec->callback.object_fn);
+            return json__object_callback(decoder, spec->callback.object_fn, (void**) dst);
+
+        case '[':
+            if (!spec) return json__index_array(decoder, NULL);
+            if (!json__check_type(decoder, JSON_ARRAY, spec->kind)) return false;
+            // @Cleanup: error and return instead
+            assert(spec->callback.array_fn);
+            return json__array_callback(decoder, spec->callback.array_fn, (json_array*) dst);
+    }
+
+    json__error(decoder, JSON_ERROR_SYNTAX, "parse: invalid value");
+    return false;
+}
+
+// The cursor is on the last character of a number or literal: check that it
+// really ends there ("1234a" is a single scalar for stage 1).
+b8 json__index_scalar_end(json_decoder *decoder) {
+    c8 c = decoder->data[decoder->cursor + 1];
+    if (c != '\0' && c != ',' && c != '}' && c != ']' && !json__is_whitespace(c)) {
+        decoder->cursor++;
+        json__error(decoder, JSON_ERROR_SYNTAX, "parse: invalid value");
+        return false;
+    }
+    decoder->next++;
+    return true;
+}
+
+//
+// Decode plans
+//
+
+json_plan* json_plan_scalar(json_value_type kind) {
+    json_plan *plan = struct_init(json_plan);
+    plan->kind = kind;
+    switch (kind) {
+        case JSON_STRING:  plan->size = sizeof(c8*); break;
+        case JSON_INTEGER: plan->size = sizeof(s32); break;
+        case JSON_FLOAT:   plan->size = sizeof(f32); break;
+        case JSON_BOOLEAN: plan->size = sizeof(b32); break;
+        default:
+            assert(!"json_plan_scalar: not a scalar kind");
+    }
+    return plan;
+}
+
+json_plan* json_plan_object(s32 size) {
+    json_plan *plan = struct_init(json_plan);
+    plan->kind = JSON_OBJECT;
+    plan->size = size;
+    return plan;
+}
+
+json_plan* json_plan_array(json_plan *item) {
+    json_plan *plan = struct_init(json_plan);
+    plan->kind = JSON_ARRAY;
+    plan->size = sizeof(json_array);
+    plan->item = item;
+    return plan;
+}
+
+// `value` can be shared between fields, and plans can be recursive (e.g. a
+// person with an array of persons).
+void json_plan_field(json_plan *object, c8 *name, s32 offset, json_plan *value) {
+    assert(object->kind == JSON_OBJECT);
+    assert(offset + value->size <= object->size);
+
+    if (object->n_fields == object->cap_fields) {
+        object->cap_fields = object->cap_fields ? 2 * object->cap_fields : 8;
+        object->fields = memory_realloc(object->fields, object->cap_fields * sizeof(json__plan_field));
+    }
+    object->fields[object->n_fields++] = (json__plan_field){
+        .name   = name,
+        .offset = offset,
+        .plan   = value,
+    };
+}
+
+// Build the field tables of every object reachable from `plan`.
+void json_compile_plan(json_plan *plan) {
+    if (plan->kind == JSON_ARRAY) {
+        json_compile_plan(plan->item);
+        return;
+    }
+    if (plan->kind != JSON_OBJECT || plan->table) {
+        return;
+    }
+
+    // json_make_field_table only reads the names.
+    json_field_spec *specs = array_init(plan->n_fields, json_field_spec);
+    for (s32 i = 0; i < plan->n_fields; i++) {
+        specs[i].name = plan->fields[i].name;
+    }
+    plan->table = json_make_field_table(specs, plan->n_fields);
+    free(specs);
+
+    // The table is set before recursing, so cycles stop here.
+    for (s32 i = 0; i < plan->n_fields; i++) {
+        json_compile_plan(plan->fields[i].plan);
+    }
+}
+
+b8 json_decode_with_plan(json_decoder *decoder, json_plan *plan, void *dst) {
+    // Same as json_parse_object, see the comments there.
+    b32 root = decoder->root;
+    c8 c;
+
+    if (!plan->table) {
+        json_compile_plan(plan);
+    }
+
+    if (decoder->error.code) return false;
+    if (root) {
+        json__begin(decoder);
+        decoder->cursor = -1;
+        json__read_nonblank(decoder);
+    }
+
+    b8 ok = json__execute_plan(decoder, plan, (u8*) dst);
+    if (!root) return ok;
+
+    if (ok) {
+        c = json__read_nonblank(decoder);
+        if (c != '\0') {
+            json__error(decoder, JSON_ERROR_TRAILING, "decode plan: expected end of string, but found other data");
+            ok = false;
+        }
+    }
+
+    return json__end(decoder, ok);
+}
+
+// The cursor should be on the first character of the value, it is left on the last one.
+b8 json__execute_plan(json_decoder *decoder, json_plan *plan, u8 *dst) {
+    c8 c = json__char(decoder);
+
+    switch (plan->kind) {
+        case JSON_STRING:
+            if (c != '"') break;
+            return json__parse_string(decoder, (c8**) dst);
+
+        case JSON_INTEGER:
+        case JSON_FLOAT:
+            if (c != '-' && !json__is_digit(c)) break;
+            return json__parse_number(decoder, plan->kind, dst);
+
+        case JSON_BOOLEAN:
+            if (c != 't' && c != 'f') break;
+            return json__parse_boolean(decoder, (b32*) dst);
+
+        case JSON_OBJECT:
+            if (c == '{') return json__execute_object(decoder, plan, dst);
+            if (c != 'n') break;
+            memory_set(dst, plan->size, 0);
+            return json__parse_null(decoder, NULL);
+
+        case JSON_ARRAY:
+            if (c == '[') return json__execute_array(decoder, plan, (json_array*) dst);
+            if (c != 'n') break;
+            memory_set(dst, plan->size, 0);
+            return json__parse_null(decoder, NULL);
+
+        default:
+            break;
+    }
+
+    json__errorf(decoder, JSON_ERROR_TYPE, "decode plan: unexpected value, expected kind %d", plan->kind);
+    return false;
+}
+
+b8 json__execute_object(json_decoder *decoder, json_plan *plan, u8 *dst) {
+    memory_set(dst, plan->size, 0);
+
+    c8 c = json__read_nonblank(decoder);
+    if (c == '}') return true;
+
+    for (;;) {
+        if (c != '"') {
+            json__error(decoder, JSON_ERROR_SYNTAX, "decode plan: expected '\"'");
+            return false;
+        }
+
+        s32 index, key = decoder->cursor;
+        if (!json__parse_key(decoder, NULL, 0, plan->table, &index)) return false;
+
+        if (json__read_nonblank(decoder) != ':') {
+            json__error(decoder, JSON_ERROR_SYNTAX, "decode plan: expected ':'");
+            return false;
+        }
+        json__read_nonblank(decoder);
+
+        b8 ok;
+        if (index >= 0) {
+            json__plan_field *field = &plan->fields[index];
+            ok = json__execute_plan(decoder, field->plan, dst + field->offset);
+        } else {
+            ok = json__skip_value(decoder);
+        }
+        if (!ok) return json__error_key(decoder, key);
+
+        c = json__read_nonblank(decoder);
+        if (c == '}') return true;
+        if (c != ',') {
+            json__error(decoder, JSON_ERROR_SYNTAX, "decode plan: expected ',' or '}'");
+            return false;
+        }
+        c = json__read_nonblank(decoder);
+    }
+}
+
+b8 json__execute_array(json_decoder *decoder, json_plan *plan, json_array *dst) {
+    json_plan *item = plan->item;
+    s32 len = 0, cap = 0;
+    u8 *items = NULL;
+
+    dst->length = 0;
+    dst->data   = NULL;
+
+    c8 c = json__read_nonblank(decoder);
+    if (c == ']') return true;
+
+    for (;;) {
+        if (len == cap) {
+            s32 new_cap = cap ? 2 * cap : 8;
+            items = json__realloc(decoder, items, cap * item->size, new_cap * item->size);
+            cap   = new_cap;
+        }
+        if (!json__execute_plan(decoder, item, items + len * item->size)) {
+            json__free(decoder, items);
+            return json__error_index(decoder, len);
+        }
+        len++;
+
+        c = json__read_nonblank(decoder);
+        if (c == ']') break;
+        if (c != ',') {
+            json__error(decoder, JSON_ERROR_SYNTAX, "decode plan: expected ',' or ']'");
+            json__free(decoder, items);
+            return false;
+        }
+        json__read_nonblank(decoder);
+    }
+
+    dst->length = len;
+    dst->data   = items;
+    return true;
+}
+
+// Parse the value under the cursor without storing it anywhere.
+b8 json__skip_value(json_decoder *decoder) {
+    switch (json__char(decoder)) {
+        case '"':
+            return json__parse_string(decoder, NULL);
+        case '-': case '0':
+        case '1': case '2': case '3':
+        case '4': case '5': case '6':
+        case '7': case '8': case '9':
+            return json__parse_number(decoder, JSON_UNKNOWN_KIND, NULL);
+        case 't': case 'f':
+            return json__parse_boolean(decoder, NULL);
+        case 'n':
+            return json__parse_null(decoder, NULL);
+        case '{':
+            return json__parse_object(decoder, NULL, 0, NULL);
+        case '[':
+            return json__parse_array(decoder, NULL);
+    }
+    json__error(decoder, JSON_ERROR_SYNTAX, "skip value: invalid value");
+    return false;
+}
+
+c8 json__read(json_decoder *decoder) {
+    return decoder->data[++decoder->cursor];
+}
+
+void json__back(json_decoder *decoder) {
+    decoder->cursor--;
+}
+
+c8 json__char(json_decoder *decoder) {
+    return decoder->data[decoder->cursor];
+}
+
+// Read the next non-whitespace character.
+c8 json__read_nonblank(json_decoder *decoder) {
+    c8 c = json__read(decoder);
+    while (json__is_whitespace(c)) c = json__read(decoder);
+    return c;
+}
+
+b8 json__check_type(json_decoder *decoder, json_value_type expected, json_value_type spec) {
+    if (!(expected & spec)) {
+        json__errorf(decoder, JSON_ERROR_TYPE, "unexpected type found: expected one of %d but got %d", expected, spec);
+        return false;
+    }
+    return true;
+}
+
+//
+// Record the first error, at the cursor. Later ones (there shouldn't be any,
+// everything returns right away) are ignored.
+//
+void json__error(json_decoder *decoder, json_error_code code, c8 *msg) {
+    json_error *error = &decoder->error;
+    if (error->code != JSON_OK) return;
+
+    const c8 *data = decoder->data;
+    s32 offset = decoder->cursor < 0 ? 0 : decoder->cursor;
+    if (data[offset] == '\0') code = JSON_ERROR_END;
+
+    // Only paid once, on failure.
+    s32 line = 1, start = 0;
+    for (const c8 *p = data; (p = __builtin_memchr(p, '\n', data + offset - p)); p++) {
+        line++;
+        start = p - data + 1;
+    }
+
+    error->code   = code;
+    error->offset = offset;
+    error->line   = line;
+    error->column = offset - start + 1;
+    error->path[0] = '\0';
+    snprintf(error->message, sizeof(error->message), "%s", msg);
+}
+
+void json__errorf(json_decoder *decoder, json_error_code code, const c8 *fmt, ...) {
+    c8 msg[128];
+    va_list arglist;
+    va_start(arglist, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, arglist);
+    va_end(arglist);
+    json__error(decoder, code, msg);
+}
+
+//
+// On the way out of a failed member or item, prepend its key or index to the
+// path. `key` is the position of the opening quote of the key in the input.
+// Both return false, to be returned.
+//
+b8 json__error_key(json_decoder *decoder, s32 key) {
+    const c8 *data = decoder->data;
+    s32 end = key + 1;
+    while (data[end] != '"' && data[end] != '\0') {
+        if (data[end] == '\\' && data[end + 1] != '\0') end++;
+        end++;
+    }
+    json__error_prepend(&decoder->error, data + key + 1, end - key - 1);
+    return false;
+}
+
+b8 json__error_index(json_decoder *decoder, s32 index) {
+    c8 segment[16];
+    s32 length = snprintf(segment, sizeof(segment), "%d", index);
+    json__error_prepend(&decoder->error, segment, length);
+    return false;
+}
+
+// Keys are left escaped as in the input, '~' and '/' are escaped for the pointer.
+void json__error_prepend(json_error *error, const c8 *segment, s32 length) {
+    c8 *path = error->path;
+    if (path[0] == '.') return; // Truncated already
+
+    c8 escaped[X_JSON_ERROR_PATH_SIZE];
+    s32 n = 0;
+    escaped[n++] = '/';
+    for (s32 i = 0; i < length && n + 2 < X_JSON_ERROR_PATH_SIZE; i++) {
+        c8 c = segment[i];
+        if (c == '~' || c == '/') {
+            escaped[n++] = '~';
+            escaped[n++] = c == '~' ? '0' : '1';
+        } else {
+            escaped[n++] = c;
+        }
+    }
+
+    s32 size = __builtin_strlen(path);
+    if (n + size + 1 > X_JSON_ERROR_PATH_SIZE) {
+        // Too deep: the outer part is replaced by "...".
+        if (size + 4 > X_JSON_ERROR_PATH_SIZE) return;
+        __builtin_memmove(path + 3, path, size + 1);
+        __builtin_memcpy(path, "...", 3);
+        return;
+    }
+    __builtin_memmove(path + n, path, size + 1);
+    __builtin_memcpy(path, escaped, n);
+}
+
+//
+// The error with the lines of `data` around it (the input it happened in), an
+// arrow below the faulty character.
+//
+void json_print_error(json_error *error, const c8 *data) {
+    if (error->code == JSON_OK) return;
+    printf("json: %s, at %d:%d", error->message, error->line, error->column);
+    if (error->path[0]) printf(", in %s", error->path);
+    printf("\n");
+
+    s32 cursor = error->offset;
+    s32 line = cursor;
+    while (line > 0 && data[line] != '\n') line--;
+
+    // Print previous line
+    if (line > 0) {
+        line++;
+        s32 previous_line = line - 2;
+        while (previous_line > 0 && data[previous_line] != '\n') previous_line--;
+        if (previous_line > 0) {
+            printf("...\n");
+            previous_line++;
+        }
+
+        while (data[previous_line] != '\n' && data[previous_line] != '\0') {
             if (data[previous_line] == '\t') {
                 printf("  ");
             } else {
@@ -896,9 +2588,9 @@ void json__error(json_decoder *decoder, c8 *msg) {
     }
 
     // Print current line, and the arrow below
-    s32 idx = 0, len;
+    s32 idx = 0, len = 0;
     while (data[line] != '\n' && data[line] != '\0') {
-        if (line == decoder->cursor) len = idx;
+        if (line == cursor) len = idx;
         if (data[line] == '\t') {
             printf("  ");
             idx += 2;
@@ -908,6 +2600,7 @@ void json__error(json_decoder *decoder, c8 *msg) {
         }
         line++;
     }
+    if (line == cursor) len = idx;
     printf("\n");
 
     for (s32 i = 0; i < len; i++) {
@@ -927,18 +2620,8 @@ void json__error(json_decoder *decoder, c8 *msg) {
             line++;
         }
         printf("\n");
-		if (data[line] == '\n') printf("...\n");
+        if (data[line] == '\n') printf("...\n");
     }
 }
 
-void json__errorf(json_decoder *decoder, const c8 *fmt, ...) {
-    c8 msg[1024];
-    va_list arglist;
-    va_start(arglist, fmt);
-    vsprintf(msg, fmt, arglist);
-    va_end(arglist);
-    json__error(decoder, msg);
-}
-
-
 #endif // __robin_c_json
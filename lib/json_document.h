@@ -0,0 +1,519 @@
+#ifndef __robin_c_json_document
+#define __robin_c_json_document
+
+
+#include "c.h"
+#include "io.h"
+#include "string.h"
+#include "json.h"
+
+
+//
+// Schema-less access to a parsed document. The document is parsed once into
+// a flat tape of 8 bytes entries (from the structural index of json.h), and
+// values are then reached with cursors:
+//
+//     json_document *document = json_parse_document(data);
+//     json_cursor job = json_lookup(json_lookup(json_root(document), "labels"), "job");
+//     if (json_type(job) == JSON_STRING) {
+//         string name = json_get_string(job);
+//     }
+//     json_free_document(document);
+//
+// Looking up a missing key, or anything in an invalid cursor, gives an
+// invalid cursor (json_type is JSON_UNKNOWN_KIND), so lookups can be chained.
+//
+// The tape is a single allocation, and strings aren't copied: they are
+// slices of the input, which must outlive the document. Strings with escape
+// sequences are left escaped in the input, see json_unescape.
+//
+// Tape entries: the character of the value in the top byte, and
+//  '{' '[' : the index after the closing entry (bits 0-31), the number of
+//            members or items (bits 32-55, saturated)
+//  '}' ']' : the index of the opening entry
+//  '"' 'k' : (string, key) the offset of the first character in the input,
+//            followed by an entry with the length and the escaped flag (bit 32)
+//  'l' 'd' : (integer, float) followed by an entry with the s64 / f64 value
+//  't' 'f' 'n'
+//
+
+
+//
+// Declarations
+//
+
+
+typedef struct json_document json_document;
+typedef struct json_cursor   json_cursor;
+
+
+external json_document* json_parse_document(const c8 *data);
+external json_document* json_parse_document_with_error(const c8 *data, json_error *error);
+external void           json_free_document (json_document *document);
+
+external json_cursor     json_root  (json_document *document);
+external json_value_type json_type  (json_cursor cursor);
+external s32             json_length(json_cursor cursor);
+external json_cursor     json_lookup(json_cursor object, const c8 *key);
+external json_cursor     json_index (json_cursor array, s32 i);
+external json_cursor     json_first (json_cursor container);
+external json_cursor     json_next  (json_cursor item);
+external string          json_key   (json_cursor member);
+external json_cursor     json_value (json_cursor member);
+
+external s64    json_get_integer(json_cursor cursor);
+external f64    json_get_float  (json_cursor cursor);
+external b32    json_get_boolean(json_cursor cursor);
+external string json_get_string (json_cursor cursor);
+external b32    json_is_escaped (json_cursor cursor);
+external s32    json_unescape   (json_cursor cursor, c8 *dst);
+
+internal inline u64  json__tape_entry (c8 tag, u64 payload);
+internal inline c8   json__tape_tag   (u64 entry);
+internal inline void json__tape_count (u64 *container);
+internal inline json_cursor json__cursor(json_document *document, s32 at);
+internal b8   json__tape_build (json_document *document, json_decoder *decoder);
+internal b8   json__tape_string(json_document *document, json_decoder *decoder, c8 tag);
+internal b8   json__tape_number(json_document *document, json_decoder *decoder);
+internal b32  json__key_equal  (json_document *document, s32 at, const c8 *key, s32 length);
+
+
+//
+// Definitions
+//
+
+
+struct json_document {
+    const c8 *data;
+    s64      length; // Of `data`
+    s32      n_tape;
+    u64      *tape;  // Follows the struct, in the same allocation, unless mapped
+
+    // Memory the document owns: the input it read, or the snapshot it was
+    // loaded from (see json_snapshot.h).
+    c8       *owned;
+    c8       *mapping;
+    s64      mapping_size;
+};
+
+struct json_cursor {
+    json_document *document;
+    s32           at; // Index in the tape, -1 for an invalid cursor
+};
+
+
+// Returns NULL if the document is invalid.
+json_document* json_parse_document(const c8 *data) {
+    return json_parse_document_with_error(data, NULL);
+}
+
+// Same, with the reason in `error` (if not NULL), without a path.
+json_document* json_parse_document_with_error(const c8 *data, json_error *error) {
+    json_decoder *decoder = json_make_indexed_decoder(data);
+    decoder->root = false;
+
+    if (decoder->invalid >= 0) {
+        decoder->cursor = decoder->invalid;
+        json__error(decoder, JSON_ERROR_STRING, "parse document: invalid or unterminated string");
+        if (error) *error = decoder->error;
+        json_free_decoder(decoder);
+        return NULL;
+    }
+
+    // Each structural is at most 2 entries (strings and numbers), most are
+    // less (commas and colons aren't in the tape).
+    s32 cap = 2 * decoder->n_index + 1;
+    json_document *document = memory_alloc(sizeof(json_document) + cap * sizeof(u64));
+    document->data         = data;
+    document->length       = decoder->length;
+    document->n_tape       = 0;
+    document->tape         = (u64*) (document + 1);
+    document->owned        = NULL;
+    document->mapping      = NULL;
+    document->mapping_size = 0;
+
+    b8 ok = json__tape_build(document, decoder);
+    if (!ok && error) *error = decoder->error;
+    json_free_decoder(decoder);
+    if (!ok) {
+        free(document);
+        return NULL;
+    }
+    return document;
+}
+
+void json_free_document(json_document *document) {
+    if (document->owned) free(document->owned);
+    if (document->mapping) io_unmap_file(document->mapping, document->mapping_size);
+    free(document);
+}
+
+//
+// Walk the structural index and write the tape. While a container is open,
+// its entry links to the parent container (bits 0-31) instead of the end:
+// there is no separate stack.
+//
+b8 json__tape_build(json_document *document, json_decoder *decoder) {
+    u64 *tape   = document->tape;
+    s32 parent  = -1; // Innermost open container
+    c8  c;
+
+value:
+    // Objects count their keys, arrays their values.
+    if (parent >= 0 && json__tape_tag(tape[parent]) == '[') json__tape_count(&tape[parent]);
+
+    c = json__token(decoder);
+    switch (c) {
+        case '{': case '[':
+            tape[document->n_tape] = json__tape_entry(c, (u32) parent);
+            parent = document->n_tape++;
+            decoder->next++;
+            if (json__token(decoder) == (c == '{' ? '}' : ']')) goto close;
+            if (c == '{') goto key;
+            goto value;
+
+        case '"':
+            if (!json__tape_string(document, decoder, '"')) return false;
+            goto end_value;
+
+        case 't': case 'f': case 'n': {
+            b8 ok = c == 'n' ? json__parse_null(decoder, NULL) : json__parse_boolean(decoder, NULL);
+            if (!ok || !json__index_scalar_end(decoder)) return false;
+            tape[document->n_tape++] = json__tape_entry(c, 0);
+            goto end_value;
+        }
+
+        default:
+            if (!json__tape_number(document, decoder)) return false;
+            goto end_value;
+    }
+
+key:
+    if (json__token(decoder) != '"') {
+        json__error(decoder, JSON_ERROR_SYNTAX, "parse document: expected '\"'");
+        return false;
+    }
+    json__tape_count(&tape[parent]);
+    if (!json__tape_string(document, decoder, 'k')) return false;
+    if (json__token(decoder) != ':') {
+        json__error(decoder, JSON_ERROR_SYNTAX, "parse document: expected ':'");
+        return false;
+    }
+    decoder->next++;
+    goto value;
+
+end_value:
+    if (parent < 0) {
+        if (decoder->next != decoder->n_index) {
+            json__token(decoder);
+            json__error(decoder, JSON_ERROR_TRAILING, "parse document: expected end of string, but found other data");
+            return false;
+        }
+        return true;
+    }
+
+    c = json__token(decoder);
+    if (c == ',') {
+        decoder->next++;
+        if (json__tape_tag(tape[parent]) == '{') goto key;
+        goto value;
+    }
+    if (c != (json__tape_tag(tape[parent]) == '{' ? '}' : ']')) {
+        json__error(decoder, JSON_ERROR_SYNTAX, "parse document: expected ',' or a closing bracket");
+        return false;
+    }
+
+close:
+    {
+        // The current token is the closing bracket of `parent`.
+        s32 open  = parent;
+        s32 count = (tape[open] >> 32) & 0xFFFFFF;
+        parent    = (s32) (u32) tape[open];
+
+        tape[document->n_tape++] = json__tape_entry(json__token(decoder), (u32) open);
+        tape[open] = json__tape_entry(json__tape_tag(tape[open]), ((u64) count << 32) | (u32) document->n_tape);
+        decoder->next++;
+        goto end_value;
+    }
+}
+
+// Two entries: the offset of the first character, then the length and whether it has escapes.
+b8 json__tape_string(json_document *document, json_decoder *decoder, c8 tag) {
+    const c8 *data = decoder->data;
+    s32 start = decoder->cursor + 1;
+    s32 end   = json__scan_string(data, start, decoder->length);
+    u64 escaped = 0;
+
+    if (data[end] != '"') {
+        // Strings were validated by stage 1, but not the \u escapes.
+        if (!json__parse_string(decoder, NULL)) return false;
+        end     = decoder->cursor;
+        escaped = 1ull << 32;
+    }
+
+    u64 *tape = document->tape + document->n_tape;
+    tape[0] = json__tape_entry(tag, (u64) start);
+    tape[1] = escaped | (u32) (end - start);
+    document->n_tape += 2;
+    decoder->next++;
+    return true;
+}
+
+//
+// Two entries: 'l' and the s64 value for integers that fit, 'd' and the f64
+// value for the others (see json__number_at).
+//
+b8 json__tape_number(json_document *document, json_decoder *decoder) {
+    const c8 *data = decoder->data;
+    s32 start = decoder->cursor;
+    if (data[start] != '-' && !json__is_digit(data[start])) {
+        json__error(decoder, JSON_ERROR_SYNTAX, "parse document: invalid value");
+        return false;
+    }
+
+    s64 integer;
+    f64 real;
+    s32 end = json__number_at(data, start, decoder->length, JSON_INTEGER, &integer, &real);
+    b32 is_integer = end >= 0;
+    if (end == -2 || end == -3) {
+        end = json__number_at(data, start, decoder->length, JSON_FLOAT, &integer, &real);
+    }
+    if (end < 0) {
+        json__error(decoder, JSON_ERROR_NUMBER, "parse document: invalid number");
+        return false;
+    }
+
+    decoder->cursor = end - 1;
+    if (!json__index_scalar_end(decoder)) return false;
+
+    u64 *tape = document->tape + document->n_tape;
+    if (is_integer) {
+        tape[0] = json__tape_entry('l', 0);
+        memory_copy(&tape[1], &integer, 8);
+    } else {
+        tape[0] = json__tape_entry('d', 0);
+        memory_copy(&tape[1], &real, 8);
+    }
+    document->n_tape += 2;
+    return true;
+}
+
+u64 json__tape_entry(c8 tag, u64 payload) {
+    return ((u64) (u8) tag << 56) | (payload & 0x00FFFFFFFFFFFFFFull);
+}
+
+c8 json__tape_tag(u64 entry) {
+    return (c8) (entry >> 56);
+}
+
+// One more member or item, in bits 32-55 (saturated).
+void json__tape_count(u64 *container) {
+    if (((*container >> 32) & 0xFFFFFF) != 0xFFFFFF) *container += 1ull << 32;
+}
+
+json_cursor json__cursor(json_document *document, s32 at) {
+    return (json_cursor){ .document = document, .at = at };
+}
+
+json_cursor json_root(json_document *document) {
+    return json__cursor(document, 0);
+}
+
+json_value_type json_type(json_cursor cursor) {
+    if (cursor.at < 0) return JSON_UNKNOWN_KIND;
+
+    switch (json__tape_tag(cursor.document->tape[cursor.at])) {
+        case '{': return JSON_OBJECT;
+        case '[': return JSON_ARRAY;
+        case '"': case 'k': return JSON_STRING;
+        case 'l': return JSON_INTEGER;
+        case 'd': return JSON_FLOAT;
+        case 't': case 'f': return JSON_BOOLEAN;
+        case 'n': return JSON_NULL;
+    }
+    return JSON_UNKNOWN_KIND;
+}
+
+// Number of members of an object, or items of an array; 0 for anything else.
+s32 json_length(json_cursor cursor) {
+    json_value_type type = json_type(cursor);
+    if (type != JSON_OBJECT && type != JSON_ARRAY) return 0;
+
+    s32 count = (cursor.document->tape[cursor.at] >> 32) & 0xFFFFFF;
+    if (count == 0xFFFFFF) {
+        // Too many to be stored in the entry, count them.
+        count = 0;
+        for (json_cursor item = json_first(cursor); item.at >= 0; item = json_next(item)) count++;
+    }
+    return count;
+}
+
+// First item of an array, or first member (its key) of an object.
+json_cursor json_first(json_cursor container) {
+    json_value_type type = json_type(container);
+    if (type != JSON_OBJECT && type != JSON_ARRAY) return json__cursor(container.document, -1);
+
+    s32 at = container.at + 1;
+    c8 tag = json__tape_tag(container.document->tape[at]);
+    if (tag == '}' || tag == ']') at = -1;
+    return json__cursor(container.document, at);
+}
+
+// Next item of an array, or next member of an object (from the key of the current one).
+json_cursor json_next(json_cursor item) {
+    if (item.at < 0) return item;
+
+    u64 *tape = item.document->tape;
+    s32 at = item.at;
+    if (json__tape_tag(tape[at]) == 'k') at += 2;
+
+    switch (json__tape_tag(tape[at])) {
+        case '{': case '[':
+            at = (u32) tape[at];
+            break;
+        case '"': case 'k': case 'l': case 'd':
+            at += 2;
+            break;
+        default:
+            at += 1;
+    }
+
+    c8 tag = json__tape_tag(tape[at]);
+    if (tag == '}' || tag == ']') at = -1;
+    return json__cursor(item.document, at);
+}
+
+string json_key(json_cursor member) {
+    if (member.at < 0 || json__tape_tag(member.document->tape[member.at]) != 'k') {
+        return (string){ .length = 0, .data = NULL };
+    }
+    return json_get_string(member);
+}
+
+json_cursor json_value(json_cursor member) {
+    if (member.at < 0 || json__tape_tag(member.document->tape[member.at]) != 'k') {
+        return json__cursor(member.document, -1);
+    }
+    return json__cursor(member.document, member.at + 2);
+}
+
+// Linear in the number of members, but whole values are jumped over.
+json_cursor json_lookup(json_cursor object, const c8 *key) {
+    if (json_type(object) != JSON_OBJECT) return json__cursor(object.document, -1);
+
+    s32 length = __builtin_strlen(key);
+    for (json_cursor member = json_first(object); member.at >= 0; member = json_next(member)) {
+        if (json__key_equal(object.document, member.at, key, length)) {
+            return json_value(member);
+        }
+    }
+    return json__cursor(object.document, -1);
+}
+
+json_cursor json_index(json_cursor array, s32 i) {
+    if (json_type(array) != JSON_ARRAY || i < 0) return json__cursor(array.document, -1);
+
+    json_cursor item = json_first(array);
+    while (i-- > 0 && item.at >= 0) item = json_next(item);
+    return item;
+}
+
+b32 json__key_equal(json_document *document, s32 at, const c8 *key, s32 length) {
+    u64 *tape = document->tape;
+    const c8 *name = document->data + (tape[at] & 0x00FFFFFFFFFFFFFFull);
+    s32 name_length = (u32) tape[at + 1];
+
+    if (!(tape[at + 1] >> 32)) {
+        return name_length == length && __builtin_memcmp(name, key, length) == 0;
+    }
+
+    // Escaped keys are never longer than their input.
+    if (length > name_length) return false;
+    c8 local[256];
+    c8 *unescaped = name_length < 256 ? local : memory_alloc(name_length + 1);
+    s32 n = json_unescape(json__cursor(document, at), unescaped);
+    b32 equal = n == length && __builtin_memcmp(unescaped, key, length) == 0;
+    if (unescaped != local) free(unescaped);
+    return equal;
+}
+
+// Integers as is, floats truncated, 0 for anything else.
+s64 json_get_integer(json_cursor cursor) {
+    json_value_type type = json_type(cursor);
+    if (type == JSON_INTEGER) {
+        s64 n;
+        memory_copy(&n, &cursor.document->tape[cursor.at + 1], 8);
+        return n;
+    }
+    if (type == JSON_FLOAT) return (s64) json_get_float(cursor);
+    return 0;
+}
+
+f64 json_get_float(json_cursor cursor) {
+    json_value_type type = json_type(cursor);
+    if (type == JSON_FLOAT) {
+        f64 d;
+        memory_copy(&d, &cursor.document->tape[cursor.at + 1], 8);
+        return d;
+    }
+    if (type == JSON_INTEGER) return (f64) json_get_integer(cursor);
+    return 0;
+}
+
+b32 json_get_boolean(json_cursor cursor) {
+    return cursor.at >= 0 && json__tape_tag(cursor.document->tape[cursor.at]) == 't';
+}
+
+// Slice of the input, still escaped if json_is_escaped. Empty for non-strings.
+string json_get_string(json_cursor cursor) {
+    if (json_type(cursor) != JSON_STRING) return (string){ .length = 0, .data = NULL };
+
+    u64 *tape = cursor.document->tape;
+    return (string){
+        .length = (u32) tape[cursor.at + 1],
+        .data   = (c8*) cursor.document->data + (tape[cursor.at] & 0x00FFFFFFFFFFFFFFull),
+    };
+}
+
+b32 json_is_escaped(json_cursor cursor) {
+    return json_type(cursor) == JSON_STRING && (cursor.document->tape[cursor.at + 1] >> 32);
+}
+
+//
+// Write the unescaped string (NUL-terminated) in `dst`, which must hold at
+// least the length of json_get_string + 1 bytes. Returns the length.
+//
+s32 json_unescape(json_cursor cursor, c8 *dst) {
+    string s = json_get_string(cursor);
+    s32 n = 0;
+
+    // Validated when the document was parsed.
+    for (u32 i = 0; i < s.length; i++) {
+        c8 c = s.data[i];
+        if (c != '\\') {
+            dst[n++] = c;
+            continue;
+        }
+
+        c = s.data[++i];
+        if (c != 'u') {
+            dst[n++] = json__escaped(c);
+            continue;
+        }
+
+        s32 codepoint = json__hex4(s.data + i + 1);
+        i += 4;
+        if (0xD800 <= codepoint && codepoint <= 0xDBFF) {
+            s32 low = json__hex4(s.data + i + 3);
+            codepoint = 0x10000 + ((codepoint - 0xD800) << 10) + (low - 0xDC00);
+            i += 6;
+        }
+        n += json__encode_utf8((u32) codepoint, dst + n);
+    }
+
+    dst[n] = '\0';
+    return n;
+}
+
+
+#endif // __robin_c_json_document
@@ -0,0 +1,516 @@
+#ifndef __robin_c_json_encoder
+#define __robin_c_json_encoder
+
+
+#include <unistd.h> // write(2)
+#include <errno.h>  // EINTR
+
+#include "c.h"
+#include "json.h"
+#include "string_builder.h"
+
+
+#ifndef X_JSON_ENCODER_BUFFER_SIZE
+#define X_JSON_ENCODER_BUFFER_SIZE (64 * KILOBYTE)
+#endif
+
+#ifndef X_JSON_ENCODER_MAX_DEPTH
+#define X_JSON_ENCODER_MAX_DEPTH (256)
+#endif
+
+
+//
+// JSON encoder, driven by the same specs as the decoder: the `target` of each
+// `json_field_spec` is read instead of written. Nested objects and arrays use
+// the `encode_object_fn` / `encode_array_fn` callbacks.
+//
+// Output is buffered, then flushed to a string builder or a file descriptor.
+// It is compact by default, `json_set_indent` makes it pretty.
+//
+// The json_write_XXX procedures can also be used directly (e.g. from the
+// callbacks): commas, colons and indentation are handled by the encoder.
+//
+
+
+//
+// Declarations
+//
+
+
+external json_encoder* json_make_encoder   (string_builder *builder);
+external json_encoder* json_make_fd_encoder(s32 fd);
+external b8            json_free_encoder   (json_encoder *encoder);
+external b8            json_flush_encoder  (json_encoder *encoder);
+external void          json_set_indent     (json_encoder *encoder, s32 indent);
+
+external void json_encode_object(json_encoder *encoder, json_field_spec *fields, s32 n_fields);
+external void json_encode_array (json_encoder *encoder, json_array_spec *array);
+external void json_encode_value (json_encoder *encoder, json_value_spec *spec);
+
+external void json_encode_array_of_integer(json_encoder *encoder, json_array *array);
+external void json_encode_array_of_float  (json_encoder *encoder, json_array *array);
+external void json_encode_array_of_string (json_encoder *encoder, json_array *array);
+
+external void json_begin_object (json_encoder *encoder);
+external void json_end_object   (json_encoder *encoder);
+external void json_begin_array  (json_encoder *encoder);
+external void json_end_array    (json_encoder *encoder);
+external void json_write_key    (json_encoder *encoder, const c8 *key);
+external void json_write_key_n  (json_encoder *encoder, const c8 *key, s32 length);
+external void json_write_string (json_encoder *encoder, const c8 *s);
+external void json_write_string_n(json_encoder *encoder, const c8 *s, s32 length);
+external void json_write_integer(json_encoder *encoder, s64 value);
+external void json_write_float  (json_encoder *encoder, f32 value);
+external void json_write_boolean(json_encoder *encoder, b32 value);
+external void json_write_null   (json_encoder *encoder);
+
+internal void json__separate     (json_encoder *encoder);
+internal void json__newline      (json_encoder *encoder);
+internal void json__put          (json_encoder *encoder, const c8 *data, s32 length);
+internal void json__escape       (json_encoder *encoder, const c8 *s, s32 length);
+internal s32  json__format_u64   (u64 value, c8 *dst);
+internal s32  json__format_f32   (f32 value, c8 *dst);
+internal f64  json__pow10        (s32 n);
+
+
+//
+// Definitions
+//
+
+
+struct json_encoder {
+    string_builder *builder; // Either a builder,
+    s32            fd;       // or a file descriptor (-1 when unused)
+    b32            failed;   // A write(2) failed
+
+    s32 indent;              // Spaces per level, 0 for compact output
+    s32 depth;
+    b8  empty[X_JSON_ENCODER_MAX_DEPTH]; // Nothing written yet in the container
+    b32 after_key;           // The next value follows a key, no separator
+
+    s32 length;
+    c8  buffer[X_JSON_ENCODER_BUFFER_SIZE];
+};
+
+
+json_encoder* json_make_encoder(string_builder *builder) {
+    json_encoder *encoder = struct_alloc(json_encoder);
+    encoder->builder   = builder;
+    encoder->fd        = -1;
+    encoder->failed    = false;
+    encoder->indent    = 0;
+    encoder->depth     = 0;
+    encoder->after_key = false;
+    encoder->length    = 0;
+    return encoder;
+}
+
+json_encoder* json_make_fd_encoder(s32 fd) {
+    json_encoder *encoder = json_make_encoder(NULL);
+    encoder->fd = fd;
+    return encoder;
+}
+
+// Flushes, returns false if any write failed.
+b8 json_free_encoder(json_encoder *encoder) {
+    b8 ok = json_flush_encoder(encoder);
+    free(encoder);
+    return ok;
+}
+
+b8 json_flush_encoder(json_encoder *encoder) {
+    if (encoder->builder) {
+        string_write_n(encoder->builder, encoder->buffer, encoder->length);
+    } else {
+        s32 written = 0;
+        while (!encoder->failed && written < encoder->length) {
+            s32 n = write(encoder->fd, encoder->buffer + written, encoder->length - written);
+            if (n < 0) {
+                if (errno != EINTR) encoder->failed = true; // Interrupted before writing anything: again
+            } else {
+                written += n;
+            }
+        }
+    }
+    encoder->length = 0;
+    return !encoder->failed;
+}
+
+void json_set_indent(json_encoder *encoder, s32 indent) {
+    encoder->indent = indent;
+}
+
+//
+// Spec driven encoding
+//
+
+void json_encode_object(json_encoder *encoder, json_field_spec *fields, s32 n_fields) {
+    json_begin_object(encoder);
+    for (s32 i = 0; i < n_fields; i++) {
+        json_write_key(encoder, fields[i].name);
+        json_encode_value(encoder, &fields[i].spec);
+    }
+    json_end_object(encoder);
+}
+
+void json_encode_array(json_encoder *encoder, json_array_spec *array) {
+    json_value_spec *spec = &array->spec;
+    u8 *item = array->array->data;
+
+    json_begin_array(encoder);
+    for (s32 i = 0; i < array->array->length; i++, item += array->item_size) {
+        switch (spec->kind) {
+            case JSON_STRING:  json_write_string (encoder, *(c8**) item);  break;
+            case JSON_INTEGER: json_write_integer(encoder, *(s32*) item);  break;
+            case JSON_FLOAT:   json_write_float  (encoder, *(f32*) item);  break;
+            case JSON_BOOLEAN: json_write_boolean(encoder, *(b32*) item);  break;
+            case JSON_OBJECT:
+                if (*(void**) item) spec->callback.encode_object_fn(encoder, *(void**) item);
+                else json_write_null(encoder);
+                break;
+            case JSON_ARRAY:
+                spec->callback.encode_array_fn(encoder, (json_array*) item);
+                break;
+            default:
+                json_write_null(encoder);
+        }
+    }
+    json_end_array(encoder);
+}
+
+void json_encode_value(json_encoder *encoder, json_value_spec *spec) {
+    switch (spec->kind) {
+        case JSON_STRING:  json_write_string (encoder, *spec->target.string);  break;
+        case JSON_INTEGER: json_write_integer(encoder, *spec->target.integer); break;
+        case JSON_FLOAT:   json_write_float  (encoder, *spec->target.real);    break;
+        case JSON_BOOLEAN: json_write_boolean(encoder, *spec->target.boolean); break;
+        case JSON_OBJECT:
+            assert(spec->callback.encode_object_fn);
+            if (*spec->target.object) spec->callback.encode_object_fn(encoder, *spec->target.object);
+            else json_write_null(encoder);
+            break;
+        case JSON_ARRAY:
+            assert(spec->callback.encode_array_fn);
+            spec->callback.encode_array_fn(encoder, spec->target.array);
+            break;
+        default:
+            json_write_null(encoder);
+    }
+}
+
+//
+// Reusable json_encode_array_fn
+//
+
+void json_encode_array_of_integer(json_encoder *encoder, json_array *integers) {
+    json_array_spec array = { .item_size=sizeof(s32), .array=integers, .spec={ .kind=JSON_INTEGER } };
+    json_encode_array(encoder, &array);
+}
+
+void json_encode_array_of_float(json_encoder *encoder, json_array *floats) {
+    json_array_spec array = { .item_size=sizeof(f32), .array=floats, .spec={ .kind=JSON_FLOAT } };
+    json_encode_array(encoder, &array);
+}
+
+void json_encode_array_of_string(json_encoder *encoder, json_array *strings) {
+    json_array_spec array = { .item_size=sizeof(c8*), .array=strings, .spec={ .kind=JSON_STRING } };
+    json_encode_array(encoder, &array);
+}
+
+//
+// Low level writers
+//
+
+void json_begin_object(json_encoder *encoder) {
+    json__separate(encoder);
+    json__put(encoder, "{", 1);
+    assert(encoder->depth < X_JSON_ENCODER_MAX_DEPTH);
+    encoder->empty[encoder->depth++] = true;
+}
+
+void json_end_object(json_encoder *encoder) {
+    if (!encoder->empty[--encoder->depth]) json__newline(encoder);
+    json__put(encoder, "}", 1);
+}
+
+void json_begin_array(json_encoder *encoder) {
+    json__separate(encoder);
+    json__put(encoder, "[", 1);
+    assert(encoder->depth < X_JSON_ENCODER_MAX_DEPTH);
+    encoder->empty[encoder->depth++] = true;
+}
+
+void json_end_array(json_encoder *encoder) {
+    if (!encoder->empty[--encoder->depth]) json__newline(encoder);
+    json__put(encoder, "]", 1);
+}
+
+void json_write_key(json_encoder *encoder, const c8 *key) {
+    s32 length = 0;
+    while (key[length] != '\0') length++;
+    json_write_key_n(encoder, key, length);
+}
+
+void json_write_key_n(json_encoder *encoder, const c8 *key, s32 length) {
+    json_write_string_n(encoder, key, length);
+    if (encoder->indent) json__put(encoder, ": ", 2);
+    else                 json__put(encoder, ":", 1);
+    encoder->after_key = true;
+}
+
+void json_write_string(json_encoder *encoder, const c8 *s) {
+    if (!s) {
+        json_write_null(encoder);
+        return;
+    }
+    s32 length = 0;
+    while (s[length] != '\0') length++;
+    json_write_string_n(encoder, s, length);
+}
+
+void json_write_string_n(json_encoder *encoder, const c8 *s, s32 length) {
+    json__separate(encoder);
+    json__put(encoder, "\"", 1);
+    json__escape(encoder, s, length);
+    json__put(encoder, "\"", 1);
+}
+
+void json_write_integer(json_encoder *encoder, s64 value) {
+    c8 digits[24];
+    s32 n;
+    if (value < 0) {
+        digits[0] = '-';
+        n = 1 + json__format_u64(-(u64) value, digits + 1);
+    } else {
+        n = json__format_u64((u64) value, digits);
+    }
+    json__separate(encoder);
+    json__put(encoder, digits, n);
+}
+
+// NaN and infinities aren't valid JSON, they are written as null.
+void json_write_float(json_encoder *encoder, f32 value) {
+    if (value != value || value - value != 0) {
+        json_write_null(encoder);
+        return;
+    }
+    c8 digits[32];
+    s32 n = json__format_f32(value, digits);
+    json__separate(encoder);
+    json__put(encoder, digits, n);
+}
+
+void json_write_boolean(json_encoder *encoder, b32 value) {
+    json__separate(encoder);
+    if (value) json__put(encoder, "true", 4);
+    else       json__put(encoder, "false", 5);
+}
+
+void json_write_null(json_encoder *encoder) {
+    json__separate(encoder);
+    json__put(encoder, "null", 4);
+}
+
+// Before a value: a comma if it isn't the first of its container, and the indentation.
+void json__separate(json_encoder *encoder) {
+    if (encoder->after_key) {
+        encoder->after_key = false;
+        return;
+    }
+    if (encoder->depth == 0) return;
+
+    if (encoder->empty[encoder->depth - 1]) {
+        encoder->empty[encoder->depth - 1] = false;
+    } else {
+        json__put(encoder, ",", 1);
+    }
+    json__newline(encoder);
+}
+
+void json__newline(json_encoder *encoder) {
+    local_persist const c8 spaces[] = "                                ";
+
+    if (!encoder->indent) return;
+    json__put(encoder, "\n", 1);
+    for (s32 n = encoder->depth * encoder->indent; n > 0; n -= sizeof(spaces) - 1) {
+        json__put(encoder, spaces, n < (s32) sizeof(spaces) - 1 ? n : (s32) sizeof(spaces) - 1);
+    }
+}
+
+void json__put(json_encoder *encoder, const c8 *data, s32 length) {
+    while (length > 0) {
+        if (encoder->length == X_JSON_ENCODER_BUFFER_SIZE) {
+            json_flush_encoder(encoder);
+        }
+        s32 n = X_JSON_ENCODER_BUFFER_SIZE - encoder->length;
+        if (n > length) n = length;
+        memory_copy(encoder->buffer + encoder->length, (void*) data, n);
+        encoder->length += n;
+        data   += n;
+        length -= n;
+    }
+}
+
+//
+// Same scan as the decoder: runs of characters that don't need escaping are
+// found 16 bytes at a time and copied at once.
+//
+void json__escape(json_encoder *encoder, const c8 *s, s32 length) {
+    local_persist const c8 hex[] = "0123456789abcdef";
+
+    s32 start = 0;
+    for (;;) {
+        s32 end = json__scan_string(s, start, length);
+        json__put(encoder, s + start, end - start);
+        if (end == length) break;
+
+        u8 c = (u8) s[end];
+        switch (c) {
+            case '"':  json__put(encoder, "\\\"", 2); break;
+            case '\\': json__put(encoder, "\\\\", 2); break;
+            case '\b': json__put(encoder, "\\b", 2);  break;
+            case '\f': json__put(encoder, "\\f", 2);  break;
+            case '\n': json__put(encoder, "\\n", 2);  break;
+            case '\r': json__put(encoder, "\\r", 2);  break;
+            case '\t': json__put(encoder, "\\t", 2);  break;
+            default: {
+                c8 escaped[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xF] };
+                json__put(encoder, escaped, 6);
+            }
+        }
+        start = end + 1;
+    }
+}
+
+// Write the decimal digits of `value` in `dst` (at least 20 bytes), two at a time.
+s32 json__format_u64(u64 value, c8 *dst) {
+    local_persist const c8 pairs[] =
+        "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+        "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+
+    c8 digits[20];
+    s32 i = sizeof(digits);
+    while (value >= 100) {
+        u32 pair = (u32) (value % 100);
+        value /= 100;
+        digits[--i] = pairs[2 * pair + 1];
+        digits[--i] = pairs[2 * pair];
+    }
+    if (value >= 10) {
+        digits[--i] = pairs[2 * value + 1];
+        digits[--i] = pairs[2 * value];
+    } else {
+        digits[--i] = '0' + (c8) value;
+    }
+
+    s32 n = sizeof(digits) - i;
+    memory_copy(dst, digits + i, n);
+    return n;
+}
+
+//
+// Shortest decimal representation of a finite `value` that reads back to the
+// same f32. The digits are computed in f64, which has enough precision to
+// check each candidate: try 1, 2, ... 9 significant digits (9 always works).
+//
+s32 json__format_f32(f32 value, c8 *dst) {
+    s32 n = 0;
+    if (value == 0) {
+        dst[0] = '0';
+        return 1;
+    }
+    if (value < 0) {
+        dst[n++] = '-';
+        value = -value;
+    }
+
+    f64 x = value;
+
+    // Decimal exponent: x is in [10^exponent, 10^(exponent+1)).
+    u32 bits;
+    memory_copy(&bits, &value, 4);
+    s32 exponent = ((s32) ((bits >> 23) & 0xFF) - 127) * 30103 / 100000;
+    while (x >= json__pow10(exponent + 1)) exponent++;
+    while (x <  json__pow10(exponent))     exponent--;
+
+    u64 mantissa;
+    s32 precision, e;
+    for (precision = 1;; precision++) {
+        // Rounding can carry into a new digit (9.96 -> 10), and the estimated
+        // exponent can be off since the powers of 10 aren't exact: move to
+        // the next exponent while the mantissa has too many digits.
+        for (e = exponent;; e++) {
+            s32 shift = precision - 1 - e;
+            f64 scaled = shift >= 0 ? x * json__pow10(shift) : x / json__pow10(-shift);
+            mantissa = (u64) (scaled + 0.5);
+            if (mantissa < (u64) json__pow10(precision)) break;
+        }
+
+        s32 shift = precision - 1 - e;
+        f64 candidate = shift >= 0 ? mantissa / json__pow10(shift) : mantissa * json__pow10(-shift);
+        if ((f32) candidate == value || precision == 9) break;
+    }
+    exponent = e;
+
+    while (precision > 1 && mantissa % 10 == 0) {
+        mantissa /= 10;
+        precision--;
+    }
+
+    c8 digits[24];
+    s32 n_digits = json__format_u64(mantissa, digits);
+
+    if (0 <= exponent && exponent < 16) {
+        // 123, 1.5, 12.25
+        if (n_digits <= exponent + 1) {
+            memory_copy(dst + n, digits, n_digits);
+            n += n_digits;
+            for (s32 i = n_digits; i <= exponent; i++) dst[n++] = '0';
+        } else {
+            memory_copy(dst + n, digits, exponent + 1);
+            n += exponent + 1;
+            dst[n++] = '.';
+            memory_copy(dst + n, digits + exponent + 1, n_digits - exponent - 1);
+            n += n_digits - exponent - 1;
+        }
+    } else if (-6 <= exponent && exponent < 0) {
+        // 0.001
+        dst[n++] = '0';
+        dst[n++] = '.';
+        for (s32 i = -1; i > exponent; i--) dst[n++] = '0';
+        memory_copy(dst + n, digits, n_digits);
+        n += n_digits;
+    } else {
+        // 1.5e-07, 3e+38
+        dst[n++] = digits[0];
+        if (n_digits > 1) {
+            dst[n++] = '.';
+            memory_copy(dst + n, digits + 1, n_digits - 1);
+            n += n_digits - 1;
+        }
+        dst[n++] = 'e';
+        dst[n++] = exponent < 0 ? '-' : '+';
+        n += json__format_u64(exponent < 0 ? -exponent : exponent, dst + n);
+    }
+    return n;
+}
+
+// 10^n, exact up to 10^22.
+f64 json__pow10(s32 n) {
+    local_persist const f64 powers[] = {
+        1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+    };
+    if (n < 0) return 1.0 / json__pow10(-n);
+
+    f64 result = 1.0;
+    while (n > 22) {
+        result *= 1e22;
+        n -= 22;
+    }
+    return result * powers[n];
+}
+
+
+#endif // __robin_c_json_encoder
@@ -0,0 +1,287 @@
+#ifndef __robin_c_json_lines
+#define __robin_c_json_lines
+
+
+#include "c.h"
+#include "arena.h"
+#include "job.h"
+#include "json.h"
+
+
+#ifndef X_JSON_LINES_CHUNK_SIZE
+#define X_JSON_LINES_CHUNK_SIZE (MEGABYTE)
+#endif
+
+
+//
+// Decoding of newline-delimited JSON (NDJSON, JSON Lines): one document per
+// line, e.g. a mapped log file.
+//
+//     io_map_file(&data, &length, "events.ndjson");
+//     json_lines lines = json_decode_lines(jobs, data, length, sizeof(event), decode_event, NULL);
+//     event *events = lines.records;
+//     ...
+//     json_free_lines(&lines);
+//
+// The input is split into chunks of about X_JSON_LINES_CHUNK_SIZE, at newline
+// boundaries, and the chunks are decoded in parallel on the job system. Each
+// line is decoded by `decode` into a zeroed record of `record_size` bytes,
+// with the usual procedures (json_parse_object, json_decode_with_plan, ...):
+//
+//     b8 decode_event(json_decoder *decoder, void *dst, void *user) {
+//         return json_decode_with_plan(decoder, event_plan, dst);
+//     }
+//
+// Records come out in the order of the lines. Strings and arrays of a record
+// live in per-thread arenas (see json_alloc), released by json_free_lines.
+// Blank lines are skipped, lines that fail to decode are counted and left out
+// (what they allocated is released), the first error is kept.
+//
+// `decode` runs concurrently on several threads: it must not modify shared
+// state (plans and field tables can be shared, they are only read).
+//
+
+
+//
+// Declarations
+//
+
+
+typedef struct json_lines         json_lines;
+typedef struct json__lines_chunk  json__lines_chunk;
+typedef struct json__lines_thread json__lines_thread;
+typedef struct json__lines_job    json__lines_job;
+
+typedef b8 (*json_record_fn)(json_decoder *decoder, void *dst, void *user);
+
+
+external json_lines json_decode_lines(job_system *jobs, const c8 *data, s64 length, s32 record_size, json_record_fn decode, void *user);
+external void       json_free_lines(json_lines *lines);
+
+internal void json__lines_decode(void *data, s32 index, s32 thread);
+internal void json__lines_gather(void *data, s32 index, s32 thread);
+
+
+//
+// Definitions
+//
+
+
+struct json_lines {
+    s64   length;     // Number of records
+    void  *records;
+    s64   n_errors;   // Lines that couldn't be decoded
+    s64   error_line; // Number (from 1) of the first one, 0 if none
+    json_error error; // Of the first one, its offset and line in the whole input
+
+    s32   n_arenas;
+    arena **arenas;
+};
+
+struct json__lines_chunk {
+    s64  start;
+    s64  end;         // Past the last newline of the chunk
+
+    // Decoded
+    s64  n_lines;
+    s64  length;
+    s64  cap;
+    u8   *records;
+    s64  n_errors;
+    s64  error_line;  // In the chunk, from 1
+    json_error error;
+    s64  offset;      // Of the first record in the output
+};
+
+// The decoder needs a NUL-terminated document: lines are copied into `line`.
+struct json__lines_thread {
+    arena *arena;
+    c8    *line;
+    s64   cap;
+};
+
+struct json__lines_job {
+    const c8           *data;
+    s32                record_size;
+    json_record_fn     decode;
+    void               *user;
+    json__lines_chunk  *chunks;
+    json__lines_thread *threads;
+    u8                 *records;
+};
+
+
+//
+// `jobs` can be NULL, to decode on the calling thread only. `data` doesn't
+// need to be NUL-terminated, the last line doesn't need a newline.
+//
+json_lines json_decode_lines(job_system *jobs, const c8 *data, s64 length, s32 record_size, json_record_fn decode, void *user) {
+    s32 n_threads = jobs ? job_thread_count(jobs) : 1;
+
+    // Chunks end after the first newline following X_JSON_LINES_CHUNK_SIZE bytes.
+    s32 n_chunks = 0, cap_chunks = (s32) (length / X_JSON_LINES_CHUNK_SIZE) + 1;
+    json__lines_chunk *chunks = array_alloc(cap_chunks, json__lines_chunk);
+    for (s64 start = 0; start < length;) {
+        s64 end = start + X_JSON_LINES_CHUNK_SIZE;
+        if (end >= length) {
+            end = length;
+        } else {
+            const c8 *newline = __builtin_memchr(data + end, '\n', length - end);
+            end = newline ? newline - data + 1 : length;
+        }
+
+        if (n_chunks == cap_chunks) {
+            cap_chunks *= 2;
+            chunks = memory_realloc(chunks, cap_chunks * sizeof(json__lines_chunk));
+        }
+        chunks[n_chunks++] = (json__lines_chunk){ .start = start, .end = end };
+        start = end;
+    }
+
+    json__lines_job job = {
+        .data        = data,
+        .record_size = record_size,
+        .decode      = decode,
+        .user        = user,
+        .chunks      = chunks,
+        .threads     = array_alloc(n_threads, json__lines_thread),
+        .records     = NULL,
+    };
+    for (s32 i = 0; i < n_threads; i++) {
+        job.threads[i] = (json__lines_thread){ .arena = arena_make(0), .line = NULL, .cap = 0 };
+    }
+
+    if (jobs) {
+        job_run(jobs, json__lines_decode, &job, n_chunks);
+    } else {
+        for (s32 i = 0; i < n_chunks; i++) json__lines_decode(&job, i, 0);
+    }
+
+    // Chunk order is line order: offsets are a prefix sum.
+    json_lines lines = { .length = 0, .records = NULL, .n_errors = 0, .error_line = 0, .error = { .code = JSON_OK } };
+    s64 n_lines = 0;
+    for (s32 i = 0; i < n_chunks; i++) {
+        json__lines_chunk *chunk = &chunks[i];
+        chunk->offset = lines.length;
+        if (chunk->error_line && !lines.error_line) {
+            lines.error_line = n_lines + chunk->error_line;
+            lines.error      = chunk->error;
+            lines.error.line = (s32) lines.error_line;
+        }
+        lines.length   += chunk->length;
+        lines.n_errors += chunk->n_errors;
+        n_lines        += chunk->n_lines;
+    }
+
+    job.records = memory_alloc(lines.length * record_size + 1);
+    if (jobs) {
+        job_run(jobs, json__lines_gather, &job, n_chunks);
+    } else {
+        for (s32 i = 0; i < n_chunks; i++) json__lines_gather(&job, i, 0);
+    }
+    lines.records = job.records;
+
+    lines.n_arenas = n_threads;
+    lines.arenas   = array_alloc(n_threads, arena*);
+    for (s32 i = 0; i < n_threads; i++) {
+        lines.arenas[i] = job.threads[i].arena;
+        free(job.threads[i].line);
+    }
+    free(job.threads);
+    free(chunks);
+    return lines;
+}
+
+void json_free_lines(json_lines *lines) {
+    for (s32 i = 0; i < lines->n_arenas; i++) {
+        arena_free(lines->arenas[i]);
+    }
+    free(lines->arenas);
+    free(lines->records);
+    lines->length   = 0;
+    lines->records  = NULL;
+    lines->n_arenas = 0;
+    lines->arenas   = NULL;
+}
+
+void json__lines_decode(void *data, s32 index, s32 thread) {
+    json__lines_job    *job    = data;
+    json__lines_chunk  *chunk  = &job->chunks[index];
+    json__lines_thread *local  = &job->threads[thread];
+    s32 size = job->record_size;
+
+    chunk->n_lines    = 0;
+    chunk->length     = 0;
+    chunk->cap        = 0;
+    chunk->records    = NULL;
+    chunk->n_errors   = 0;
+    chunk->error_line = 0;
+
+    for (s64 start = chunk->start; start < chunk->end;) {
+        const c8 *newline = __builtin_memchr(job->data + start, '\n', chunk->end - start);
+        s64 end  = newline ? newline - job->data : chunk->end;
+        s64 next = end + 1;
+        chunk->n_lines++;
+
+        while (end > start && json__is_whitespace(job->data[end - 1])) end--;
+        s64 line_start = start, first = start;
+        while (first < end && json__is_whitespace(job->data[first])) first++;
+        start = next;
+        if (first == end) continue;
+
+        s64 length = end - first;
+        if (length + 1 > local->cap) {
+            local->cap  = 2 * (length + 1);
+            local->line = memory_realloc(local->line, local->cap);
+        }
+        __builtin_memcpy(local->line, job->data + first, length);
+        local->line[length] = '\0';
+
+        if (chunk->length == chunk->cap) {
+            chunk->cap     = chunk->cap ? 2 * chunk->cap : 256;
+            chunk->records = memory_realloc(chunk->records, chunk->cap * size);
+        }
+        u8 *record = chunk->records + chunk->length * size;
+        memory_set(record, size, 0);
+
+        json_decoder decoder = {
+            .root    = true,
+            .data    = local->line,
+            .cursor  = 0,
+            .length  = (s32) length,
+            .index   = NULL,
+            .n_index = 0,
+            .next    = 0,
+            .invalid = -1,
+            .arena   = local->arena,
+            .error   = { .code = JSON_OK },
+        };
+        arena_mark mark = arena_save(local->arena);
+        if (job->decode(&decoder, record, job->user)) {
+            chunk->length++;
+        } else {
+            arena_rewind(local->arena, mark);
+            if (!chunk->error_line) {
+                chunk->error_line = chunk->n_lines;
+                chunk->error      = decoder.error;
+                chunk->error.offset += (s32) first;
+                chunk->error.column += (s32) (first - line_start);
+                if (chunk->error.code == JSON_OK) chunk->error.code = JSON_ERROR_CALLBACK;
+            }
+            chunk->n_errors++;
+        }
+    }
+}
+
+void json__lines_gather(void *data, s32 index, s32 thread) {
+    json__lines_job   *job   = data;
+    json__lines_chunk *chunk = &job->chunks[index];
+
+    if (chunk->length) {
+        __builtin_memcpy(job->records + chunk->offset * job->record_size, chunk->records, chunk->length * job->record_size);
+    }
+    free(chunk->records);
+}
+
+
+#endif // __robin_c_json_lines
@@ -0,0 +1,294 @@
+#ifndef __robin_c_json_parallel
+#define __robin_c_json_parallel
+
+
+#include "c.h"
+#include "job.h"
+#include "json.h"
+
+
+#ifndef X_JSON_PARALLEL_BATCH_SIZE
+#define X_JSON_PARALLEL_BATCH_SIZE (64) // Items decoded by a job at a time
+#endif
+
+
+//
+// Parallel decoding of a big array, e.g. a document that is a single array of
+// hundreds of thousands of objects:
+//
+//     json_array persons = { .length=0, .data=NULL };
+//     json_array_spec array = {
+//         .item_size=sizeof(person*),
+//         .array=&persons,
+//         .spec={ .kind=JSON_OBJECT, .callback={ .object_fn=decode_person } },
+//     };
+//     json_parse_array_parallel(jobs, decoder, &array);
+//
+// Same as json_parse_array, but the items are first delimited with the
+// structural index (json_make_indexed_decoder, built here if the decoder
+// doesn't have one), then decoded on the job system, straight to their spot
+// in an array allocated once at the right size.
+//
+// Callbacks run concurrently on several threads, on copies of the decoder:
+// they must not modify shared state. The copies allocate with malloc, never
+// from the decoder's arena (it isn't thread-safe), only the array itself does.
+//
+// On failure, the error is the one of the first failing item when decoding
+// on a single thread, of any failing item otherwise. Everything the items
+// allocated is released, as usual.
+//
+
+
+//
+// Declarations
+//
+
+
+typedef struct json__parallel_job   json__parallel_job;
+typedef struct json__parallel_batch json__parallel_batch;
+
+
+external b8 json_parse_array_parallel(job_system *jobs, json_decoder *decoder, json_array_spec *array);
+
+internal s32  json__parallel_items (json_decoder *decoder, s32 start, s32 **items);
+internal void json__parallel_decode(void *data, s32 index, s32 thread);
+
+
+//
+// Definitions
+//
+
+
+// What the copy of the decoder allocated for a batch, see json__track.
+struct json__parallel_batch {
+    void **allocations;
+    s32  n_allocations;
+};
+
+struct json__parallel_job {
+    json_decoder         *decoder;
+    json_array_spec      *array;
+    u8                   *items;
+    s32                  *starts;  // Entry of the first structural of each item, then of ']'
+    s32                  n_items;
+    json__parallel_batch *batches;
+    b32                  failed;
+    json_error           error;    // Of the item that set `failed`
+};
+
+
+//
+// Works on the root, or from a callback (the cursor on the opening bracket).
+// `jobs` can be NULL, to decode on the calling thread only.
+//
+b8 json_parse_array_parallel(job_system *jobs, json_decoder *decoder, json_array_spec *array) {
+    if (decoder->error.code) return false;
+
+    b32 root    = decoder->root;
+    b32 indexed = decoder->index != NULL;
+
+    if (!indexed) json__build_index(decoder);
+
+    // Entry of the opening bracket.
+    s32 start;
+    if (root) {
+        json__begin(decoder);
+        start = 0;
+    } else if (indexed) {
+        start = decoder->next;
+    } else {
+        s32 low = 0, high = decoder->n_index;
+        while (low < high) {
+            s32 middle = low + (high - low) / 2;
+            if ((s32) decoder->index[middle] < decoder->cursor) low = middle + 1;
+            else high = middle;
+        }
+        start = low;
+    }
+
+    b8 ok = false;
+    s32 *starts = NULL;
+    s32 n_items = -1;
+
+    if (decoder->invalid >= 0) {
+        decoder->cursor = decoder->invalid;
+        json__error(decoder, JSON_ERROR_STRING, "parse string: invalid or unterminated string");
+        goto end;
+    }
+
+    decoder->next = start;
+    if (json__token(decoder) != '[') {
+        json__error(decoder, JSON_ERROR_SYNTAX, "parse array: missing opening bracket");
+        goto end;
+    }
+
+    n_items = json__parallel_items(decoder, start, &starts);
+    if (n_items < 0) goto end;
+
+    s32 end_entry = starts[n_items];
+    if (root && end_entry + 1 != decoder->n_index) {
+        decoder->next = end_entry + 1;
+        json__token(decoder);
+        json__error(decoder, JSON_ERROR_TRAILING, "parse: expected end of string, but found other data");
+        goto end;
+    }
+
+    s32 n_batches = (n_items + X_JSON_PARALLEL_BATCH_SIZE - 1) / X_JSON_PARALLEL_BATCH_SIZE;
+    json__parallel_job job = {
+        .decoder = decoder,
+        .array   = array,
+        .items   = NULL,
+        .starts  = starts,
+        .n_items = n_items,
+        .batches = array_alloc(n_batches + 1, json__parallel_batch), // Each set by its job
+        .failed  = false,
+    };
+    if (array && array->array && n_items > 0) {
+        job.items = json_alloc(decoder, (s64) n_items * array->item_size);
+    }
+
+    if (jobs) {
+        job_run(jobs, json__parallel_decode, &job, n_batches);
+    } else {
+        for (s32 i = 0; i < n_batches; i++) json__parallel_decode(&job, i, 0);
+    }
+
+    // The items' allocations are released with the rest if anything fails.
+    for (s32 i = 0; i < n_batches; i++) {
+        json__parallel_batch *batch = &job.batches[i];
+        for (s32 j = 0; j < batch->n_allocations; j++) {
+            if (job.failed)             free(batch->allocations[j]);
+            else if (decoder->tracking) json__track(decoder, batch->allocations[j], -1);
+        }
+        free(batch->allocations);
+    }
+    free(job.batches);
+
+    if (job.failed) {
+        json__free(decoder, job.items);
+        decoder->error = job.error;
+        goto end;
+    }
+
+    if (array && array->array) {
+        array->array->data   = job.items;
+        array->array->length = n_items;
+    } else {
+        json__free(decoder, job.items);
+    }
+
+    decoder->next   = end_entry + 1;
+    decoder->cursor = decoder->index[end_entry];
+    ok = true;
+
+end:
+    free(starts);
+    if (!indexed) {
+        free(decoder->index);
+        decoder->index   = NULL;
+        decoder->n_index = 0;
+        decoder->next    = 0;
+    }
+    if (root) return json__end(decoder, ok);
+    return ok;
+}
+
+//
+// Walk the index from the opening bracket at `start`, to the entries where
+// the items of the array start (after '[' and ',' at depth 1). `items` gets
+// one more entry, the closing bracket. Only the nesting is checked here, the
+// items themselves are when they are decoded.
+//
+s32 json__parallel_items(json_decoder *decoder, s32 start, s32 **items) {
+    const c8 *data = decoder->data;
+    u32 *index = decoder->index;
+
+    s32 n = 0, cap = 64;
+    s32 *starts = array_alloc(cap, s32);
+    s32 depth = 0;
+
+    for (s32 k = start; k < decoder->n_index; k++) {
+        c8 c = data[index[k]];
+        switch (c) {
+            case '[': case '{':
+                depth++;
+                break;
+            case ']': case '}':
+                depth--;
+                break;
+        }
+        if (depth == 0) {
+            if (c != ']') break;
+            // "[]" has no items, "[1,]" misses one.
+            if (data[index[k - 1]] == ',' || (n > 0 && k == start + 1)) break;
+            starts[n] = k;
+            *items = starts;
+            return n;
+        }
+
+        if (depth == 1 && (c == '[' || c == ',')) {
+            c8 next = data[index[k + 1]];
+            if (next == ']' && c == '[') continue;
+            if (next == ',' || next == ']' || next == ':' || next == '}') break;
+            if (n + 1 == cap) {
+                cap   *= 2;
+                starts = memory_realloc(starts, cap * sizeof(s32));
+            }
+            starts[n++] = k + 1;
+        }
+    }
+
+    decoder->next = decoder->n_index;
+    json__token(decoder);
+    json__error(decoder, JSON_ERROR_SYNTAX, "parse array: invalid array");
+    free(starts);
+    return -1;
+}
+
+void json__parallel_decode(void *data, s32 index, s32 thread) {
+    json__parallel_job *job = data;
+    json_array_spec *array  = job->array;
+
+    s32 first = index * X_JSON_PARALLEL_BATCH_SIZE;
+    s32 last  = first + X_JSON_PARALLEL_BATCH_SIZE;
+    if (last > job->n_items) last = job->n_items;
+
+    json_decoder decoder = *job->decoder;
+    decoder.root            = false;
+    decoder.arena           = NULL;
+    decoder.tracking        = true;
+    decoder.allocations     = NULL;
+    decoder.n_allocations   = 0;
+    decoder.cap_allocations = 0;
+
+    for (s32 i = first; i < last; i++) {
+        if (__atomic_load_n(&job->failed, __ATOMIC_RELAXED)) break;
+
+        void *item_ptr = job->items ? job->items + (s64) i * array->item_size : NULL;
+        decoder.next = job->starts[i];
+
+        // The item must end right before the following ',' (or the ']').
+        b8 ok = json__index_value(&decoder, array ? &array->spec : NULL, item_ptr);
+        s32 end = i + 1 < job->n_items ? job->starts[i + 1] - 1 : job->starts[i + 1];
+        if (ok && decoder.next != end) {
+            json__token(&decoder);
+            json__error(&decoder, JSON_ERROR_SYNTAX, "parse array: expected ',' or ']'");
+            ok = false;
+        }
+        if (!ok) {
+            if (!__atomic_exchange_n(&job->failed, true, __ATOMIC_RELAXED)) {
+                json__error_index(&decoder, i);
+                job->error = decoder.error;
+            }
+            break;
+        }
+    }
+
+    job->batches[index] = (json__parallel_batch){
+        .allocations   = decoder.allocations,
+        .n_allocations = decoder.n_allocations,
+    };
+}
+
+
+#endif // __robin_c_json_parallel
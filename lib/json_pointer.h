@@ -0,0 +1,428 @@
+#ifndef __robin_c_json_pointer
+#define __robin_c_json_pointer
+
+
+#include "c.h"
+#include "string.h"
+#include "json.h"
+
+
+//
+// Extraction of values by JSON Pointer (RFC 6901), e.g. "/metadata/labels/job"
+// or "/items/0/name", without parsing the document: the input is read from the
+// start until every requested value is found, and every subtree that isn't on
+// the way to one of them is jumped over (strings and brackets only, nothing is
+// decoded or validated there).
+//
+//     string job = json_extract_n(data, length, "/metadata/labels/job");
+//
+// or, for several values out of many documents:
+//
+//     const c8 *pointers[] = { "/metadata/name", "/metadata/labels/job", "/spec/replicas" };
+//     json_extractor *extractor = json_make_extractor(pointers, 3);
+//     string values[3];
+//     json_extract_with(extractor, data, length, values);
+//
+// `data` is NUL-terminated and `length` is its length, which bounds the
+// vector scans: with it, nothing after the last value found is read.
+// json_extract takes the length with strlen, reading the whole document.
+//
+// Values are slices of the input, with their JSON text: strings keep their
+// quotes and escape sequences. Values not found have a NULL `data`.
+//
+
+
+#ifndef X_JSON_EXTRACTOR_MAX_POINTERS
+#define X_JSON_EXTRACTOR_MAX_POINTERS (64) // Pointers are tracked in a u64
+#endif
+
+
+//
+// Declarations
+//
+
+
+typedef struct json_extractor  json_extractor;
+typedef struct json__reference json__reference;
+typedef struct json__pointer   json__pointer;
+
+
+external string          json_extract  (const c8 *data, const c8 *pointer);
+external string          json_extract_n(const c8 *data, s32 length, const c8 *pointer);
+external json_extractor* json_make_extractor(const c8 **pointers, s32 n_pointers);
+external void            json_free_extractor(json_extractor *extractor);
+external s32             json_extract_with  (json_extractor *extractor, const c8 *data, s32 length, string *values);
+
+internal b8   json__parse_pointer (const c8 *pointer, json__pointer *dst);
+internal s32  json__extract_value (json_extractor *extractor, s32 i, s32 depth, u64 active);
+internal s32  json__extract_object(json_extractor *extractor, s32 i, s32 depth, u64 active);
+internal s32  json__extract_array (json_extractor *extractor, s32 i, s32 depth, u64 active);
+internal u64  json__match_key     (json_extractor *extractor, s32 depth, u64 active, s32 start, s32 end, b32 escaped);
+
+internal s32 json__scan_structure(const c8 *data, s32 i, s32 length);
+internal s32 json__skip_string_at(const c8 *data, s32 i, s32 length);
+internal s32 json__skip_nested_at(const c8 *data, s32 i, s32 length, s32 depth);
+internal s32 json__skip_value_at (const c8 *data, s32 i, s32 length);
+
+
+//
+// Definitions
+//
+
+
+// A reference token of a pointer, unescaped ("~1" is '/', "~0" is '~').
+struct json__reference {
+    c8  *name;
+    s32 length;
+    s32 index;  // Array index, -1 if the token isn't one
+};
+
+struct json__pointer {
+    s32             n_references;
+    json__reference *references;
+};
+
+struct json_extractor {
+    s32           n_pointers;
+    json__pointer pointers[X_JSON_EXTRACTOR_MAX_POINTERS];
+
+    // Current extraction
+    const c8      *data;
+    s32           length;
+    string        *values;
+    u64           found;
+    u64           all;
+};
+
+
+string json_extract(const c8 *data, const c8 *pointer) {
+    return json_extract_n(data, __builtin_strlen(data), pointer);
+}
+
+string json_extract_n(const c8 *data, s32 length, const c8 *pointer) {
+    string value = { .length = 0, .data = NULL };
+
+    json_extractor *extractor = json_make_extractor(&pointer, 1);
+    if (extractor) {
+        json_extract_with(extractor, data, length, &value);
+        json_free_extractor(extractor);
+    }
+    return value;
+}
+
+// Returns NULL if a pointer is invalid (not empty and not starting with '/').
+json_extractor* json_make_extractor(const c8 **pointers, s32 n_pointers) {
+    assert(n_pointers <= X_JSON_EXTRACTOR_MAX_POINTERS);
+
+    json_extractor *extractor = struct_alloc(json_extractor);
+    extractor->n_pointers = 0;
+
+    for (s32 i = 0; i < n_pointers; i++) {
+        if (!json__parse_pointer(pointers[i], &extractor->pointers[i])) {
+            json_free_extractor(extractor);
+            return NULL;
+        }
+        extractor->n_pointers++;
+    }
+    extractor->all = n_pointers == 64 ? ~0ull : (1ull << n_pointers) - 1;
+    return extractor;
+}
+
+void json_free_extractor(json_extractor *extractor) {
+    for (s32 i = 0; i < extractor->n_pointers; i++) {
+        free(extractor->pointers[i].references);
+    }
+    free(extractor);
+}
+
+//
+// Fill `values` (one per pointer) and return how many were found, or -1 if
+// the document turned out to be malformed before they all were.
+//
+s32 json_extract_with(json_extractor *extractor, const c8 *data, s32 length, string *values) {
+    for (s32 i = 0; i < extractor->n_pointers; i++) {
+        values[i] = (string){ .length = 0, .data = NULL };
+    }
+    extractor->data   = data;
+    extractor->length = length;
+    extractor->values = values;
+    extractor->found  = 0;
+
+    s32 start = json__skip_blank_at(data, 0);
+    if (json__extract_value(extractor, start, 0, extractor->all) < 0) return -1;
+    return __builtin_popcountll(extractor->found);
+}
+
+//
+// The tokens and their names are in a single allocation. Array indices are
+// only recognized without leading zeros, "-" (past the end) never matches.
+//
+b8 json__parse_pointer(const c8 *pointer, json__pointer *dst) {
+    s32 length = __builtin_strlen(pointer);
+    if (length > 0 && pointer[0] != '/') return false;
+
+    s32 n = 0;
+    for (s32 i = 0; i < length; i++) {
+        if (pointer[i] == '/') n++;
+    }
+
+    json__reference *references = memory_alloc(n * sizeof(json__reference) + length + 1);
+    c8 *names = (c8*) (references + n);
+
+    s32 r = -1;
+    for (s32 i = 0; i < length; i++) {
+        c8 c = pointer[i];
+        if (c == '/') {
+            references[++r] = (json__reference){ .name = names, .length = 0, .index = 0 };
+            continue;
+        }
+        if (c == '~') {
+            c8 e = pointer[i + 1];
+            if (e != '0' && e != '1') {
+                free(references);
+                return false;
+            }
+            c = e == '0' ? '~' : '/';
+            i++;
+        }
+        *names++ = c;
+        references[r].length++;
+    }
+
+    for (r = 0; r < n; r++) {
+        json__reference *reference = &references[r];
+        b32 number = reference->length > 0 && reference->length <= 9 &&
+                     (reference->name[0] != '0' || reference->length == 1);
+        s32 index = 0;
+        for (s32 i = 0; number && i < reference->length; i++) {
+            number = json__is_digit(reference->name[i]);
+            index  = 10 * index + (reference->name[i] - '0');
+        }
+        reference->index = number ? index : -1;
+    }
+
+    dst->n_references = n;
+    dst->references   = references;
+    return true;
+}
+
+//
+// `i` is on the first character of the value, `active` the pointers going
+// through it (matching all references before `depth`). Returns the position
+// of the last character of the value, or -1 on error. Once everything is
+// found (`found == all`), the returned position doesn't matter anymore.
+//
+s32 json__extract_value(json_extractor *extractor, s32 i, s32 depth, u64 active) {
+    u64 ending = 0;
+    for (u64 bits = active; bits; bits &= bits - 1) {
+        s32 p = __builtin_ctzll(bits);
+        if (extractor->pointers[p].n_references == depth) ending |= 1ull << p;
+    }
+    active &= ~ending;
+
+    const c8 *data = extractor->data;
+    s32 end;
+    if (!active) {
+        end = json__skip_value_at(data, i, extractor->length);
+    } else if (data[i] == '{') {
+        end = json__extract_object(extractor, i, depth, active);
+    } else if (data[i] == '[') {
+        end = json__extract_array(extractor, i, depth, active);
+    } else {
+        // Scalars have no children, the deeper pointers can't be found.
+        end = json__skip_value_at(data, i, extractor->length);
+    }
+    if (end < 0 || extractor->found == extractor->all) return end;
+
+    for (u64 bits = ending; bits; bits &= bits - 1) {
+        s32 p = __builtin_ctzll(bits);
+        extractor->values[p] = (string){ .length = end - i + 1, .data = (c8*) data + i };
+    }
+    extractor->found |= ending;
+    return end;
+}
+
+s32 json__extract_object(json_extractor *extractor, s32 i, s32 depth, u64 active) {
+    const c8 *data = extractor->data;
+
+    i = json__skip_blank_at(data, i + 1);
+    if (data[i] == '}') return i;
+
+    for (;;) {
+        if (data[i] != '"') return -1;
+        s32 start = i + 1;
+        i = json__skip_string_at(data, i, extractor->length);
+        if (i < 0) return -1;
+
+        b32 escaped = json__scan_string(data, start, extractor->length) < i;
+        u64 matching = json__match_key(extractor, depth, active, start, i, escaped);
+
+        i = json__skip_blank_at(data, i + 1);
+        if (data[i] != ':') return -1;
+        i = json__skip_blank_at(data, i + 1);
+
+        if (matching) {
+            i = json__extract_value(extractor, i, depth + 1, matching);
+            if (extractor->found == extractor->all) return i;
+        } else {
+            i = json__skip_value_at(data, i, extractor->length);
+        }
+        if (i < 0) return -1;
+
+        i = json__skip_blank_at(data, i + 1);
+        if (data[i] == '}') return i;
+        if (data[i] != ',') return -1;
+        i = json__skip_blank_at(data, i + 1);
+    }
+}
+
+s32 json__extract_array(json_extractor *extractor, s32 i, s32 depth, u64 active) {
+    const c8 *data = extractor->data;
+
+    // Past the last index wanted, the rest of the array is jumped over at once.
+    s32 last = -1;
+    for (u64 bits = active; bits; bits &= bits - 1) {
+        s32 index = extractor->pointers[__builtin_ctzll(bits)].references[depth].index;
+        if (index > last) last = index;
+    }
+
+    i = json__skip_blank_at(data, i + 1);
+    if (data[i] == ']') return i;
+
+    for (s32 index = 0;; index++) {
+        if (index > last) return json__skip_nested_at(data, i, extractor->length, 1);
+
+        u64 matching = 0;
+        for (u64 bits = active; bits; bits &= bits - 1) {
+            s32 p = __builtin_ctzll(bits);
+            if (extractor->pointers[p].references[depth].index == index) matching |= 1ull << p;
+        }
+
+        if (matching) {
+            i = json__extract_value(extractor, i, depth + 1, matching);
+            if (extractor->found == extractor->all) return i;
+        } else {
+            i = json__skip_value_at(data, i, extractor->length);
+        }
+        if (i < 0) return -1;
+
+        i = json__skip_blank_at(data, i + 1);
+        if (data[i] == ']') return i;
+        if (data[i] != ',') return -1;
+        i = json__skip_blank_at(data, i + 1);
+    }
+}
+
+// Pointers of `active` whose reference at `depth` is the key in data[start..end).
+u64 json__match_key(json_extractor *extractor, s32 depth, u64 active, s32 start, s32 end, b32 escaped) {
+    const c8 *key = extractor->data + start;
+    s32 length    = end - start;
+    c8 *copy      = NULL;
+
+    if (escaped) {
+        json_decoder decoder = { .root = false, .data = extractor->data, .length = extractor->length, .cursor = start - 1 };
+        if (!json__parse_string(&decoder, &copy)) return 0;
+        key    = copy;
+        length = __builtin_strlen(copy);
+    }
+
+    // With duplicated keys, the first one wins.
+    u64 matching = 0;
+    for (u64 bits = active & ~extractor->found; bits; bits &= bits - 1) {
+        s32 p = __builtin_ctzll(bits);
+        json__reference *reference = &extractor->pointers[p].references[depth];
+        if (reference->length == length && __builtin_memcmp(reference->name, key, length) == 0) {
+            matching |= 1ull << p;
+        }
+    }
+
+    if (copy) free(copy);
+    return matching;
+}
+
+//
+// Skipping without validation, to find where a value ends: strings are
+// jumped over with json__scan_string, containers by counting brackets with
+// json__scan_structure.
+// Positions are in NUL-terminated `data` of `length` characters, -1 means the
+// data ended first.
+//
+
+// Same as json__scan_string, for '"', '{', '}', '[', ']' and NUL.
+s32 json__scan_structure(const c8 *data, s32 i, s32 length) {
+#if defined(__SSE2__)
+    for (; i + 16 <= length; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*) (data + i));
+        // '[' and ']' are '{' and '}' without the 0x20 bit.
+        __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+        __m128i special = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(lower, _mm_set1_epi8('{')), _mm_cmpeq_epi8(lower, _mm_set1_epi8('}'))),
+            _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')),     _mm_cmpeq_epi8(v, _mm_setzero_si128())));
+        u32 mask = (u32) _mm_movemask_epi8(special);
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+#endif
+    for (; i < length; i++) {
+        c8 c = data[i];
+        if (c == '"' || c == '{' || c == '}' || c == '[' || c == ']' || c == '\0') return i;
+    }
+    return length;
+}
+
+// `i` is on the opening quote, return the position of the closing one.
+s32 json__skip_string_at(const c8 *data, s32 i, s32 length) {
+    for (i = json__scan_string(data, i + 1, length); data[i] != '"'; i = json__scan_string(data, i, length)) {
+        if (data[i] == '\0') return -1;
+        if (data[i] == '\\') {
+            if (data[i + 1] == '\0') return -1;
+            i += 2;
+        } else {
+            i++; // Control character, not our business here
+        }
+    }
+    return i;
+}
+
+// `i` is inside `depth` brackets, return the position of the one closing the outermost.
+s32 json__skip_nested_at(const c8 *data, s32 i, s32 length, s32 depth) {
+    for (;;) {
+        i = json__scan_structure(data, i, length);
+        switch (data[i]) {
+            case '"':
+                i = json__skip_string_at(data, i, length);
+                if (i < 0) return -1;
+                break;
+            case '{': case '[':
+                depth++;
+                break;
+            case '}': case ']':
+                if (--depth == 0) return i;
+                break;
+            default:
+                return -1;
+        }
+        i++;
+    }
+}
+
+// `i` is on the first character of a value, return the position of its last one.
+s32 json__skip_value_at(const c8 *data, s32 i, s32 length) {
+    switch (data[i]) {
+        case '"':
+            return json__skip_string_at(data, i, length);
+        case '{': case '[':
+            return json__skip_nested_at(data, i + 1, length, 1);
+        case '\0': case ',': case ':': case '}': case ']':
+            return -1;
+    }
+    while (data[i + 1] != '\0' && data[i + 1] != ',' && data[i + 1] != '}' && data[i + 1] != ']' &&
+           !json__is_whitespace(data[i + 1])) {
+        i++;
+    }
+    return i;
+}
+
+
+#endif // __robin_c_json_pointer
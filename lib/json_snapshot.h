@@ -0,0 +1,241 @@
+#ifndef __robin_c_json_snapshot
+#define __robin_c_json_snapshot
+
+
+#include <stdio.h>    // rename(2)
+#include <sys/stat.h> // stat(2)
+
+#include "c.h"
+#include "io.h"
+#include "json_document.h"
+
+
+#define JSON_SNAPSHOT_VERSION (1)
+
+
+//
+// Snapshots of parsed documents (json_document.h), to skip parsing the same
+// big documents at every start:
+//
+//     json_document *document = json_open_document("reference.json", "reference.json.snapshot");
+//
+// loads the snapshot if it's there and up to date, otherwise parses the file
+// and writes the snapshot for next time.
+//
+// The tape only has offsets and indices, no pointers, so a snapshot is the
+// tape followed by the input, as is: it is mapped and used in place, nothing
+// is parsed or copied. Snapshots record the size, the modification time and a
+// hash of the source file: when the time changed, the content is hashed again
+// to tell an actual change from a touch. Snapshots have a version and a
+// checksum, and they're native endian: anything unexpected is a reparse.
+//
+// Layout: header (64 bytes), tape (`n_tape` u64), input (`length` bytes + NUL).
+//
+
+
+//
+// Declarations
+//
+
+
+typedef struct json__snapshot_header json__snapshot_header;
+
+
+external json_document* json_open_document(const c8 *filename, const c8 *snapshot);
+external json_document* json_load_snapshot(const c8 *snapshot, const c8 *source);
+external b8             json_save_snapshot(json_document *document, const c8 *source, const c8 *snapshot);
+
+internal b8  json__snapshot_write(json_document *document, struct stat *source, const c8 *snapshot);
+internal u64 json__snapshot_hash (const c8 *data, s64 length);
+internal u64 json__snapshot_checksum(const u64 *tape, s64 n_tape, const c8 *data, s64 length);
+internal s64 json__snapshot_mtime(struct stat *info);
+
+
+//
+// Definitions
+//
+
+
+struct json__snapshot_header {
+    c8  magic[8];     // "JSONSNAP"
+    u32 version;
+    u32 byte_order;   // 0x01020304, as written
+    s64 n_tape;
+    s64 length;       // Of the input
+    s64 source_size;
+    s64 source_mtime; // In nanoseconds
+    u64 source_hash;  // Of the input
+    u64 checksum;     // Of the tape and the input
+};
+
+
+//
+// Returns NULL if the file can't be read or isn't valid JSON. A snapshot that
+// can't be written isn't an error, the document is parsed again next time.
+//
+json_document* json_open_document(const c8 *filename, const c8 *snapshot) {
+    json_document *document = json_load_snapshot(snapshot, filename);
+    if (document) return document;
+
+    // Stat before reading: if the file changes while it's read, the snapshot
+    // has the old time and is checked against the new content next time.
+    struct stat source;
+    if (stat(filename, &source) < 0) return NULL;
+
+    c8 *data;
+    if (!io_read_file(&data, filename)) return NULL;
+
+    document = json_parse_document(data);
+    if (!document) {
+        free(data);
+        return NULL;
+    }
+    document->owned = data;
+
+    json__snapshot_write(document, &source, snapshot);
+    return document;
+}
+
+//
+// Returns NULL if the snapshot is missing, invalid, or older than `source`.
+// `source` can be NULL, to not check it.
+//
+json_document* json_load_snapshot(const c8 *snapshot, const c8 *source) {
+    c8 *mapping;
+    s64 size;
+    if (!io_map_file(&mapping, &size, snapshot)) return NULL;
+
+    json__snapshot_header *header = (json__snapshot_header*) mapping;
+    if (size < (s64) sizeof(json__snapshot_header) ||
+        __builtin_memcmp(header->magic, "JSONSNAP", 8) != 0 ||
+        header->version != JSON_SNAPSHOT_VERSION ||
+        header->byte_order != 0x01020304 ||
+        header->n_tape < 0 || header->length < 0 ||
+        size != (s64) sizeof(json__snapshot_header) + header->n_tape * 8 + header->length + 1) {
+        goto invalid;
+    }
+
+    const c8 *payload = mapping + sizeof(json__snapshot_header);
+    const c8 *data    = payload + header->n_tape * 8;
+    if (data[header->length] != '\0' ||
+        json__snapshot_checksum((const u64*) payload, header->n_tape, data, header->length) != header->checksum) {
+        goto invalid;
+    }
+
+    if (source) {
+        struct stat info;
+        if (stat(source, &info) < 0 || info.st_size != header->source_size) goto invalid;
+
+        if (json__snapshot_mtime(&info) != header->source_mtime) {
+            c8 *content;
+            s64 length;
+            if (!io_map_file(&content, &length, source)) goto invalid;
+            b32 same = json__snapshot_hash(content, length) == header->source_hash;
+            io_unmap_file(content, length);
+            if (!same) goto invalid;
+        }
+    }
+
+    // Checked in order, then queried all over: the sequential advice of
+    // io_map_file lasts, and would have the pages reclaimed early.
+    madvise(mapping, size, MADV_RANDOM);
+
+    json_document *document = struct_alloc(json_document);
+    document->data         = data;
+    document->length       = header->length;
+    document->n_tape       = (s32) header->n_tape;
+    document->tape         = (u64*) payload;
+    document->owned        = NULL;
+    document->mapping      = mapping;
+    document->mapping_size = size;
+    return document;
+
+invalid:
+    io_unmap_file(mapping, size);
+    return NULL;
+}
+
+// `source` is the file the document was parsed from, it should not have changed since.
+b8 json_save_snapshot(json_document *document, const c8 *source, const c8 *snapshot) {
+    struct stat info;
+    if (stat(source, &info) < 0) return false;
+    return json__snapshot_write(document, &info, snapshot);
+}
+
+// Written next to `snapshot` then renamed, readers never see a partial file.
+b8 json__snapshot_write(json_document *document, struct stat *source, const c8 *snapshot) {
+    json__snapshot_header header = {
+        .magic        = { 'J', 'S', 'O', 'N', 'S', 'N', 'A', 'P' },
+        .version      = JSON_SNAPSHOT_VERSION,
+        .byte_order   = 0x01020304,
+        .n_tape       = document->n_tape,
+        .length       = document->length,
+        .source_size  = source->st_size,
+        .source_mtime = json__snapshot_mtime(source),
+        .source_hash  = json__snapshot_hash(document->data, document->length),
+        .checksum     = json__snapshot_checksum(document->tape, document->n_tape, document->data, document->length),
+    };
+
+    c8 temporary[4096];
+    s32 n = snprintf(temporary, sizeof(temporary), "%s.%d.tmp", snapshot, (s32) getpid());
+    if (n < 0 || n >= (s32) sizeof(temporary)) return false;
+
+    s32 fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+
+    b32 ok = io_write_all(fd, &header, sizeof(header)) &&
+             io_write_all(fd, document->tape, (s64) document->n_tape * 8) &&
+             io_write_all(fd, document->data, document->length + 1);
+    ok = close(fd) == 0 && ok;
+
+    if (!ok || rename(temporary, snapshot) < 0) {
+        unlink(temporary);
+        return false;
+    }
+    return true;
+}
+
+//
+// 64 bits hash, 32 bytes at a time in 4 independent lanes (not cryptographic,
+// only to catch changes and corruption).
+//
+u64 json__snapshot_hash(const c8 *data, s64 length) {
+    const u64 k1 = 0x9E3779B185EBCA87ull, k2 = 0xC2B2AE3D27D4EB4Full;
+    u64 lanes[4] = { k1, k2, ~k1, ~k2 };
+    s64 i = 0;
+
+    for (; i + 32 <= length; i += 32) {
+        for (s32 l = 0; l < 4; l++) {
+            u64 word;
+            __builtin_memcpy(&word, data + i + 8 * l, 8);
+            lanes[l] = (lanes[l] ^ word) * k1;
+            lanes[l] ^= lanes[l] >> 29;
+        }
+    }
+
+    u64 h = (u64) length * k2;
+    for (s32 l = 0; l < 4; l++) {
+        h = (h ^ lanes[l]) * k1;
+        h ^= h >> 31;
+    }
+    for (; i < length; i++) {
+        h = (h ^ (u8) data[i]) * k2;
+    }
+    h ^= h >> 33;
+    h *= k1;
+    h ^= h >> 29;
+    return h;
+}
+
+// The tape and the input, with its NUL.
+u64 json__snapshot_checksum(const u64 *tape, s64 n_tape, const c8 *data, s64 length) {
+    u64 h = json__snapshot_hash((const c8*) tape, n_tape * 8);
+    return (h ^ json__snapshot_hash(data, length + 1)) * 0x9E3779B185EBCA87ull + h;
+}
+
+s64 json__snapshot_mtime(struct stat *info) {
+    return (s64) info->st_mtim.tv_sec * 1000000000 + info->st_mtim.tv_nsec;
+}
+
+
+#endif // __robin_c_json_snapshot
@@ -0,0 +1,503 @@
+#ifndef __robin_c_json_stream
+#define __robin_c_json_stream
+
+
+#include "c.h"
+#include "json.h"
+
+
+#ifndef X_JSON_STREAM_MAX_DEPTH
+#define X_JSON_STREAM_MAX_DEPTH (256)
+#endif
+
+
+//
+// Push-style JSON parser: the input is fed in chunks of any size, as they
+// arrive (e.g. from recv), and events are emitted as soon as each token is
+// complete. A token can be split between chunks anywhere, the parser
+// suspends and resumes in the middle of it.
+//
+//     json_stream *stream = json_make_stream(on_event, user);
+//     while ((n = recv(socket, buffer, sizeof(buffer), 0)) > 0) {
+//         if (!json_stream_feed(stream, buffer, n)) break;
+//     }
+//     json_stream_finish(stream);
+//
+// Several documents can follow each other in the same stream, the depth of
+// the events goes back to 0 between them. They must be separated by
+// whitespace, even after a '}', ']' or '"': "1 2" is two documents, "12"
+// one, and "truefalse" or "{}{}" an error.
+//
+
+
+//
+// Declarations
+//
+
+
+typedef enum json_event_type json_event_type;
+typedef struct json_event    json_event;
+typedef struct json_stream   json_stream;
+
+// Return false to stop the parser, json_stream_feed will then fail.
+typedef b8 (*json_stream_fn)(void *user, json_event *event);
+
+
+external json_stream* json_make_stream(json_stream_fn callback, void *user);
+external void         json_free_stream(json_stream *stream);
+external b8           json_stream_feed  (json_stream *stream, const c8 *chunk, s32 length);
+external b8           json_stream_finish(json_stream *stream);
+
+internal b8   json__stream_emit     (json_stream *stream, json_event_type type, const c8 *data, s32 length);
+internal void json__stream_end_value(json_stream *stream);
+internal b8   json__stream_number   (json_stream *stream);
+internal b8   json__stream_codepoint(json_stream *stream);
+internal void json__stream_append   (json_stream *stream, const c8 *data, s32 length);
+internal b8   json__stream_fail     (json_stream *stream, s32 i, const c8 *msg);
+internal b32  json__is_number       (const c8 *s, s32 length);
+
+
+//
+// Definitions
+//
+
+
+enum json_event_type {
+    JSON_EVENT_BEGIN_OBJECT,
+    JSON_EVENT_END_OBJECT,
+    JSON_EVENT_BEGIN_ARRAY,
+    JSON_EVENT_END_ARRAY,
+    JSON_EVENT_KEY,     // `data`, `length`
+    JSON_EVENT_STRING,  // `data`, `length`
+    JSON_EVENT_NUMBER,  // `data`, `length`, `number`
+    JSON_EVENT_BOOLEAN, // `boolean`
+    JSON_EVENT_NULL,
+};
+
+//
+// `data` is only valid during the callback: it points either in the chunk
+// being fed, or in the stream's own buffer. Strings are unescaped, but not
+// NUL-terminated (numbers are).
+//
+struct json_event {
+    json_event_type type;
+    s32             depth; // Depth of the value: 0 for the root
+    const c8        *data;
+    s32             length;
+    f64             number;
+    b32             boolean;
+};
+
+enum {
+    JSON__STREAM_VALUE,        // Root, after ':' or after ',' in an array
+    JSON__STREAM_SEPARATOR,    // After a root value, expecting whitespace
+    JSON__STREAM_VALUE_OR_END, // After '['
+    JSON__STREAM_KEY_OR_END,   // After '{'
+    JSON__STREAM_KEY,          // After ',' in an object
+    JSON__STREAM_COLON,
+    JSON__STREAM_COMMA_OR_END,
+    JSON__STREAM_STRING,
+    JSON__STREAM_ESCAPE,       // After '\' in a string
+    JSON__STREAM_UNICODE,      // In the hex digits of a '\u' escape
+    JSON__STREAM_SURROGATE,    // After a high surrogate, expecting '\'
+    JSON__STREAM_NUMBER,
+    JSON__STREAM_LITERAL,      // true, false, null
+};
+
+struct json_stream {
+    json_stream_fn callback;
+    void           *user;
+
+    s32 state;
+    s32 depth;
+    c8  stack[X_JSON_STREAM_MAX_DEPTH]; // '{' or '[' for each open container
+
+    // Current token, when it doesn't fit in a single chunk (or needs unescaping)
+    c8  *buffer;
+    s32 length;
+    s32 capacity;
+    b32 buffered;
+
+    b32      is_key;
+    u32      codepoint;      // '\uXXXX' escape being read
+    s32      hex_digits;
+    u32      high_surrogate; // Waiting for its low surrogate when != 0
+    const c8 *literal;       // "true", "false" or "null"
+    s32      literal_length;
+
+    s64      offset;         // Number of bytes fed before the current chunk
+    const c8 *chunk;         // Current chunk, during json_stream_feed
+
+    const c8 *error;         // Set on the first error, the stream is unusable then
+    s64      error_offset;
+};
+
+
+json_stream* json_make_stream(json_stream_fn callback, void *user) {
+    json_stream *stream = struct_init(json_stream);
+    stream->callback = callback;
+    stream->user     = user;
+    stream->state    = JSON__STREAM_VALUE;
+    stream->capacity = 256;
+    stream->buffer   = array_alloc(stream->capacity, c8);
+    return stream;
+}
+
+void json_free_stream(json_stream *stream) {
+    free(stream->buffer);
+    free(stream);
+}
+
+b8 json_stream_feed(json_stream *stream, const c8 *chunk, s32 length) {
+    if (stream->error) return false;
+
+    stream->chunk = chunk;
+    s32 i = 0;
+
+    while (i < length) {
+        c8 c = chunk[i];
+
+        switch (stream->state) {
+
+            case JSON__STREAM_STRING: {
+                s32 end = json__scan_string(chunk, i, length);
+                if (end == length) {
+                    // The string continues in the next chunk.
+                    json__stream_append(stream, chunk + i, end - i);
+                    stream->buffered = true;
+                    i = end;
+                    break;
+                }
+
+                c = chunk[end];
+                if (c == '"') {
+                    json_event_type type = stream->is_key ? JSON_EVENT_KEY : JSON_EVENT_STRING;
+                    b8 ok;
+                    if (stream->buffered) {
+                        json__stream_append(stream, chunk + i, end - i);
+                        ok = json__stream_emit(stream, type, stream->buffer, stream->length);
+                    } else {
+                        ok = json__stream_emit(stream, type, chunk + i, end - i);
+                    }
+                    if (!ok) return json__stream_fail(stream, end, "stopped by the callback");
+
+                    if (stream->is_key) {
+                        stream->state = JSON__STREAM_COLON;
+                    } else {
+                        json__stream_end_value(stream);
+                    }
+                } else if (c == '\\') {
+                    json__stream_append(stream, chunk + i, end - i);
+                    stream->buffered = true;
+                    stream->state    = JSON__STREAM_ESCAPE;
+                } else {
+                    return json__stream_fail(stream, end, "unescaped control character in string");
+                }
+                i = end + 1;
+            } break;
+
+            case JSON__STREAM_ESCAPE: {
+                if (c == 'u') {
+                    stream->codepoint  = 0;
+                    stream->hex_digits = 0;
+                    stream->state      = JSON__STREAM_UNICODE;
+                } else if (stream->high_surrogate) {
+                    return json__stream_fail(stream, i, "unpaired high surrogate");
+                } else if (json__is_escapable(c)) {
+                    c8 escaped = json__escaped(c);
+                    json__stream_append(stream, &escaped, 1);
+                    stream->state = JSON__STREAM_STRING;
+                } else {
+                    return json__stream_fail(stream, i, "invalid escaped character");
+                }
+                i++;
+            } break;
+
+            case JSON__STREAM_UNICODE: {
+                s32 digit;
+                if      ('0' <= c && c <= '9') digit = c - '0';
+                else if ('a' <= c && c <= 'f') digit = c - 'a' + 10;
+                else if ('A' <= c && c <= 'F') digit = c - 'A' + 10;
+                else return json__stream_fail(stream, i, "invalid '\\u' escape");
+
+                stream->codepoint = (stream->codepoint << 4) | digit;
+                if (++stream->hex_digits == 4 && !json__stream_codepoint(stream)) {
+                    return json__stream_fail(stream, i, "unpaired surrogate");
+                }
+                i++;
+            } break;
+
+            case JSON__STREAM_SURROGATE: {
+                if (c != '\\') return json__stream_fail(stream, i, "unpaired high surrogate");
+                stream->state = JSON__STREAM_ESCAPE;
+                i++;
+            } break;
+
+            case JSON__STREAM_NUMBER: {
+                s32 end = i;
+                while (end < length && (json__is_digit(chunk[end]) || chunk[end] == '.' ||
+                                        chunk[end] == 'e' || chunk[end] == 'E' ||
+                                        chunk[end] == '-' || chunk[end] == '+')) {
+                    end++;
+                }
+                json__stream_append(stream, chunk + i, end - i);
+                i = end;
+
+                // The number ends on the first other character, which is handled by the next state.
+                if (end < length && !json__stream_number(stream)) {
+                    return json__stream_fail(stream, end, stream->error ? stream->error : "invalid number");
+                }
+            } break;
+
+            case JSON__STREAM_LITERAL: {
+                if (c != stream->literal[stream->length]) {
+                    return json__stream_fail(stream, i, "invalid literal");
+                }
+                stream->length++;
+                i++;
+
+                if (stream->length == stream->literal_length) {
+                    b8 ok;
+                    if (stream->literal[0] == 'n') {
+                        ok = json__stream_emit(stream, JSON_EVENT_NULL, NULL, 0);
+                    } else {
+                        json_event event = {
+                            .type    = JSON_EVENT_BOOLEAN,
+                            .depth   = stream->depth,
+                            .boolean = stream->literal[0] == 't',
+                        };
+                        ok = stream->callback(stream->user, &event);
+                    }
+                    if (!ok) return json__stream_fail(stream, i - 1, "stopped by the callback");
+                    json__stream_end_value(stream);
+                }
+            } break;
+
+            default: {
+                // Structural states: skip whitespace first.
+                if (json__is_whitespace(c)) {
+                    if (stream->state == JSON__STREAM_SEPARATOR) stream->state = JSON__STREAM_VALUE;
+                    i++;
+                    break;
+                }
+
+                s32 state = stream->state;
+
+                if (state == JSON__STREAM_SEPARATOR) {
+                    return json__stream_fail(stream, i, "expected whitespace between documents");
+                }
+
+                if (state == JSON__STREAM_COLON) {
+                    if (c != ':') return json__stream_fail(stream, i, "expected ':'");
+                    stream->state = JSON__STREAM_VALUE;
+                    i++;
+                    break;
+                }
+
+                if (state == JSON__STREAM_COMMA_OR_END) {
+                    c8 top = stream->stack[stream->depth - 1];
+                    if (c == ',') {
+                        stream->state = top == '{' ? JSON__STREAM_KEY : JSON__STREAM_VALUE;
+                        i++;
+                        break;
+                    }
+                    if (!((c == '}' && top == '{') || (c == ']' && top == '['))) {
+                        return json__stream_fail(stream, i, top == '{' ? "expected ',' or '}'" : "expected ',' or ']'");
+                    }
+                    // Fallthrough to the end of container below.
+                } else if (state == JSON__STREAM_KEY_OR_END || state == JSON__STREAM_KEY) {
+                    if (c == '"') {
+                        stream->state    = JSON__STREAM_STRING;
+                        stream->is_key   = true;
+                        stream->buffered = false;
+                        stream->length   = 0;
+                        i++;
+                        break;
+                    }
+                    if (c != '}' || state == JSON__STREAM_KEY) {
+                        return json__stream_fail(stream, i, "expected '\"'");
+                    }
+                } else if (state == JSON__STREAM_VALUE_OR_END && c == ']') {
+                    // Empty array, fallthrough to the end of container below.
+                } else {
+                    // JSON__STREAM_VALUE, or JSON__STREAM_VALUE_OR_END with a value.
+                    stream->length = 0;
+                    switch (c) {
+                        case '{':
+                        case '[':
+                            if (stream->depth == X_JSON_STREAM_MAX_DEPTH) {
+                                return json__stream_fail(stream, i, "too deeply nested");
+                            }
+                            if (!json__stream_emit(stream, c == '{' ? JSON_EVENT_BEGIN_OBJECT : JSON_EVENT_BEGIN_ARRAY, NULL, 0)) {
+                                return json__stream_fail(stream, i, "stopped by the callback");
+                            }
+                            stream->stack[stream->depth++] = c;
+                            stream->state = c == '{' ? JSON__STREAM_KEY_OR_END : JSON__STREAM_VALUE_OR_END;
+                            break;
+
+                        case '"':
+                            stream->state    = JSON__STREAM_STRING;
+                            stream->is_key   = false;
+                            stream->buffered = false;
+                            break;
+
+                        case '-': case '0':
+                        case '1': case '2': case '3':
+                        case '4': case '5': case '6':
+                        case '7': case '8': case '9':
+                            // Handled by JSON__STREAM_NUMBER, including this character.
+                            stream->state = JSON__STREAM_NUMBER;
+                            continue;
+
+                        case 't': case 'f': case 'n':
+                            stream->state          = JSON__STREAM_LITERAL;
+                            stream->literal        = c == 't' ? "true" : c == 'f' ? "false" : "null";
+                            stream->literal_length = c == 'f' ? 5 : 4;
+                            continue;
+
+                        default:
+                            return json__stream_fail(stream, i, "invalid value");
+                    }
+                    i++;
+                    break;
+                }
+
+                // End of the current container.
+                stream->depth--;
+                if (!json__stream_emit(stream, c == '}' ? JSON_EVENT_END_OBJECT : JSON_EVENT_END_ARRAY, NULL, 0)) {
+                    return json__stream_fail(stream, i, "stopped by the callback");
+                }
+                json__stream_end_value(stream);
+                i++;
+            } break;
+        }
+    }
+
+    stream->offset += length;
+    stream->chunk   = NULL;
+    return true;
+}
+
+//
+// Signal the end of the input: emits a pending root number, and fails if a
+// document is incomplete.
+//
+b8 json_stream_finish(json_stream *stream) {
+    if (stream->error) return false;
+
+    if (stream->state == JSON__STREAM_NUMBER && !json__stream_number(stream)) {
+        return json__stream_fail(stream, 0, stream->error ? stream->error : "invalid number");
+    }
+    if ((stream->state != JSON__STREAM_VALUE && stream->state != JSON__STREAM_SEPARATOR) || stream->depth != 0) {
+        return json__stream_fail(stream, 0, "unexpected end of data");
+    }
+    return true;
+}
+
+b8 json__stream_emit(json_stream *stream, json_event_type type, const c8 *data, s32 length) {
+    json_event event = {
+        .type   = type,
+        .depth  = stream->depth,
+        .data   = data,
+        .length = length,
+    };
+    return stream->callback(stream->user, &event);
+}
+
+// A value is complete: expect the next one, or the end of its container.
+void json__stream_end_value(json_stream *stream) {
+    stream->state = stream->depth > 0 ? JSON__STREAM_COMMA_OR_END : JSON__STREAM_SEPARATOR;
+}
+
+// The buffered number is complete, validate and emit it.
+b8 json__stream_number(json_stream *stream) {
+    if (!json__is_number(stream->buffer, stream->length)) {
+        return false;
+    }
+    json__stream_append(stream, "", 1); // NUL-terminate for strtod
+    stream->length--;
+
+    json_event event = {
+        .type   = JSON_EVENT_NUMBER,
+        .depth  = stream->depth,
+        .data   = stream->buffer,
+        .length = stream->length,
+        .number = strtod(stream->buffer, NULL),
+    };
+    if (!stream->callback(stream->user, &event)) {
+        stream->error = "stopped by the callback";
+        return false;
+    }
+    json__stream_end_value(stream);
+    return true;
+}
+
+// The 4 digits of a '\u' escape were read.
+b8 json__stream_codepoint(json_stream *stream) {
+    u32 codepoint = stream->codepoint;
+
+    if (stream->high_surrogate) {
+        if (codepoint < 0xDC00 || codepoint > 0xDFFF) return false;
+        codepoint = 0x10000 + ((stream->high_surrogate - 0xD800) << 10) + (codepoint - 0xDC00);
+        stream->high_surrogate = 0;
+    } else if (0xD800 <= codepoint && codepoint <= 0xDBFF) {
+        stream->high_surrogate = codepoint;
+        stream->state = JSON__STREAM_SURROGATE;
+        return true;
+    } else if (0xDC00 <= codepoint && codepoint <= 0xDFFF) {
+        return false;
+    }
+
+    c8 utf8[4];
+    json__stream_append(stream, utf8, json__encode_utf8(codepoint, utf8));
+    stream->state = JSON__STREAM_STRING;
+    return true;
+}
+
+void json__stream_append(json_stream *stream, const c8 *data, s32 length) {
+    if (stream->length + length > stream->capacity) {
+        while (stream->length + length > stream->capacity) stream->capacity *= 2;
+        stream->buffer = memory_realloc(stream->buffer, stream->capacity);
+    }
+    memory_copy(stream->buffer + stream->length, (void*) data, length);
+    stream->length += length;
+}
+
+// `i` is the position of the error in the current chunk.
+b8 json__stream_fail(json_stream *stream, s32 i, const c8 *msg) {
+    stream->error        = msg;
+    stream->error_offset = stream->offset + (stream->chunk ? i : 0);
+    stream->chunk        = NULL;
+    return false;
+}
+
+// -?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)?
+b32 json__is_number(const c8 *s, s32 length) {
+    s32 i = 0;
+    if (i < length && s[i] == '-') i++;
+
+    if (i < length && s[i] == '0') {
+        i++;
+    } else {
+        if (i == length || !json__is_digit(s[i])) return false;
+        while (i < length && json__is_digit(s[i])) i++;
+    }
+
+    if (i < length && s[i] == '.') {
+        i++;
+        if (i == length || !json__is_digit(s[i])) return false;
+        while (i < length && json__is_digit(s[i])) i++;
+    }
+
+    if (i < length && (s[i] == 'e' || s[i] == 'E')) {
+        i++;
+        if (i < length && (s[i] == '+' || s[i] == '-')) i++;
+        if (i == length || !json__is_digit(s[i])) return false;
+        while (i < length && json__is_digit(s[i])) i++;
+    }
+
+    return i == length;
+}
+
+
+#endif // __robin_c_json_stream
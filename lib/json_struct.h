@@ -0,0 +1,251 @@
+#ifndef __robin_c_json_struct
+#define __robin_c_json_struct
+
+
+#include "c.h"
+#include "json.h"
+#include "json_encoder.h"
+
+
+//
+// Compile-time codecs: a struct is described once with an X-macro, and
+// JSON_STRUCT expands it into the struct itself, a straight-line decoder and
+// an encoder. Everything is visible to the compiler: key comparisons become a
+// few constant 8 bytes compares and the per-kind code is inlined.
+//
+/*
+    #define ADDRESS_FIELDS(X)                \
+        X(city,   c8*, JSON_STRING)          \
+        X(number, s32, JSON_INTEGER)
+    JSON_STRUCT(address, ADDRESS_FIELDS)
+
+    #define PERSON_FIELDS(X)                     \
+        X(name,    c8*,        JSON_STRING)      \
+        X(height,  f32,        JSON_FLOAT)       \
+        X(member,  b32,        JSON_BOOLEAN)     \
+        X(address, address,    JSON_OBJECT)      \
+        X(scores,  json_array, JSON_ARRAY_OF_INTEGER)
+    JSON_STRUCT(person, PERSON_FIELDS)
+*/
+//
+// defines `person`, `b8 person_json_decode(json_decoder*, person*)` and
+// `void person_json_encode(json_encoder*, person*)`. The JSON key is the
+// name of the field.
+//
+// Kinds, and the C type they expect:
+// - JSON_STRING:  c8*
+// - JSON_INTEGER: s32
+// - JSON_FLOAT:   f32
+// - JSON_BOOLEAN: b32
+// - JSON_OBJECT:  a type defined with JSON_STRUCT, stored inline
+// - JSON_ARRAY_OF_INTEGER, JSON_ARRAY_OF_FLOAT, JSON_ARRAY_OF_STRING: json_array
+//
+// Unknown keys are skipped. Other arrays aren't supported: use a json_plan.
+//
+
+
+#define JSON_STRUCT(type, FIELDS) \
+    typedef struct type type; \
+    struct type { \
+        FIELDS(JSON__STRUCT_MEMBER) \
+    }; \
+    \
+    b8 type##__json_decode(json_decoder *decoder, type *dst) { \
+        s32 open = json__struct_open(decoder, dst, sizeof(type)); \
+        if (open < 0) return false; \
+        \
+        const c8 *key; \
+        s32 length, at; \
+        c8 *copy; \
+        for (b32 first = true; open; first = false) { \
+            s32 next = json__struct_next_key(decoder, first, &key, &length, &copy, &at); \
+            if (next <= 0) { \
+                if (next < 0) return false; \
+                break; \
+            } \
+            b8 ok; \
+            if (0) {} \
+            FIELDS(JSON__STRUCT_DECODE_FIELD) \
+            else ok = json__skip_value(decoder); \
+            if (copy) json__free(decoder, copy); \
+            if (!ok) return json__error_key(decoder, at); \
+        } \
+        return true; \
+    } \
+    \
+    b8 type##_json_decode(json_decoder *decoder, type *dst) { \
+        if (decoder->error.code) return false; \
+        if (!decoder->root) return type##__json_decode(decoder, dst); \
+        \
+        json__begin(decoder); \
+        decoder->cursor = -1; \
+        json__read_nonblank(decoder); \
+        b8 ok = type##__json_decode(decoder, dst); \
+        if (ok && json__read_nonblank(decoder) != '\0') { \
+            json__error(decoder, JSON_ERROR_TRAILING, "decode " #type ": expected end of string, but found other data"); \
+            ok = false; \
+        } \
+        return json__end(decoder, ok); \
+    } \
+    \
+    void type##_json_encode(json_encoder *encoder, type *src) { \
+        json_begin_object(encoder); \
+        FIELDS(JSON__STRUCT_ENCODE_FIELD) \
+        json_end_object(encoder); \
+    }
+
+
+#define JSON__STRUCT_MEMBER(name, ctype, kind) ctype name;
+
+#define JSON__STRUCT_DECODE_FIELD(name, ctype, kind) \
+    else if (json__struct_key_equal(key, length, #name, sizeof(#name) - 1)) { \
+        ok = JSON__STRUCT_DECODE_##kind(ctype, decoder, &dst->name); \
+    }
+
+#define JSON__STRUCT_ENCODE_FIELD(name, ctype, kind) \
+    json_write_key_n(encoder, #name, sizeof(#name) - 1); \
+    JSON__STRUCT_ENCODE_##kind(ctype, encoder, &src->name);
+
+#define JSON__STRUCT_DECODE_JSON_STRING(ctype, decoder, dst)  json__struct_decode_string (decoder, dst)
+#define JSON__STRUCT_DECODE_JSON_INTEGER(ctype, decoder, dst) json__struct_decode_number (decoder, JSON_INTEGER, dst)
+#define JSON__STRUCT_DECODE_JSON_FLOAT(ctype, decoder, dst)   json__struct_decode_number (decoder, JSON_FLOAT, dst)
+#define JSON__STRUCT_DECODE_JSON_BOOLEAN(ctype, decoder, dst) json__struct_decode_boolean(decoder, dst)
+#define JSON__STRUCT_DECODE_JSON_OBJECT(ctype, decoder, dst)  ctype##_json_decode(decoder, dst)
+#define JSON__STRUCT_DECODE_JSON_ARRAY_OF_INTEGER(ctype, decoder, dst) \
+    json__struct_decode_array(decoder, dst, json_decode_array_of_integer)
+#define JSON__STRUCT_DECODE_JSON_ARRAY_OF_FLOAT(ctype, decoder, dst) \
+    json__struct_decode_array(decoder, dst, json_decode_array_of_float)
+#define JSON__STRUCT_DECODE_JSON_ARRAY_OF_STRING(ctype, decoder, dst) \
+    json__struct_decode_array(decoder, dst, json_decode_array_of_string)
+
+#define JSON__STRUCT_ENCODE_JSON_STRING(ctype, encoder, src)  json_write_string (encoder, *(src))
+#define JSON__STRUCT_ENCODE_JSON_INTEGER(ctype, encoder, src) json_write_integer(encoder, *(src))
+#define JSON__STRUCT_ENCODE_JSON_FLOAT(ctype, encoder, src)   json_write_float  (encoder, *(src))
+#define JSON__STRUCT_ENCODE_JSON_BOOLEAN(ctype, encoder, src) json_write_boolean(encoder, *(src))
+#define JSON__STRUCT_ENCODE_JSON_OBJECT(ctype, encoder, src)  ctype##_json_encode(encoder, src)
+#define JSON__STRUCT_ENCODE_JSON_ARRAY_OF_INTEGER(ctype, encoder, src) json_encode_array_of_integer(encoder, src)
+#define JSON__STRUCT_ENCODE_JSON_ARRAY_OF_FLOAT(ctype, encoder, src)   json_encode_array_of_float  (encoder, src)
+#define JSON__STRUCT_ENCODE_JSON_ARRAY_OF_STRING(ctype, encoder, src)  json_encode_array_of_string (encoder, src)
+
+
+//
+// Helpers used by the generated code.
+//
+
+
+internal inline b32 json__struct_key_equal(const c8 *key, s32 length, const c8 *name, s32 name_length);
+
+internal s32  json__struct_open       (json_decoder *decoder, void *dst, s32 size);
+internal s32  json__struct_next_key   (json_decoder *decoder, b32 first, const c8 **key, s32 *length, c8 **copy, s32 *at);
+internal b8   json__struct_decode_string (json_decoder *decoder, c8 **dst);
+internal b8   json__struct_decode_number (json_decoder *decoder, json_value_type kind, void *dst);
+internal b8   json__struct_decode_boolean(json_decoder *decoder, b32 *dst);
+internal b8   json__struct_decode_array  (json_decoder *decoder, json_array *dst, json_array_fn decode);
+
+
+//
+// `name_length` is a constant in the generated code: once inlined, the loops
+// are unrolled into compares of the key against constant 8 bytes words.
+//
+b32 json__struct_key_equal(const c8 *key, s32 length, const c8 *name, s32 name_length) {
+    if (length != name_length) return false;
+
+    s32 i = 0;
+    for (; i + 8 <= name_length; i += 8) {
+        u64 a, b;
+        memory_copy(&a, (void*) (key + i), 8);
+        memory_copy(&b, (void*) (name + i), 8);
+        if (a != b) return false;
+    }
+    for (; i < name_length; i++) {
+        if (key[i] != name[i]) return false;
+    }
+    return true;
+}
+
+//
+// The cursor should be on the opening bracket, or on a null. Returns 1 if the
+// object is opened, 0 for null (`dst` is left zeroed), -1 on error.
+//
+s32 json__struct_open(json_decoder *decoder, void *dst, s32 size) {
+    memory_set(dst, size, 0);
+
+    c8 c = json__char(decoder);
+    if (c == 'n') {
+        return json__parse_null(decoder, NULL) ? 0 : -1;
+    }
+    if (c != '{') {
+        json__error(decoder, JSON_ERROR_SYNTAX, "decode struct: missing opening bracket");
+        return -1;
+    }
+    return 1;
+}
+
+//
+// Move to the next key and past its colon, leaving the cursor on the value.
+// Returns 1 if there is a key, 0 at the end of the object, -1 on error.
+// Keys with escape sequences are unescaped in `*copy`, which must be freed.
+// `at` is the position of the key in the input.
+//
+s32 json__struct_next_key(json_decoder *decoder, b32 first, const c8 **key, s32 *length, c8 **copy, s32 *at) {
+    c8 c = json__read_nonblank(decoder);
+    if (c == '}') return 0;
+
+    if (!first) {
+        if (c != ',') {
+            json__error(decoder, JSON_ERROR_SYNTAX, "decode struct: expected ',' or '}'");
+            return -1;
+        }
+        c = json__read_nonblank(decoder);
+    }
+    if (c != '"') {
+        json__error(decoder, JSON_ERROR_SYNTAX, "decode struct: expected '\"'");
+        return -1;
+    }
+
+    *at = decoder->cursor;
+    if (!json__read_key(decoder, key, length, copy)) return -1;
+
+    if (json__read_nonblank(decoder) != ':') {
+        if (*copy) json__free(decoder, *copy);
+        json__error(decoder, JSON_ERROR_SYNTAX, "decode struct: expected ':'");
+        return -1;
+    }
+    json__read_nonblank(decoder);
+    return 1;
+}
+
+b8 json__struct_decode_string(json_decoder *decoder, c8 **dst) {
+    c8 c = json__char(decoder);
+    if (c == 'n') return json__parse_null(decoder, (void**) dst);
+    if (c != '"') {
+        json__error(decoder, JSON_ERROR_TYPE, "decode struct: expected a string");
+        return false;
+    }
+    return json__parse_string(decoder, dst);
+}
+
+b8 json__struct_decode_number(json_decoder *decoder, json_value_type kind, void *dst) {
+    c8 c = json__char(decoder);
+    if (c != '-' && !json__is_digit(c)) {
+        json__error(decoder, JSON_ERROR_TYPE, "decode struct: expected a number");
+        return false;
+    }
+    return json__parse_number(decoder, kind, dst);
+}
+
+b8 json__struct_decode_boolean(json_decoder *decoder, b32 *dst) {
+    return json__parse_boolean(decoder, dst);
+}
+
+b8 json__struct_decode_array(json_decoder *decoder, json_array *dst, json_array_fn decode) {
+    if (json__char(decoder) == 'n') {
+        dst->length = 0;
+        dst->data   = NULL;
+        return json__parse_null(decoder, NULL);
+    }
+    return json__array_callback(decoder, decode, dst);
+}
+
+
+#endif // __robin_c_json_struct
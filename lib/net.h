@@ -3,8 +3,12 @@
 
 
 #include <sys/socket.h>
+#include <sys/epoll.h> // epoll(7)
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>     // fcntl(2)
+#include <time.h>      // clock_gettime(2)
+#include <netinet/in.h>
 #include <netinet/ip.h>
 
 #include "c.h"
@@ -13,13 +17,54 @@
 #include "string_builder.h"
 
 
+#ifndef X_NET_EVENTS
+#define X_NET_EVENTS (256) // Taken from epoll at a time
+#endif
+
+#define NET_AGAIN (-2)     // net_read, net_write, net_accept: nothing to do until the next callback
+
+
+//
+// An event loop on epoll, for many non-blocking sockets on one thread:
+//
+//     net_loop *loop = net_make_loop();
+//     s32 listener = net_listen(0, 8080, 1024);
+//     net_watch(loop, listener, on_accept, NULL, NULL);
+//     net_run(loop);
+//
+// Sockets are watched edge-triggered, for reading and writing at once: a
+// callback runs when the socket becomes readable (or writable), and must
+// then read (or write) until NET_AGAIN, the next one only comes with new
+// data (or room). A socket that's closed or in error is reported to both,
+// reads get 0 or -1.
+//
+// net_close stops watching at once but closes at the end of the round of
+// events: later events of the round for the same socket are dropped, and
+// its number can't be reused by a socket accepted in the meantime. The
+// callbacks can close any socket, theirs included.
+//
+// Timers (net_add_timer) run from the loop too, in a heap by deadline,
+// which sets the epoll timeout. A timer runs once, and can be cancelled
+// until then.
+//
+// net_run returns when net_stop is called, or when there's nothing left to
+// watch and no timer.
+//
+
+
 //
 // Declarations
 //
 
 
-typedef struct net_conn   net_conn;
-typedef enum net_protocol net_protocol;
+typedef struct net_conn    net_conn;
+typedef enum net_protocol  net_protocol;
+typedef struct net_loop    net_loop;
+typedef struct net__watch  net__watch;
+typedef struct net__timer  net__timer;
+
+typedef void (*net_io_fn)   (net_loop *loop, s32 fd, void *user);
+typedef void (*net_timer_fn)(net_loop *loop, void *user);
 
 
 external net_conn net_connect(net_protocol proto, ipv4 address, u16 port);
@@ -27,6 +72,28 @@ external net_conn net_connect(net_protocol proto, ipv4 address, u16 port);
 external u16 net_reverse_bytes_16(u16 v);
 external u32 net_reverse_bytes_32(u32 v);
 
+external net_loop* net_make_loop(void);
+external void      net_free_loop(net_loop *loop);
+external s32       net_run (net_loop *loop);
+external void      net_stop(net_loop *loop);
+external b8        net_watch(net_loop *loop, s32 fd, net_io_fn on_read, net_io_fn on_write, void *user);
+external void      net_close(net_loop *loop, s32 fd);
+external u64       net_add_timer   (net_loop *loop, s64 milliseconds, net_timer_fn fn, void *user);
+external void      net_cancel_timer(net_loop *loop, u64 timer);
+
+external s32 net_listen (ipv4 address, u16 port, s32 backlog);
+external s32 net_accept (s32 listener, ipv4 *address, u16 *port);
+external s32 net_connect_start(ipv4 address, u16 port);
+external s32 net_connect_error(s32 fd);
+external s64 net_read (s32 fd, void *buffer, s64 size);
+external s64 net_write(s32 fd, const void *data, s64 length);
+
+internal s64  net__now(void);
+internal void net__timer_up  (net_loop *loop, s32 at);
+internal void net__timer_down(net_loop *loop, s32 at);
+internal void net__timer_remove(net_loop *loop, s32 at);
+internal b8   net__nonblocking(s32 fd);
+
 
 //
 // Definitions
@@ -45,12 +112,40 @@ struct net_conn {
     u16          port;
 };
 
-struct net__socket_address {
-    u8   length;     // Total length of the struct
-    u8   family;
-    u16  port;       // In network byte order
-    ipv4 address;
-    u8   padding[8];
+struct net__watch {
+    net_io_fn on_read;
+    net_io_fn on_write;
+    void      *user;
+    b32       watched;
+};
+
+struct net__timer {
+    s64          deadline;   // In nanoseconds, CLOCK_MONOTONIC
+    net_timer_fn fn;
+    void         *user;
+    u32          generation; // Of the slot, in the ids, so that old ids don't cancel new timers
+    s32          heap;       // Index in the heap, -1 when the slot is free
+};
+
+struct net_loop {
+    s32         epoll;
+    b32         stop;
+
+    net__watch  *watches;    // By fd
+    s32         cap_watches;
+    s32         n_watched;
+
+    net__timer  *timers;     // Slots
+    s32         n_timers;
+    s32         cap_timers;
+    s32         *heap;       // Slots, soonest deadline first
+    s32         n_heap;
+    s32         *free;       // Slots
+    s32         n_free;
+
+    s32         *closing;    // Closed at the end of the round
+    s32         n_closing;
+    s32         cap_closing;
 };
 
 
@@ -68,7 +163,7 @@ net_conn net_connect(net_protocol proto, ipv4 address, u16 port) {
             sock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
             break;
         case NET_UDP:
-            sock = socket(PF_INET, SOCK_STREAM, IPPROTO_UDP);
+            sock = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP);
             break;
         default:
             conn.socket = -1;
@@ -80,12 +175,13 @@ net_conn net_connect(net_protocol proto, ipv4 address, u16 port) {
         return conn;
     }
 
-    struct net__socket_address server;
-    server.length  = sizeof(struct net__socket_address);
-    server.family  = AF_INET;
-    server.address = net_reverse_bytes_32(address);
-    server.port    = net_reverse_bytes_16(port);
-    if (connect(sock, (struct sockaddr *) &server, sizeof(struct net__socket_address)) < 0) {
+    struct sockaddr_in server = {
+        .sin_family      = AF_INET,
+        .sin_port        = net_reverse_bytes_16(port),
+        .sin_addr.s_addr = net_reverse_bytes_32(address),
+    };
+    if (connect(sock, (struct sockaddr *) &server, sizeof(server)) < 0) {
+        close(sock);
         conn.socket = -1;
         return conn;
     }
@@ -106,67 +202,328 @@ u32 net_reverse_bytes_32(u32 v) {
 }
 
 
-/*
-// @Cleanup
+net_loop* net_make_loop(void) {
+    s32 epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll < 0) return NULL;
 
-struct net__conn {
-    s32  fd;
-    ipv4 client_address;
-    u16  client_port;
-};
+    net_loop *loop = memory_alloc(sizeof(net_loop));
+    *loop = (net_loop){ .epoll = epoll };
+    return loop;
+}
+
+void net_free_loop(net_loop *loop) {
+    for (s32 i = 0; i < loop->n_closing; i++)
+        close(loop->closing[i]);
+
+    close(loop->epoll);
+    free(loop->watches);
+    free(loop->timers);
+    free(loop->heap);
+    free(loop->free);
+    free(loop->closing);
+    free(loop);
+}
 
-s32 net__handle_conn(struct net__conn conn) {
-    c8 buffer[1024];
+void net_stop(net_loop *loop) {
+    loop->stop = true;
+}
+
+s32 net_run(net_loop *loop) {
+    struct epoll_event events[X_NET_EVENTS];
 
-    s32 len = read(conn, buffer, 1024);
-    while (len > 0) {
-        char c;
-        for (s32 i = 0; i < len; i++) {
-            c = buffer[i];
+    loop->stop = false;
+    while (!loop->stop && (loop->n_watched > 0 || loop->n_heap > 0)) {
+        s32 timeout = -1;
+        if (loop->n_heap > 0) {
+            s64 wait = loop->timers[loop->heap[0]].deadline - net__now();
+            timeout = wait <= 0 ? 0 : (s32) ((wait + 999999) / 1000000); // Never early
         }
-        len = read(conn, buffer, 1024);
-    }
 
-    struct net__request req = net__parse_request(conn);
-    printf("%.*s\n", len, buffer);
+        s32 n = epoll_wait(loop->epoll, events, X_NET_EVENTS, timeout);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
 
-    if (close(s) < 0)
-        return -1;
+        for (s32 i = 0; i < n; i++) {
+            s32 fd = events[i].data.fd;
+            u32 ev = events[i].events;
+            b32 hangup = (ev & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) != 0;
+
+            // Checked before each callback: the first one may close the socket
+            net__watch *w = &loop->watches[fd];
+            if (w->watched && w->on_read && (ev & EPOLLIN || hangup))
+                w->on_read(loop, fd, w->user);
+
+            w = &loop->watches[fd];
+            if (w->watched && w->on_write && (ev & EPOLLOUT || hangup))
+                w->on_write(loop, fd, w->user);
+        }
+
+        s64 now = net__now();
+        while (!loop->stop && loop->n_heap > 0 && loop->timers[loop->heap[0]].deadline <= now) {
+            s32 slot = loop->heap[0];
+            net_timer_fn fn = loop->timers[slot].fn;
+            void *user = loop->timers[slot].user;
+
+            net__timer_remove(loop, 0); // Before the call, which may add timers
+            fn(loop, user);
+        }
+
+        for (s32 i = 0; i < loop->n_closing; i++)
+            close(loop->closing[i]);
+        loop->n_closing = 0;
+    }
 
     return 0;
 }
 
-s32 net_serve(ipv4 address, u16 port) {
-    int s = socket(PF_INET, SOCK_STREAM, 0);
-    if (s == -1) return 1;
+b8 net_watch(net_loop *loop, s32 fd, net_io_fn on_read, net_io_fn on_write, void *user) {
+    if (fd < 0 || !net__nonblocking(fd)) return false;
 
-    struct net__socket_address server;
-    server.length  = sizeof(struct net__socket_address);
-    server.family  = AF_INET;
-    server.address = net_reverse_bytes_32(address);
-    server.port    = net_reverse_bytes_16(port);
+    if (fd >= loop->cap_watches) {
+        s32 cap = loop->cap_watches ? loop->cap_watches : 64;
+        while (cap <= fd) cap *= 2;
 
-    if (bind(s, (struct sockaddr *) &server, sizeof(struct net__socket_address)) < 0)
+        loop->watches = memory_realloc(loop->watches, cap * sizeof(net__watch));
+        memory_set(loop->watches + loop->cap_watches, (cap - loop->cap_watches) * sizeof(net__watch), 0);
+        loop->cap_watches = cap;
+    }
+
+    net__watch *w = &loop->watches[fd];
+    if (!w->watched) {
+        // Both ways from the start: with edge triggering there's nothing to change later
+        struct epoll_event event = {
+            .events  = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET,
+            .data.fd = fd,
+        };
+        if (epoll_ctl(loop->epoll, EPOLL_CTL_ADD, fd, &event) < 0) return false;
+        loop->n_watched += 1;
+    }
+
+    *w = (net__watch){
+        .on_read  = on_read,
+        .on_write = on_write,
+        .user     = user,
+        .watched  = true,
+    };
+    return true;
+}
+
+void net_close(net_loop *loop, s32 fd) {
+    if (fd < 0) return;
+
+    if (fd < loop->cap_watches && loop->watches[fd].watched) {
+        epoll_ctl(loop->epoll, EPOLL_CTL_DEL, fd, NULL);
+        loop->watches[fd].watched = false;
+        loop->n_watched -= 1;
+    }
+
+    if (loop->n_closing == loop->cap_closing) {
+        loop->cap_closing = loop->cap_closing ? 2 * loop->cap_closing : 64;
+        loop->closing = memory_realloc(loop->closing, loop->cap_closing * sizeof(s32));
+    }
+    loop->closing[loop->n_closing++] = fd;
+}
+
+// Returns an id for net_cancel_timer, never 0.
+u64 net_add_timer(net_loop *loop, s64 milliseconds, net_timer_fn fn, void *user) {
+    s32 slot;
+    if (loop->n_free > 0) {
+        slot = loop->free[--loop->n_free];
+    } else {
+        if (loop->n_timers == loop->cap_timers) {
+            loop->cap_timers = loop->cap_timers ? 2 * loop->cap_timers : 64;
+            loop->timers = memory_realloc(loop->timers, loop->cap_timers * sizeof(net__timer));
+            loop->heap   = memory_realloc(loop->heap,   loop->cap_timers * sizeof(s32));
+            loop->free   = memory_realloc(loop->free,   loop->cap_timers * sizeof(s32));
+        }
+        slot = loop->n_timers++;
+        loop->timers[slot].generation = 0;
+    }
+
+    net__timer *t = &loop->timers[slot];
+    t->deadline    = net__now() + (milliseconds > 0 ? milliseconds : 0) * 1000000;
+    t->fn          = fn;
+    t->user        = user;
+    t->generation += 1;
+    t->heap        = loop->n_heap;
+
+    loop->heap[loop->n_heap++] = slot;
+    net__timer_up(loop, t->heap);
+
+    return ((u64) t->generation << 32) | (u32) slot;
+}
+
+// Does nothing if the timer already ran or was cancelled.
+void net_cancel_timer(net_loop *loop, u64 timer) {
+    s32 slot = (s32) (u32) timer;
+    if (timer == 0 || slot >= loop->n_timers) return;
+
+    net__timer *t = &loop->timers[slot];
+    if (t->generation != (u32) (timer >> 32) || t->heap < 0) return;
+
+    net__timer_remove(loop, t->heap);
+}
+
+s32 net_listen(ipv4 address, u16 port, s32 backlog) {
+    s32 fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP);
+    if (fd < 0) return -1;
+
+    s32 on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    struct sockaddr_in server = {
+        .sin_family      = AF_INET,
+        .sin_port        = net_reverse_bytes_16(port),
+        .sin_addr.s_addr = net_reverse_bytes_32(address),
+    };
+    if (bind(fd, (struct sockaddr *) &server, sizeof(server)) < 0 || listen(fd, backlog) < 0) {
+        close(fd);
         return -1;
+    }
 
-    // @Cleanup: set queue length
-    if (listen(s, 10) == -1)
+    return fd;
+}
+
+// Returns a non-blocking socket, -1 on error, or NET_AGAIN when there's
+// nothing left to accept. Address and port may be NULL.
+s32 net_accept(s32 listener, ipv4 *address, u16 *port) {
+    struct sockaddr_in client;
+    socklen_t length = sizeof(client);
+
+    s32 fd;
+    for (;;) {
+        fd = accept(listener, (struct sockaddr *) &client, &length); // Not accept4, which needs _GNU_SOURCE
+        if (fd >= 0) break;
+        if (errno == ECONNABORTED || errno == EINTR) continue; // Lost that one, on to the next
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? NET_AGAIN : -1;
+    }
+    if (!net__nonblocking(fd)) {
+        close(fd);
+        return -1;
+    }
+
+    if (address) *address = net_reverse_bytes_32(client.sin_addr.s_addr);
+    if (port)    *port    = net_reverse_bytes_16(client.sin_port);
+    return fd;
+}
+
+// Starts connecting a non-blocking socket: watch it, and the connection is
+// done when it's first writable, with net_connect_error telling how it went.
+s32 net_connect_start(ipv4 address, u16 port) {
+    s32 fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP);
+    if (fd < 0) return -1;
+
+    struct sockaddr_in server = {
+        .sin_family      = AF_INET,
+        .sin_port        = net_reverse_bytes_16(port),
+        .sin_addr.s_addr = net_reverse_bytes_32(address),
+    };
+    if (connect(fd, (struct sockaddr *) &server, sizeof(server)) < 0 && errno != EINPROGRESS) {
+        close(fd);
         return -1;
+    }
+
+    return fd;
+}
 
-    struct net__socket_address client;
-    u32 client_length = sizeof(struct net__socket_address);
+// Returns 0 when connected, or the errno of the failed connection.
+s32 net_connect_error(s32 fd) {
+    s32 error = 0;
+    socklen_t length = sizeof(error);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) < 0) return errno;
+    return error;
+}
 
-    s32 conn_fd = accept(s, (struct sockaddr *) &client, &client_length);
-    if (conn_fd < 0) return -1;
+// Returns the bytes read, 0 at the end, -1 on error, or NET_AGAIN.
+s64 net_read(s32 fd, void *buffer, s64 size) {
+    for (;;) {
+        s64 n = read(fd, buffer, size);
+        if (n >= 0) return n;
+        if (errno == EINTR) continue;
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? NET_AGAIN : -1;
+    }
+}
+
+// Returns the bytes written, possibly fewer than length, -1 on error, or
+// NET_AGAIN. Never raises SIGPIPE.
+s64 net_write(s32 fd, const void *data, s64 length) {
+    for (;;) {
+        s64 n = send(fd, data, length, MSG_NOSIGNAL);
+        if (n >= 0) return n;
+        if (errno == EINTR) continue;
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? NET_AGAIN : -1;
+    }
+}
+
+s64 net__now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (s64) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+void net__timer_up(net_loop *loop, s32 at) {
+    s32 slot = loop->heap[at];
+    s64 deadline = loop->timers[slot].deadline;
+
+    while (at > 0) {
+        s32 parent = (at - 1) / 2;
+        s32 p = loop->heap[parent];
+        if (loop->timers[p].deadline <= deadline) break;
+
+        loop->heap[at] = p;
+        loop->timers[p].heap = at;
+        at = parent;
+    }
 
-    struct net__conn conn;
-    conn.fd             = conn_fd;
-    conn.client_address = reverse_byte_order_32(client.address);
-    conn.client_port    = reverse_byte_order_16(client.port);
+    loop->heap[at] = slot;
+    loop->timers[slot].heap = at;
+}
+
+void net__timer_down(net_loop *loop, s32 at) {
+    s32 slot = loop->heap[at];
+    s64 deadline = loop->timers[slot].deadline;
+
+    for (;;) {
+        s32 child = 2 * at + 1;
+        if (child >= loop->n_heap) break;
+        if (child + 1 < loop->n_heap &&
+            loop->timers[loop->heap[child + 1]].deadline < loop->timers[loop->heap[child]].deadline)
+            child += 1;
+
+        s32 c = loop->heap[child];
+        if (deadline <= loop->timers[c].deadline) break;
+
+        loop->heap[at] = c;
+        loop->timers[c].heap = at;
+        at = child;
+    }
+
+    loop->heap[at] = slot;
+    loop->timers[slot].heap = at;
+}
+
+void net__timer_remove(net_loop *loop, s32 at) {
+    s32 slot = loop->heap[at];
+    loop->timers[slot].heap = -1;
+    loop->free[loop->n_free++] = slot;
+
+    loop->n_heap -= 1;
+    if (at == loop->n_heap) return;
+
+    loop->heap[at] = loop->heap[loop->n_heap];
+    loop->timers[loop->heap[at]].heap = at;
+    net__timer_up(loop, at);
+    net__timer_down(loop, loop->timers[loop->heap[at]].heap);
+}
 
-    return net__handle_conn(conn);
+b8 net__nonblocking(s32 fd) {
+    s32 flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0) return false;
+    if (flags & O_NONBLOCK) return true;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
 }
-*/
 
 
 #endif // __robin_c_net
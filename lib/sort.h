@@ -0,0 +1,386 @@
+#ifndef __robin_c_sort
+#define __robin_c_sort
+
+
+#include "c.h"
+#include "job.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+
+#ifndef X_SORT_RADIX_BITS
+#define X_SORT_RADIX_BITS (11)   // Bits of the key per pass: 11 (3 passes) or 8 (4 passes)
+#endif
+
+#ifndef X_SORT_SMALL
+#define X_SORT_SMALL (64)        // Insertion sort below
+#endif
+
+#ifndef X_SORT_PARALLEL_MIN
+#define X_SORT_PARALLEL_MIN (1 << 18) // Serial below, the threads cost more than they save
+#endif
+
+#define SORT__BUCKETS (1 << X_SORT_RADIX_BITS)
+#define SORT__PASSES  ((32 + X_SORT_RADIX_BITS - 1) / X_SORT_RADIX_BITS)
+
+
+//
+// LSD radix sort of u32 keys (addresses, ipv4), alone or with a u32 value:
+//
+//     sort_u32(addresses, n, NULL);
+//     n = sort_unique_u32(addresses, n);
+//
+// Each pass distributes the keys by X_SORT_RADIX_BITS of their bits, lowest
+// first, into a buffer the size of the input (`scratch`, allocated when
+// NULL), stably: the sort is stable, pairs with equal keys keep their order.
+// The counts of every pass are taken in a single read of the input, and a
+// pass where every key has the same digit is skipped (e.g. the high bits of
+// addresses from a few networks). The result is always in the input array.
+//
+// 11 bits per pass is 3 passes over the data and 2048 buckets: the counts
+// and the write positions stay in L1. 8 bits is one more pass with fewer
+// streams to write to, better on small caches.
+//
+// The parallel versions cut the input in one block per thread: each block is
+// counted and distributed by its own thread, at positions found with a
+// prefix sum over all the blocks' counts.
+//
+// At most 2^32 - 1 elements.
+//
+
+
+//
+// Declarations
+//
+
+
+typedef struct sort_kv   sort_kv;
+typedef struct sort__job sort__job;
+
+
+external void sort_u32  (u32 *keys, s64 n, u32 *scratch);
+external void sort_pairs(sort_kv *pairs, s64 n, sort_kv *scratch);
+external void sort_u32_parallel  (job_system *jobs, u32 *keys, s64 n, u32 *scratch);
+external void sort_pairs_parallel(job_system *jobs, sort_kv *pairs, s64 n, sort_kv *scratch);
+
+external s64  sort_unique_u32  (u32 *keys, s64 n);
+external s64  sort_unique_pairs(sort_kv *pairs, s64 n);
+external s64  sort_merge_u32       (const u32 *a, s64 n_a, const u32 *b, s64 n_b, u32 *out);
+external s64  sort_merge_unique_u32(const u32 *a, s64 n_a, const u32 *b, s64 n_b, u32 *out);
+
+internal void sort__serial  (void *data, s64 n, b32 pairs, void *scratch);
+internal void sort__parallel(job_system *jobs, void *data, s64 n, b32 pairs, void *scratch);
+internal void sort__count(const void *data, s64 start, s64 end, b32 pairs, s32 shift, u32 *counts);
+internal void sort__distribute(const void *src, void *dst, s64 start, s64 end, b32 pairs, s32 shift, u32 *offsets);
+internal void sort__count_block     (void *data, s32 index, s32 thread);
+internal void sort__distribute_block(void *data, s32 index, s32 thread);
+internal void sort__insertion(void *data, s64 n, b32 pairs);
+internal void sort__write_line(void *dst, const void *line, b32 stream);
+
+
+//
+// Definitions
+//
+
+
+struct sort_kv {
+    u32 key;
+    u32 value;
+};
+
+struct sort__job {
+    const void *src;
+    void       *dst;
+    s64        n;
+    b32        pairs;
+    s32        shift;
+    s32        n_blocks;
+    u32        *counts;  // SORT__BUCKETS per block, then their write positions
+};
+
+
+void sort_u32(u32 *keys, s64 n, u32 *scratch) {
+    sort__serial(keys, n, false, scratch);
+}
+
+void sort_pairs(sort_kv *pairs, s64 n, sort_kv *scratch) {
+    sort__serial(pairs, n, true, scratch);
+}
+
+// `jobs` can be NULL, to sort on the calling thread only.
+void sort_u32_parallel(job_system *jobs, u32 *keys, s64 n, u32 *scratch) {
+    if (!jobs || job_thread_count(jobs) == 1 || n < X_SORT_PARALLEL_MIN) sort__serial(keys, n, false, scratch);
+    else sort__parallel(jobs, keys, n, false, scratch);
+}
+
+void sort_pairs_parallel(job_system *jobs, sort_kv *pairs, s64 n, sort_kv *scratch) {
+    if (!jobs || job_thread_count(jobs) == 1 || n < X_SORT_PARALLEL_MIN) sort__serial(pairs, n, true, scratch);
+    else sort__parallel(jobs, pairs, n, true, scratch);
+}
+
+// Sorted keys without repeats, in place. Returns their number.
+s64 sort_unique_u32(u32 *keys, s64 n) {
+    if (n == 0) return 0;
+    s64 m = 1;
+    for (s64 i = 1; i < n; i++) {
+        keys[m] = keys[i];
+        m += keys[i] != keys[m - 1];
+    }
+    return m;
+}
+
+// The first pair of each key, in place. Returns their number.
+s64 sort_unique_pairs(sort_kv *pairs, s64 n) {
+    if (n == 0) return 0;
+    s64 m = 1;
+    for (s64 i = 1; i < n; i++) {
+        pairs[m] = pairs[i];
+        m += pairs[i].key != pairs[m - 1].key;
+    }
+    return m;
+}
+
+// Two sorted arrays into `out` (n_a + n_b keys), the keys of `a` first on ties. Returns n_a + n_b.
+s64 sort_merge_u32(const u32 *a, s64 n_a, const u32 *b, s64 n_b, u32 *out) {
+    s64 i = 0, j = 0, k = 0;
+    while (i < n_a && j < n_b) {
+        b32 take_b = b[j] < a[i];
+        out[k++] = take_b ? b[j] : a[i];
+        j += take_b;
+        i += !take_b;
+    }
+    while (i < n_a) out[k++] = a[i++];
+    while (j < n_b) out[k++] = b[j++];
+    return k;
+}
+
+// Same, every key once: the sorted union. Returns its size.
+s64 sort_merge_unique_u32(const u32 *a, s64 n_a, const u32 *b, s64 n_b, u32 *out) {
+    s64 i = 0, j = 0, k = 0;
+    while (i < n_a || j < n_b) {
+        u32 key = j == n_b || (i < n_a && a[i] <= b[j]) ? a[i] : b[j];
+        while (i < n_a && a[i] == key) i++;
+        while (j < n_b && b[j] == key) j++;
+        out[k++] = key;
+    }
+    return k;
+}
+
+void sort__serial(void *data, s64 n, b32 pairs, void *scratch) {
+    assert(n >= 0 && n <= 0xFFFFFFFF);
+    if (n < X_SORT_SMALL) {
+        sort__insertion(data, n, pairs);
+        return;
+    }
+
+    s32 size = pairs ? sizeof(sort_kv) : sizeof(u32);
+    void *buffer = scratch ? scratch : memory_alloc(n * size);
+
+    // Every pass counted in one read.
+    u32 counts[SORT__PASSES][SORT__BUCKETS];
+    __builtin_memset(counts, 0, sizeof(counts));
+    if (pairs) {
+        const sort_kv *p = data;
+        for (s64 i = 0; i < n; i++) {
+            for (s32 pass = 0; pass < SORT__PASSES; pass++) {
+                counts[pass][(p[i].key >> (pass * X_SORT_RADIX_BITS)) & (SORT__BUCKETS - 1)]++;
+            }
+        }
+    } else {
+        const u32 *k = data;
+        for (s64 i = 0; i < n; i++) {
+            for (s32 pass = 0; pass < SORT__PASSES; pass++) {
+                counts[pass][(k[i] >> (pass * X_SORT_RADIX_BITS)) & (SORT__BUCKETS - 1)]++;
+            }
+        }
+    }
+
+    void *src = data, *dst = buffer;
+    for (s32 pass = 0; pass < SORT__PASSES; pass++) {
+        // Counts to write positions, unless every key is in the same bucket.
+        u32 *offsets = counts[pass];
+        b32 trivial  = false;
+        u32 total    = 0;
+        for (s32 b = 0; b < SORT__BUCKETS; b++) {
+            u32 count  = offsets[b];
+            trivial   |= count == (u32) n;
+            offsets[b] = total;
+            total     += count;
+        }
+        if (trivial) continue;
+
+        sort__distribute(src, dst, 0, n, pairs, pass * X_SORT_RADIX_BITS, offsets);
+        void *swap = src;
+        src = dst;
+        dst = swap;
+    }
+
+    if (src != data) __builtin_memcpy(data, src, n * size);
+    if (!scratch) free(buffer);
+}
+
+void sort__parallel(job_system *jobs, void *data, s64 n, b32 pairs, void *scratch) {
+    assert(n >= 0 && n <= 0xFFFFFFFF);
+    s32 size = pairs ? sizeof(sort_kv) : sizeof(u32);
+    void *buffer = scratch ? scratch : memory_alloc(n * size);
+
+    sort__job job = {
+        .src      = data,
+        .dst      = buffer,
+        .n        = n,
+        .pairs    = pairs,
+        .n_blocks = job_thread_count(jobs),
+    };
+    job.counts = array_alloc((s64) job.n_blocks * SORT__BUCKETS, u32);
+
+    for (s32 pass = 0; pass < SORT__PASSES; pass++) {
+        job.shift = pass * X_SORT_RADIX_BITS;
+        job_run(jobs, sort__count_block, &job, job.n_blocks);
+
+        // Bucket by bucket, block by block: each block writes after the
+        // blocks before it in the same bucket, which keeps the sort stable.
+        b32 trivial = false;
+        u32 total   = 0;
+        for (s32 b = 0; b < SORT__BUCKETS; b++) {
+            u32 bucket = total;
+            for (s32 k = 0; k < job.n_blocks; k++) {
+                u32 count = job.counts[k * SORT__BUCKETS + b];
+                job.counts[k * SORT__BUCKETS + b] = total;
+                total += count;
+            }
+            trivial |= total - bucket == (u32) n;
+        }
+        if (trivial) continue;
+
+        job_run(jobs, sort__distribute_block, &job, job.n_blocks);
+        void *swap = (void*) job.src;
+        job.src = job.dst;
+        job.dst = swap;
+    }
+
+    if (job.src != data) __builtin_memcpy(data, job.src, n * size);
+    free(job.counts);
+    if (!scratch) free(buffer);
+}
+
+void sort__count(const void *data, s64 start, s64 end, b32 pairs, s32 shift, u32 *counts) {
+    __builtin_memset(counts, 0, SORT__BUCKETS * sizeof(u32));
+    if (pairs) {
+        const sort_kv *p = data;
+        for (s64 i = start; i < end; i++) counts[(p[i].key >> shift) & (SORT__BUCKETS - 1)]++;
+    } else {
+        const u32 *k = data;
+        for (s64 i = start; i < end; i++) counts[(k[i] >> shift) & (SORT__BUCKETS - 1)]++;
+    }
+}
+
+//
+// Elements go through a cache line per bucket first, written out whole once
+// full: the destination gets full-line writes in a few streams at a time
+// instead of a scattered write per element, each missing the cache and,
+// with 2048 buckets, the TLB. The first line of a bucket only writes from
+// where the bucket starts, it shares the line with the previous one.
+//
+void sort__distribute(const void *src, void *dst, s64 start, s64 end, b32 pairs, s32 shift, u32 *offsets) {
+    u32 lines[SORT__BUCKETS][16] __attribute__((aligned(64)));
+    u32 begin[SORT__BUCKETS];
+    __builtin_memcpy(begin, offsets, sizeof(begin));
+    b32 stream = ((u64) dst & 15) == 0;
+
+    if (pairs) {
+        const sort_kv *s = src;
+        sort_kv *d = dst;
+        sort_kv (*buffer)[8] = (sort_kv(*)[8]) lines;
+        for (s64 i = start; i < end; i++) {
+            u32 b = (s[i].key >> shift) & (SORT__BUCKETS - 1);
+            u32 at = offsets[b]++;
+            buffer[b][at & 7] = s[i];
+            if ((at & 7) == 7) {
+                u32 line = at - 7, from = line < begin[b] ? begin[b] - line : 0;
+                if (from == 0) sort__write_line(d + line, buffer[b], stream);
+                else for (u32 k = from; k < 8; k++) d[line + k] = buffer[b][k];
+            }
+        }
+        for (s32 b = 0; b < SORT__BUCKETS; b++) {
+            u32 line = offsets[b] & ~7u, from = line < begin[b] ? begin[b] - line : 0;
+            for (u32 k = from; k < (offsets[b] & 7); k++) d[line + k] = buffer[b][k];
+        }
+    } else {
+        const u32 *s = src;
+        u32 *d = dst;
+        for (s64 i = start; i < end; i++) {
+            u32 b = (s[i] >> shift) & (SORT__BUCKETS - 1);
+            u32 at = offsets[b]++;
+            lines[b][at & 15] = s[i];
+            if ((at & 15) == 15) {
+                u32 line = at - 15, from = line < begin[b] ? begin[b] - line : 0;
+                if (from == 0) sort__write_line(d + line, lines[b], stream);
+                else for (u32 k = from; k < 16; k++) d[line + k] = lines[b][k];
+            }
+        }
+        for (s32 b = 0; b < SORT__BUCKETS; b++) {
+            u32 line = offsets[b] & ~15u, from = line < begin[b] ? begin[b] - line : 0;
+            for (u32 k = from; k < (offsets[b] & 15); k++) d[line + k] = lines[b][k];
+        }
+    }
+#if defined(__SSE2__)
+    _mm_sfence();
+#endif
+}
+
+void sort__count_block(void *data, s32 index, s32 thread) {
+    sort__job *job = data;
+    s64 start = job->n * index / job->n_blocks, end = job->n * (index + 1) / job->n_blocks;
+    sort__count(job->src, start, end, job->pairs, job->shift, job->counts + (s64) index * SORT__BUCKETS);
+}
+
+void sort__distribute_block(void *data, s32 index, s32 thread) {
+    sort__job *job = data;
+    s64 start = job->n * index / job->n_blocks, end = job->n * (index + 1) / job->n_blocks;
+    sort__distribute(job->src, job->dst, start, end, job->pairs, job->shift, job->counts + (s64) index * SORT__BUCKETS);
+}
+
+//
+// A full line of 64 bytes, with non-temporal stores when `dst` allows it: the
+// line isn't read first, and doesn't evict the lines being filled.
+//
+void sort__write_line(void *dst, const void *line, b32 stream) {
+#if defined(__SSE2__)
+    if (stream) {
+        const __m128i *src = line;
+        __m128i *d = dst;
+        _mm_stream_si128(d + 0, _mm_load_si128(src + 0));
+        _mm_stream_si128(d + 1, _mm_load_si128(src + 1));
+        _mm_stream_si128(d + 2, _mm_load_si128(src + 2));
+        _mm_stream_si128(d + 3, _mm_load_si128(src + 3));
+        return;
+    }
+#endif
+    __builtin_memcpy(dst, line, 64);
+}
+
+// Stable, for the few elements radix sort would spend more on counting than sorting.
+void sort__insertion(void *data, s64 n, b32 pairs) {
+    if (pairs) {
+        sort_kv *p = data;
+        for (s64 i = 1; i < n; i++) {
+            sort_kv x = p[i];
+            s64 j = i;
+            for (; j > 0 && p[j - 1].key > x.key; j--) p[j] = p[j - 1];
+            p[j] = x;
+        }
+    } else {
+        u32 *k = data;
+        for (s64 i = 1; i < n; i++) {
+            u32 x = k[i];
+            s64 j = i;
+            for (; j > 0 && k[j - 1] > x; j--) k[j] = k[j - 1];
+            k[j] = x;
+        }
+    }
+}
+
+
+#endif // __robin_c_sort
@@ -2,6 +2,9 @@
 #define __robin_c_string
 
 
+#include "c.h"
+
+
 //
 // Declarations
 //
@@ -47,10 +50,10 @@ inline string string_make(c8 *val) {
 
 b8 string_equal(string s1, string s2) {
     if (s1.length != s2.length) return false;
-    s32 index = s1.length;
-    c8 *c1 = s1.data, *c2 = s2.data;
-    while (*c1++ == *c2++ && index-- > 0);
-    return index == 0;
+    for (u32 i = 0; i < s1.length; i++) {
+        if (s1.data[i] != s2.data[i]) return false;
+    }
+    return true;
 }
 
 inline b8 string_is_alpha_char(c8 c) {
@@ -3,6 +3,7 @@
 
 
 #include "c.h"
+#include "string.h"
 
 
 #ifndef X_STRING_BUFFER_SIZE 
@@ -26,6 +27,7 @@ external s32             string_write       (string_builder *builder, c8 *str);
 external s32             string_write_char  (string_builder *builder, c8 c);
 external void            string_copy_builder(string_builder *builder, c8 *dst);
 external string          string_builder_to_string(string_builder *builder);
+external c8*             string_builder_to_c(string_builder *builder);
 
 
 //
@@ -170,4 +172,12 @@ string string_builder_to_string(string_builder *builder) {
     };
 }
 
+// Same as `string_builder_to_string`, but NUL-terminated.
+c8* string_builder_to_c(string_builder *builder) {
+    c8 *c_str = array_alloc(builder->total_length + 1, c8);
+    string_copy_builder(builder, c_str);
+    c_str[builder->total_length] = '\0';
+    return c_str;
+}
+
 #endif // __robin_c_string_builder